@@ -102,6 +102,8 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 		|| strncmp("\\\\?\\", lpCmdLine, 4) == 0)
 		return true;
 
+	LPCSTR* ppOverlayName = NULL;	// -overlay applies to the most recent floppy/harddisk image arg
+
 	while (*lpCmdLine)
 	{
 		LPSTR lpNextArg = GetNextArg(lpCmdLine);
@@ -130,12 +132,14 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 			lpCmdLine = GetCurrArg(lpNextArg);
 			lpNextArg = GetNextArg(lpNextArg);
 			g_cmdLine.szImageName_drive[SLOT6][DRIVE_1] = lpCmdLine;
+			ppOverlayName = &g_cmdLine.szOverlayName_drive[SLOT6][DRIVE_1];
 		}
 		else if (strcmp(lpCmdLine, "-d2") == 0)
 		{
 			lpCmdLine = GetCurrArg(lpNextArg);
 			lpNextArg = GetNextArg(lpNextArg);
 			g_cmdLine.szImageName_drive[SLOT6][DRIVE_2] = lpCmdLine;
+			ppOverlayName = &g_cmdLine.szOverlayName_drive[SLOT6][DRIVE_2];
 		}
 		else if (strcmp(lpCmdLine, "-d1-disconnected") == 0)
 		{
@@ -150,12 +154,14 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 			lpCmdLine = GetCurrArg(lpNextArg);
 			lpNextArg = GetNextArg(lpNextArg);
 			g_cmdLine.szImageName_harddisk[SLOT7][HARDDISK_1] = lpCmdLine;
+			ppOverlayName = &g_cmdLine.szOverlayName_harddisk[SLOT7][HARDDISK_1];
 		}
 		else if (strcmp(lpCmdLine, "-h2") == 0)
 		{
 			lpCmdLine = GetCurrArg(lpNextArg);
 			lpNextArg = GetNextArg(lpNextArg);
 			g_cmdLine.szImageName_harddisk[SLOT7][HARDDISK_2] = lpCmdLine;
+			ppOverlayName = &g_cmdLine.szOverlayName_harddisk[SLOT7][HARDDISK_2];
 		}
 		else if (strcmp(lpCmdLine, "-s0") == 0)	// Language Card options for Apple II/II+
 		{
@@ -304,6 +310,7 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 					lpCmdLine = GetCurrArg(lpNextArg);
 					lpNextArg = GetNextArg(lpNextArg);
 					g_cmdLine.szImageName_drive[slot][drive] = lpCmdLine;
+					ppOverlayName = &g_cmdLine.szOverlayName_drive[slot][drive];
 				}
 			}
 			else if (lpCmdLine[3] == 'h' && (lpCmdLine[4] >= '1' || lpCmdLine[4] <= '8'))	// -s[1..7]h[1|2|...|8] <dsk-image>
@@ -320,6 +327,7 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 					lpCmdLine = GetCurrArg(lpNextArg);
 					lpNextArg = GetNextArg(lpNextArg);
 					g_cmdLine.szImageName_harddisk[slot][drive] = lpCmdLine;
+					ppOverlayName = &g_cmdLine.szOverlayName_harddisk[slot][drive];
 				}
 			}
 			else if (strcmp(lpCmdLine, "-s7-empty-on-exit") == 0)
@@ -358,6 +366,15 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 				LogFileOutput("Unsupported aux slot card: %s\n", lpCmdLine);
 			}
 		}
+		else if (strcmp(lpCmdLine, "-overlay") == 0)	// copy-on-write overlay for the preceding floppy/harddisk image
+		{
+			lpCmdLine = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+			if (ppOverlayName)
+				*ppOverlayName = lpCmdLine;
+			else
+				LogFileOutput("-overlay: no preceding floppy or harddisk image: %s\n", lpCmdLine);
+		}
 		else if (strcmp(lpCmdLine, "-harddisknumblocks") == 0)		// number of blocks to report for ProDOS
 		{
 			lpCmdLine = GetCurrArg(lpNextArg);
@@ -373,6 +390,13 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 					g_cmdLine.uHarddiskNumBlocks = 0;
 			}
 		}
+		else if (strcmp(lpCmdLine, "-harddiskcacheblocks") == 0)	// number of blocks in each HDD's block cache (0 = disabled)
+		{
+			lpCmdLine = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+			const int numBlocks = atoi(lpCmdLine);
+			g_cmdLine.uHarddiskCacheBlocks = numBlocks > 0 ? (UINT)numBlocks : 0;
+		}
 		else if (strcmp(lpCmdLine, "-load-state") == 0)
 		{
 			lpCmdLine = GetCurrArg(lpNextArg);
@@ -383,6 +407,55 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 		{
 			g_cmdLine.snapshotIgnoreHdcFirmware = true;
 		}
+		else if (strcmp(lpCmdLine, "-save-state-format") == 0)
+		{
+			lpCmdLine = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+			if (strcmp(lpCmdLine, "yaml") == 0)
+				g_cmdLine.snapshotFormat = SNAPSHOT_FORMAT_YAML;
+			else if (strcmp(lpCmdLine, "binary") == 0)
+				g_cmdLine.snapshotFormat = SNAPSHOT_FORMAT_BINARY;
+			else if (strcmp(lpCmdLine, "binary-zlib") == 0)
+				g_cmdLine.snapshotFormat = SNAPSHOT_FORMAT_BINARY_ZLIB;
+			else
+				LogFileOutput("-save-state-format: unsupported format: %s\n", lpCmdLine);
+		}
+		else if (strcmp(lpCmdLine, "-autosave") == 0)
+		{
+			lpCmdLine = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+			const int seconds = atoi(lpCmdLine);
+			g_cmdLine.uAutoSaveSeconds = seconds > 0 ? (UINT)seconds : 0;
+		}
+		else if (strcmp(lpCmdLine, "-record") == 0)
+		{
+			g_cmdLine.szRecordFilename = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+		}
+		else if (strcmp(lpCmdLine, "-replay") == 0)
+		{
+			g_cmdLine.szReplayFilename = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+		}
+		else if (strcmp(lpCmdLine, "-replay-exit") == 0)
+		{
+			g_cmdLine.bReplayExit = true;
+		}
+		else if (strcmp(lpCmdLine, "-rewind") == 0)
+		{
+			lpCmdLine = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+			const int seconds = atoi(lpCmdLine);
+			g_cmdLine.uRewindSeconds = seconds > 0 ? (UINT)seconds : 0;
+		}
+		else if (strcmp(lpCmdLine, "-rewind-mem") == 0)
+		{
+			lpCmdLine = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+			const int maxMB = atoi(lpCmdLine);
+			if (maxMB > 0)
+				g_cmdLine.uRewindMaxMB = (UINT)maxMB;
+		}
 		else if (strcmp(lpCmdLine, "-f") == 0 || strcmp(lpCmdLine, "-full-screen") == 0)
 		{
 			g_cmdLine.setFullScreen = 1;
@@ -578,6 +651,32 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 		{
 			g_cmdLine.supportDCD = true;
 		}
+		else if (strcmp(lpCmdLine, "-ssc-tcp-port") == 0)
+		{
+			lpCmdLine = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+			const int port = atoi(lpCmdLine);
+			if (port > 0 && port <= 0xFFFF)
+				g_cmdLine.uSscTcpPort = (UINT)port;
+			else
+				LogFileOutput("Invalid -ssc-tcp-port: %s\n", lpCmdLine);
+		}
+		else if (strcmp(lpCmdLine, "-ssc-pacing=baud") == 0)
+		{
+			g_cmdLine.sscTcpPacing = TCP_PACING_BAUD;
+		}
+		else if (strcmp(lpCmdLine, "-ssc-pacing=unthrottled") == 0)
+		{
+			g_cmdLine.sscTcpPacing = TCP_PACING_UNTHROTTLED;
+		}
+		else if (strcmp(lpCmdLine, "-ssc-flow=rts-cts") == 0)
+		{
+			g_cmdLine.sscFlowControl = FLOW_CONTROL_RTS_CTS;
+		}
+		else if (strcmp(lpCmdLine, "-ssc-flow=none") == 0)
+		{
+			g_cmdLine.sscFlowControl = FLOW_CONTROL_NONE;
+		}
 		else if (strcmp(lpCmdLine, "-alt-enter=toggle-full-screen") == 0)	// GH#556
 		{
 			GetFrame().SetAltEnterToggleFullScreen(true);
@@ -692,6 +791,12 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 			lpNextArg = GetNextArg(lpNextArg);
 			g_cmdLine.strCurrentDir = lpCmdLine;
 		}
+		else if (strcmp(lpCmdLine, "-image-cache") == 0)
+		{
+			lpCmdLine = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+			g_cmdLine.strImageCacheDir = lpCmdLine;
+		}
 		else if (strcmp(lpCmdLine, "-no-nsc") == 0)
 		{
 			g_cmdLine.bRemoveNoSlotClock = true;
@@ -724,6 +829,12 @@ bool ProcessCmdLine(LPSTR lpCmdLine)
 			lpNextArg = GetNextArg(lpNextArg);
 			g_cmdLine.wavFileSpeaker = lpCmdLine;
 		}
+		else if (strcmp(lpCmdLine, "-net-capture") == 0)
+		{
+			lpCmdLine = GetCurrArg(lpNextArg);
+			lpNextArg = GetNextArg(lpNextArg);
+			g_cmdLine.netCaptureFile = lpCmdLine;
+		}
 		else if (strcmp(lpCmdLine, "-wav-mockingboard") == 0)
 		{
 			lpCmdLine = GetCurrArg(lpNextArg);
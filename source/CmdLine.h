@@ -6,6 +6,9 @@
 #include "Common.h"
 #include "Card.h"
 #include "MockingboardDefs.h"
+#include "SaveState.h"
+#include "Rewind.h"
+#include "SerialComms.h"
 
 struct CmdLine
 {
@@ -40,6 +43,9 @@ struct CmdLine
 		snesMaxAltControllerType[0] = false;
 		snesMaxAltControllerType[1] = false;
 		supportDCD = false;
+		uSscTcpPort = TCP_SERIAL_PORT;
+		sscTcpPacing = TCP_PACING_UNTHROTTLED;
+		sscFlowControl = FLOW_CONTROL_NONE;
 		enableDumpToRealPrinter = false;
 		supportExtraMBCardTypes = false;
 		noDisk2StepperDefer = false;
@@ -47,8 +53,16 @@ struct CmdLine
 		useHdcFirmwareV2 = false;
 		szSnapshotName = NULL;
 		snapshotIgnoreHdcFirmware = false;
+		snapshotFormat = SNAPSHOT_FORMAT_YAML;
+		uAutoSaveSeconds = 0;
+		szRecordFilename = NULL;
+		szReplayFilename = NULL;
+		bReplayExit = false;
+		uRewindSeconds = 0;
+		uRewindMaxMB = RewindBuffer::kDefaultMaxMB;
 		szScreenshotFilename = NULL;
 		uHarddiskNumBlocks = 0;
+		uHarddiskCacheBlocks = HarddiskBlockCache::kDefaultCapacity;
 		uRamWorksExPages = 0;
 		uSaturnBanks = 0;
 		newVideoType = -1;
@@ -78,6 +92,10 @@ struct CmdLine
 			driveConnected[i][DRIVE_2] = true;
 			szImageName_harddisk[i][HARDDISK_1] = NULL;
 			szImageName_harddisk[i][HARDDISK_2] = NULL;
+			szOverlayName_drive[i][DRIVE_1] = NULL;
+			szOverlayName_drive[i][DRIVE_2] = NULL;
+			for (UINT j = 0; j < NUM_HARDDISKS; j++)
+				szOverlayName_harddisk[i][j] = NULL;
 		}
 	}
 
@@ -91,6 +109,9 @@ struct CmdLine
 	bool bRemoveNoSlotClock;
 	bool snesMaxAltControllerType[2];
 	bool supportDCD;
+	UINT uSscTcpPort;				// -ssc-tcp-port <port>
+	eSSCTcpPacing sscTcpPacing;		// -ssc-pacing=<baud|unthrottled>
+	eSSCFlowControl sscFlowControl;	// -ssc-flow=<rts-cts|none>
 	bool enableDumpToRealPrinter;
 	bool supportExtraMBCardTypes;
 	bool noDisk2StepperDefer;	// debug
@@ -102,9 +123,19 @@ struct CmdLine
 	LPCSTR szImageName_drive[NUM_SLOTS][NUM_DRIVES];
 	bool driveConnected[NUM_SLOTS][NUM_DRIVES];
 	LPCSTR szImageName_harddisk[NUM_SLOTS][NUM_HARDDISKS];
+	LPCSTR szOverlayName_drive[NUM_SLOTS][NUM_DRIVES];			// -overlay <file> after a floppy image
+	LPCSTR szOverlayName_harddisk[NUM_SLOTS][NUM_HARDDISKS];	// -overlay <file> after a harddisk image
 	UINT uHarddiskNumBlocks;
+	UINT uHarddiskCacheBlocks;
 	LPSTR szSnapshotName;
 	bool snapshotIgnoreHdcFirmware;
+	SnapshotFormat_e snapshotFormat;
+	UINT uAutoSaveSeconds;	// -autosave <seconds>: 0 = disabled
+	LPSTR szRecordFilename;	// -record <file>
+	LPSTR szReplayFilename;	// -replay <file>
+	bool bReplayExit;		// -replay-exit
+	UINT uRewindSeconds;	// -rewind <seconds>: 0 = disabled
+	UINT uRewindMaxMB;		// -rewind-mem <MB>
 	LPSTR szScreenshotFilename;
 	UINT uRamWorksExPages;
 	UINT uSaturnBanks;
@@ -118,11 +149,13 @@ struct CmdLine
 	int rgbCardForegroundColor;
 	int rgbCardBackgroundColor;
 	std::string strCurrentDir;
+	std::string strImageCacheDir;	// -image-cache <folder>: extracted zip/gzip images, shared between instances
 	bool bestFullScreenResolution;
 	UINT userSpecifiedWidth;
 	UINT userSpecifiedHeight;
 	std::string wavFileSpeaker;
 	std::string wavFileMockingboard;
+	std::string netCaptureFile;	// -net-capture <file.pcapng>
 	bool auxSlotEmpty;
 	SS_CARDTYPE auxSlotInsert;
 	std::string sBootSectorFileName;
@@ -111,6 +111,9 @@ enum AppMode_e
 #define  REGVALUE_UTHERNET_ACTIVE       "Uthernet Active"	// GH#977: Deprecated from 1.30.5
 #define  REGVALUE_UTHERNET_INTERFACE    "Uthernet Interface"
 #define  REGVALUE_UTHERNET_VIRTUAL_DNS  "Uthernet Virtual DNS"
+#define  REGVALUE_UTHERNET_VIRTUAL_DNS_HOSTS  "Uthernet Virtual DNS Hosts"
+#define  REGVALUE_VIRTUAL_SWITCH_RESPONDER  "Virtual Switch Responder"
+#define  REGVALUE_VIRTUAL_SWITCH_UPLINK     "Virtual Switch Uplink"
 #define  REGVALUE_SLOT4					"Slot 4"			// GH#977: Deprecated from 1.30.4
 #define  REGVALUE_SLOT5					"Slot 5"			// GH#977: Deprecated from 1.30.4
 #define  REGVALUE_VERSION				"Version"
@@ -144,7 +147,6 @@ enum AppMode_e
 #define WM_USER_LOADSTATE	WM_USER+3
 #define VK_SNAPSHOT_560		WM_USER+4 // PrintScreen
 #define VK_SNAPSHOT_280		WM_USER+5 // PrintScreen+Shift
-#define WM_USER_TCP_SERIAL	WM_USER+6
 #define WM_USER_BOOT		WM_USER+7
 #define WM_USER_FULLSCREEN	WM_USER+8
 #define VK_SNAPSHOT_TEXT	WM_USER+9 // PrintScreen+Ctrl
@@ -29,6 +29,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "../Registry.h"
 #include "../resource/resource.h"
 #include "../Tfe/PCapBackend.h"
+#include "../Tfe/VirtualSwitch.h"
 
 CPageConfigTfe* CPageConfigTfe::ms_this = 0;	// reinit'd in ctor
 
@@ -146,7 +147,16 @@ void CPageConfigTfe::gray_ungray_items(HWND hwnd)
 
 		const int number = SendMessage(GetDlgItem(hwnd, IDC_TFE_SETTINGS_INTERFACE), CB_GETCURSEL, 0, 0);
 
-		if (get_tfename(number, name, description))
+		char buffer[256];
+		buffer[255] = 0;
+		GetDlgItemText(hwnd, IDC_TFE_SETTINGS_INTERFACE, buffer, sizeof(buffer)-1);
+
+		if (VirtualSwitchBackend::getName() == buffer)
+		{
+			SetWindowText(GetDlgItem(hwnd, IDC_TFE_SETTINGS_INTERFACE_NAME), buffer);
+			SetWindowText(GetDlgItem(hwnd, IDC_TFE_SETTINGS_INTERFACE_DESC), "In-process virtual Ethernet switch (no pcap needed)");
+		}
+		else if (get_tfename(number, name, description))
 		{
 			SetWindowText(GetDlgItem(hwnd, IDC_TFE_SETTINGS_INTERFACE_NAME), name.c_str());
 			SetWindowText(GetDlgItem(hwnd, IDC_TFE_SETTINGS_INTERFACE_DESC), description.c_str());
@@ -179,14 +189,12 @@ void CPageConfigTfe::init_tfe_dialog(HWND hwnd)
 	}
 	else
 	{
-		EnableWindow(GetDlgItem(hwnd, IDC_TFE_SETTINGS_INTERFACE), 0);
-		EnableWindow(GetDlgItem(hwnd, IDC_TFE_SETTINGS_INTERFACE_NAME), 0);
-		EnableWindow(GetDlgItem(hwnd, IDC_TFE_SETTINGS_INTERFACE_DESC), 0);
-
+		// NB. the interface list still has the VirtualSwitch
 		SetWindowText(GetDlgItem(hwnd, IDC_TFE_NPCAP_INFO),
 			"Limited Uthernet support is available on your system.\n\n"
 			"Install Npcap from https://npcap.com\n"
-			"or select Uthernet II with Virtual DNS.");
+			"or select Uthernet II with Virtual DNS,\n"
+			"or the VirtualSwitch interface.");
 	}
 
 	switch (m_tfe_selected)
@@ -210,15 +218,14 @@ void CPageConfigTfe::init_tfe_dialog(HWND hwnd)
 	SendMessage(temp_hwnd, CB_ADDSTRING, 0, (LPARAM)"Uthernet II");
 	SendMessage(temp_hwnd, CB_SETCURSEL, (WPARAM)active_value, 0);
 
+	int cnt = 0;
+	temp_hwnd=GetDlgItem(hwnd,IDC_TFE_SETTINGS_INTERFACE);
+
 	if (PCapBackend::tfe_enumadapter_open())
 	{
-		int cnt = 0;
-
 		std::string name;
 		std::string description;
 
-		temp_hwnd=GetDlgItem(hwnd,IDC_TFE_SETTINGS_INTERFACE);
-
 		for (cnt = 0; PCapBackend::tfe_enumadapter(name, description); cnt++)
 		{
 			BOOL this_entry = FALSE;
@@ -242,6 +249,13 @@ void CPageConfigTfe::init_tfe_dialog(HWND hwnd)
 		PCapBackend::tfe_enumadapter_close();
 	}
 
+	// always available (after the pcap interfaces)
+	SendMessage(temp_hwnd, CB_ADDSTRING, 0, (LPARAM)VirtualSwitchBackend::getName().c_str());
+	if (m_tfe_interface_name == VirtualSwitchBackend::getName())
+	{
+		SendMessage(temp_hwnd, CB_SETCURSEL, (WPARAM)cnt, 0);
+	}
+
 	gray_ungray_items(hwnd);
 }
 
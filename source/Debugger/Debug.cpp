@@ -40,9 +40,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "../CardManager.h"
 #include "../CPU.h"
 #include "../Disk.h"
+#include "../Harddisk.h"
 #include "../Keyboard.h"
 #include "../Memory.h"
 #include "../NTSC.h"
+#include "../Rewind.h"
 #include "../SoundCore.h"	// SoundCore_SetFade()
 
 //	#define DEBUG_COMMAND_HELP  1
@@ -3633,6 +3635,11 @@ Update_t CmdFlag (int nArgs)
 //     DISK # EJECT                                  // Unmount disk
 //     DISK # PROTECT #                              // Write-protect disk on/off
 //     DISK # "<filename>"                           // Mount filename as floppy disk
+//     DISK # COMMIT                                 // Write the disk's overlay back to its base image
+//     DISK # DISCARD                                // Throw away the disk's overlay (ie. revert to the base image)
+//     DISK HDCACHE [#]                              // Block cache stats for the HDD card(s) [in slot #]
+//     DISK HDCOMMIT <slot> <drive>                  // Write the hard disk's overlay back to its base image
+//     DISK HDDISCARD <slot> <drive>                 // Throw away the hard disk's overlay
 // TODO:
 //     DISK # READ  <Track> <Sector> <NumSec> <Addr>     // Read Track/Sector(s)
 //     DISK # READ  <Track> <Sector> Addr:Addr           // Read Track/Sector(s)
@@ -3668,6 +3675,90 @@ Update_t CmdDisk (int nArgs)
 		return ConsoleUpdate();
 	}
 
+	if (iParam == PARAM_DISK_HDCACHE)
+	{
+		if (nArgs > 2)
+			return HelpLastCommand();
+
+		UINT slotBegin = SLOT1, slotEnd = SLOT7;
+		if (nArgs == 2)
+		{
+			slotBegin = slotEnd = g_aArgs[2].nValue;
+			if (slotBegin < SLOT1 || slotBegin > SLOT7)
+				return HelpLastCommand();
+		}
+
+		bool foundCard = false;
+		for (UINT slot = slotBegin; slot <= slotEnd; slot++)
+		{
+			if (GetCardMgr().QuerySlot(slot) != CT_GenericHDD)
+				continue;
+
+			foundCard = true;
+			HarddiskInterfaceCard& hddCard = dynamic_cast<HarddiskInterfaceCard&>(GetCardMgr().GetRef(slot));
+
+			for (UINT drive = 0; drive < NUM_HARDDISKS; drive++)
+			{
+				if (!hddCard.IsImageLoaded(drive))
+					continue;
+
+				const HarddiskBlockCache& cache = hddCard.GetBlockCache(drive);
+				const HarddiskBlockCache::Stats& stats = cache.GetStats();
+				const UINT64 reads = stats.hits + stats.misses;
+
+				ConsolePrintFormat(
+					CHC_DEFAULT "S" CHC_NUM_DEC "%d" CHC_DEFAULT " D" CHC_NUM_DEC "%d" CHC_ARG_SEP ": " CHC_STRING "%s",
+					slot, drive + 1, hddCard.GetFullName(drive).c_str());
+				ConsolePrintFormat(
+					CHC_DEFAULT "  Blocks " CHC_NUM_DEC "%u" CHC_ARG_SEP "/" CHC_NUM_DEC "%u" CHC_ARG_SEP ","
+					CHC_DEFAULT " Dirty "   CHC_NUM_DEC "%u",
+					cache.GetNumCached(), cache.GetCapacity(), cache.GetNumDirty());
+				ConsolePrintFormat(
+					CHC_DEFAULT "  Hits "   CHC_NUM_DEC "%llu" CHC_ARG_SEP " (" CHC_NUM_DEC "%.1f%%" CHC_ARG_SEP "),"
+					CHC_DEFAULT " Misses "  CHC_NUM_DEC "%llu" CHC_ARG_SEP ","
+					CHC_DEFAULT " Read-ahead " CHC_NUM_DEC "%llu",
+					stats.hits, reads ? (100.0 * stats.hits / reads) : 0.0, stats.misses, stats.readAheadBlocks);
+				ConsolePrintFormat(
+					CHC_DEFAULT "  Miss latency (us): avg " CHC_NUM_DEC "%llu" CHC_ARG_SEP ","
+					CHC_DEFAULT " max " CHC_NUM_DEC "%u",
+					stats.misses ? (stats.missTime_us / stats.misses) : 0, stats.missTimeMax_us);
+				ConsolePrintFormat(
+					CHC_DEFAULT "  Writes " CHC_NUM_DEC "%llu" CHC_ARG_SEP ","
+					CHC_DEFAULT " Coalesced " CHC_NUM_DEC "%llu" CHC_ARG_SEP ","
+					CHC_DEFAULT " Flushes " CHC_NUM_DEC "%llu" CHC_ARG_SEP ","
+					CHC_DEFAULT " Written " CHC_NUM_DEC "%llu",
+					stats.writes, stats.writesCoalesced, stats.flushes, stats.blocksWritten);
+			}
+		}
+
+		if (!foundCard)
+			return ConsoleDisplayError("No hard disk card");
+
+		return ConsoleUpdate();
+	}
+
+	if (iParam == PARAM_DISK_HDCOMMIT || iParam == PARAM_DISK_HDDISCARD)
+	{
+		if (nArgs != 3)
+			return HelpLastCommand();
+
+		const UINT slot = g_aArgs[2].nValue;
+		const UINT drive = g_aArgs[3].nValue;
+		if (slot < SLOT1 || slot > SLOT7 || drive < 1 || drive > NUM_HARDDISKS)
+			return HelpLastCommand();
+
+		if (GetCardMgr().QuerySlot(slot) != CT_GenericHDD)
+			return ConsoleDisplayErrorFormat("No hard disk card in slot-%d", slot);
+
+		HarddiskInterfaceCard& hddCard = dynamic_cast<HarddiskInterfaceCard&>(GetCardMgr().GetRef(slot));
+		const bool bRes = (iParam == PARAM_DISK_HDCOMMIT) ? hddCard.CommitOverlay(drive - 1) : hddCard.DiscardOverlay(drive - 1);
+		if (!bRes)
+			return ConsoleDisplayError("Failed: no overlay, or unable to access it");
+
+		GetFrame().FrameRefreshStatus(DRAW_LEDS | DRAW_BUTTON_DRIVES | DRAW_DISK_STATUS);
+		return ConsoleUpdate();
+	}
+
 	if (GetCardMgr().QuerySlot(currentSlot) != CT_Disk2)
 		return ConsoleDisplayErrorFormat("No Disk II card in slot-%d", currentSlot);
 
@@ -3757,6 +3848,18 @@ Update_t CmdDisk (int nArgs)
 		GetFrame().FrameRefreshStatus(DRAW_LEDS | DRAW_BUTTON_DRIVES | DRAW_DISK_STATUS);
 	}
 	else
+	if (iParam == PARAM_DISK_COMMIT || iParam == PARAM_DISK_DISCARD)
+	{
+		if (nArgs > 2)
+			return HelpLastCommand();
+
+		const bool bRes = (iParam == PARAM_DISK_COMMIT) ? diskCard.CommitOverlay( iDrive ) : diskCard.DiscardOverlay( iDrive );
+		if (!bRes)
+			return ConsoleDisplayError("Failed: no overlay, or unable to access it");
+
+		GetFrame().FrameRefreshStatus(DRAW_LEDS | DRAW_BUTTON_DRIVES | DRAW_DISK_STATUS);
+	}
+	else
 	{
 		if (nArgs != 3)
 			return HelpLastCommand();
@@ -4513,6 +4616,7 @@ Update_t CmdMemoryLoad (int nArgs)
 			}
 
 			memcpy(pMemBankBase + nAddressStart, pMemory.get() + nAddressStart, nAddressLen);
+			GetRewindBuffer().ForceKeyframe();	// NB. memdirty isn't set for a (non-active) bank
 
 			MemUpdatePaging(TRUE);
 		}
@@ -1474,8 +1474,7 @@ void AssemblerProcessDelayedSymols()
 				
 				if (bModified)
 				{
-					AssemblerPokeAddress( nOpcode, nOpmode, pTarget->m_nBaseAddress, nTargetValue );
-					*(memdirty + (pTarget->m_nBaseAddress >> 8)) |= 1;
+					AssemblerPokeAddress( nOpcode, nOpmode, pTarget->m_nBaseAddress, nTargetValue );	// NB. WriteByteToMemory() sets memdirty (inc. the rewind bit) for the operand's page(s)
 
 					m_vDelayedTargets.erase( iSymbol );
 
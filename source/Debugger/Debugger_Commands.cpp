@@ -458,6 +458,11 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 		{"EJECT"      , NULL, PARAM_DISK_EJECT     },
 		{"PROTECT"    , NULL, PARAM_DISK_PROTECT   },
 		{"READ"       , NULL, PARAM_DISK_READ      },
+		{"HDCACHE"    , NULL, PARAM_DISK_HDCACHE   },
+		{"COMMIT"     , NULL, PARAM_DISK_COMMIT    },
+		{"DISCARD"    , NULL, PARAM_DISK_DISCARD   },
+		{"HDCOMMIT"   , NULL, PARAM_DISK_HDCOMMIT  },
+		{"HDDISCARD"  , NULL, PARAM_DISK_HDDISCARD },
 // Font (Config)
 		{"MODE"       , NULL, PARAM_FONT_MODE      }, // also INFO, CONSOLE, DISASM (from Window)
 // General
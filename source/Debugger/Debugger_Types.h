@@ -1411,6 +1411,11 @@ const	DisasmData_t* pDisasmData; // If != NULL then bytes are marked up as data
 		, PARAM_DISK_EJECT                     // DISK 1 EJECT
 		, PARAM_DISK_PROTECT                   // DISK 1 PROTECT
 		, PARAM_DISK_READ                      // DISK 1 READ Track Sector NumSectors MemAddress
+		, PARAM_DISK_HDCACHE                   // DISK HDCACHE [slot]
+		, PARAM_DISK_COMMIT                    // DISK 1 COMMIT
+		, PARAM_DISK_DISCARD                   // DISK 1 DISCARD
+		, PARAM_DISK_HDCOMMIT                  // DISK HDCOMMIT slot drive
+		, PARAM_DISK_HDDISCARD                 // DISK HDDISCARD slot drive
 	, _PARAM_DISK_END
 	,  PARAM_DISK_NUM = _PARAM_DISK_END - _PARAM_DISK_BEGIN
 
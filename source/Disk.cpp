@@ -37,6 +37,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "CardManager.h"
 #include "CPU.h"
 #include "DiskImage.h"
+#include "InputRecorder.h"
 #include "Log.h"
 #include "Memory.h"
 #include "Registry.h"
@@ -56,6 +57,12 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 // NB. Non-standard 4&4, with Vol=0x00 and Chk=0x00 (only a few match, eg. Wasteland, Legacy of the Ancients, Planetfall, Border Zone & Wizardry). [*1]
 const BYTE Disk2InterfaceCard::m_T00S00Pattern[] = {0xD5,0xAA,0x96,0xAA,0xAA,0xAA,0xAA,0xAA,0xAA,0xAA,0xAA,0xDE};
 
+// The only latch delays that the read sequencer can be in at the start/end of a bit-cell (7 -> 3 -> 0, or held at 4 or 7 by 0 bits)
+const int Disk2InterfaceCard::ms_latchDelays[4] = {0, 3, 4, 7};
+Disk2InterfaceCard::ReadSeqEntry Disk2InterfaceCard::ms_readSeqTable[4*256*16];
+bool Disk2InterfaceCard::ms_readSeqTableInit = false;
+bool Disk2InterfaceCard::ms_readSeqTableEnabled = true;
+
 Disk2InterfaceCard::Disk2InterfaceCard(UINT slot) :
 	Card(CT_Disk2, slot),
 	m_syncEvent(slot, 0, SyncEventCallback)	// use slot# as "unique" id for Disk2InterfaceCards
@@ -77,6 +84,10 @@ Disk2InterfaceCard::Disk2InterfaceCard(UINT slot) :
 	m_deferredStepperCumulativeCycles = 0;
 
 	ResetLogicStateSequencer();
+	InitReadSequencerTable();
+
+	for (UINT i = 0; i < NUM_DRIVES; i++)
+		m_floppyDrive[i].m_weakBitRand = 0x9E3779B9 * (slot * NUM_DRIVES + i + 1);	// odd multiplier, so never 0
 
 	// Debug:
 #if LOG_DISK_NIBBLES_USE_RUNTIME_VAR
@@ -234,7 +245,9 @@ void Disk2InterfaceCard::SaveLastDiskImage(const int drive)
 
 	const std::string& pathName = DiskGetFullPathName(drive);
 
-	RegSaveString(regSection.c_str(), regKey.c_str(), TRUE, pathName);
+	// Don't save a base image that has an overlay, as next time it would be opened without the overlay (ie. writable)
+	const bool hasOverlay = ImageHasOverlay(m_floppyDrive[drive].m_disk.m_imagehandle);
+	RegSaveString(regSection.c_str(), regKey.c_str(), TRUE, hasOverlay ? "" : pathName);
 
 	//
 
@@ -338,7 +351,7 @@ void Disk2InterfaceCard::ReadTrack(const int drive, ULONG uExecutedCycles)
 		const UINT32 currentBitPosition = pFloppy->m_bitOffset;
 		const UINT32 currentBitTrackLength = pFloppy->m_bitCount;
 
-		ImageReadTrack(
+		m_trackWriter.ReadTrack(
 			pFloppy->m_imagehandle,
 			pDrive->m_phasePrecise,
 			pFloppy->m_trackimage,
@@ -398,7 +411,7 @@ void Disk2InterfaceCard::EjectDiskInternal(const int drive)
 
 	if (pFloppy->m_imagehandle)
 	{
-		FlushCurrentTrack(drive);
+		FlushCurrentTrack(drive, true);
 
 		ImageClose(pFloppy->m_imagehandle);
 		pFloppy->m_imagehandle = NULL;
@@ -421,6 +434,8 @@ void Disk2InterfaceCard::EjectDisk(const int drive)
 	if (!IsDriveValid(drive))
 		return;
 
+	GetInputRecorder().Record(InputRecorder::EV_DISK_EJECT, InputRecorder::DiskArg(m_slot, drive));
+
 	EjectDiskInternal(drive);
 	Snapshot_UpdatePath();
 
@@ -459,7 +474,7 @@ void Disk2InterfaceCard::WriteTrack(const int drive)
 #if LOG_DISK_TRACKS
 		LOG_DISK("track $%s write\r\n", GetCurrentTrackString().c_str());
 #endif
-		ImageWriteTrack(
+		m_trackWriter.Write(
 			pFloppy->m_imagehandle,
 			pDrive->m_phasePrecise,
 			pFloppy->m_trackimage,
@@ -469,12 +484,17 @@ void Disk2InterfaceCard::WriteTrack(const int drive)
 	pFloppy->m_trackimagedirty = false;
 }
 
-void Disk2InterfaceCard::FlushCurrentTrack(const int drive)
+// bWait: also wait for the track (and any other queued tracks for this image) to be written to the image file
+// . eg. before the image is closed, or is accessed outside of the emulator
+void Disk2InterfaceCard::FlushCurrentTrack(const int drive, const bool bWait /*=false*/)
 {
 	FloppyDisk* pFloppy = &m_floppyDrive[drive].m_disk;
 
 	if (pFloppy->m_trackimage && pFloppy->m_trackimagedirty)
 		WriteTrack(drive);
+
+	if (bWait && pFloppy->m_imagehandle)
+		m_trackWriter.Wait(pFloppy->m_imagehandle);
 }
 
 //===========================================================================
@@ -814,7 +834,8 @@ void Disk2InterfaceCard::GetLightStatus(Disk_Status_e *pDisk1Status, Disk_Status
 //===========================================================================
 
 // Pre: pathname likely to include path (but can also just be filename)
-ImageError_e Disk2InterfaceCard::InsertDisk(const int drive, const std::string& pathname, const bool bForceWriteProtected, const bool bCreateIfNecessary)
+// . overlayPathname: optional copy-on-write overlay, so that pathname (the base image) is only read
+ImageError_e Disk2InterfaceCard::InsertDisk(const int drive, const std::string& pathname, const bool bForceWriteProtected, const bool bCreateIfNecessary, const std::string& overlayPathname /*=""*/)
 {
 	FloppyDrive* pDrive = &m_floppyDrive[drive];
 	FloppyDisk* pFloppy = &pDrive->m_disk;
@@ -826,13 +847,17 @@ ImageError_e Disk2InterfaceCard::InsertDisk(const int drive, const std::string&
 	// . Changing the disk (in the drive) doesn't affect the drive's attributes.
 	pFloppy->clear();
 
-	const DWORD dwAttributes = GetFileAttributes(pathname.c_str());
+	// With an overlay, the write-protect state comes from the overlay (which will be created if it doesn't exist)
+	const bool hasOverlay = !overlayPathname.empty();
+	const DWORD dwAttributes = GetFileAttributes(hasOverlay ? overlayPathname.c_str() : pathname.c_str());
 	if (dwAttributes == INVALID_FILE_ATTRIBUTES)
 		pFloppy->m_bWriteProtected = false;	// Assume this is a new file to create (so it must be write-enabled to allow it to be formatted)
 	else
 		pFloppy->m_bWriteProtected = bForceWriteProtected ? true : (dwAttributes & FILE_ATTRIBUTE_READONLY);
 
 	// Check if image is being used by the other drive, and if so remove it in order so it can be swapped
+	// . not when using an overlay, as a base image can be shared (read-only)
+	if (!hasOverlay)
 	{
 		const std::string & pszOtherPathname = DiskGetFullPathName(!drive);
 
@@ -852,7 +877,9 @@ ImageError_e Disk2InterfaceCard::InsertDisk(const int drive, const std::string&
 		&pFloppy->m_imagehandle,
 		&pFloppy->m_bWriteProtected,
 		bCreateIfNecessary,
-		pFloppy->m_strFilenameInZip);
+		pFloppy->m_strFilenameInZip,
+		true,
+		overlayPathname);
 
 	if (Error == eIMAGE_ERROR_NONE && ImageIsMultiFileZip(pFloppy->m_imagehandle))
 	{
@@ -869,6 +896,9 @@ ImageError_e Disk2InterfaceCard::InsertDisk(const int drive, const std::string&
 
 	if (Error == eIMAGE_ERROR_NONE)
 	{
+		const std::string payload = pathname + std::string(1, '\0') + overlayPathname;
+		GetInputRecorder().Record(InputRecorder::EV_DISK_INSERT, InputRecorder::DiskArg(m_slot, drive, bForceWriteProtected, bCreateIfNecessary), 0, payload.data(), (UINT32)payload.size());
+
 		GetImageTitle(pathname.c_str(), pFloppy->m_imagename, pFloppy->m_fullname);
 		Snapshot_UpdatePath();
 
@@ -887,6 +917,37 @@ ImageError_e Disk2InterfaceCard::InsertDisk(const int drive, const std::string&
 	return Error;
 }
 
+// Write the overlay's blocks back to the base image
+bool Disk2InterfaceCard::CommitOverlay(const int drive)
+{
+	FloppyDisk* pFloppy = &m_floppyDrive[drive].m_disk;
+	if (!ImageHasOverlay(pFloppy->m_imagehandle))
+		return false;
+
+	FlushCurrentTrack(drive, true);
+
+	return ImageCommitOverlay(pFloppy->m_imagehandle);
+}
+
+// Throw away the overlay's blocks, and re-insert so that the base image's data is used
+bool Disk2InterfaceCard::DiscardOverlay(const int drive)
+{
+	FloppyDisk* pFloppy = &m_floppyDrive[drive].m_disk;
+	if (!ImageHasOverlay(pFloppy->m_imagehandle))
+		return false;
+
+	pFloppy->m_trackimagedirty = false;	// Drop the current track's changes too
+	m_trackWriter.Wait(pFloppy->m_imagehandle);	// ... but let any queued tracks finish writing to the overlay first
+
+	if (!ImageDiscardOverlay(pFloppy->m_imagehandle))
+		return false;
+
+	const std::string pathname = ImageGetPathname(pFloppy->m_imagehandle);		// copy, as InsertDisk() closes the image
+	const std::string overlayPathname = ImageGetOverlayPathname(pFloppy->m_imagehandle);
+	const bool bWriteProtected = pFloppy->m_bWriteProtected;
+	return InsertDisk(drive, pathname, bWriteProtected, IMAGE_DONT_CREATE, overlayPathname) == eIMAGE_ERROR_NONE;
+}
+
 //===========================================================================
 
 bool Disk2InterfaceCard::IsConditionForFullSpeed(void)
@@ -957,6 +1018,17 @@ void Disk2InterfaceCard::NotifyInvalidImage(const int drive, const std::string &
 							pszImageFilename);
 		break;
 
+	case eIMAGE_ERROR_UNABLE_TO_OPEN_OVERLAY:
+		strText = StrFormat("Unable to open or create the overlay for the file %s.",
+							pszImageFilename);
+		break;
+
+	case eIMAGE_ERROR_OVERLAY_MISMATCH:
+		strText = StrFormat("Unable to use the file %s\n"
+							"because its overlay was created for a different disk image.",
+							pszImageFilename);
+		break;
+
 	default:
 		// IGNORE OTHER ERRORS SILENTLY
 		return;
@@ -1397,6 +1469,136 @@ void __stdcall Disk2InterfaceCard::DataLatchReadWriteWOZ(WORD pc, WORD addr, BYT
 		GetFrame().FrameDrawDiskStatus();
 }
 
+// Build the read sequencer's 4 bit-cell transition table, by running DataLatchReadWOZ()'s per bit-cell logic
+void Disk2InterfaceCard::InitReadSequencerTable(void)
+{
+	if (ms_readSeqTableInit)
+		return;
+
+	for (UINT latchDelayIdx = 0; latchDelayIdx < 4; latchDelayIdx++)
+	{
+		for (UINT shiftReg = 0; shiftReg < 256; shiftReg++)
+		{
+			for (UINT outputBits = 0; outputBits < 16; outputBits++)
+			{
+				ReadSeqEntry& entry = ms_readSeqTable[(latchDelayIdx << 12) | (shiftReg << 4) | outputBits];
+				memset(&entry, 0, sizeof(entry));
+
+				BYTE sr = shiftReg;
+				int latchDelay = ms_latchDelays[latchDelayIdx];
+
+				for (int bit = 3; bit >= 0; bit--)	// b3 is the 1st bit-cell's output
+				{
+					sr <<= 1;
+					sr |= (outputBits >> bit) & 1;
+
+					if (latchDelay)
+					{
+						latchDelay -= 4;
+						if (latchDelay < 0)
+							latchDelay = 0;
+
+						if (sr)
+						{
+							entry.flags |= ReadSeqEntry::DBG_LATCH_DELAYED_RESET;
+							entry.dbgLatchDelayedInc = 0;
+						}
+						else
+						{
+							latchDelay += 4;
+							entry.dbgLatchDelayedInc++;
+						}
+					}
+
+					if (!latchDelay)
+					{
+						entry.latch = sr;
+						entry.flags |= ReadSeqEntry::LATCH_WRITTEN;
+
+						if (sr & 0x80)
+						{
+							_ASSERT(!(entry.flags & ReadSeqEntry::LATCH_NIBBLE));
+							entry.nibble = sr;
+							entry.flags |= ReadSeqEntry::LATCH_NIBBLE;
+							latchDelay = 7;
+							sr = 0;
+						}
+					}
+				}
+
+				entry.shiftReg = sr;
+				for (BYTE i = 0; i < 4; i++)
+				{
+					if (ms_latchDelays[i] == latchDelay)
+						entry.latchDelayIdx = i;
+				}
+			}
+		}
+	}
+
+	ms_readSeqTableInit = true;
+}
+
+// Process the next 4 bit-cells via the read sequencer table, or return NULL if they need the per bit-cell path:
+// . the track wraps, m_revs is inc'd, or there's a track seam jitter check (see AddTrackSeamJitter())
+// . a run of 4 zero bits in the head window (ie. a weak bit-cell, which needs a random bit)
+// . the latch delay is not one the table knows about (eg. from an old save-state)
+__forceinline const Disk2InterfaceCard::ReadSeqEntry* Disk2InterfaceCard::DataLatchReadWOZ4(FloppyDrive& drive, FloppyDisk& floppy, const bool seamJitter)
+{
+	const UINT bitOffset = floppy.m_bitOffset;
+	if (bitOffset + 4 >= floppy.m_bitCount)
+		return NULL;
+	if (floppy.m_initialBitOffset - (bitOffset + 1) < 4)
+		return NULL;
+	if (seamJitter && (UINT)floppy.m_longestSyncFFBitOffsetStart - (bitOffset + 1) < 4)
+		return NULL;
+
+	UINT latchDelayIdx;
+	switch (m_latchDelay)
+	{
+	case 0: latchDelayIdx = 0; break;
+	case 3: latchDelayIdx = 1; break;
+	case 4: latchDelayIdx = 2; break;
+	case 7: latchDelayIdx = 3; break;
+	default: return NULL;
+	}
+
+	// Next 4 bits from the track, 1st bit-cell in b3 (NB. they don't span the track's end, so m_byte+1 is valid if needed)
+	const UINT bitPos = bitOffset & 7;
+	UINT bits = floppy.m_trackimage[floppy.m_byte] << 8;
+	if (bitPos > 4)
+		bits |= floppy.m_trackimage[floppy.m_byte + 1];
+	const BYTE inputBits = (bits >> (12 - bitPos)) & 0xf;
+
+	// Each bit-cell's head window (lower 4 bits) is a 4-bit slice of these 7 bits, so check for any run of 4 zeros
+	const BYTE headWindow = drive.m_headWindow;
+	const BYTE zeros = ~(((headWindow & 7) << 4) | inputBits) & 0x7f;
+	if (zeros & (zeros >> 1) & (zeros >> 2) & (zeros >> 3))
+		return NULL;
+
+	// Each bit-cell outputs the previous bit-cell's input bit
+	const BYTE outputBits = ((headWindow & 1) << 3) | (inputBits >> 1);
+	const ReadSeqEntry& entry = ms_readSeqTable[(latchDelayIdx << 12) | (m_shiftReg << 4) | outputBits];
+
+	drive.m_headWindow = (headWindow << 4) | inputBits;
+
+	floppy.m_bitOffset = bitOffset + 4;
+	floppy.m_byte = floppy.m_bitOffset / 8;
+	floppy.m_bitMask = 1 << (7 - (floppy.m_bitOffset & 7));
+
+	m_shiftReg = entry.shiftReg;
+	m_latchDelay = ms_latchDelays[entry.latchDelayIdx];
+	if (entry.flags & ReadSeqEntry::LATCH_WRITTEN)
+		m_floppyLatch = entry.latch;
+
+	if (entry.flags & ReadSeqEntry::DBG_LATCH_DELAYED_RESET)
+		m_dbgLatchDelayedCnt = entry.dbgLatchDelayedInc;
+	else
+		m_dbgLatchDelayedCnt += entry.dbgLatchDelayedInc;
+
+	return &entry;
+}
+
 void Disk2InterfaceCard::DataLatchReadWOZ(WORD pc, WORD addr, UINT bitCellRemainder)
 {
 	// m_diskLastReadLatchCycle = g_nCumulativeCycles;	// Not used by WOZ (only by NIB)
@@ -1417,14 +1619,37 @@ void Disk2InterfaceCard::DataLatchReadWOZ(WORD pc, WORD addr, UINT bitCellRemain
 	}
 #endif
 
-	for (UINT i = 0; i < bitCellRemainder; i++)
+	const bool seamJitter = drive.m_phasePrecise >= (33.0 * 2) && floppy.m_longestSyncFFRunLength > 110;	// See AddTrackSeamJitter()
+
+	while (bitCellRemainder)
 	{
+#if !(LOG_DISK_ENABLED && LOG_DISK_NIBBLES_READ)
+		if (bitCellRemainder >= 4 && ms_readSeqTableEnabled)
+		{
+			const ReadSeqEntry* pEntry = DataLatchReadWOZ4(drive, floppy, seamJitter);
+			if (pEntry)
+			{
+				bitCellRemainder -= 4;
+#if LOG_DISK_NIBBLES_READ
+				if (pEntry->flags & ReadSeqEntry::LATCH_NIBBLE)
+				{
+					m_formatTrack.DecodeLatchNibbleRead(pEntry->nibble);
+					newLatchData = true;
+				}
+#endif
+				continue;
+			}
+		}
+#endif
+
+		bitCellRemainder--;
+
 		BYTE n = floppy.m_trackimage[floppy.m_byte];
 
 		drive.m_headWindow <<= 1;
 		drive.m_headWindow |= (n & floppy.m_bitMask) ? 1 : 0;
 		BYTE outputBit = (drive.m_headWindow & 0xf)	? (drive.m_headWindow >> 1) & 1
-													: (rand() < RAND_THRESHOLD(3, 10)) ? 1 : 0;	// ~30% chance of a 1 bit (Ref: WOZ-2.0)
+													: drive.GetWeakBit();
 
 		IncBitStream(floppy);
 
@@ -1479,7 +1704,7 @@ void Disk2InterfaceCard::DataLatchReadWOZ(WORD pc, WORD addr, UINT bitCellRemain
 #endif
 			}
 		}
-	} // for
+	} // while
 
 #if LOG_DISK_NIBBLES_READ
 	if (m_floppyLatch & 0x80)
@@ -1981,7 +2206,8 @@ bool Disk2InterfaceCard::DriveSwap(void)
 {
 	// Refuse to swap if either Disk][ is active
 	// TODO: if Shift-Click then FORCE drive swap to bypass message
-	if (m_floppyDrive[DRIVE_1].m_spinning || m_floppyDrive[DRIVE_2].m_spinning)
+	// . NB. when replaying, the user already agreed to the swap when it was recorded
+	if ((m_floppyDrive[DRIVE_1].m_spinning || m_floppyDrive[DRIVE_2].m_spinning) && !GetInputRecorder().IsReplaying())
 	{
 		// 1.26.2.4 Prompt when trying to swap disks while drive is on instead of silently failing
 		int status = GetFrame().FrameMessageBox(
@@ -2024,6 +2250,8 @@ bool Disk2InterfaceCard::DriveSwap(void)
 	SaveLastDiskImage(DRIVE_1);
 	SaveLastDiskImage(DRIVE_2);
 
+	GetInputRecorder().Record(InputRecorder::EV_DISK_SWAP, InputRecorder::DiskArg(m_slot, DRIVE_1));
+
 	GetFrame().FrameRefreshStatus(DRAW_LEDS | DRAW_BUTTON_DRIVES);
 
 	return true;
@@ -2218,7 +2446,8 @@ BYTE __stdcall Disk2InterfaceCard::IOWrite(WORD pc, WORD addr, BYTE bWrite, BYTE
 // 7: Deprecated SS_YAML_KEY_LSS_RESET_SEQUENCER, SS_YAML_KEY_DISK_ACCESSED
 // 8: Added: deferred stepper: event, address & cycle
 // 9: Added: absolute path
-static const UINT kUNIT_VERSION = 9;
+// 10: Added: overlay path
+static const UINT kUNIT_VERSION = 10;
 
 #define SS_YAML_VALUE_CARD_DISK2 "Disk]["
 
@@ -2251,6 +2480,7 @@ static const UINT kUNIT_VERSION = 9;
 #define SS_YAML_KEY_FLOPPY "Floppy"
 #define SS_YAML_KEY_FILENAME "Filename"
 #define SS_YAML_KEY_ABSOLUTE_PATH "Absolute Path"
+#define SS_YAML_KEY_OVERLAY_PATH "Overlay Path"
 #define SS_YAML_KEY_BYTE "Byte"
 #define SS_YAML_KEY_NIBBLES "Nibbles"
 #define SS_YAML_KEY_BIT_OFFSET "Bit Offset"
@@ -2274,6 +2504,7 @@ void Disk2InterfaceCard::SaveSnapshotFloppy(YamlSaveHelper& yamlSaveHelper, UINT
 	YamlSaveHelper::Label label(yamlSaveHelper, "%s:\n", SS_YAML_KEY_FLOPPY);
 	yamlSaveHelper.SaveString(SS_YAML_KEY_FILENAME, m_floppyDrive[unit].m_disk.m_fullname);
 	yamlSaveHelper.SaveString(SS_YAML_KEY_ABSOLUTE_PATH, ImageGetPathname(m_floppyDrive[unit].m_disk.m_imagehandle));
+	yamlSaveHelper.SaveString(SS_YAML_KEY_OVERLAY_PATH, ImageGetOverlayPathname(m_floppyDrive[unit].m_disk.m_imagehandle));
 	yamlSaveHelper.SaveHexUint16(SS_YAML_KEY_BYTE, m_floppyDrive[unit].m_disk.m_byte);
 	yamlSaveHelper.SaveHexUint16(SS_YAML_KEY_NIBBLES, m_floppyDrive[unit].m_disk.m_nibbles);
 	yamlSaveHelper.SaveHexUint32(SS_YAML_KEY_BIT_OFFSET, m_floppyDrive[unit].m_disk.m_bitOffset);	// v4
@@ -2307,6 +2538,8 @@ void Disk2InterfaceCard::SaveSnapshotDriveUnit(YamlSaveHelper& yamlSaveHelper, U
 
 void Disk2InterfaceCard::SaveSnapshot(YamlSaveHelper& yamlSaveHelper)
 {
+	m_trackWriter.Wait();	// So the image files are up-to-date with the save-state (NB. the current track is saved in the save-state)
+
 	YamlSaveHelper::Slot slot(yamlSaveHelper, GetSnapshotCardName(), m_slot, kUNIT_VERSION);
 
 	YamlSaveHelper::Label state(yamlSaveHelper, "%s:\n", SS_YAML_KEY_STATE);
@@ -2333,11 +2566,36 @@ bool Disk2InterfaceCard::LoadSnapshotFloppy(YamlLoadHelper& yamlLoadHelper, UINT
 {
 	const std::string simpleFilename = yamlLoadHelper.LoadString(SS_YAML_KEY_FILENAME);
 	const std::string absolutePath = version >= 9 ? yamlLoadHelper.LoadString(SS_YAML_KEY_ABSOLUTE_PATH) : "";
+	const std::string overlayPath = version >= 10 ? yamlLoadHelper.LoadString(SS_YAML_KEY_OVERLAY_PATH) : "";
+
+	FloppyDisk& floppy = m_floppyDrive[unit].m_disk;
+
+	// Restoring in place (eg. rewind): keep the image open if it's the snapshot's image, rather than re-open it
+	const bool bKeepImage = yamlLoadHelper.IsRestoreInPlace() && floppy.m_imagehandle
+		&& !simpleFilename.empty() && floppy.m_fullname == simpleFilename
+		&& ImageGetPathname(floppy.m_imagehandle) == absolutePath
+		&& ImageGetOverlayPathname(floppy.m_imagehandle) == overlayPath;
+
+	if (bKeepImage)
+	{
+		FlushCurrentTrack(unit);	// As InsertDisk() would (via EjectDisk()), as the track image is about to be replaced
+
+		// Reset the disk's attributes that aren't loaded below (as InsertDisk() would, via FloppyDisk::clear())
+		floppy.m_bitMask = 1 << 7;
+		floppy.m_longestSyncFFRunLength = 0;
+		floppy.m_longestSyncFFBitOffsetStart = -1;
+		floppy.m_initialBitOffset = 0;
+		floppy.m_revs = 0;
+	}
+	else if (floppy.m_imagehandle)
+	{
+		EjectDisk(unit);	// Only when restoring in place (otherwise this is a new card)
+	}
 
 	std::string filename = simpleFilename;
 	bool bImageError = filename.empty();
 
-	if (!bImageError)
+	if (!bImageError && !bKeepImage)
 	{
 		DWORD dwAttributes = GetFileAttributes(filename.c_str());
 		if (dwAttributes == INVALID_FILE_ATTRIBUTES && !absolutePath.empty())
@@ -2360,7 +2618,8 @@ bool Disk2InterfaceCard::LoadSnapshotFloppy(YamlLoadHelper& yamlLoadHelper, UINT
 		bImageError = (dwAttributes == INVALID_FILE_ATTRIBUTES);
 		if (!bImageError)
 		{
-			if (InsertDisk(unit, filename, dwAttributes & FILE_ATTRIBUTE_READONLY, IMAGE_DONT_CREATE) != eIMAGE_ERROR_NONE)
+			const bool bForceWriteProtected = overlayPath.empty() && (dwAttributes & FILE_ATTRIBUTE_READONLY);	// with an overlay, the (shared) base image is typically read-only
+			if (InsertDisk(unit, filename, bForceWriteProtected, IMAGE_DONT_CREATE, overlayPath) != eIMAGE_ERROR_NONE)
 				bImageError = true;
 
 			// InsertDisk() zeros m_floppyDrive[unit], then sets up:
@@ -28,6 +28,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "DiskLog.h"
 #include "DiskFormatTrack.h"
 #include "DiskImage.h"
+#include "DiskTrackWriter.h"
 #include "SynchronousEventManager.h"
 
 enum Drive_e
@@ -119,6 +120,16 @@ public:
 		m_disk.clear();
 	}
 
+	// ~30% chance of a 1 bit for a weak (flux-zero) bit-cell (Ref: WOZ-2.0)
+	// NB. xorshift32 rather than rand(): cheaper, and the sequence is per-drive (so not perturbed by other rand() users)
+	BYTE GetWeakBit(void)
+	{
+		m_weakBitRand ^= m_weakBitRand << 13;
+		m_weakBitRand ^= m_weakBitRand >> 17;
+		m_weakBitRand ^= m_weakBitRand << 5;
+		return (m_weakBitRand < 0x4CCCCCCD) ? 1 : 0;
+	}
+
 public:
 	bool m_isConnected;
 	float m_phasePrecise;	// Phase precise to half a phase (aka quarter track)
@@ -128,6 +139,7 @@ public:
 	BYTE m_headWindow;
 	uint32_t m_spinning;
 	uint32_t m_writelight;
+	uint32_t m_weakBitRand;	// xorshift32 state (never 0) - not cleared, so not reset by a snapshot load
 	FloppyDisk m_disk;
 };
 
@@ -145,7 +157,7 @@ public:
 	virtual void Destroy(void);		// no, doesn't "destroy" the disk image.  DiskIIManagerShutdown()
 
 	void Boot(void);
-	void FlushCurrentTrack(const int drive);
+	void FlushCurrentTrack(const int drive, const bool bWait = false);
 
 	const std::string & GetFullDiskFilename(const int drive);
 	const std::string & DiskGetFullPathName(const int drive);
@@ -154,7 +166,9 @@ public:
 	void GetFilenameAndPathForSaveState(std::string& filename, std::string& path);
 	void GetLightStatus (Disk_Status_e* pDisk1Status, Disk_Status_e* pDisk2Status);
 
-	ImageError_e InsertDisk(const int drive, const std::string& pathname, const bool bForceWriteProtected, const bool bCreateIfNecessary);
+	ImageError_e InsertDisk(const int drive, const std::string& pathname, const bool bForceWriteProtected, const bool bCreateIfNecessary, const std::string& overlayPathname = std::string());
+	bool CommitOverlay(const int drive);
+	bool DiscardOverlay(const int drive);
 	void EjectDisk(const int drive);
 	void UnplugDrive(const int drive);
 
@@ -179,6 +193,7 @@ public:
 	bool DriveSwap(void);
 	bool IsDriveConnected(int drive) { return m_floppyDrive[drive].m_isConnected; }
 	void SetFirmware13Sector(void) { m_force13SectorFirmware = true; }
+	static void SetReadSequencerTable(const bool enable) { ms_readSeqTableEnabled = enable; }	// false: WOZ reads use only the per bit-cell path (for test/TestDisk)
 
 	static const std::string& GetSnapshotCardName(void);
 	virtual void SaveSnapshot(YamlSaveHelper& yamlSaveHelper);
@@ -190,6 +205,8 @@ public:
 	bool GetProtect(const int drive);
 	void SetProtect(const int drive, const bool bWriteProtect);
 	bool IsDriveEmpty(const int drive);
+	UINT32 GetWeakBitSeed(const int drive) { return m_floppyDrive[drive].m_weakBitRand; }
+	void SetWeakBitSeed(const int drive, const UINT32 seed) { m_floppyDrive[drive].m_weakBitRand = seed ? seed : 1; }	// xorshift32 state must be non-zero
 	bool IsWozImageInDrive(const int drive);
 
 	bool GetEnhanceDisk(void);
@@ -213,6 +230,9 @@ private:
 	void UpdateBitStreamOffsets(FloppyDisk& floppy);
 	__forceinline void IncBitStream(FloppyDisk& floppy);
 	void DataLatchReadWOZ(WORD pc, WORD addr, UINT bitCellRemainder);
+	struct ReadSeqEntry;
+	__forceinline const ReadSeqEntry* DataLatchReadWOZ4(FloppyDrive& drive, FloppyDisk& floppy, const bool seamJitter);
+	static void InitReadSequencerTable(void);
 	void DataLoadWriteWOZ(WORD pc, WORD addr, UINT bitCellRemainder);
 	void DataShiftWriteWOZ(WORD pc, WORD addr, ULONG uExecutedCycles);
 	void SetSequencerFunction(WORD addr, ULONG executedCycles);
@@ -272,6 +292,7 @@ private:
 	unsigned __int64 m_diskLastReadLatchCycle;
 	FormatTrack m_formatTrack;
 	bool m_enhanceDisk;
+	CDiskTrackWriter m_trackWriter;
 
 	static const UINT SPINNING_CYCLES = 1000*1000;		// 1M cycles = ~1.000s
 	static const UINT WRITELIGHT_CYCLES = 1000*1000;	// 1M cycles = ~1.000s
@@ -296,6 +317,23 @@ private:
 	SEQUENCER_FUNCTION m_seqFunc;
 	UINT m_dbgLatchDelayedCnt;
 
+	// Read sequencer, 4 bit-cells at a time (see DataLatchReadWOZ4):
+	// . indexed by [latchDelayIdx:2][shiftReg:8][outputBits:4], where latchDelayIdx indexes ms_latchDelays[]
+	struct ReadSeqEntry
+	{
+		enum { LATCH_WRITTEN = 1<<0, LATCH_NIBBLE = 1<<1, DBG_LATCH_DELAYED_RESET = 1<<2 };
+		BYTE shiftReg;
+		BYTE latchDelayIdx;
+		BYTE latch;					// last value written to the latch (if LATCH_WRITTEN)
+		BYTE nibble;				// latch value with b7 set (if LATCH_NIBBLE) - at most 1 per 4 bit-cells
+		BYTE flags;
+		BYTE dbgLatchDelayedInc;	// since the last reset (if DBG_LATCH_DELAYED_RESET)
+	};
+	static const int ms_latchDelays[4];
+	static ReadSeqEntry ms_readSeqTable[4*256*16];
+	static bool ms_readSeqTableInit;
+	static bool ms_readSeqTableEnabled;
+
 	bool m_deferredStepperEvent;
 	WORD m_deferredStepperAddress;
 	unsigned __int64 m_deferredStepperCumulativeCycles;
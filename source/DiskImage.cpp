@@ -30,25 +30,60 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "DiskImage.h"
 #include "Common.h"
+#include "DiskImageExtractCache.h"
 #include "DiskImageHelper.h"
+#include "DiskImageJournal.h"
+#include "DiskImageOverlay.h"
+#include "DiskImageTrackCache.h"
+#include "Log.h"
 
 
+#include <mutex>
+
 static CDiskImageHelper sg_DiskImageHelper;
 static CHardDiskImageHelper sg_HardDiskImageHelper;
 
+// Held by every Image*() accessor: the image helpers are shared by all images (eg. CImageBase::m_pWorkBuffer & the WOZ
+// helper's state), and an image can be accessed by both the emulation thread & a card's worker (see CDiskTrackWriter)
+// . recursive, as some accessors call others (eg. ImageOpen() -> DeleteImageInfo())
+// . not taken by the accessors of an image's fixed attributes (eg. ImageIsWOZ()), which the emulation thread calls on each
+//   WOZ latch read & head step, and never held across a journal commit (see ImageFlush())
+static std::recursive_mutex sg_imageMutex;
+
+// Serialises the journal commits (and ImageClose()), so that they can write the image file without holding sg_imageMutex
+// . lock order: sg_imageFlushMutex, then sg_imageMutex
+static std::mutex sg_imageFlushMutex;
+
+// Pre: pImageInfo isn't accessible by any other thread (or sg_imageFlushMutex is held & its journal has been committed)
+static void DeleteImageInfo(ImageInfo* const pImageInfo)
+{
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
+	pImageInfo->pImageHelper->Close(pImageInfo);
+	delete pImageInfo;
+}
+
 //===========================================================================
 
 // Pre: *pWriteProtected_ already set to file's r/w status - see DiskInsert()
+// . with an overlay: *pWriteProtected is the overlay's r/w status, and the base image (pszImageFilename) is opened read-only
 ImageError_e ImageOpen(	const std::string & pszImageFilename,
 						ImageInfo** ppImageInfo,
 						bool* pWriteProtected,
 						const bool bCreateIfNecessary,
 						std::string& strFilenameInZip,
-						const bool bExpectFloppy /*=true*/)
+						const bool bExpectFloppy /*=true*/,
+						const std::string& overlayFilename /*=""*/)
 {
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
 	if (!(!pszImageFilename.empty() && ppImageInfo && pWriteProtected))
 		return eIMAGE_ERROR_BAD_POINTER;
 
+	// Complete (or discard) any track write that was interrupted last time this image was used
+	if (bExpectFloppy)
+		CImageJournal::Recover(pszImageFilename);
+
 	// CREATE A RECORD FOR THE FILE
 	*ppImageInfo = new ImageInfo();
 
@@ -57,10 +92,24 @@ ImageError_e ImageOpen(	const std::string & pszImageFilename,
 	if (bExpectFloppy)	pImageInfo->pImageHelper = &sg_DiskImageHelper;
 	else				pImageInfo->pImageHelper = &sg_HardDiskImageHelper;
 
-	ImageError_e Err = pImageInfo->pImageHelper->Open(pszImageFilename.c_str(), pImageInfo, bCreateIfNecessary, strFilenameInZip);
+	if (!overlayFilename.empty())
+	{
+		pImageInfo->pOverlay = new CImageOverlay();
+		pImageInfo->bWriteProtected = true;	// The base image is never written to
+	}
+
+	ImageError_e Err = pImageInfo->pImageHelper->Open(pszImageFilename.c_str(), pImageInfo, bCreateIfNecessary && !pImageInfo->pOverlay, strFilenameInZip);
+
+	if (Err == eIMAGE_ERROR_NONE && pImageInfo->pOverlay)
+	{
+		pImageInfo->bWriteProtected = *pWriteProtected;
+		const bool bImageBuffered = bExpectFloppy || pImageInfo->FileType != eFileNormal;
+		Err = pImageInfo->pImageHelper->OpenOverlay(pImageInfo, overlayFilename, bImageBuffered);
+	}
+
 	if (Err != eIMAGE_ERROR_NONE)
 	{
-		ImageClose(*ppImageInfo);
+		DeleteImageInfo(*ppImageInfo);
 		*ppImageInfo = NULL;
 		return Err;
 	}
@@ -69,7 +118,7 @@ ImageError_e ImageOpen(	const std::string & pszImageFilename,
 	{
 		if (bExpectFloppy)
 		{
-			ImageClose(*ppImageInfo);
+			DeleteImageInfo(*ppImageInfo);
 			*ppImageInfo = NULL;
 			Err = eIMAGE_ERROR_UNSUPPORTED_HDV;
 		}
@@ -85,31 +134,142 @@ ImageError_e ImageOpen(	const std::string & pszImageFilename,
 	_ASSERT(bExpectFloppy);
 	if (!bExpectFloppy || !pImageInfo->uNumTracks)
 	{
-		ImageClose(*ppImageInfo);
+		DeleteImageInfo(*ppImageInfo);
 		*ppImageInfo = NULL;
 		return eIMAGE_ERROR_UNSUPPORTED;
 	}
 
 	*pWriteProtected = pImageInfo->bWriteProtected;
 
+	// Pre-nibblize all tracks in the background (for images that get nibblized on each track change)
+	CImageBase::SectorOrder_e sectorOrder;
+	if (pImageInfo->pImageType->AllowRW() && pImageInfo->pImageType->GetSectorOrder(sectorOrder))
+	{
+		pImageInfo->pTrackCache = new CNibblizedTrackCache(pImageInfo, sectorOrder, pImageInfo->pImageType->GetVolumeNumber());
+		pImageInfo->pTrackCache->StartWorker();
+	}
+
 	return eIMAGE_ERROR_NONE;
 }
 
 //===========================================================================
 
+// Pre: sg_imageFlushMutex is held
+static bool CommitJournal(ImageInfo* const pImageInfo)
+{
+	CImageJournal* pJournal = NULL;
+	{
+		std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+		if (pImageInfo)
+		{
+			pJournal = pImageInfo->pJournal;
+			pImageInfo->pJournal = NULL;	// any further track writes start a new journal
+		}
+	}
+
+	if (!pJournal)
+		return true;
+
+	// The image buffer already has these writes (only the file lags behind), so commit them without sg_imageMutex:
+	// otherwise the emulation thread's next track read would wait for the commit's FlushFileBuffers()
+	const bool bRes = pJournal->Commit();
+	if (!bRes)
+		LogFileOutput("ImageFlush: failed to write track(s) for file: %s\n", pImageInfo->szFilename.c_str());
+
+	delete pJournal;
+	return bRes;
+}
+
 void ImageClose(ImageInfo* const pImageInfo)
 {
-	pImageInfo->pImageHelper->Close(pImageInfo);
+	std::lock_guard<std::mutex> flushLock(sg_imageFlushMutex);
 
-	delete pImageInfo;
+	CommitJournal(pImageInfo);
+	DeleteImageInfo(pImageInfo);
+}
+
+//===========================================================================
+
+// Folder for extracted zip/gzip images, so that other instances (or a later run) can skip the decompression
+void ImageSetExtractCacheDir(const std::string& pathname)
+{
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
+	GetImageExtractCache().SetCacheDir(pathname);
+}
+
+//===========================================================================
+
+// Determine an image's type without opening it (see CImageHelperBase::Sniff())
+ImageError_e ImageSniff(const std::string& pathname, eImageType& imageType, const bool bExpectFloppy /*=true*/)
+{
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
+	if (bExpectFloppy)
+		return sg_DiskImageHelper.Sniff(pathname.c_str(), imageType);
+
+	return sg_HardDiskImageHelper.Sniff(pathname.c_str(), imageType);
+}
+
+// For an image that could be for either card (eg. drag & drop): the floppy helper, then the harddisk helper
+// . eg. an HDV bigger than the floppy helper's GetMaxImageSize() is a "bad size" floppy image
+ImageError_e ImageSniffFloppyOrHarddisk(const std::string& pathname, eImageType& imageType)
+{
+	const ImageError_e Err = ImageSniff(pathname, imageType, true);
+	if (Err == eIMAGE_ERROR_NONE && imageType != eImageUNKNOWN)
+		return Err;
+
+	return ImageSniff(pathname, imageType, false);
+}
+
+//===========================================================================
+
+bool ImageHasOverlay(ImageInfo* const pImageInfo)
+{
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+	return pImageInfo ? (pImageInfo->pOverlay != NULL) : false;
+}
+
+const std::string & ImageGetOverlayPathname(ImageInfo* const pImageInfo)
+{
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+	static const std::string szEmpty;
+	return (pImageInfo && pImageInfo->pOverlay) ? pImageInfo->pOverlay->GetPathname() : szEmpty;
+}
+
+// Write the overlay's modified blocks to the base image (and empty the overlay)
+bool ImageCommitOverlay(ImageInfo* const pImageInfo)
+{
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
+	if (!pImageInfo || !pImageInfo->pOverlay)
+		return false;
+
+	return pImageInfo->pOverlay->Commit(pImageInfo);
+}
+
+// Drop the overlay's modified blocks
+// Post: caller must close & re-open the image, to reload the base image's data
+bool ImageDiscardOverlay(ImageInfo* const pImageInfo)
+{
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
+	if (!pImageInfo || !pImageInfo->pOverlay)
+		return false;
+
+	return pImageInfo->pOverlay->Discard();
 }
 
 //===========================================================================
 
 BOOL ImageBoot(ImageInfo* const pImageInfo)
 {
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
 	BOOL result = 0;
 
+	CheckImageBufferMapping(pImageInfo, true);
+
 	if (pImageInfo->pImageType->AllowBoot())
 		result = pImageInfo->pImageType->Boot(pImageInfo);
 
@@ -128,12 +288,16 @@ void ImageReadTrack(	ImageInfo* const pImageInfo,
 						UINT* pBitCount,
 						bool enhanceDisk)
 {
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
 	_ASSERT(phase >= 0);
 	if (phase < 0)
 		phase = 0;
 
 	const UINT track = pImageInfo->pImageType->PhaseToTrack(phase);
 
+	CheckImageBufferMapping(pImageInfo, true);
+
 	if (pImageInfo->pImageType->AllowRW())
 	{
 		pImageInfo->pImageType->Read(pImageInfo, phase, pTrackImageBuffer, pNibbles, pBitCount, enhanceDisk);
@@ -153,24 +317,52 @@ void ImageWriteTrack(	ImageInfo* const pImageInfo,
 						LPBYTE pTrackImageBuffer,
 						const int nNibbles)
 {
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
 	_ASSERT(phase >= 0);
 	if (phase < 0)
 		phase = 0;
 
 	const UINT track = pImageInfo->pImageType->PhaseToTrack(phase);
 
-	if (pImageInfo->pImageType->AllowRW() && !pImageInfo->bWriteProtected)
+	bool bFlush = false;
+
 	{
-		pImageInfo->pImageType->Write(pImageInfo, phase, pTrackImageBuffer, nNibbles);
+		std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
 
-		eImageType imageType = pImageInfo->pImageType->GetType();
-		if (imageType == eImageWOZ1 || imageType == eImageWOZ2)
+		CheckImageBufferMapping(pImageInfo, true);
+
+		if (pImageInfo->pImageType->AllowRW() && !pImageInfo->bWriteProtected)
 		{
-			uint32_t dummy;
-			bool res = sg_DiskImageHelper.WOZUpdateInfo(pImageInfo, dummy);
-			_ASSERT(res);
+			// NB. only journals writes to a normal image file (not gzip/zip or an overlay)
+			if (!pImageInfo->pJournal)
+				pImageInfo->pJournal = new CImageJournal(pImageInfo);
+
+			pImageInfo->pImageType->Write(pImageInfo, phase, pTrackImageBuffer, nNibbles);
+
+			eImageType imageType = pImageInfo->pImageType->GetType();
+			if (imageType == eImageWOZ1 || imageType == eImageWOZ2)
+			{
+				bool res = sg_DiskImageHelper.WOZUpdateTrackMap(pImageInfo);	// a new track re-allocates pImageBuffer
+				_ASSERT(res);
+			}
+
+			bFlush = pImageInfo->pJournal->GetSize() >= CImageJournal::kMaxSize;
 		}
 	}
+
+	if (bFlush)
+		ImageFlush(pImageInfo);
+}
+
+// Write any journalled track writes to the image file (see CImageJournal)
+// . called by the track writer once it's idle (or asked to flush), and on close
+// . NB. the file writes are done without sg_imageMutex (see CommitJournal())
+bool ImageFlush(ImageInfo* const pImageInfo)
+{
+	std::lock_guard<std::mutex> flushLock(sg_imageFlushMutex);
+
+	return CommitJournal(pImageInfo);
 }
 
 //===========================================================================
@@ -179,6 +371,8 @@ bool ImageReadBlock(	ImageInfo* const pImageInfo,
 						UINT nBlock,
 						LPBYTE pBlockBuffer)
 {
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
 	bool bRes = false;
 	if (pImageInfo->pImageType->AllowRW())
 		bRes = pImageInfo->pImageType->Read(pImageInfo, nBlock, pBlockBuffer);
@@ -192,6 +386,8 @@ bool ImageWriteBlock(	ImageInfo* const pImageInfo,
 						UINT nBlock,
 						LPBYTE pBlockBuffer)
 {
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
+
 	bool bRes = false;
 	if (pImageInfo->pImageType->AllowRW() && !pImageInfo->bWriteProtected)
 		bRes = pImageInfo->pImageType->Write(pImageInfo, nBlock, pBlockBuffer);
@@ -201,6 +397,7 @@ bool ImageWriteBlock(	ImageInfo* const pImageInfo,
 
 //===========================================================================
 
+// Fixed once the image is open, so no lock: called by the emulation thread on each head step (& by the UI thread)
 UINT ImageGetNumTracks(ImageInfo* const pImageInfo)
 {
 	return pImageInfo ? pImageInfo->uNumTracks : 0;
@@ -208,25 +405,30 @@ UINT ImageGetNumTracks(ImageInfo* const pImageInfo)
 
 bool ImageIsMultiFileZip(ImageInfo* const pImageInfo)
 {
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
 	return pImageInfo ? (pImageInfo->uNumValidImagesInZip > 1) : false;
 }
 
 const std::string & ImageGetPathname(ImageInfo* const pImageInfo)
 {
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
 	static const std::string szEmpty;
 	return pImageInfo ? pImageInfo->szFilename : szEmpty;
 }
 
 UINT ImageGetImageSize(ImageInfo* const pImageInfo)
 {
+	std::lock_guard<std::recursive_mutex> lock(sg_imageMutex);
 	return pImageInfo ? pImageInfo->uImageSize : 0;
 }
 
+// Fixed once the image is open, so no lock (as for ImageGetNumTracks())
 bool ImageIsWOZ(ImageInfo* const pImageInfo)
 {
 	return pImageInfo ? (pImageInfo->pImageType->GetType() == eImageWOZ1 || pImageInfo->pImageType->GetType() == eImageWOZ2) : false;
 }
 
+// Fixed once the image is open, so no lock: called by the emulation thread on each WOZ latch read
 BYTE ImageGetOptimalBitTiming(ImageInfo* const pImageInfo)
 {
 	return pImageInfo ? pImageInfo->optimalBitTiming : 32;
@@ -237,6 +439,7 @@ bool ImageIsBootSectorFormatSector13(ImageInfo* const pImageInfo)
 	return pImageInfo ? pImageInfo->bootSectorFormat == CWOZHelper::bootSector13 : false;
 }
 
+// No lock, as for ImageGetNumTracks(): CImageBase::PhaseToTrack() is just arithmetic
 UINT ImagePhaseToTrack(ImageInfo* const pImageInfo, const float phase, const bool limit/*=true*/)
 {
 	if (!pImageInfo)
@@ -71,19 +71,31 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 		eIMAGE_ERROR_FAILED_TO_GET_PATHNAME,
 		eIMAGE_ERROR_ZEROLENGTH_WRITEPROTECTED,
 		eIMAGE_ERROR_FAILED_TO_INIT_ZEROLENGTH,
+		eIMAGE_ERROR_UNABLE_TO_OPEN_OVERLAY,
+		eIMAGE_ERROR_OVERLAY_MISMATCH,
 	};
 
+	enum eImageType {eImageUNKNOWN, eImageDO, eImagePO, eImageNIB1, eImageNIB2, eImageHDV, eImageIIE, eImageAPL, eImagePRG, eImageWOZ1, eImageWOZ2};
+
 	const int MAX_DISK_IMAGE_NAME = 15;
 	const int MAX_DISK_FULL_NAME  = 127;
 
 struct ImageInfo;
 
-ImageError_e ImageOpen(const std::string & pszImageFilename, ImageInfo** ppImageInfo, bool* pWriteProtected, const bool bCreateIfNecessary, std::string& strFilenameInZip, const bool bExpectFloppy=true);
+ImageError_e ImageOpen(const std::string & pszImageFilename, ImageInfo** ppImageInfo, bool* pWriteProtected, const bool bCreateIfNecessary, std::string& strFilenameInZip, const bool bExpectFloppy=true, const std::string& overlayFilename=std::string());
 void ImageClose(ImageInfo* const pImageInfo);
+bool ImageHasOverlay(ImageInfo* const pImageInfo);
+const std::string & ImageGetOverlayPathname(ImageInfo* const pImageInfo);
+bool ImageCommitOverlay(ImageInfo* const pImageInfo);
+bool ImageDiscardOverlay(ImageInfo* const pImageInfo);
+void ImageSetExtractCacheDir(const std::string& pathname);
+ImageError_e ImageSniff(const std::string& pathname, eImageType& imageType, const bool bExpectFloppy=true);
+ImageError_e ImageSniffFloppyOrHarddisk(const std::string& pathname, eImageType& imageType);
 BOOL ImageBoot(ImageInfo* const pImageInfo);
 
 void ImageReadTrack(ImageInfo* const pImageInfo, float phase, LPBYTE pTrackImageBuffer, int* pNibbles, UINT* pBitCount, bool enhanceDisk);
 void ImageWriteTrack(ImageInfo* const pImageInfo, float phase, LPBYTE pTrackImageBuffer, int nNibbles);
+bool ImageFlush(ImageInfo* const pImageInfo);
 bool ImageReadBlock(ImageInfo* const pImageInfo, UINT nBlock, LPBYTE pBlockBuffer);
 bool ImageWriteBlock(ImageInfo* const pImageInfo, UINT nBlock, LPBYTE pBlockBuffer);
 
@@ -0,0 +1,303 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: Extraction cache for zip & gzip disk images
+ *
+ * Mounting images from collection zips (with thousands of entries) would otherwise inflate every entry
+ * on each insert, just to find the image (and to know whether the zip holds more than one image).
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "DiskImageExtractCache.h"
+#include "Common.h"
+#include "Log.h"
+#include "StrFormat.h"
+
+#include "zlib.h"
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+static CImageExtractCache sg_ImageExtractCache;
+
+CImageExtractCache& GetImageExtractCache(void)
+{
+	return sg_ImageExtractCache;
+}
+
+CImageExtractCache::CImageExtractCache(void)
+	: m_totalSize(0)
+	, m_useCount(0)
+{
+}
+
+void CImageExtractCache::SetCacheDir(const std::string& cacheDir)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_cacheDir = cacheDir;
+	if (!m_cacheDir.empty() && m_cacheDir[m_cacheDir.size() - 1] != PATH_SEPARATOR)
+		m_cacheDir += PATH_SEPARATOR;
+}
+
+bool CImageExtractCache::GetFileIdentity(const std::string& pathname, FileIdentity& identity)
+{
+#ifdef _WIN32
+	WIN32_FILE_ATTRIBUTE_DATA data;
+	if (!GetFileAttributesEx(pathname.c_str(), GetFileExInfoStandard, &data))
+		return false;
+
+	identity.size = ((UINT64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+	identity.lastWriteTime = ((UINT64)data.ftLastWriteTime.dwHighDateTime << 32) | data.ftLastWriteTime.dwLowDateTime;
+#else
+	struct stat st;
+	if (stat(pathname.c_str(), &st) != 0)
+		return false;
+
+	identity.size = st.st_size;
+	identity.lastWriteTime = st.st_mtime;
+#endif
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+CImageExtractCache::ZipIndexPtr CImageExtractCache::GetZipIndex(const std::string& pathname, const FileIdentity& identity)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::map<std::string, ZipIndexPtr>::iterator it = m_zipIndexes.find(pathname);
+	if (it == m_zipIndexes.end())
+		return ZipIndexPtr();
+
+	if (it->second->identity.size != identity.size || it->second->identity.lastWriteTime != identity.lastWriteTime)
+	{
+		m_zipIndexes.erase(it);	// stale: zip has been modified
+		return ZipIndexPtr();
+	}
+
+	return it->second;
+}
+
+CImageExtractCache::ZipIndexPtr CImageExtractCache::AddZipIndex(const std::string& pathname, ZipIndex index)
+{
+	ZipIndexPtr pIndex = std::make_shared<const ZipIndex>(std::move(index));
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_zipIndexes[pathname] = pIndex;
+	return pIndex;
+}
+
+// Record which entry a helper detected as the image (see CheckZipFile())
+// . copy-on-write, as other threads may hold the current index
+void CImageExtractCache::SetZipImageEntry(const std::string& pathname, const ZipIndexPtr& pIndex, const UINT helper, const int imageEntry, const UINT numValidImages)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	std::map<std::string, ZipIndexPtr>::iterator it = m_zipIndexes.find(pathname);
+	if (it == m_zipIndexes.end() || it->second != pIndex)
+		return;	// invalidated (or replaced) since pIndex was got
+
+	std::shared_ptr<ZipIndex> pNewIndex = std::make_shared<ZipIndex>(*pIndex);
+	pNewIndex->imageEntry[helper] = imageEntry;
+	pNewIndex->numValidImages[helper] = numValidImages;
+	it->second = pNewIndex;
+}
+
+// Call when the zip is re-written (as its last-write time may not have changed, eg. within the file system's time resolution)
+void CImageExtractCache::InvalidateZipIndex(const std::string& pathname)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_zipIndexes.erase(pathname);
+}
+
+//-----------------------------------------------------------------------------
+
+// NB. the archive's pathname can't contain a newline, and the entry's name comes last
+CImageExtractCache::Key CImageExtractCache::GetKey(const EntryId& id)
+{
+	return StrFormat("%08X %08X %016llX %016llX %s\n", id.crc, id.size, id.identity.size, id.identity.lastWriteTime, id.pathname.c_str()) + id.entryName;
+}
+
+bool CImageExtractCache::Read(const EntryId& id, BYTE* pData)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const Key key = GetKey(id);
+
+	std::map<Key, Entry>::iterator it = m_entries.find(key);
+	if (it != m_entries.end())
+	{
+		memcpy(pData, &it->second.data[0], id.size);
+		it->second.lastUsed = ++m_useCount;
+		return true;
+	}
+
+	if (!ReadCacheFile(key, id, pData))
+		return false;
+
+	AddEntry(key, pData, id.size);
+	return true;
+}
+
+// Pre: pData has already been checked against the crc (eg. by minizip or zlib)
+void CImageExtractCache::Add(const EntryId& id, const BYTE* pData)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const Key key = GetKey(id);
+	if (m_entries.find(key) != m_entries.end())
+		return;
+
+	AddEntry(key, pData, id.size);
+	WriteCacheFile(key, id, pData);
+}
+
+void CImageExtractCache::AddEntry(const Key& key, const BYTE* pData, const UINT size)
+{
+	if (size == 0 || size > kCapacity / 4)	// don't let one large (eg. HDD) image flush everything else
+		return;
+
+	// Evict the least recently used images
+	while (m_totalSize + size > kCapacity && !m_entries.empty())
+	{
+		std::map<Key, Entry>::iterator lru = m_entries.begin();
+		for (std::map<Key, Entry>::iterator it = m_entries.begin(); it != m_entries.end(); ++it)
+		{
+			if (it->second.lastUsed < lru->second.lastUsed)
+				lru = it;
+		}
+
+		m_totalSize -= lru->second.data.size();
+		m_entries.erase(lru);
+	}
+
+	Entry& entry = m_entries[key];
+	entry.data.assign(pData, pData + size);
+	entry.lastUsed = ++m_useCount;
+	m_totalSize += size;
+}
+
+//-----------------------------------------------------------------------------
+
+// Cache file: UINT32 keySize, the key, then the data
+std::string CImageExtractCache::GetCachePathname(const Key& key, const EntryId& id)
+{
+	const UINT32 keyCRC = crc32(0, (const Bytef*)key.c_str(), (uInt)key.size());
+	return m_cacheDir + StrFormat("%08X-%08X-%08X.img", keyCRC, id.crc, id.size);
+}
+
+bool CImageExtractCache::ReadCacheFile(const Key& key, const EntryId& id, BYTE* pData)
+{
+	if (m_cacheDir.empty())
+		return false;
+
+	const std::string pathname = GetCachePathname(key, id);
+
+	HANDLE hFile = CreateFile(pathname.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		(LPSECURITY_ATTRIBUTES)NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	UINT32 keySize = 0;
+	DWORD dwBytesRead;
+	bool bKeyMatch = GetFileSize(hFile, NULL) == sizeof(keySize) + key.size() + id.size
+		&& ReadFile(hFile, &keySize, sizeof(keySize), &dwBytesRead, NULL) && dwBytesRead == sizeof(keySize)
+		&& keySize == key.size();
+
+	if (bKeyMatch)	// otherwise it's another entry's file, whose name has the same hash
+	{
+		std::string fileKey(keySize, '\0');
+		bKeyMatch = ReadFile(hFile, &fileKey[0], keySize, &dwBytesRead, NULL) && dwBytesRead == keySize
+			&& fileKey == key;
+	}
+
+	const bool bRes = bKeyMatch
+		&& ReadFile(hFile, pData, id.size, &dwBytesRead, NULL) && dwBytesRead == id.size
+		&& crc32(0, pData, id.size) == id.crc;
+
+	CloseHandle(hFile);
+
+	if (bKeyMatch && !bRes)
+	{
+		// Corrupt, so delete it (rather than read & reject it every time): the next Add() then re-writes it
+		LogFileOutput("Image cache: deleting corrupt file: %s\n", pathname.c_str());
+		DeleteFile(pathname.c_str());
+	}
+
+	return bRes;
+}
+
+// Written to a temp file & then renamed, so that (eg. after a crash) the cache never has a partly written file
+void CImageExtractCache::WriteCacheFile(const Key& key, const EntryId& id, const BYTE* pData)
+{
+	if (m_cacheDir.empty())
+		return;
+
+	const std::string pathname = GetCachePathname(key, id);
+	const std::string tmpPathname = pathname + ".tmp";
+
+	// NB. no sharing: if another instance is writing the same file, then just leave it to them
+	HANDLE hFile = CreateFile(tmpPathname.c_str(),
+		GENERIC_WRITE,
+		0,
+		(LPSECURITY_ATTRIBUTES)NULL,
+		CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return;
+
+	const UINT32 keySize = (UINT32)key.size();
+	DWORD dwBytesWritten[3];
+	bool bRes = WriteFile(hFile, &keySize, sizeof(keySize), &dwBytesWritten[0], NULL) && dwBytesWritten[0] == sizeof(keySize)
+		&& WriteFile(hFile, key.c_str(), keySize, &dwBytesWritten[1], NULL) && dwBytesWritten[1] == keySize
+		&& WriteFile(hFile, pData, id.size, &dwBytesWritten[2], NULL) && dwBytesWritten[2] == id.size;
+	CloseHandle(hFile);
+
+	if (bRes)
+	{
+#ifdef _WIN32
+		bRes = MoveFileEx(tmpPathname.c_str(), pathname.c_str(), MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+		bRes = rename(tmpPathname.c_str(), pathname.c_str()) == 0;
+#endif
+	}
+
+	if (!bRes)
+	{
+		LogFileOutput("Image cache: failed to write: %s\n", pathname.c_str());
+		DeleteFile(tmpPathname.c_str());
+	}
+}
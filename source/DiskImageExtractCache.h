@@ -0,0 +1,122 @@
+#pragma once
+
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "minizip/unzip.h"
+
+#include <memory>
+#include <mutex>
+
+// Process-wide cache of images extracted from zip & gzip archives:
+// . extracted data is keyed by the archive's identity (pathname, size & last-write time) and the entry's name, CRC32 &
+//   uncompressed size (all held in the zip's central directory, or the gzip trailer), so a cached image is found without
+//   inflating anything - and two entries with the same CRC32 can't get each other's data
+// . optionally backed by a cache folder, so that extracted images are also shared between AppleWin instances (& runs).
+//   A cached file is written to a temp file & then renamed, holds its full key (as its name is just a hash of it), and is
+//   deleted if its data doesn't match its CRC32
+// . a zip's central directory is indexed once per archive identity (pathname, size & last-write time), along with which
+//   entry was detected as the image, so a re-insert of a large collection zip doesn't re-scan (and inflate) its entries
+// . thread-safe (eg. a Disk II card's track writer re-writes a zip while another card opens one): an index is handed out
+//   as a shared_ptr to an immutable ZipIndex, so it stays valid even if it's invalidated (or replaced) meanwhile
+class CImageExtractCache
+{
+public:
+	CImageExtractCache(void);
+	~CImageExtractCache(void) {}
+
+	struct FileIdentity
+	{
+		UINT64 size;
+		UINT64 lastWriteTime;
+	};
+
+	struct ZipEntry
+	{
+		std::string filename;
+		unz_file_info fileInfo;	// crc, uncompressed_size, dates & attributes
+		unz_file_pos filePos;	// for unzGoToFilePos()
+	};
+
+	struct ZipIndex
+	{
+		FileIdentity identity;
+		UINT numEntries;		// from the zip's global info (NB. includes directories & empty files)
+		std::vector<ZipEntry> entries;
+		// Indexed by kFloppy or kHarddisk, as each image helper detects different image types:
+		int imageEntry[2];		// index of the 1st valid image, or -1 if not detected yet
+		UINT numValidImages[2];	// only meaningful if imageEntry >= 0 (and then capped at 2, ie. "more than 1")
+	};
+
+	enum { kFloppy = 0, kHarddisk = 1 };
+
+	void SetCacheDir(const std::string& cacheDir);
+
+	typedef std::shared_ptr<const ZipIndex> ZipIndexPtr;
+
+	ZipIndexPtr GetZipIndex(const std::string& pathname, const FileIdentity& identity);
+	ZipIndexPtr AddZipIndex(const std::string& pathname, ZipIndex index);
+	void SetZipImageEntry(const std::string& pathname, const ZipIndexPtr& pIndex, const UINT helper, const int imageEntry, const UINT numValidImages);
+	void InvalidateZipIndex(const std::string& pathname);
+
+	// An archive's entry (for a gzip: just the archive)
+	struct EntryId
+	{
+		std::string pathname;	// archive
+		FileIdentity identity;	// archive's
+		std::string entryName;	// empty for a gzip
+		UINT32 crc;
+		UINT size;
+	};
+
+	bool Read(const EntryId& id, BYTE* pData);
+	void Add(const EntryId& id, const BYTE* pData);
+
+	static bool GetFileIdentity(const std::string& pathname, FileIdentity& identity);
+
+	static const UINT kCapacity = 64 * 1024 * 1024;	// bytes of extracted images held in memory
+
+private:
+	typedef std::string Key;	// see GetKey()
+
+	struct Entry
+	{
+		std::vector<BYTE> data;
+		UINT64 lastUsed;
+	};
+
+	static Key GetKey(const EntryId& id);
+	std::string GetCachePathname(const Key& key, const EntryId& id);
+	bool ReadCacheFile(const Key& key, const EntryId& id, BYTE* pData);
+	void WriteCacheFile(const Key& key, const EntryId& id, const BYTE* pData);
+	void AddEntry(const Key& key, const BYTE* pData, const UINT size);
+
+	std::map<Key, Entry> m_entries;
+	UINT64 m_totalSize;
+	UINT64 m_useCount;
+	std::map<std::string, ZipIndexPtr> m_zipIndexes;	// pathname -> index
+	std::string m_cacheDir;
+	std::mutex m_mutex;		// To guard all the above
+};
+
+CImageExtractCache& GetImageExtractCache(void);
@@ -38,10 +38,24 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "CPU.h"
 #include "DiskImage.h"
+#include "DiskImageExtractCache.h"
+#include "DiskImageJournal.h"
+#include "DiskImageOverlay.h"
+#include "DiskImageTrackCache.h"
 #include "Log.h"
 #include "Memory.h"
 #include "Interface.h"
 
+#ifndef _WIN32
+#include <atomic>
+#include <mutex>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 ImageInfo::ImageInfo()
 {
 	// this is not a POD as it contains c++ strings
@@ -56,14 +70,249 @@ ImageInfo::ImageInfo()
 	memset(&zipFileInfo, 0, sizeof(zipFileInfo));
 	uNumEntriesInZip = 0;
 	uNumValidImagesInZip = 0;
+	pOverlay = NULL;
+	pJournal = NULL;
 	uNumTracks = 0;
 	pImageBuffer = NULL;
+	pTrackCache = NULL;
+	uImageBufferMappedSize = 0;
+	iImageBufferMappedFd = -1;
+	iImageBufferMappedRange = -1;
 	pWOZTrackMap = NULL;
 	optimalBitTiming = 0;
 	bootSectorFormat = CWOZHelper::bootUnknown;
 	maxNibblesPerTrack = 0;
 }
 
+//-----------------------------------------------------------------------------
+
+#ifndef _WIN32
+// Another process can truncate a mapped image file (eg. by overwriting it in place), and touching a mapped page beyond
+// the new end of the file then raises SIGBUS. So each mapping is registered here, and the SIGBUS handler maps a page of
+// zeros over the faulting page (with the mapping's protection): the access completes, and the mapping is flagged as
+// truncated. CheckImageBufferMapping() then stops using it. A SIGBUS outside the registered mappings is left as fatal.
+namespace MappedImages
+{
+	struct Range
+	{
+		std::atomic<uintptr_t> start;	// 0 if the slot is free
+		size_t size;
+		int prot;
+		std::atomic<bool> truncated;
+	};
+
+	static const int kNumRanges = 32;	// then the images are read into a buffer instead
+	static Range s_ranges[kNumRanges];
+	static std::mutex s_mutex;			// To guard registering (not needed by the handler)
+	static struct sigaction s_oldAction;
+	static uintptr_t s_pageMask;
+
+	static void SigBusHandler(int sig, siginfo_t* pInfo, void* pContext)
+	{
+		const uintptr_t addr = (uintptr_t) pInfo->si_addr;
+		for (int i = 0; i < kNumRanges; i++)
+		{
+			Range& range = s_ranges[i];
+			const uintptr_t start = range.start.load(std::memory_order_acquire);
+			if (start && addr - start < range.size)
+			{
+				if (mmap((void*)(addr & s_pageMask), ~s_pageMask + 1, range.prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED)
+					break;
+
+				range.truncated.store(true, std::memory_order_release);
+				return;	// the access is retried, and now reads zeros
+			}
+		}
+
+		// Not an image: as if this handler wasn't installed (returning re-raises the SIGBUS with the default action)
+		if (s_oldAction.sa_flags & SA_SIGINFO)
+			s_oldAction.sa_sigaction(sig, pInfo, pContext);
+		else if (s_oldAction.sa_handler != SIG_DFL && s_oldAction.sa_handler != SIG_IGN)
+			s_oldAction.sa_handler(sig);
+		else
+			signal(SIGBUS, SIG_DFL);
+	}
+
+	// Returns the range's index, or -1 if they're all in use
+	static int Register(BYTE* pStart, const size_t size, const int prot)
+	{
+		std::lock_guard<std::mutex> lock(s_mutex);
+
+		if (!s_pageMask)
+		{
+			s_pageMask = ~(uintptr_t)(sysconf(_SC_PAGESIZE) - 1);
+
+			struct sigaction action;
+			memset(&action, 0, sizeof(action));
+			action.sa_sigaction = SigBusHandler;
+			action.sa_flags = SA_SIGINFO;
+			sigemptyset(&action.sa_mask);
+			sigaction(SIGBUS, &action, &s_oldAction);
+		}
+
+		for (int i = 0; i < kNumRanges; i++)
+		{
+			Range& range = s_ranges[i];
+			if (range.start.load(std::memory_order_relaxed) == 0)
+			{
+				range.size = size;
+				range.prot = prot;
+				range.truncated.store(false, std::memory_order_relaxed);
+				range.start.store((uintptr_t) pStart, std::memory_order_release);
+				return i;
+			}
+		}
+
+		return -1;
+	}
+
+	static void Unregister(const int index)
+	{
+		s_ranges[index].start.store(0, std::memory_order_release);
+	}
+
+	static bool IsTruncated(const int index)
+	{
+		return s_ranges[index].truncated.load(std::memory_order_acquire);
+	}
+}
+#endif
+
+// Map a normal (ie. not gzip/zip) image file into memory (pImageBuffer), instead of reading it all into a private buffer.
+// . bPrivate=false: read-only shared mapping, so all instances using this image share the host's page cache.
+// . bPrivate=true: copy-on-write mapping, for writable floppy images (which update pImageBuffer, then write through the file handle).
+// Returns false if not supported (ie. Windows) or on failure - so caller should fall back to ReadFile().
+static bool MapImageFile(ImageInfo* pImageInfo, LPCTSTR pszImageFilename, const UINT uSize, const bool bPrivate)
+{
+#ifdef _WIN32
+	return false;
+#else
+	if (uSize == 0)
+		return false;
+
+	const int fd = open(pszImageFilename, O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	const int prot = bPrivate ? (PROT_READ | PROT_WRITE) : PROT_READ;
+	void* pMapping = mmap(NULL, uSize, prot, bPrivate ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+	if (pMapping == MAP_FAILED)
+	{
+		close(fd);
+		return false;
+	}
+
+	const int range = MappedImages::Register((BYTE*) pMapping, uSize, prot);
+	if (range < 0)
+	{
+		munmap(pMapping, uSize);
+		close(fd);
+		return false;
+	}
+
+	pImageInfo->pImageBuffer = (BYTE*) pMapping;
+	pImageInfo->uImageBufferMappedSize = uSize;
+	pImageInfo->iImageBufferMappedFd = fd;
+	pImageInfo->iImageBufferMappedRange = range;
+	return true;
+#endif
+}
+
+static void UnmapImageFile(ImageInfo* pImageInfo)
+{
+#ifndef _WIN32
+	MappedImages::Unregister(pImageInfo->iImageBufferMappedRange);
+	munmap(pImageInfo->pImageBuffer, pImageInfo->uImageBufferMappedSize);
+	close(pImageInfo->iImageBufferMappedFd);
+#endif
+	pImageInfo->uImageBufferMappedSize = 0;
+	pImageInfo->iImageBufferMappedFd = -1;
+	pImageInfo->iImageBufferMappedRange = -1;
+}
+
+bool IsImageBufferMappingTruncated(const ImageInfo* pImageInfo)
+{
+#ifndef _WIN32
+	return pImageInfo->uImageBufferMappedSize && MappedImages::IsTruncated(pImageInfo->iImageBufferMappedRange);
+#else
+	return false;
+#endif
+}
+
+// Once a mapped image file has been truncated (see MappedImages), stop using the mapping:
+// . bKeepCopy=false (harddisk): reads go through the file handle instead, and so fail beyond the new end of the file
+// . bKeepCopy=true (floppy): the image continues from a private copy, with the lost part of the image zero-filled
+// NB. Only an atomic flag is checked, so this is cheap enough to call before each access
+void CheckImageBufferMapping(ImageInfo* pImageInfo, const bool bKeepCopy)
+{
+#ifndef _WIN32
+	if (!IsImageBufferMappingTruncated(pImageInfo))
+		return;
+
+	struct stat fileStat;
+	const bool bStatOK = fstat(pImageInfo->iImageBufferMappedFd, &fileStat) == 0;
+
+	const UINT uMappedSize = pImageInfo->uImageBufferMappedSize;
+	const UINT uValidSize = bStatOK ? (UINT) MIN((UINT64)fileStat.st_size, (UINT64)uMappedSize) : 0;
+	LogFileOutput("Disk image: %s was truncated (%u -> %u bytes) while in use\n", pImageInfo->szFilename.c_str(), uMappedSize, uValidSize);
+
+	CNibblizedTrackCache::WriteLock trackCacheLock(pImageInfo->pTrackCache, CNibblizedTrackCache::kNoTrack);	// its worker reads pImageBuffer
+
+	BYTE* pCopy = NULL;
+	if (bKeepCopy)
+	{
+		pCopy = new BYTE [uMappedSize];
+		memcpy(pCopy, pImageInfo->pImageBuffer, uValidSize);
+		memset(pCopy + uValidSize, 0, uMappedSize - uValidSize);
+
+		if (pImageInfo->pWOZTrackMap)
+			pImageInfo->pWOZTrackMap = pCopy + (pImageInfo->pWOZTrackMap - pImageInfo->pImageBuffer);
+	}
+
+	UnmapImageFile(pImageInfo);
+	pImageInfo->pImageBuffer = pCopy;
+#endif
+}
+
+// gzip & zip images are re-written in full, so write to a temp file and then rename it over the image:
+// a crash part way through the write then leaves the old image intact (rather than a truncated archive)
+static std::string GetTempPathname(const std::string& pathname)
+{
+	return pathname + ".tmp";
+}
+
+static bool ReplaceImageFile(const std::string& tmpPathname, const std::string& pathname)
+{
+#ifdef _WIN32
+	if (MoveFileEx(tmpPathname.c_str(), pathname.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		return true;
+#else
+	if (rename(tmpPathname.c_str(), pathname.c_str()) == 0)
+		return true;
+#endif
+
+	LogFileOutput("Disk image: failed to replace %s with %s\n", pathname.c_str(), tmpPathname.c_str());
+	DeleteFile(tmpPathname.c_str());
+	return false;
+}
+
+// Free pImageBuffer, whether it was allocated or memory-mapped
+static void ReleaseImageBuffer(ImageInfo* pImageInfo)
+{
+	if (pImageInfo->uImageBufferMappedSize)
+	{
+		UnmapImageFile(pImageInfo);
+	}
+	else
+	{
+		delete [] pImageInfo->pImageBuffer;
+	}
+
+	pImageInfo->pImageBuffer = NULL;
+}
+
+//-----------------------------------------------------------------------------
+
 CImageBase::CImageBase()
 	: m_uNumTracksInImage(0)
 	, m_uVolumeNumber(DEFAULT_VOLUME_NUMBER)
@@ -96,6 +345,30 @@ BYTE CImageBase::ms_DiskByte[0x40] =
 	0xF7,0xF9,0xFA,0xFB,0xFC,0xFD,0xFE,0xFF
 };
 
+// Inverse of ms_DiskByte[], indexed by (disk byte & 0x7F)
+const BYTE CImageBase::ms_SixBitByte[0x80] =
+{
+	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,	// $80
+	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,	// $88
+	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x01,	// $90
+	0x00,0x00,0x02,0x03,0x00,0x04,0x05,0x06,	// $98
+	0x00,0x00,0x00,0x00,0x00,0x00,0x07,0x08,	// $A0
+	0x00,0x00,0x00,0x09,0x0A,0x0B,0x0C,0x0D,	// $A8
+	0x00,0x00,0x0E,0x0F,0x10,0x11,0x12,0x13,	// $B0
+	0x00,0x14,0x15,0x16,0x17,0x18,0x19,0x1A,	// $B8
+	0x00,0x00,0x00,0x00,0x00,0x00,0x00,0x00,	// $C0
+	0x00,0x00,0x00,0x1B,0x00,0x1C,0x1D,0x1E,	// $C8
+	0x00,0x00,0x00,0x1F,0x00,0x00,0x20,0x21,	// $D0
+	0x00,0x22,0x23,0x24,0x25,0x26,0x27,0x28,	// $D8
+	0x00,0x00,0x00,0x00,0x00,0x29,0x2A,0x2B,	// $E0
+	0x00,0x2C,0x2D,0x2E,0x2F,0x30,0x31,0x32,	// $E8
+	0x00,0x00,0x33,0x34,0x35,0x36,0x37,0x38,	// $F0
+	0x00,0x39,0x3A,0x3B,0x3C,0x3D,0x3E,0x3F,	// $F8
+};
+
+// 6-and-2 encoding stores the low 2 bits of each data byte with b0 & b1 swapped
+const BYTE CImageBase::ms_SwapBits01[4] = {0x00, 0x02, 0x01, 0x03};
+
 BYTE CImageBase::ms_SectorNumber[NUM_SECTOR_ORDERS][0x10] =
 {
 	{0x00,0x08,0x01,0x09,0x02,0x0A,0x03,0x0B, 0x04,0x0C,0x05,0x0D,0x06,0x0E,0x07,0x0F},
@@ -136,8 +409,23 @@ bool CImageBase::ReadBlock(ImageInfo* pImageInfo, const int nBlock, LPBYTE pBloc
 {
 	long Offset = pImageInfo->uOffset + nBlock * HD_BLOCK_SIZE;
 
+	if (pImageInfo->pOverlay && !pImageInfo->pOverlay->IsImageBuffered())
+		return pImageInfo->pOverlay->Read(pImageInfo, pBlockBuffer, HD_BLOCK_SIZE, Offset);	// NB. a buffered image was already patched by the overlay
+
 	if (pImageInfo->FileType == eFileNormal)
 	{
+		CheckImageBufferMapping(pImageInfo, false);
+
+		if ((UINT)Offset + HD_BLOCK_SIZE <= pImageInfo->uImageBufferMappedSize)
+		{
+			// Read-only & memory-mapped (NB. blocks appended to the image after it was mapped are read via the file handle)
+			memcpy(pBlockBuffer, &pImageInfo->pImageBuffer[Offset], HD_BLOCK_SIZE);
+			if (!IsImageBufferMappingTruncated(pImageInfo))
+				return true;
+
+			CheckImageBufferMapping(pImageInfo, false);	// truncated during the copy: re-read (or fail) via the file handle
+		}
+
 		if (pImageInfo->hFile == INVALID_HANDLE_VALUE)
 			return false;
 
@@ -206,11 +494,17 @@ bool CImageBase::WriteBlock(ImageInfo* pImageInfo, const int nBlock, LPBYTE pBlo
 
 bool CImageBase::WriteImageData(ImageInfo* pImageInfo, LPBYTE pSrcBuffer, const UINT uSrcSize, const long offset)
 {
+	if (pImageInfo->pOverlay)
+		return pImageInfo->pOverlay->Write(pImageInfo, pSrcBuffer, uSrcSize, offset);	// The base image is never written
+
 	if (pImageInfo->FileType == eFileNormal)
 	{
 		if (pImageInfo->hFile == INVALID_HANDLE_VALUE)
 			return false;
 
+		if (pImageInfo->pJournal)
+			return pImageInfo->pJournal->Add(offset, pSrcBuffer, uSrcSize);	// written to the file by CImageJournal::Commit()
+
 		if (SetFilePointer(pImageInfo->hFile, offset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
 		{
 			DWORD err = GetLastError();
@@ -226,7 +520,8 @@ bool CImageBase::WriteImageData(ImageInfo* pImageInfo, LPBYTE pSrcBuffer, const
 	else if (pImageInfo->FileType == eFileGZip)
 	{
 		// Write entire compressed image each time (dirty track change or dirty disk removal or a HDD block is written)
-		gzFile hGZFile = gzopen(pImageInfo->szFilename.c_str(), "wb");
+		const std::string tmpPathname = GetTempPathname(pImageInfo->szFilename);
+		gzFile hGZFile = gzopen(tmpPathname.c_str(), "wb");
 		if (hGZFile == NULL)
 			return false;
 
@@ -234,10 +529,13 @@ bool CImageBase::WriteImageData(ImageInfo* pImageInfo, LPBYTE pSrcBuffer, const
 		int nRes = gzclose(hGZFile);	// close before returning (due to error) to avoid resource leak
 		hGZFile = NULL;
 
-		if (nLen != pImageInfo->uImageSize)
+		if (nLen != pImageInfo->uImageSize || nRes != Z_OK)
+		{
+			DeleteFile(tmpPathname.c_str());
 			return false;
+		}
 
-		if (nRes != Z_OK)
+		if (!ReplaceImageFile(tmpPathname, pImageInfo->szFilename))
 			return false;
 	}
 	else if (pImageInfo->FileType == eFileZip)
@@ -249,7 +547,8 @@ bool CImageBase::WriteImageData(ImageInfo* pImageInfo, LPBYTE pSrcBuffer, const
 		if (pImageInfo->uNumEntriesInZip > 1)
 			return false;
 
-		zipFile hZipFile = zipOpen(pImageInfo->szFilename.c_str(), APPEND_STATUS_CREATE);
+		const std::string tmpPathname = GetTempPathname(pImageInfo->szFilename);
+		zipFile hZipFile = zipOpen(tmpPathname.c_str(), APPEND_STATUS_CREATE);
 		if (hZipFile == NULL)
 			return false;
 
@@ -276,13 +575,22 @@ bool CImageBase::WriteImageData(ImageInfo* pImageInfo, LPBYTE pSrcBuffer, const
 				zipCloseFileInZip(hZipFile);
 
 			zipClose(hZipFile, NULL);
+			DeleteFile(tmpPathname.c_str());
 
 			return false;
 		}
 
 		int nRes = zipClose(hZipFile, NULL);
 		if (nRes != ZIP_OK)
+		{
+			DeleteFile(tmpPathname.c_str());
+			return false;
+		}
+
+		if (!ReplaceImageFile(tmpPathname, pImageInfo->szFilename))
 			return false;
+
+		GetImageExtractCache().InvalidateZipIndex(pImageInfo->szFilename);
 	}
 	else
 	{
@@ -295,134 +603,53 @@ bool CImageBase::WriteImageData(ImageInfo* pImageInfo, LPBYTE pSrcBuffer, const
 
 //-----------------------------------------------------------------------------
 
-LPBYTE CImageBase::Code62(int sector)
+// 6-and-2 encode a 256-byte sector into 343 disk bytes (342 + checksum), in a single pass:
+// . first the 86 auxiliary 6-bit values, each holding the (bit-swapped) low 2 bits of 3 data bytes: [i], [i+86] & [i+172]
+// . then the high 6 bits of each data byte
+// . each 6-bit value is exclusive-or'd with the previous one (the last value is the checksum), then converted to a disk byte
+void CImageBase::Code62(const BYTE* pSector, LPBYTE pNibbles)
 {
-	// CONVERT THE 256 8-BIT BYTES INTO 342 6-BIT BYTES, WHICH WE STORE
-	// STARTING AT 4K INTO THE WORK BUFFER.
-	{
-		LPBYTE sectorbase = m_pWorkBuffer+(sector << 8);
-		LPBYTE resultptr  = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE;
-		BYTE   offset     = 0xAC;
-		while (offset != 0x02)
-		{
-			BYTE value = 0;
-#define ADDVALUE(a) value = (value << 2) |        \
-							(((a) & 0x01) << 1) | \
-							(((a) & 0x02) >> 1)
-			ADDVALUE(*(sectorbase+offset));  offset -= 0x56;
-			ADDVALUE(*(sectorbase+offset));  offset -= 0x56;
-			ADDVALUE(*(sectorbase+offset));  offset -= 0x53;
-#undef ADDVALUE
-			*(resultptr++) = value << 2;
-		}
-		*(resultptr-2) &= 0x3F;
-		*(resultptr-1) &= 0x3F;
-		int loop = 0;
-		while (loop < 0x100)
-			*(resultptr++) = *(sectorbase+(loop++));
-	}
+	BYTE prev = 0;
 
-	// EXCLUSIVE-OR THE ENTIRE DATA BLOCK WITH ITSELF OFFSET BY ONE BYTE,
-	// CREATING A 343RD BYTE WHICH IS USED AS A CHECKSUM.  STORE THE NEW
-	// BLOCK OF 343 BYTES STARTING AT 5K INTO THE WORK BUFFER.
+	for (UINT i = 0; i < 0x56; i++)
 	{
-		BYTE   savedval  = 0;
-		LPBYTE sourceptr = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE;
-		LPBYTE resultptr = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE+0x400;
-		int    loop      = 342;
-		while (loop--)
-		{
-			*(resultptr++) = savedval ^ *sourceptr;
-			savedval = *(sourceptr++);
-		}
-		*resultptr = savedval;
+		BYTE value = ms_SwapBits01[pSector[i] & 3] | (ms_SwapBits01[pSector[i+0x56] & 3] << 2);
+		if (i + 0xAC < 0x100)
+			value |= ms_SwapBits01[pSector[i+0xAC] & 3] << 4;
+
+		*(pNibbles++) = ms_DiskByte[value ^ prev];
+		prev = value;
 	}
 
-	// USING A LOOKUP TABLE, CONVERT THE 6-BIT BYTES INTO DISK BYTES.  A VALID
-	// DISK BYTE IS A BYTE THAT HAS THE HIGH BIT SET, AT LEAST TWO ADJACENT
-	// BITS SET (EXCLUDING THE HIGH BIT), AND AT MOST ONE PAIR OF CONSECUTIVE
-	// ZERO BITS.  THE CONVERTED BLOCK OF 343 BYTES IS STORED STARTING AT 4K
-	// INTO THE WORK BUFFER.
+	for (UINT i = 0; i < 0x100; i++)
 	{
-		LPBYTE sourceptr = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE+0x400;
-		LPBYTE resultptr = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE;
-		int    loop      = 343;
-		while (loop--)
-			*(resultptr++) = ms_DiskByte[(*(sourceptr++)) >> 2];
+		const BYTE value = pSector[i] >> 2;
+		*(pNibbles++) = ms_DiskByte[value ^ prev];
+		prev = value;
 	}
 
-	return m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE;
+	*pNibbles = ms_DiskByte[prev];
 }
 
 //-------------------------------------
 
-void CImageBase::Decode62(LPBYTE imageptr)
+// Reverse of Code62(): decode 342 disk bytes into a 256-byte sector (the checksum isn't checked)
+// . invalid disk bytes decode as 0
+void CImageBase::Decode62(const BYTE* pNibbles, LPBYTE pSector)
 {
-	// IF WE HAVEN'T ALREADY DONE SO, GENERATE A TABLE FOR CONVERTING
-	// DISK BYTES BACK INTO 6-BIT BYTES
-	static BOOL tablegenerated = 0;
-	static BYTE sixbitbyte[0x80];
-	if (!tablegenerated)
-	{
-		memset(sixbitbyte, 0, 0x80);
-		int loop = 0;
-		while (loop < 0x40) {
-			sixbitbyte[ms_DiskByte[loop]-0x80] = loop << 2;
-			loop++;
-		}
-		tablegenerated = 1;
-	}
+	BYTE value[0x56+0x100];
+	BYTE prev = 0;
 
-	// USING OUR TABLE, CONVERT THE DISK BYTES BACK INTO 6-BIT BYTES
+	for (UINT i = 0; i < sizeof(value); i++)
 	{
-		LPBYTE sourceptr = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE;
-		LPBYTE resultptr = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE+0x400;
-		int    loop      = 343;
-		while (loop--)
-			*(resultptr++) = sixbitbyte[*(sourceptr++) & 0x7F];
+		prev ^= ms_SixBitByte[pNibbles[i] & 0x7F];
+		value[i] = prev;
 	}
 
-	// EXCLUSIVE-OR THE ENTIRE DATA BLOCK WITH ITSELF OFFSET BY ONE BYTE
-	// TO UNDO THE EFFECTS OF THE CHECKSUMMING PROCESS
+	for (UINT i = 0; i < 0x100; i++)
 	{
-		BYTE   savedval  = 0;
-		LPBYTE sourceptr = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE+0x400;
-		LPBYTE resultptr = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE;
-		int    loop      = 342;
-		while (loop--)
-		{
-			*resultptr = savedval ^ *(sourceptr++);
-			savedval = *(resultptr++);
-		}
-	}
-
-	// CONVERT THE 342 6-BIT BYTES INTO 256 8-BIT BYTES
-	{
-		LPBYTE lowbitsptr = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE;
-		LPBYTE sectorbase = m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE+0x56;
-		BYTE   offset     = 0xAC;
-		while (offset != 0x02)
-		{
-			if (offset >= 0xAC)
-			{
-				*(imageptr+offset) = (*(sectorbase+offset) & 0xFC)
-										| (((*lowbitsptr) & 0x80) >> 7)
-										| (((*lowbitsptr) & 0x40) >> 5);
-			}
-
-			offset -= 0x56;
-			*(imageptr+offset) = (*(sectorbase+offset) & 0xFC)
-										| (((*lowbitsptr) & 0x20) >> 5)
-										| (((*lowbitsptr) & 0x10) >> 3);
-
-			offset -= 0x56;
-			*(imageptr+offset) = (*(sectorbase+offset) & 0xFC)
-										| (((*lowbitsptr) & 0x08) >> 3)
-										| (((*lowbitsptr) & 0x04) >> 1);
-
-			offset -= 0x53;
-			lowbitsptr++;
-		}
+		const BYTE aux = value[i % 0x56] >> ((i / 0x56) * 2);
+		pSector[i] = (value[0x56+i] << 2) | ms_SwapBits01[aux & 3];
 	}
 }
 
@@ -495,7 +722,7 @@ void CImageBase::DenibblizeTrack(LPBYTE trackimage, SectorOrder_e SectorOrder, i
 					uWriteDataFieldPrologueCount++;
 					_ASSERT(uWriteDataFieldPrologueCount <= NUM_SECTORS);
 #endif
-					Decode62(m_pWorkBuffer+(ms_SectorNumber[SectorOrder][sector] << 8));
+					Decode62(m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE, m_pWorkBuffer+(ms_SectorNumber[SectorOrder][sector] << 8));
 				}
 				sector = 0;
 			}
@@ -507,7 +734,13 @@ void CImageBase::DenibblizeTrack(LPBYTE trackimage, SectorOrder_e SectorOrder, i
 
 uint32_t CImageBase::NibblizeTrack(LPBYTE trackimagebuffer, SectorOrder_e SectorOrder, int track)
 {
-	memset(m_pWorkBuffer+TRACK_DENIBBLIZED_SIZE, 0, TRACK_DENIBBLIZED_SIZE);
+	return NibblizeTrack(m_pWorkBuffer, trackimagebuffer, SectorOrder, track, m_uVolumeNumber);
+}
+
+// Pre: pTrackData is the track's 16 sectors (in the image's sector order)
+// NB. Doesn't use m_pWorkBuffer, so can be called by the nibblized track cache's worker thread
+uint32_t CImageBase::NibblizeTrack(const BYTE* pTrackData, LPBYTE trackimagebuffer, SectorOrder_e SectorOrder, int track, BYTE volumeNumber)
+{
 	LPBYTE imageptr = trackimagebuffer;
 	BYTE   sector   = 0;
 
@@ -530,14 +763,14 @@ uint32_t CImageBase::NibblizeTrack(LPBYTE trackimagebuffer, SectorOrder_e Sector
 		*(imageptr++) = 0x96;
 #define CODE44A(a) ((((a) >> 1) & 0x55) | 0xAA)
 #define CODE44B(a) (((a) & 0x55) | 0xAA)
-		*(imageptr++) = CODE44A(m_uVolumeNumber);
-		*(imageptr++) = CODE44B(m_uVolumeNumber);
+		*(imageptr++) = CODE44A(volumeNumber);
+		*(imageptr++) = CODE44B(volumeNumber);
 		*(imageptr++) = CODE44A((BYTE)track);
 		*(imageptr++) = CODE44B((BYTE)track);
 		*(imageptr++) = CODE44A(sector);
 		*(imageptr++) = CODE44B(sector);
-		*(imageptr++) = CODE44A(m_uVolumeNumber ^ ((BYTE)track) ^ sector);
-		*(imageptr++) = CODE44B(m_uVolumeNumber ^ ((BYTE)track) ^ sector);
+		*(imageptr++) = CODE44A(volumeNumber ^ ((BYTE)track) ^ sector);
+		*(imageptr++) = CODE44B(volumeNumber ^ ((BYTE)track) ^ sector);
 #undef CODE44A
 #undef CODE44B
 		*(imageptr++) = 0xDE;
@@ -555,7 +788,7 @@ uint32_t CImageBase::NibblizeTrack(LPBYTE trackimagebuffer, SectorOrder_e Sector
 		*(imageptr++) = 0xD5;
 		*(imageptr++) = 0xAA;
 		*(imageptr++) = 0xAD;
-		memcpy(imageptr, Code62(ms_SectorNumber[SectorOrder][sector]), 343);
+		Code62(pTrackData+(ms_SectorNumber[SectorOrder][sector] << 8), imageptr);
 		imageptr += 343;
 		*(imageptr++) = 0xDE;
 		*(imageptr++) = 0xAA;
@@ -583,6 +816,29 @@ void CImageBase::SkewTrack(const int nTrack, const int nNumNibbles, const LPBYTE
 
 //-------------------------------------
 
+// Get the track from the nibblized track cache, or nibblize it (and cache it)
+void CImageBase::ReadNibblizedTrack(ImageInfo* pImageInfo, const UINT track, SectorOrder_e SectorOrder, LPBYTE pTrackImageBuffer, int* pNibbles)
+{
+	if (pImageInfo->pTrackCache && pImageInfo->pTrackCache->Read(track, pTrackImageBuffer, pNibbles))
+		return;
+
+	ReadTrack(pImageInfo, track, m_pWorkBuffer, TRACK_DENIBBLIZED_SIZE);
+	*pNibbles = NibblizeTrack(pTrackImageBuffer, SectorOrder, track);
+
+	if (pImageInfo->pTrackCache)
+		pImageInfo->pTrackCache->Update(track, pTrackImageBuffer, *pNibbles);
+}
+
+void CImageBase::WriteNibblizedTrack(ImageInfo* pImageInfo, const UINT track, SectorOrder_e SectorOrder, LPBYTE pTrackImageBuffer, int nNibbles)
+{
+	DenibblizeTrack(pTrackImageBuffer, SectorOrder, nNibbles);
+
+	CNibblizedTrackCache::WriteLock lock(pImageInfo->pTrackCache, track);
+	WriteTrack(pImageInfo, track, m_pWorkBuffer, TRACK_DENIBBLIZED_SIZE);
+}
+
+//-------------------------------------
+
 bool CImageBase::IsValidImageSize(const uint32_t uImageSize)
 {
 	m_uNumTracksInImage = 0;
@@ -688,11 +944,16 @@ public:
 		return ePossibleMatch;
 	}
 
+	virtual eDetectResult Sniff(const LPBYTE pImage, const uint32_t dwImageSize, const char* pszExt)
+	{
+		// The order heuristics above need track 0 & track 17
+		return IsValidImageSize(dwImageSize) ? ePossibleMatch : eMismatch;
+	}
+
 	virtual void Read(ImageInfo* pImageInfo, const float phase, LPBYTE pTrackImageBuffer, int* pNibbles, UINT* pBitCount, bool enhanceDisk)
 	{
 		const UINT track = PhaseToTrack(phase);
-		ReadTrack(pImageInfo, track, m_pWorkBuffer, TRACK_DENIBBLIZED_SIZE);
-		*pNibbles = NibblizeTrack(pTrackImageBuffer, eDOSOrder, track);
+		ReadNibblizedTrack(pImageInfo, track, eDOSOrder, pTrackImageBuffer, pNibbles);
 		if (!enhanceDisk)
 			SkewTrack(track, *pNibbles, pTrackImageBuffer);
 	}
@@ -700,10 +961,11 @@ public:
 	virtual void Write(ImageInfo* pImageInfo, const float phase, LPBYTE pTrackImageBuffer, int nNibbles)
 	{
 		const UINT track = PhaseToTrack(phase);
-		DenibblizeTrack(pTrackImageBuffer, eDOSOrder, nNibbles);
-		WriteTrack(pImageInfo, track, m_pWorkBuffer, TRACK_DENIBBLIZED_SIZE);
+		WriteNibblizedTrack(pImageInfo, track, eDOSOrder, pTrackImageBuffer, nNibbles);
 	}
 
+	virtual bool GetSectorOrder(SectorOrder_e& sectorOrder) { sectorOrder = eDOSOrder; return true; }
+
 	virtual bool AllowCreate(void) { return true; }
 	virtual UINT GetImageSizeForCreate(void) { m_uNumTracksInImage = TRACKS_STANDARD; return TRACK_DENIBBLIZED_SIZE * TRACKS_STANDARD; }
 
@@ -756,11 +1018,15 @@ public:
 		return ePossibleMatch;
 	}
 
+	virtual eDetectResult Sniff(const LPBYTE pImage, const uint32_t dwImageSize, const char* pszExt)
+	{
+		return IsValidImageSize(dwImageSize) ? ePossibleMatch : eMismatch;
+	}
+
 	virtual void Read(ImageInfo* pImageInfo, const float phase, LPBYTE pTrackImageBuffer, int* pNibbles, UINT* pBitCount, bool enhanceDisk)
 	{
 		const UINT track = PhaseToTrack(phase);
-		ReadTrack(pImageInfo, track, m_pWorkBuffer, TRACK_DENIBBLIZED_SIZE);
-		*pNibbles = NibblizeTrack(pTrackImageBuffer, eProDOSOrder, track);
+		ReadNibblizedTrack(pImageInfo, track, eProDOSOrder, pTrackImageBuffer, pNibbles);
 		if (!enhanceDisk)
 			SkewTrack(track, *pNibbles, pTrackImageBuffer);
 	}
@@ -768,10 +1034,11 @@ public:
 	virtual void Write(ImageInfo* pImageInfo, const float phase, LPBYTE pTrackImageBuffer, int nNibbles)
 	{
 		const UINT track = PhaseToTrack(phase);
-		DenibblizeTrack(pTrackImageBuffer, eProDOSOrder, nNibbles);
-		WriteTrack(pImageInfo, track, m_pWorkBuffer, TRACK_DENIBBLIZED_SIZE);
+		WriteNibblizedTrack(pImageInfo, track, eProDOSOrder, pTrackImageBuffer, nNibbles);
 	}
 
+	virtual bool GetSectorOrder(SectorOrder_e& sectorOrder) { sectorOrder = eProDOSOrder; return true; }
+
 	virtual eImageType GetType(void) { return eImagePO; }
 	virtual const char* GetCreateExtensions(void) { return ".po"; }
 	virtual const char* GetRejectExtensions(void) { return ".do;.iie;.nib;.prg;.woz"; }
@@ -822,6 +1089,15 @@ public:
 		return eMatch;
 	}
 
+	virtual eDetectResult Sniff(const LPBYTE pImage, const uint32_t dwImageSize, const char* pszExt)
+	{
+		// Just the size (skip the per-track sanity check)
+		if (dwImageSize < NIB1_TRACK_SIZE*TRACKS_STANDARD || dwImageSize % NIB1_TRACK_SIZE != 0 || dwImageSize > NIB1_TRACK_SIZE*TRACKS_MAX)
+			return eMismatch;
+
+		return eMatch;
+	}
+
 	virtual void Read(ImageInfo* pImageInfo, const float phase, LPBYTE pTrackImageBuffer, int* pNibbles, UINT* pBitCount, bool enhanceDisk)
 	{
 		const UINT track = PhaseToTrack(phase);
@@ -1228,7 +1504,7 @@ public:
 
 			// NB. delete old pImageBuffer: pWOZTrackMap updated in WOZUpdateInfo() by parent function
 
-			delete [] pImageInfo->pImageBuffer;
+			ReleaseImageBuffer(pImageInfo);
 			pTrackMap = NULL;	// invalidate
 			pImageInfo->pImageBuffer = pNewImageBuffer;
 			pImageInfo->uImageSize = newImageSize;
@@ -1355,7 +1631,7 @@ public:
 
 			// NB. delete old pImageBuffer: pWOZTrackMap updated in WOZUpdateInfo() by parent function
 
-			delete [] pImageInfo->pImageBuffer;
+			ReleaseImageBuffer(pImageInfo);
 			pTrackMap = NULL;	// invalidate
 			pImageInfo->pImageBuffer = pNewImageBuffer;
 			pImageInfo->uImageSize = newImageSize;
@@ -1589,6 +1865,7 @@ eDetectResult CWOZHelper::ProcessChunks(ImageInfo* pImageInfo, uint32_t& dwOffse
 
 // NB. Of the 6 cases (floppy/harddisk x gzip/zip/normal) only harddisk-normal isn't read entirely to memory
 // - harddisk-normal-create also doesn't create a max size image-buffer
+// - on Linux, floppy-normal & read-only harddisk-normal are memory-mapped instead (see MapImageFile())
 
 // DETERMINE THE FILE'S EXTENSION AND CONVERT IT TO LOWERCASE
 void CImageHelperBase::GetCharLowerExt(char* pszExt, LPCTSTR pszImageFilename, const UINT uExtSize)
@@ -1622,39 +1899,125 @@ void CImageHelperBase::GetCharLowerExt2(char* pszExt, LPCTSTR pszImageFilename,
 
 //-----------------
 
+// The gzip trailer (last 8 bytes) holds the CRC32 & size (mod 2^32) of the uncompressed data
+// NB. For a multi-member gzip file this is just for the last member, so the caller must check the size
+static bool ReadGZipTrailer(LPCTSTR pszImageFilename, UINT32& crc, UINT32& size)
+{
+	HANDLE hFile = CreateFile(pszImageFilename,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		(LPSECURITY_ATTRIBUTES)NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	BYTE magic[2];
+	UINT32 trailer[2];
+	DWORD dwBytesRead;
+	const bool bRes = ReadFile(hFile, magic, sizeof(magic), &dwBytesRead, NULL) && dwBytesRead == sizeof(magic)
+		&& magic[0] == 0x1F && magic[1] == 0x8B
+		&& SetFilePointer(hFile, -(long)sizeof(trailer), NULL, FILE_END) != INVALID_SET_FILE_POINTER
+		&& ReadFile(hFile, trailer, sizeof(trailer), &dwBytesRead, NULL) && dwBytesRead == sizeof(trailer);
+
+	CloseHandle(hFile);
+
+	crc = trailer[0];	// NB. little-endian
+	size = trailer[1];
+	return bRes;
+}
+
 ImageError_e CImageHelperBase::CheckGZipFile(LPCTSTR pszImageFilename, ImageInfo* pImageInfo)
 {
-	gzFile hGZFile = gzopen(pszImageFilename, "rb");
-	if (hGZFile == NULL)
-		return eIMAGE_ERROR_UNABLE_TO_OPEN_GZ;
+	CImageExtractCache& cache = GetImageExtractCache();
+
+	UINT32 trailerCRC = 0, trailerSize = 0;
+	const bool hasTrailer = ReadGZipTrailer(pszImageFilename, trailerCRC, trailerSize)
+		&& trailerSize != 0 && trailerSize <= GetMaxImageSize();
 
-	// determine uncompressed file length
-	UINT fileSize = 0;
+	CImageExtractCache::EntryId cacheId;
+	cacheId.pathname = pszImageFilename;
+	cacheId.crc = trailerCRC;
+	cacheId.size = trailerSize;
+	const bool useCache = hasTrailer && CImageExtractCache::GetFileIdentity(pszImageFilename, cacheId.identity);
+
+	int nLen = 0;
+
+	if (hasTrailer)
 	{
-		const UINT tempBufferSize = 256 * 1024;
-		BYTE* tempBuffer = new BYTE[tempBufferSize];
-		while (int len = gzread(hGZFile, tempBuffer, tempBufferSize))
-			fileSize += len;
-		delete[] tempBuffer;
-		int res = gzrewind(hGZFile);
-		if (res != 0)
-			return eIMAGE_ERROR_GZ;
+		pImageInfo->pImageBuffer = new BYTE[trailerSize];
+		if (useCache && cache.Read(cacheId, pImageInfo->pImageBuffer))
+			nLen = trailerSize;
 	}
 
-	if (fileSize == 0 || fileSize > GetMaxImageSize())
-		return eIMAGE_ERROR_BAD_SIZE;
+	if (nLen == 0)
+	{
+		gzFile hGZFile = gzopen(pszImageFilename, "rb");
+		if (hGZFile == NULL)
+			return eIMAGE_ERROR_UNABLE_TO_OPEN_GZ;
+
+		if (hasTrailer)
+		{
+			// Inflate straight into the buffer, and just check that there's no more data (ie. trailer's size was correct)
+			BYTE extra;
+			nLen = gzread(hGZFile, pImageInfo->pImageBuffer, trailerSize);
+			if (nLen != trailerSize || gzread(hGZFile, &extra, 1) != 0)
+			{
+				nLen = 0;
+				delete [] pImageInfo->pImageBuffer;
+				pImageInfo->pImageBuffer = NULL;
+				if (gzrewind(hGZFile) != 0)
+				{
+					gzclose(hGZFile);
+					return eIMAGE_ERROR_GZ;
+				}
+			}
+		}
 
-	pImageInfo->pImageBuffer = new BYTE[fileSize];
+		if (nLen == 0)
+		{
+			// determine uncompressed file length
+			UINT fileSize = 0;
+			{
+				const UINT tempBufferSize = 256 * 1024;
+				BYTE* tempBuffer = new BYTE[tempBufferSize];
+				while (int len = gzread(hGZFile, tempBuffer, tempBufferSize))
+					fileSize += len;
+				delete[] tempBuffer;
+				int res = gzrewind(hGZFile);
+				if (res != 0)
+				{
+					gzclose(hGZFile);
+					return eIMAGE_ERROR_GZ;
+				}
+			}
 
-	int nLen = gzread(hGZFile, pImageInfo->pImageBuffer, fileSize);
-	int nRes = gzclose(hGZFile);	// close before returning (due to error) to avoid resource leak
-	hGZFile = NULL;
+			if (fileSize == 0 || fileSize > GetMaxImageSize())
+			{
+				gzclose(hGZFile);
+				return eIMAGE_ERROR_BAD_SIZE;
+			}
 
-	if (nLen <= 0)
-		return eIMAGE_ERROR_BAD_SIZE;
+			pImageInfo->pImageBuffer = new BYTE[fileSize];
+
+			nLen = gzread(hGZFile, pImageInfo->pImageBuffer, fileSize);
+		}
 
-	if (nRes != Z_OK)
-		return eIMAGE_ERROR_GZ;
+		int nRes = gzclose(hGZFile);	// close before returning (due to error) to avoid resource leak
+		hGZFile = NULL;
+
+		if (nLen <= 0)
+			return eIMAGE_ERROR_BAD_SIZE;
+
+		if (nRes != Z_OK)
+			return eIMAGE_ERROR_GZ;
+
+		// NB. Check the CRC, as the trailer is only for the last member of a multi-member file
+		if (useCache && (UINT)nLen == trailerSize && crc32(0, pImageInfo->pImageBuffer, nLen) == trailerCRC)
+			cache.Add(cacheId, pImageInfo->pImageBuffer);
+	}
 
 	//
 
@@ -1679,47 +2042,137 @@ ImageError_e CImageHelperBase::CheckGZipFile(LPCTSTR pszImageFilename, ImageInfo
 
 //-------------------------------------
 
+// Index the zip's central directory (without inflating any entries)
+static bool ReadZipIndex(unzFile hZipFile, CImageExtractCache::ZipIndex& index)
+{
+	unz_global_info global_info;
+	int nRes = unzGetGlobalInfo(hZipFile, &global_info);
+	if (nRes != UNZ_OK)
+		return false;
+
+	index.numEntries = global_info.number_entry;
+	index.entries.clear();
+	index.entries.reserve(global_info.number_entry);
+	for (UINT i = 0; i < 2; i++)
+	{
+		index.imageEntry[i] = -1;
+		index.numValidImages[i] = 0;
+	}
+
+	nRes = unzGoToFirstFile(hZipFile);
+	if (nRes != UNZ_OK)
+		return false;
+
+	for (UINT n=0; n<global_info.number_entry; n++)
+	{
+		if (n)
+		{
+			nRes = unzGoToNextFile(hZipFile);
+			if (nRes == UNZ_END_OF_LIST_OF_FILE)
+				break;
+			if (nRes != UNZ_OK)
+				return false;
+		}
+
+		CImageExtractCache::ZipEntry entry;
+		char szFilename[MAX_PATH];
+		memset(szFilename, 0, sizeof(szFilename));
+
+		nRes = unzGetCurrentFileInfo(hZipFile, &entry.fileInfo, szFilename, MAX_PATH, NULL, 0, NULL, 0);
+		if (nRes != UNZ_OK)
+			return false;
+
+		nRes = unzGetFilePos(hZipFile, &entry.filePos);
+		if (nRes != UNZ_OK)
+			return false;
+
+		entry.filename = szFilename;
+		index.entries.push_back(entry);
+	}
+
+	return true;
+}
+
+// Returns the number of bytes read, or -1 on error
+// . pIdentity: the zip's, or NULL to not use the extract cache
+static int ReadZipEntry(unzFile hZipFile, LPCTSTR pszZipFilename, const CImageExtractCache::FileIdentity* pIdentity, const CImageExtractCache::ZipEntry& entry, BYTE* pImageBuffer)
+{
+	CImageExtractCache& cache = GetImageExtractCache();
+	const UINT uFileSize = entry.fileInfo.uncompressed_size;
+
+	CImageExtractCache::EntryId cacheId;
+	if (pIdentity)
+	{
+		cacheId.pathname = pszZipFilename;
+		cacheId.identity = *pIdentity;
+		cacheId.entryName = entry.filename;
+		cacheId.crc = entry.fileInfo.crc;
+		cacheId.size = uFileSize;
+
+		if (cache.Read(cacheId, pImageBuffer))
+			return uFileSize;
+	}
+
+	unz_file_pos filePos = entry.filePos;
+	if (unzGoToFilePos(hZipFile, &filePos) != UNZ_OK)
+		return -1;
+
+	if (unzOpenCurrentFile(hZipFile) != UNZ_OK)
+		return -1;
+
+	int nLen = unzReadCurrentFile(hZipFile, pImageBuffer, uFileSize);
+
+	// NB. unzCloseCurrentFile() checks the CRC (if the whole file was read)
+	if (unzCloseCurrentFile(hZipFile) != UNZ_OK)
+		return -1;
+
+	if (pIdentity && nLen == (int)uFileSize)
+		cache.Add(cacheId, pImageBuffer);
+
+	return nLen;
+}
+
 ImageError_e CImageHelperBase::CheckZipFile(LPCTSTR pszImageFilename, ImageInfo* pImageInfo, std::string& strFilenameInZip)
 {
 	unzFile hZipFile = unzOpen(pszImageFilename);
 	if (hZipFile == NULL)
 		return eIMAGE_ERROR_UNABLE_TO_OPEN_ZIP;
 
-	unz_global_info global_info;
-	unz_file_info file_info;
-	char szFilename[MAX_PATH];
-	memset(szFilename, 0, sizeof(szFilename));
+	CImageExtractCache& cache = GetImageExtractCache();
+	CImageExtractCache::FileIdentity identity;
+	const bool hasIdentity = CImageExtractCache::GetFileIdentity(pszImageFilename, identity);
+
+	CImageExtractCache::ZipIndexPtr pIndex = hasIdentity ? cache.GetZipIndex(pszImageFilename, identity) : CImageExtractCache::ZipIndexPtr();
+	const UINT helper = m_bIsFloppy ? CImageExtractCache::kFloppy : CImageExtractCache::kHarddisk;
+
 	BYTE* pImageBuffer = NULL;
 	ImageInfo* pImageInfo2 = NULL;
 	CImageBase* pImageType = NULL;
 	UINT numValidImages = 0;
+	int imageEntry = -1;
 
 	try
 	{
-		int nRes = unzGetGlobalInfo(hZipFile, &global_info);
-		if (nRes != UNZ_OK)
-			throw eIMAGE_ERROR_ZIP;
+		if (!pIndex)
+		{
+			CImageExtractCache::ZipIndex localIndex;
+			if (!ReadZipIndex(hZipFile, localIndex))
+				throw eIMAGE_ERROR_ZIP;
 
-		nRes = unzGoToFirstFile(hZipFile);
-		if (nRes != UNZ_OK)
-			throw eIMAGE_ERROR_ZIP;
+			localIndex.identity = identity;
+			pIndex = hasIdentity ? cache.AddZipIndex(pszImageFilename, std::move(localIndex))
+								 : std::make_shared<const CImageExtractCache::ZipIndex>(std::move(localIndex));
+		}
 
-		for (UINT n=0; n<global_info.number_entry; n++)
-		{
-			if (n)
-			{
-				nRes = unzGoToNextFile(hZipFile);
-				if (nRes == UNZ_END_OF_LIST_OF_FILE)
-					break;
-				if (nRes != UNZ_OK)
-					throw eIMAGE_ERROR_ZIP;
-			}
+		// If this zip has been opened before, then go straight to its image
+		const bool isDetected = pIndex->imageEntry[helper] >= 0;
+		const UINT firstEntry = isDetected ? pIndex->imageEntry[helper] : 0;
 
-			nRes = unzGetCurrentFileInfo(hZipFile, &file_info, szFilename, MAX_PATH, NULL, 0, NULL, 0);
-			if (nRes != UNZ_OK)
-				throw eIMAGE_ERROR_ZIP;
+		for (UINT n=firstEntry; n<pIndex->entries.size(); n++)
+		{
+			const CImageExtractCache::ZipEntry& entry = pIndex->entries[n];
 
-			const UINT uFileSize = file_info.uncompressed_size;
+			const UINT uFileSize = entry.fileInfo.uncompressed_size;
 			if (uFileSize > GetMaxImageSize())
 				throw eIMAGE_ERROR_BAD_SIZE;
 
@@ -1728,25 +2181,14 @@ ImageError_e CImageHelperBase::CheckZipFile(LPCTSTR pszImageFilename, ImageInfo*
 
 			//
 
-			nRes = unzOpenCurrentFile(hZipFile);
-			if (nRes != UNZ_OK)
-				throw eIMAGE_ERROR_ZIP;
-
-			BYTE* pImageBuffer = new BYTE[uFileSize];
-			int nLen = unzReadCurrentFile(hZipFile, pImageBuffer, uFileSize);
+			pImageBuffer = new BYTE[uFileSize];
+			int nLen = ReadZipEntry(hZipFile, pszImageFilename, hasIdentity ? &identity : NULL, entry, pImageBuffer);
 			if (nLen < 0)
-			{
-				unzCloseCurrentFile(hZipFile);	// Must CloseCurrentFile before Close
-				throw eIMAGE_ERROR_UNSUPPORTED;
-			}
-
-			nRes = unzCloseCurrentFile(hZipFile);
-			if (nRes != UNZ_OK)
 				throw eIMAGE_ERROR_ZIP;
 
 			// Determine the file's extension and convert it to lowercase
 			char szExt[_MAX_EXT] = "";
-			GetCharLowerExt(szExt, szFilename, _MAX_EXT);
+			GetCharLowerExt(szExt, entry.filename.c_str(), _MAX_EXT);
 
 			uint32_t dwSize = nLen;
 			uint32_t dwOffset = 0;
@@ -1762,17 +2204,18 @@ ImageError_e CImageHelperBase::CheckZipFile(LPCTSTR pszImageFilename, ImageInfo*
 				if (numValidImages == 1)
 				{
 					pImageType = pNewImageType;
-
-					pImageInfo->szFilenameInZip = szFilename;
-					memcpy(&pImageInfo->zipFileInfo.tmz_date, &file_info.tmu_date, sizeof(file_info.tmu_date));
-					pImageInfo->zipFileInfo.dosDate     = file_info.dosDate;
-					pImageInfo->zipFileInfo.internal_fa = file_info.internal_fa;
-					pImageInfo->zipFileInfo.external_fa = file_info.external_fa;
-					pImageInfo->uNumEntriesInZip = global_info.number_entry;
+					imageEntry = n;
+
+					pImageInfo->szFilenameInZip = entry.filename;
+					memcpy(&pImageInfo->zipFileInfo.tmz_date, &entry.fileInfo.tmu_date, sizeof(entry.fileInfo.tmu_date));
+					pImageInfo->zipFileInfo.dosDate     = entry.fileInfo.dosDate;
+					pImageInfo->zipFileInfo.internal_fa = entry.fileInfo.internal_fa;
+					pImageInfo->zipFileInfo.external_fa = entry.fileInfo.external_fa;
+					pImageInfo->uNumEntriesInZip = pIndex->numEntries;
 					pImageInfo->pImageBuffer = pImageBuffer;
 
 					pImageBuffer = NULL;
-					strFilenameInZip = szFilename;
+					strFilenameInZip = entry.filename;
 
 					SetImageInfo(pImageInfo, eFileZip, dwOffset, pImageType, dwSize);
 
@@ -1784,6 +2227,10 @@ ImageError_e CImageHelperBase::CheckZipFile(LPCTSTR pszImageFilename, ImageInfo*
 				pImageInfo->pImageBuffer = NULL;
 			delete [] pImageBuffer;
 			pImageBuffer = NULL;
+
+			// Only need to know if there's more than 1 image (see ImageIsMultiFileZip()), so don't inflate the rest
+			if (isDetected ? (numValidImages == 1) : (numValidImages > 1))
+				break;
 		}
 	}
 	catch (ImageError_e error)
@@ -1809,11 +2256,16 @@ ImageError_e CImageHelperBase::CheckZipFile(LPCTSTR pszImageFilename, ImageInfo*
 	if (!pImageType)
 		return eIMAGE_ERROR_UNSUPPORTED;
 
+	if (pIndex->imageEntry[helper] >= 0)
+		numValidImages = pIndex->numValidImages[helper];
+	else if (hasIdentity)
+		cache.SetZipImageEntry(pszImageFilename, pIndex, helper, imageEntry, numValidImages);
+
 	const eImageType Type = pImageType->GetType();
 	if (Type == eImageAPL || Type == eImageIIE || Type == eImagePRG)
 		return eIMAGE_ERROR_UNSUPPORTED;
 
-	if (global_info.number_entry > 1)
+	if (pIndex->numEntries > 1)
 		pImageInfo->bWriteProtected = 1;	// Zip archives with multiple files are read-only (for now) - see WriteImageData() for zipfile
 
 	pImageInfo->uNumValidImagesInZip = numValidImages;
@@ -1886,22 +2338,42 @@ ImageError_e CImageHelperBase::CheckNormalFile(LPCTSTR pszImageFilename, ImageIn
 		bool bTempDetectBuffer;
 		const UINT uDetectSize = GetMinDetectSize(dwSize, &bTempDetectBuffer);
 
-		pImageInfo->pImageBuffer = new BYTE [dwSize];
-
-		DWORD dwBytesRead;
-		BOOL bRes = ReadFile(hFile, pImageInfo->pImageBuffer, dwSize, &dwBytesRead, NULL);
-		if (!bRes || dwSize != dwBytesRead)
+		if (bTempDetectBuffer)
 		{
-			delete [] pImageInfo->pImageBuffer;
-			pImageInfo->pImageBuffer = NULL;
-			return eIMAGE_ERROR_BAD_SIZE;
-		}
+			// Image is accessed block-by-block via the file handle, so only read the header needed by Detect()
+			const UINT uHeaderSize = (uDetectSize < dwSize) ? uDetectSize : dwSize;
+			std::vector<BYTE> header(uDetectSize, 0);
 
-		pImageType = Detect(pImageInfo->pImageBuffer, dwSize, szExt, dwOffset, pImageInfo);
-		if (bTempDetectBuffer)
+			DWORD dwBytesRead;
+			BOOL bRes = ReadFile(hFile, &header[0], uHeaderSize, &dwBytesRead, NULL);
+			if (!bRes || uHeaderSize != dwBytesRead)
+				return eIMAGE_ERROR_BAD_SIZE;
+
+			pImageType = Detect(&header[0], dwSize, szExt, dwOffset, pImageInfo);
+
+			if (pImageType && pImageInfo->bWriteProtected)
+			{
+				// Read-only: serve blocks directly from a shared mapping (writable images use explicit block reads & writes)
+				MapImageFile(pImageInfo, pszImageFilename, dwSize, false);
+			}
+		}
+		else
 		{
-			delete [] pImageInfo->pImageBuffer;
-			pImageInfo->pImageBuffer = NULL;
+			// NB. With an overlay, the (read-only) base image's buffer gets patched & written to, so needs a private mapping
+			if (!MapImageFile(pImageInfo, pszImageFilename, dwSize, !pImageInfo->bWriteProtected || pImageInfo->pOverlay))
+			{
+				pImageInfo->pImageBuffer = new BYTE [dwSize];
+
+				DWORD dwBytesRead;
+				BOOL bRes = ReadFile(hFile, pImageInfo->pImageBuffer, dwSize, &dwBytesRead, NULL);
+				if (!bRes || dwSize != dwBytesRead)
+				{
+					ReleaseImageBuffer(pImageInfo);
+					return eIMAGE_ERROR_BAD_SIZE;
+				}
+			}
+
+			pImageType = Detect(pImageInfo->pImageBuffer, dwSize, szExt, dwOffset, pImageInfo);
 		}
 	}
 	else	// Create (or pre-existing zero-length file)
@@ -2012,6 +2484,124 @@ ImageError_e CImageHelperBase::Open(	LPCTSTR pszImageFilename,
 	if (uNameLen == 0 || uNameLen >= MAX_PATH)
 		Err = eIMAGE_ERROR_FAILED_TO_GET_PATHNAME;
 
+	AddSniffResult(pszImageFilename, pImageInfo->pImageType->GetType());
+
+	return eIMAGE_ERROR_NONE;
+}
+
+//-------------------------------------
+
+void CImageHelperBase::AddSniffResult(LPCTSTR pszImageFilename, const eImageType imageType)
+{
+	CImageExtractCache::FileIdentity identity;
+	if (!CImageExtractCache::GetFileIdentity(pszImageFilename, identity))
+		return;
+
+	SniffResult& result = m_sniffCache[pszImageFilename];
+	result.size = identity.size;
+	result.lastWriteTime = identity.lastWriteTime;
+	result.imageType = imageType;
+}
+
+// Determine the image's type without loading it, eg. for scanning a library of images:
+// . 1st pass: just the header & file size, which resolves everything except ambiguous DO/PO sized images
+// . 2nd pass: only for these, read the whole image for the order heuristics
+// The result is cached (as is the result of a successful Open()) until the file's size or last-write time changes.
+ImageError_e CImageHelperBase::Sniff(LPCTSTR pszImageFilename, eImageType& imageType)
+{
+	imageType = eImageUNKNOWN;
+
+	CImageExtractCache::FileIdentity identity;
+	if (CImageExtractCache::GetFileIdentity(pszImageFilename, identity))
+	{
+		std::map<std::string, SniffResult>::const_iterator it = m_sniffCache.find(pszImageFilename);
+		if (it != m_sniffCache.end() && it->second.size == identity.size && it->second.lastWriteTime == identity.lastWriteTime)
+		{
+			imageType = it->second.imageType;
+			return eIMAGE_ERROR_NONE;
+		}
+	}
+
+	// A zip/gzip image has to be inflated anyway, so just open it (the extracted image is cached, see CImageExtractCache)
+	const size_t uStrLen = strlen(pszImageFilename);
+	if ((uStrLen > GZ_SUFFIX_LEN && _stricmp(pszImageFilename+uStrLen-GZ_SUFFIX_LEN, GZ_SUFFIX) == 0) ||
+		(uStrLen > ZIP_SUFFIX_LEN && _stricmp(pszImageFilename+uStrLen-ZIP_SUFFIX_LEN, ZIP_SUFFIX) == 0))
+	{
+		ImageInfo* pImageInfo = new ImageInfo();
+		pImageInfo->bWriteProtected = true;
+		std::string strFilenameInZip;
+
+		ImageError_e Err = Open(pszImageFilename, pImageInfo, false, strFilenameInZip);
+		if (Err == eIMAGE_ERROR_NONE)
+			imageType = pImageInfo->pImageType->GetType();
+
+		Close(pImageInfo);
+		delete pImageInfo;
+		return Err;
+	}
+
+	HANDLE hFile = CreateFile(pszImageFilename,
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		(LPSECURITY_ATTRIBUTES)NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+		return eIMAGE_ERROR_UNABLE_TO_OPEN;
+
+	const uint32_t dwFileSize = GetFileSize(hFile, NULL);
+	if (dwFileSize == 0 || dwFileSize > GetMaxImageSize())
+	{
+		CloseHandle(hFile);
+		return eIMAGE_ERROR_BAD_SIZE;
+	}
+
+	char szExt[_MAX_EXT] = "";
+	GetCharLowerExt(szExt, pszImageFilename, _MAX_EXT);
+
+	// 1st pass: header & size
+	std::vector<BYTE> image(kSniffHdrSize, 0);
+	const UINT uHdrSize = (dwFileSize < kSniffHdrSize) ? dwFileSize : kSniffHdrSize;
+
+	DWORD dwBytesRead;
+	BOOL bRes = ReadFile(hFile, &image[0], uHdrSize, &dwBytesRead, NULL);
+	if (!bRes || dwBytesRead != uHdrSize)
+	{
+		CloseHandle(hFile);
+		return eIMAGE_ERROR_BAD_SIZE;
+	}
+
+	bool bNeedImage = false;
+	LPBYTE pImage = &image[0];
+	uint32_t dwSize = dwFileSize;
+	uint32_t dwOffset = 0;
+	imageType = DetectImageType(pImage, dwSize, szExt, dwOffset, &bNeedImage);
+
+	// 2nd pass: whole image
+	if (bNeedImage)
+	{
+		image.resize(dwFileSize);
+
+		bRes = ReadFile(hFile, &image[uHdrSize], dwFileSize - uHdrSize, &dwBytesRead, NULL);
+		if (!bRes || dwBytesRead != dwFileSize - uHdrSize)
+		{
+			CloseHandle(hFile);
+			return eIMAGE_ERROR_BAD_SIZE;
+		}
+
+		pImage = &image[0];
+		dwSize = dwFileSize;
+		imageType = DetectImageType(pImage, dwSize, szExt, dwOffset);
+	}
+
+	CloseHandle(hFile);
+
+	if (imageType == eImageUNKNOWN)
+		return eIMAGE_ERROR_UNSUPPORTED;
+
+	AddSniffResult(pszImageFilename, imageType);
 	return eIMAGE_ERROR_NONE;
 }
 
@@ -2019,6 +2609,10 @@ ImageError_e CImageHelperBase::Open(	LPCTSTR pszImageFilename,
 
 void CImageHelperBase::Close(ImageInfo* pImageInfo)
 {
+	// Stop the track cache's worker thread before the image buffer is released
+	delete pImageInfo->pTrackCache;
+	pImageInfo->pTrackCache = NULL;
+
 	if (pImageInfo->hFile != INVALID_HANDLE_VALUE)
 	{
 		CloseHandle(pImageInfo->hFile);
@@ -2027,8 +2621,58 @@ void CImageHelperBase::Close(ImageInfo* pImageInfo)
 
 	pImageInfo->szFilename.clear();
 
-	delete [] pImageInfo->pImageBuffer;
-	pImageInfo->pImageBuffer = NULL;
+	ReleaseImageBuffer(pImageInfo);
+
+	delete pImageInfo->pOverlay;
+	pImageInfo->pOverlay = NULL;
+}
+
+//-------------------------------------
+
+// Pre: pImageInfo->pOverlay is allocated, and the base image has been opened (read-only)
+// . bImageBuffered: pImageBuffer holds the whole image (floppy or zip/gzip), so patch it now
+// . otherwise (normal file harddisk image) blocks are read from the overlay or the base as needed
+ImageError_e CImageHelperBase::OpenOverlay(ImageInfo* pImageInfo, const std::string& overlayFilename, const bool bImageBuffered)
+{
+	CImageOverlay* pOverlay = pImageInfo->pOverlay;
+
+	ImageError_e Err = pOverlay->Open(overlayFilename, pImageInfo, bImageBuffered);
+	if (Err != eIMAGE_ERROR_NONE)
+		return Err;
+
+	const UINT uImageSize = pOverlay->GetImageSize();
+
+	if (bImageBuffered)
+	{
+		if (uImageSize > pImageInfo->uImageSize)
+		{
+			// Overlay has appended blocks (HDD) or tracks (WOZ)
+			BYTE* pNewImageBuffer = new BYTE[uImageSize];
+			memcpy(pNewImageBuffer, pImageInfo->pImageBuffer, pImageInfo->uImageSize);
+			memset(&pNewImageBuffer[pImageInfo->uImageSize], 0, uImageSize - pImageInfo->uImageSize);
+
+			ReleaseImageBuffer(pImageInfo);
+			pImageInfo->pImageBuffer = pNewImageBuffer;
+		}
+
+		pOverlay->Patch(pImageInfo->pImageBuffer, uImageSize);
+	}
+
+	pImageInfo->uImageSize = uImageSize;
+
+	if (pImageInfo->pImageType->GetType() == eImageWOZ1 || pImageInfo->pImageType->GetType() == eImageWOZ2)
+	{
+		// TMAP & TRKS may have been modified by the overlay
+		uint32_t dwOffset = 0;
+		if (!WOZUpdateInfo(pImageInfo, dwOffset))
+			return eIMAGE_ERROR_BAD_FILE;
+		pImageInfo->uOffset = dwOffset;
+	}
+
+	if (pOverlay->IsReadOnly())
+		pImageInfo->bWriteProtected = true;
+
+	return eIMAGE_ERROR_NONE;
 }
 
 //-------------------------------------
@@ -2052,6 +2696,16 @@ bool CImageHelperBase::WOZUpdateInfo(ImageInfo* pImageInfo, uint32_t& dwOffset)
 	return true;
 }
 
+// After a track write: just re-locate the TMAP (& TRKS) in pImageBuffer, as a new track re-allocates it
+// . NB. unlike WOZUpdateInfo(), doesn't touch the INFO chunk's values, as the emulation thread reads these without a lock
+bool CImageHelperBase::WOZUpdateTrackMap(ImageInfo* pImageInfo)
+{
+	uint32_t dwOffset = 0;
+	const bool bRes = m_WOZHelper.ProcessChunks(pImageInfo, dwOffset) == eMatch;
+	m_WOZHelper.InvalidateInfo();
+	return bRes;
+}
+
 //-----------------------------------------------------------------------------
 
 CDiskImageHelper::CDiskImageHelper(void) :
@@ -2069,14 +2723,14 @@ CDiskImageHelper::CDiskImageHelper(void) :
 	m_vecImageTypes.push_back( new CPrgImage );
 }
 
-CImageBase* CDiskImageHelper::Detect(LPBYTE pImage, uint32_t dwSize, const char* pszExt, uint32_t& dwOffset, ImageInfo* pImageInfo)
+// Skip any MacBinary/2IMG header, then call the detection functions in order, looking for a match
+// . pNeedImage: pImage is just the 1st kSniffHdrSize bytes (see Sniff()), so set *pNeedImage if the whole image is needed to decide
+eImageType CDiskImageHelper::DetectImageType(LPBYTE& pImage, uint32_t& dwSize, const char* pszExt, uint32_t& dwOffset, bool* pNeedImage)
 {
 	dwOffset = 0;
 	m_MacBinaryHelper.DetectHdr(pImage, dwSize, dwOffset);
 	m_Result2IMG = m_2IMGHelper.DetectHdr(pImage, dwSize, dwOffset);
-	pImageInfo->maxNibblesPerTrack = NIBBLES_PER_TRACK;	// Start with the default size (for all types). May get changed below.
 
-	// CALL THE DETECTION FUNCTIONS IN ORDER, LOOKING FOR A MATCH
 	eImageType imageType = eImageUNKNOWN;
 	eImageType possibleType = eImageUNKNOWN;
 
@@ -2102,6 +2756,22 @@ CImageBase* CDiskImageHelper::Detect(LPBYTE pImage, uint32_t dwSize, const char*
 			if (*pszExt && strstr(GetImage(uLoop)->GetRejectExtensions(), pszExt))
 				continue;
 
+			if (pNeedImage)
+			{
+				eDetectResult Result = GetImage(uLoop)->Sniff(pImage, dwSize, pszExt);
+				if (Result == eMatch)
+				{
+					imageType = GetImage(uLoop)->GetType();
+				}
+				else if (Result == ePossibleMatch)
+				{
+					// eg. DO vs PO: a later type could still match, but only if this one doesn't
+					*pNeedImage = true;
+					return eImageUNKNOWN;
+				}
+				continue;
+			}
+
 			eDetectResult Result = GetImage(uLoop)->Detect(pImage, dwSize, pszExt);
 			if (Result == eMatch)
 				imageType = GetImage(uLoop)->GetType();
@@ -2113,6 +2783,15 @@ CImageBase* CDiskImageHelper::Detect(LPBYTE pImage, uint32_t dwSize, const char*
 	if (imageType == eImageUNKNOWN)
 		imageType = possibleType;
 
+	return imageType;
+}
+
+CImageBase* CDiskImageHelper::Detect(LPBYTE pImage, uint32_t dwSize, const char* pszExt, uint32_t& dwOffset, ImageInfo* pImageInfo)
+{
+	pImageInfo->maxNibblesPerTrack = NIBBLES_PER_TRACK;	// Start with the default size (for all types). May get changed below.
+
+	const eImageType imageType = DetectImageType(pImage, dwSize, pszExt, dwOffset);
+
 	CImageBase* pImageType = GetImage(imageType);
 	if (!pImageType)
 		return NULL;
@@ -2204,7 +2883,8 @@ CHardDiskImageHelper::CHardDiskImageHelper(void) :
 	m_vecImageTypes.push_back( new CHDVImage );
 }
 
-CImageBase* CHardDiskImageHelper::Detect(LPBYTE pImage, uint32_t dwSize, const char* pszExt, uint32_t& dwOffset, ImageInfo* pImageInfo)
+// NB. HDV detection only needs the size (and any 2IMG header), so *pNeedImage is never set
+eImageType CHardDiskImageHelper::DetectImageType(LPBYTE& pImage, uint32_t& dwSize, const char* pszExt, uint32_t& dwOffset, bool* pNeedImage)
 {
 	dwOffset = 0;
 	m_Result2IMG = m_2IMGHelper.DetectHdr(pImage, dwSize, dwOffset);
@@ -2216,13 +2896,20 @@ CImageBase* CHardDiskImageHelper::Detect(LPBYTE pImage, uint32_t dwSize, const c
 		if (*pszExt && strstr(GetImage(uLoop)->GetRejectExtensions(), pszExt))
 			continue;
 
-		eDetectResult Result = GetImage(uLoop)->Detect(pImage, dwSize, pszExt);
+		eDetectResult Result = pNeedImage ? GetImage(uLoop)->Sniff(pImage, dwSize, pszExt) : GetImage(uLoop)->Detect(pImage, dwSize, pszExt);
 		if (Result == eMatch)
 			ImageType = GetImage(uLoop)->GetType();
 
 		_ASSERT(Result != ePossibleMatch);
 	}
 
+	return ImageType;
+}
+
+CImageBase* CHardDiskImageHelper::Detect(LPBYTE pImage, uint32_t dwSize, const char* pszExt, uint32_t& dwOffset, ImageInfo* pImageInfo)
+{
+	const eImageType ImageType = DetectImageType(pImage, dwSize, pszExt, dwOffset);
+
 	CImageBase* pImageType = GetImage(ImageType);
 
 	if (pImageType)
@@ -11,11 +11,13 @@
 #define ZIP_SUFFIX_LEN (sizeof(ZIP_SUFFIX)-1)
 
 
-enum eImageType {eImageUNKNOWN, eImageDO, eImagePO, eImageNIB1, eImageNIB2, eImageHDV, eImageIIE, eImageAPL, eImagePRG, eImageWOZ1, eImageWOZ2};
 enum eDetectResult {eMismatch, ePossibleMatch, eMatch};
 
 class CImageBase;
 class CImageHelperBase;
+class CImageOverlay;
+class CImageJournal;
+class CNibblizedTrackCache;
 
 enum FileType_e {eFileNormal, eFileGZip, eFileZip};
 
@@ -33,9 +35,15 @@ struct ImageInfo
 	zip_fileinfo	zipFileInfo;
 	UINT			uNumEntriesInZip;
 	UINT			uNumValidImagesInZip;
+	CImageOverlay*	pOverlay;			// Non-NULL if writes go to an overlay (and the file is the read-only base image)
+	CImageJournal*	pJournal;			// Non-NULL while track writes are journalled but not yet written (see ImageWriteTrack() & ImageFlush())
 	// Floppy only
 	UINT			uNumTracks;
 	BYTE*			pImageBuffer;
+	CNibblizedTrackCache* pTrackCache;	// DO & PO only
+	UINT			uImageBufferMappedSize;	// Non-zero if pImageBuffer is a memory-mapped view of the file (Linux only)
+	int				iImageBufferMappedFd;	// The mapped file, kept open to get its size once it has been truncated
+	int				iImageBufferMappedRange;	// The mapping's SIGBUS guard (see CheckImageBufferMapping())
 	BYTE*			pWOZTrackMap;		// WOZ only (points into pImageBuffer)
 	BYTE			optimalBitTiming;	// WOZ only
 	BYTE			bootSectorFormat;	// WOZ only
@@ -44,6 +52,9 @@ struct ImageInfo
 	ImageInfo();
 };
 
+void CheckImageBufferMapping(ImageInfo* pImageInfo, const bool bKeepCopy);
+bool IsImageBufferMappingTruncated(const ImageInfo* pImageInfo);
+
 //-------------------------------------
 
 #define HD_BLOCK_SIZE 512
@@ -61,6 +72,8 @@ public:
 
 	virtual bool Boot(ImageInfo* pImageInfo) { return false; }
 	virtual eDetectResult Detect(const LPBYTE pImage, const uint32_t dwImageSize, const char* pszExt) = 0;
+	// As Detect(), but pImage is just the image's 1st kSniffHdrSize bytes: so ePossibleMatch means the whole image is needed
+	virtual eDetectResult Sniff(const LPBYTE pImage, const uint32_t dwImageSize, const char* pszExt) { return Detect(pImage, dwImageSize, pszExt); }
 	virtual void Read(ImageInfo* pImageInfo, const float phase, LPBYTE pTrackImageBuffer, int* pNibbles, UINT* pBitCount, bool enhanceDisk) { }
 	virtual bool Read(ImageInfo* pImageInfo, UINT nBlock, LPBYTE pBlockBuffer) { return false; }
 	virtual void Write(ImageInfo* pImageInfo, const float phase, LPBYTE pTrackImageBuffer, int nNibbles) { }
@@ -77,6 +90,7 @@ public:
 
 	bool WriteImageHeader(ImageInfo* pImageInfo, LPBYTE pHdr, const UINT hdrSize);
 	void SetVolumeNumber(const BYTE uVolumeNumber) { m_uVolumeNumber = uVolumeNumber; }
+	BYTE GetVolumeNumber(void) { return m_uVolumeNumber; }
 	bool IsValidImageSize(const uint32_t uImageSize);
 
 	// To accurately convert a half phase (quarter track) back to a track (round half tracks down), use: ceil(phase)/2, eg:
@@ -85,6 +99,7 @@ public:
 	UINT PhaseToTrack(const float phase) { return ((UINT)ceil(phase)) >> 1; }
 
 	enum SectorOrder_e {eProDOSOrder, eDOSOrder, eSIMSYSTEMOrder, NUM_SECTOR_ORDERS};
+	virtual bool GetSectorOrder(SectorOrder_e& sectorOrder) { return false; }	// Only: DO and PO (ie. images that get nibblized)
 
 protected:
 	bool ReadTrack(ImageInfo* pImageInfo, const int nTrack, LPBYTE pTrackBuffer, const UINT uTrackSize);
@@ -93,20 +108,27 @@ protected:
 	bool WriteBlock(ImageInfo* pImageInfo, const int nBlock, LPBYTE pBlockBuffer);
 	bool WriteImageData(ImageInfo* pImageInfo, LPBYTE pSrcBuffer, const UINT uSrcSize, const long offset);
 
-	LPBYTE Code62(int sector);
-	void Decode62(LPBYTE imageptr);
+	static void Code62(const BYTE* pSector, LPBYTE pNibbles);
+	static void Decode62(const BYTE* pNibbles, LPBYTE pSector);
 	void DenibblizeTrack (LPBYTE trackimage, SectorOrder_e SectorOrder, int nibbles);
 	uint32_t NibblizeTrack (LPBYTE trackimagebuffer, SectorOrder_e SectorOrder, int track);
+
+public:
+	static uint32_t NibblizeTrack (const BYTE* pTrackData, LPBYTE trackimagebuffer, SectorOrder_e SectorOrder, int track, BYTE volumeNumber);
 	void SkewTrack (const int nTrack, const int nNumNibbles, const LPBYTE pTrackImageBuffer);
+	void ReadNibblizedTrack(ImageInfo* pImageInfo, const UINT track, SectorOrder_e SectorOrder, LPBYTE pTrackImageBuffer, int* pNibbles);
+	void WriteNibblizedTrack(ImageInfo* pImageInfo, const UINT track, SectorOrder_e SectorOrder, LPBYTE pTrackImageBuffer, int nNibbles);
 
 public:
 	UINT m_uNumTracksInImage;	// Init'd by CDiskImageHelper.Detect()/GetImageForCreation() & possibly updated by IsValidImageSize()
 
 protected:
 	static BYTE ms_DiskByte[0x40];
+	static const BYTE ms_SixBitByte[0x80];
+	static const BYTE ms_SwapBits01[4];
 	static BYTE ms_SectorNumber[NUM_SECTOR_ORDERS][NUM_SECTORS];
 	BYTE m_uVolumeNumber;
-	LPBYTE m_pWorkBuffer;
+	LPBYTE m_pWorkBuffer;	// NB. shared by all images of this type, so only used under the Image*() accessors' lock (see DiskImage.cpp)
 };
 
 //-------------------------------------
@@ -365,6 +387,7 @@ class CImageHelperBase
 {
 public:
 	CImageHelperBase(const bool bIsFloppy) :
+		m_bIsFloppy(bIsFloppy),
 		m_2IMGHelper(bIsFloppy),
 		m_Result2IMG(eMismatch),
 		m_WOZHelper()
@@ -378,14 +401,21 @@ public:
 
 	ImageError_e Open(LPCTSTR pszImageFilename, ImageInfo* pImageInfo, const bool bCreateIfNecessary, std::string& strFilenameInZip);
 	void Close(ImageInfo* pImageInfo);
+	ImageError_e Sniff(LPCTSTR pszImageFilename, eImageType& imageType);
+	ImageError_e OpenOverlay(ImageInfo* pImageInfo, const std::string& overlayFilename, const bool bImageBuffered);
 	bool WOZUpdateInfo(ImageInfo* pImageInfo, uint32_t& dwOffset);
+	bool WOZUpdateTrackMap(ImageInfo* pImageInfo);
 
 	virtual CImageBase* Detect(LPBYTE pImage, uint32_t dwSize, const char* pszExt, uint32_t& dwOffset, ImageInfo* pImageInfo) = 0;
 	virtual CImageBase* GetImageForCreation(const char* pszExt, uint32_t* pCreateImageSize) = 0;
 	virtual UINT GetMaxImageSize(void) = 0;
 	virtual UINT GetMinDetectSize(const UINT uImageSize, bool* pTempDetectBuffer) = 0;
 
+	static const UINT kSniffHdrSize = 1024;	// enough for a MacBinary + 2IMG header, followed by the image's own header
+
 protected:
+	virtual eImageType DetectImageType(LPBYTE& pImage, uint32_t& dwSize, const char* pszExt, uint32_t& dwOffset, bool* pNeedImage=NULL) = 0;
+	void AddSniffResult(LPCTSTR pszImageFilename, const eImageType imageType);
 	ImageError_e CheckGZipFile(LPCTSTR pszImageFilename, ImageInfo* pImageInfo);
 	ImageError_e CheckZipFile(LPCTSTR pszImageFilename, ImageInfo* pImageInfo, std::string& strFilenameInZip);
 	ImageError_e CheckNormalFile(LPCTSTR pszImageFilename, ImageInfo* pImageInfo, const bool bCreateIfNecessary);
@@ -412,9 +442,18 @@ protected:
 	typedef std::vector<CImageBase*> VECIMAGETYPE;
 	VECIMAGETYPE m_vecImageTypes;
 
+	const bool m_bIsFloppy;
 	C2IMGHelper m_2IMGHelper;
 	eDetectResult m_Result2IMG;
 	CWOZHelper m_WOZHelper;
+
+	struct SniffResult
+	{
+		UINT64 size;
+		UINT64 lastWriteTime;
+		eImageType imageType;
+	};
+	std::map<std::string, SniffResult> m_sniffCache;	// pathname -> type (valid while the file's size & last-write time are unchanged)
 };
 
 //-------------------------------------
@@ -433,6 +472,9 @@ public:
 	UINT GetNumTracksInImage(CImageBase* pImageType) { return pImageType->m_uNumTracksInImage; }
 	void SetNumTracksInImage(CImageBase* pImageType, UINT uNumTracks) { pImageType->m_uNumTracksInImage = uNumTracks; }
 
+protected:
+	virtual eImageType DetectImageType(LPBYTE& pImage, uint32_t& dwSize, const char* pszExt, uint32_t& dwOffset, bool* pNeedImage=NULL);
+
 private:
 	void SkipMacBinaryHdr(LPBYTE& pImage, uint32_t& dwSize, uint32_t& dwOffset);
 
@@ -452,4 +494,7 @@ public:
 	virtual CImageBase* GetImageForCreation(const char* pszExt, uint32_t* pCreateImageSize);
 	virtual UINT GetMaxImageSize(void);
 	virtual UINT GetMinDetectSize(const UINT uImageSize, bool* pTempDetectBuffer);
+
+protected:
+	virtual eImageType DetectImageType(LPBYTE& pImage, uint32_t& dwSize, const char* pszExt, uint32_t& dwOffset, bool* pNeedImage=NULL);
 };
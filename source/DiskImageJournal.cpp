@@ -0,0 +1,206 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: Write-ahead journal for floppy image track writes
+ *
+ * A track write can be several writes to the image file (eg. WOZ track data, then the header's CRC),
+ * so a crash (of the emulator or host) between them would leave a torn image.
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "DiskImageJournal.h"
+#include "DiskImageHelper.h"
+#include "Log.h"
+
+#include "zlib.h"
+
+CImageJournal::CImageJournal(ImageInfo* pImageInfo)
+	: m_pImageInfo(pImageInfo)
+	, m_numRecords(0)
+{
+}
+
+bool CImageJournal::Add(const UINT offset, const BYTE* pData, const UINT size)
+{
+	const UINT32 record[2] = { offset, size };
+	m_records.insert(m_records.end(), (const BYTE*)record, (const BYTE*)record + sizeof(record));
+	m_records.insert(m_records.end(), pData, pData + size);
+	m_numRecords++;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool CImageJournal::Apply(HANDLE hFile, const std::vector<BYTE>& records, const UINT numRecords)
+{
+	UINT pos = 0;
+	for (UINT i = 0; i < numRecords; i++)
+	{
+		UINT32 record[2];
+		if (pos + sizeof(record) > records.size())
+			return false;
+		memcpy(record, &records[pos], sizeof(record));
+		pos += sizeof(record);
+
+		const UINT offset = record[0];
+		const UINT size = record[1];
+		if (size > records.size() - pos)
+			return false;
+
+		if (SetFilePointer(hFile, offset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+			return false;
+
+		DWORD dwBytesWritten;
+		BOOL bRes = WriteFile(hFile, &records[pos], size, &dwBytesWritten, NULL);
+		if (!bRes || dwBytesWritten != size)
+			return false;
+
+		pos += size;
+	}
+
+	return FlushFileBuffers(hFile) != FALSE;
+}
+
+// Pre: the image buffer has already been updated, so it's just the image file that lags behind until this completes
+bool CImageJournal::Commit(void)
+{
+	if (m_numRecords == 0)
+		return true;
+
+	const std::string journalPathname = GetJournalPathname(m_pImageInfo->szFilename);
+
+	HANDLE hJournal = CreateFile(journalPathname.c_str(),
+		GENERIC_WRITE,
+		0,
+		(LPSECURITY_ATTRIBUTES)NULL,
+		CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	bool bJournalled = false;
+	if (hJournal != INVALID_HANDLE_VALUE)
+	{
+		JournalHeader hdr;
+		hdr.id = kID;
+		hdr.numRecords = m_numRecords;
+		hdr.recordsSize = (UINT32)m_records.size();
+		hdr.recordsCRC = crc32(0, &m_records[0], (uInt)m_records.size());
+
+		DWORD dwBytesWritten;
+		bJournalled = WriteFile(hJournal, &hdr, sizeof(hdr), &dwBytesWritten, NULL) && dwBytesWritten == sizeof(hdr)
+			&& WriteFile(hJournal, &m_records[0], (DWORD)m_records.size(), &dwBytesWritten, NULL) && dwBytesWritten == m_records.size()
+			&& FlushFileBuffers(hJournal);
+
+		CloseHandle(hJournal);
+	}
+
+	if (!bJournalled)	// eg. image's folder is read-only: still write the image, just not atomically
+	{
+		LogFileOutput("Journal: failed to create journal for image: %s\n", m_pImageInfo->szFilename.c_str());
+		DeleteFile(journalPathname.c_str());
+	}
+
+	if (!Apply(m_pImageInfo->hFile, m_records, m_numRecords))
+		return false;	// NB. Leave any journal, so that the write is re-tried by Recover()
+
+	if (bJournalled)
+		DeleteFile(journalPathname.c_str());
+
+	m_records.clear();
+	m_numRecords = 0;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+// Pre: image file is not open
+void CImageJournal::Recover(const std::string& pathname)
+{
+	const std::string journalPathname = GetJournalPathname(pathname);
+
+	if (GetFileAttributes(journalPathname.c_str()) == INVALID_FILE_ATTRIBUTES)
+		return;	// the normal case: just a stat (on each image open), rather than an open of the journal
+
+	HANDLE hJournal = CreateFile(journalPathname.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		(LPSECURITY_ATTRIBUTES)NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (hJournal == INVALID_HANDLE_VALUE)
+		return;
+
+	JournalHeader hdr;
+	std::vector<BYTE> records;
+	const UINT fileSize = GetFileSize(hJournal, NULL);
+
+	DWORD dwBytesRead;
+	bool bValid = fileSize >= sizeof(hdr)
+		&& ReadFile(hJournal, &hdr, sizeof(hdr), &dwBytesRead, NULL) && dwBytesRead == sizeof(hdr)
+		&& hdr.id == kID
+		&& hdr.recordsSize == fileSize - sizeof(hdr)
+		&& hdr.recordsSize != 0;
+
+	if (bValid)
+	{
+		records.resize(hdr.recordsSize);
+		bValid = ReadFile(hJournal, &records[0], hdr.recordsSize, &dwBytesRead, NULL) && dwBytesRead == hdr.recordsSize
+			&& crc32(0, &records[0], hdr.recordsSize) == hdr.recordsCRC;
+	}
+
+	CloseHandle(hJournal);
+
+	if (!bValid)
+	{
+		// Crashed while writing the journal, so the image file wasn't touched
+		LogFileOutput("Journal: discarding incomplete journal for image: %s\n", pathname.c_str());
+		DeleteFile(journalPathname.c_str());
+		return;
+	}
+
+	HANDLE hFile = CreateFile(pathname.c_str(),
+		GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ,
+		(LPSECURITY_ATTRIBUTES)NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		LogFileOutput("Journal: unable to open image to replay journal: %s\n", pathname.c_str());	// NB. Keep the journal
+		return;
+	}
+
+	const bool bRes = Apply(hFile, records, hdr.numRecords);
+	CloseHandle(hFile);
+
+	LogFileOutput("Journal: %s %d write(s) to image: %s\n", bRes ? "replayed" : "failed to replay", hdr.numRecords, pathname.c_str());
+	if (bRes)
+		DeleteFile(journalPathname.c_str());
+}
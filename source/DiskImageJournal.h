@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+struct ImageInfo;
+
+// Write-ahead journal, so that track writes (each may be several writes to the image file, eg. WOZ track + header CRC)
+// are applied atomically to a normal (ie. not gzip/zip) image file:
+// . while ImageInfo::pJournal is set, WriteImageData() adds the image file writes to it (instead of writing them)
+// . the writes are batched: ImageFlush() (eg. once the track writer is idle, or the journal reaches kMaxSize) Commit()s them
+// . Commit() writes them all to "<image>.journal" (and flushes it), then applies them to the image, then deletes the journal
+// . if the emulator dies part way through, then Recover() (on the next open of the image) re-applies a complete journal,
+//   or discards an incomplete one (in which case the image file was never touched)
+// Journal file: JournalHeader, followed by numRecords x { UINT32 offset; UINT32 size; BYTE data[size] }
+class CImageJournal
+{
+public:
+	CImageJournal(ImageInfo* pImageInfo);
+	~CImageJournal(void) {}
+
+	bool Add(const UINT offset, const BYTE* pData, const UINT size);
+	bool Commit(void);
+	UINT GetSize(void) const { return (UINT)m_records.size(); }
+
+	static void Recover(const std::string& pathname);
+
+	static const UINT kMaxSize = 256*1024;	// Commit once this many bytes are journalled (ie. ~60 DSK tracks)
+
+private:
+	static std::string GetJournalPathname(const std::string& pathname) { return pathname + ".journal"; }
+	static bool Apply(HANDLE hFile, const std::vector<BYTE>& records, const UINT numRecords);
+
+#pragma pack(push)
+#pragma pack(1)
+	struct JournalHeader
+	{
+		UINT32 id;			// 'AWJN'
+		UINT32 numRecords;
+		UINT32 recordsSize;	// size of the records following the header
+		UINT32 recordsCRC;	// crc32 of the records: to catch a journal that was only partly written
+	};
+#pragma pack(pop)
+
+	static const UINT32 kID = 'NJWA';	// 'AWJN'
+
+	ImageInfo* m_pImageInfo;
+	std::vector<BYTE> m_records;
+	UINT m_numRecords;
+};
@@ -0,0 +1,424 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: Copy-on-write overlay (sparse delta file) for floppy & harddisk images
+ *
+ * Allows many instances to boot from the same (read-only) base image, with each instance's
+ * writes going to its own overlay file.
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "DiskImageOverlay.h"
+#include "DiskImageHelper.h"
+#include "Log.h"
+
+#include "zlib.h"
+
+CImageOverlay::CImageOverlay(void)
+	: m_hFile(INVALID_HANDLE_VALUE)
+	, m_baseSize(0)
+	, m_bImageBuffered(false)
+	, m_bReadOnly(false)
+{
+	memset(&m_hdr, 0, sizeof(m_hdr));
+}
+
+CImageOverlay::~CImageOverlay(void)
+{
+	Close();
+}
+
+void CImageOverlay::Close(void)
+{
+	if (m_hFile != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(m_hFile);
+		m_hFile = INVALID_HANDLE_VALUE;
+	}
+
+	m_index.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+// Pre: pImageInfo is the opened base image (and not yet modified by the overlay)
+// . bImageBuffered: pImageInfo->pImageBuffer holds the whole image, and the caller will Patch() it
+ImageError_e CImageOverlay::Open(const std::string& pathname, ImageInfo* pImageInfo, const bool bImageBuffered)
+{
+	m_pathname = pathname;
+	m_bImageBuffered = bImageBuffered;
+	m_baseSize = pImageInfo->uImageSize;
+	m_bReadOnly = false;
+
+	m_hFile = CreateFile(pathname.c_str(),
+		GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ,
+		(LPSECURITY_ATTRIBUTES)NULL,
+		OPEN_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	// Overlay may have read-only attribute set, so try to open as read-only (and the image will be write-protected)
+	if (m_hFile == INVALID_HANDLE_VALUE)
+	{
+		m_hFile = CreateFile(pathname.c_str(),
+			GENERIC_READ,
+			FILE_SHARE_READ,
+			(LPSECURITY_ATTRIBUTES)NULL,
+			OPEN_EXISTING,
+			FILE_ATTRIBUTE_NORMAL,
+			NULL);
+
+		if (m_hFile == INVALID_HANDLE_VALUE)
+			return eIMAGE_ERROR_UNABLE_TO_OPEN_OVERLAY;
+
+		m_bReadOnly = true;
+	}
+
+	BYTE block0[kBlockSize];
+	if (!ReadBaseBlock(pImageInfo, 0, block0))
+		return eIMAGE_ERROR_UNABLE_TO_OPEN_OVERLAY;
+	const UINT32 baseCRC = crc32(0, block0, kBlockSize);
+
+	const UINT32 fileSize = GetFileSize(m_hFile, NULL);
+	if (fileSize == 0)
+	{
+		// New overlay
+		if (m_bReadOnly)
+			return eIMAGE_ERROR_UNABLE_TO_OPEN_OVERLAY;
+
+		m_hdr.id = kID;
+		m_hdr.version = kVersion;
+		m_hdr.headerSize = sizeof(OverlayHeader);
+		m_hdr.baseSize = m_baseSize;
+		m_hdr.baseCRC = baseCRC;
+		m_hdr.imageSize = m_baseSize;
+		m_hdr.numBlocks = 0;
+		return WriteHeader() ? eIMAGE_ERROR_NONE : eIMAGE_ERROR_UNABLE_TO_OPEN_OVERLAY;
+	}
+
+	if (!ReadData(0, &m_hdr, sizeof(m_hdr))
+		|| m_hdr.id != kID
+		|| m_hdr.version > kVersion
+		|| m_hdr.headerSize < sizeof(OverlayHeader)
+		|| fileSize < m_hdr.headerSize + m_hdr.numBlocks * kRecordSize)
+	{
+		LogFileOutput("Overlay: not a valid overlay file: %s\n", pathname.c_str());
+		return eIMAGE_ERROR_UNABLE_TO_OPEN_OVERLAY;
+	}
+
+	if (m_hdr.baseSize != m_baseSize || m_hdr.baseCRC != baseCRC)
+	{
+		LogFileOutput("Overlay: %s was not created for the base image: %s\n", pathname.c_str(), pImageInfo->szFilename.c_str());
+		return eIMAGE_ERROR_OVERLAY_MISMATCH;
+	}
+
+	// Rebuild the index (a later record for the same block can't occur, since re-written blocks are updated in-place)
+	for (UINT i = 0; i < m_hdr.numBlocks; i++)
+	{
+		const UINT recordOffset = m_hdr.headerSize + i * kRecordSize;
+		UINT32 block = 0;
+		if (!ReadData(recordOffset, &block, sizeof(block)))
+			return eIMAGE_ERROR_UNABLE_TO_OPEN_OVERLAY;
+
+		m_index[block] = recordOffset + sizeof(UINT32);
+	}
+
+	return eIMAGE_ERROR_NONE;
+}
+
+//-----------------------------------------------------------------------------
+
+bool CImageOverlay::ReadData(const UINT offset, void* pData, const UINT size)
+{
+	if (SetFilePointer(m_hFile, offset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+		return false;
+
+	DWORD dwBytesRead;
+	BOOL bRes = ReadFile(m_hFile, pData, size, &dwBytesRead, NULL);
+	return bRes && dwBytesRead == size;
+}
+
+bool CImageOverlay::WriteData(const UINT offset, const void* pData, const UINT size)
+{
+	if (SetFilePointer(m_hFile, offset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+		return false;
+
+	DWORD dwBytesWritten;
+	BOOL bRes = WriteFile(m_hFile, pData, size, &dwBytesWritten, NULL);
+	return bRes && dwBytesWritten == size;
+}
+
+bool CImageOverlay::WriteHeader(void)
+{
+	return WriteData(0, &m_hdr, sizeof(m_hdr));
+}
+
+bool CImageOverlay::ReadRecord(const UINT dataOffset, BYTE* pBlock)
+{
+	return ReadData(dataOffset, pBlock, kBlockSize);
+}
+
+//-----------------------------------------------------------------------------
+
+// Get a block of the unmodified base image (zero-filled beyond the end of the base)
+bool CImageOverlay::ReadBaseBlock(ImageInfo* pImageInfo, const UINT block, BYTE* pBlock)
+{
+	memset(pBlock, 0, kBlockSize);
+
+	const UINT offset = block * kBlockSize;
+	if (offset >= m_baseSize)
+		return true;
+
+	const UINT size = MIN(kBlockSize, m_baseSize - offset);
+
+	if (!m_bImageBuffered)
+		CheckImageBufferMapping(pImageInfo, false);	// NB. a buffered (floppy) image is checked by its ImageReadTrack() etc
+
+	if (m_bImageBuffered || offset + size <= pImageInfo->uImageBufferMappedSize)
+	{
+		memcpy(pBlock, &pImageInfo->pImageBuffer[offset], size);
+		if (m_bImageBuffered || !IsImageBufferMappingTruncated(pImageInfo))
+			return true;
+
+		CheckImageBufferMapping(pImageInfo, false);	// truncated during the copy: re-read (or fail) via the file handle
+	}
+
+	if (pImageInfo->hFile == INVALID_HANDLE_VALUE)
+		return false;
+
+	if (SetFilePointer(pImageInfo->hFile, offset, NULL, FILE_BEGIN) == INVALID_SET_FILE_POINTER)
+		return false;
+
+	DWORD dwBytesRead;
+	BOOL bRes = ReadFile(pImageInfo->hFile, pBlock, size, &dwBytesRead, NULL);
+	return bRes && dwBytesRead == size;
+}
+
+// Get the current contents of a block
+bool CImageOverlay::GetBlock(ImageInfo* pImageInfo, const UINT block, BYTE* pBlock)
+{
+	if (m_bImageBuffered)
+	{
+		// pImageBuffer is always up-to-date (it was patched on Open(), and is updated before each write)
+		memset(pBlock, 0, kBlockSize);
+		const UINT offset = block * kBlockSize;
+		if (offset < pImageInfo->uImageSize)
+			memcpy(pBlock, &pImageInfo->pImageBuffer[offset], MIN(kBlockSize, pImageInfo->uImageSize - offset));
+		return true;
+	}
+
+	std::map<UINT, UINT>::const_iterator it = m_index.find(block);
+	if (it != m_index.end())
+		return ReadRecord(it->second, pBlock);
+
+	return ReadBaseBlock(pImageInfo, block, pBlock);
+}
+
+bool CImageOverlay::PutBlock(const UINT block, const BYTE* pBlock)
+{
+	std::map<UINT, UINT>::const_iterator it = m_index.find(block);
+	if (it != m_index.end())
+		return WriteData(it->second, pBlock, kBlockSize);
+
+	// Append a new record, then commit it by updating the header
+	BYTE record[kRecordSize];
+	memcpy(&record[0], &block, sizeof(UINT32));
+	memcpy(&record[sizeof(UINT32)], pBlock, kBlockSize);
+
+	const UINT recordOffset = m_hdr.headerSize + m_hdr.numBlocks * kRecordSize;
+	if (!WriteData(recordOffset, record, kRecordSize))
+		return false;
+
+	m_index[block] = recordOffset + sizeof(UINT32);
+	m_hdr.numBlocks++;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+// Apply the overlay's blocks to a buffered image
+// Pre: pImage is at least GetImageSize() bytes
+void CImageOverlay::Patch(BYTE* pImage, const UINT imageSize)
+{
+	for (std::map<UINT, UINT>::const_iterator it = m_index.begin(); it != m_index.end(); ++it)
+	{
+		const UINT offset = it->first * kBlockSize;
+		if (offset >= imageSize)
+			continue;
+
+		BYTE data[kBlockSize];
+		if (!ReadRecord(it->second, data))
+		{
+			_ASSERT(0);
+			continue;
+		}
+
+		memcpy(&pImage[offset], data, MIN(kBlockSize, imageSize - offset));
+	}
+}
+
+// Read from an unbuffered image (ie. a normal file harddisk image)
+bool CImageOverlay::Read(ImageInfo* pImageInfo, LPBYTE pDst, const UINT size, const UINT offset)
+{
+	const UINT end = offset + size;
+
+	for (UINT block = offset / kBlockSize; block * kBlockSize < end; block++)
+	{
+		BYTE data[kBlockSize];
+		if (!GetBlock(pImageInfo, block, data))
+			return false;
+
+		const UINT blockStart = block * kBlockSize;
+		const UINT from = MAX(offset, blockStart);
+		const UINT to = MIN(end, blockStart + kBlockSize);
+		memcpy(&pDst[from - offset], &data[from - blockStart], to - from);
+	}
+
+	return true;
+}
+
+// Called instead of writing to the base image's file
+bool CImageOverlay::Write(ImageInfo* pImageInfo, const BYTE* pSrc, const UINT size, const UINT offset)
+{
+	if (m_bReadOnly)
+		return false;
+
+	const UINT end = offset + size;
+	const UINT numBlocks = m_hdr.numBlocks;
+
+	for (UINT block = offset / kBlockSize; block * kBlockSize < end; block++)
+	{
+		BYTE data[kBlockSize];
+		if (!GetBlock(pImageInfo, block, data))
+			return false;
+
+		const UINT blockStart = block * kBlockSize;
+		const UINT from = MAX(offset, blockStart);
+		const UINT to = MIN(end, blockStart + kBlockSize);
+		memcpy(&data[from - blockStart], &pSrc[from - offset], to - from);
+
+		if (!PutBlock(block, data))
+			return false;
+	}
+
+	const UINT imageSize = MAX(end, pImageInfo->uImageSize);
+	if (imageSize > m_hdr.imageSize || m_hdr.numBlocks != numBlocks)
+	{
+		m_hdr.imageSize = MAX(imageSize, m_hdr.imageSize);
+		return WriteHeader();
+	}
+
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+
+// Write the overlay's blocks to the base image, then start again with an empty overlay
+// . only for uncompressed (normal file) base images
+// . the base image must be writable, and not opened by any other instance
+bool CImageOverlay::Commit(ImageInfo* pImageInfo)
+{
+	if (m_bReadOnly)
+		return false;
+
+	if (pImageInfo->FileType != eFileNormal)
+	{
+		LogFileOutput("Overlay: commit is only supported for uncompressed base images: %s\n", pImageInfo->szFilename.c_str());
+		return false;
+	}
+
+	BYTE block0[kBlockSize];
+	if (!GetBlock(pImageInfo, 0, block0))
+		return false;
+
+	// The base image was opened read-only, so re-open it for writing
+	if (pImageInfo->hFile != INVALID_HANDLE_VALUE)
+		CloseHandle(pImageInfo->hFile);
+
+	HANDLE hBaseFile = CreateFile(pImageInfo->szFilename.c_str(),
+		GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ,
+		(LPSECURITY_ATTRIBUTES)NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	bool res = (hBaseFile != INVALID_HANDLE_VALUE);
+
+	for (std::map<UINT, UINT>::const_iterator it = m_index.begin(); res && it != m_index.end(); ++it)
+	{
+		BYTE data[kBlockSize];
+		const UINT offset = it->first * kBlockSize;
+		if (offset >= m_hdr.imageSize || !ReadRecord(it->second, data))
+			continue;
+
+		const UINT size = MIN(kBlockSize, m_hdr.imageSize - offset);
+		DWORD dwBytesWritten;
+		res = SetFilePointer(hBaseFile, offset, NULL, FILE_BEGIN) != INVALID_SET_FILE_POINTER
+			&& WriteFile(hBaseFile, data, size, &dwBytesWritten, NULL)
+			&& dwBytesWritten == size;
+	}
+
+	if (hBaseFile != INVALID_HANDLE_VALUE)
+		CloseHandle(hBaseFile);
+
+	pImageInfo->hFile = CreateFile(pImageInfo->szFilename.c_str(),
+		GENERIC_READ,
+		FILE_SHARE_READ,
+		(LPSECURITY_ATTRIBUTES)NULL,
+		OPEN_EXISTING,
+		FILE_ATTRIBUTE_NORMAL,
+		NULL);
+
+	if (!res)
+	{
+		LogFileOutput("Overlay: failed to commit %s to base image: %s\n", m_pathname.c_str(), pImageInfo->szFilename.c_str());
+		return false;
+	}
+
+	// The base image now matches the image, so the overlay is empty again
+	m_baseSize = m_hdr.imageSize;
+	m_hdr.baseSize = m_baseSize;
+	m_hdr.baseCRC = crc32(0, block0, kBlockSize);
+	m_hdr.numBlocks = 0;
+	m_index.clear();
+	return WriteHeader();
+}
+
+// Drop all modified blocks
+// . the overlay file isn't truncated: stale records are ignored (and are overwritten by new blocks)
+// . for a buffered image, the caller must re-open the image to reload the base image's data
+bool CImageOverlay::Discard(void)
+{
+	if (m_bReadOnly)
+		return false;
+
+	m_hdr.imageSize = m_hdr.baseSize;
+	m_hdr.numBlocks = 0;
+	m_index.clear();
+	return WriteHeader();
+}
@@ -0,0 +1,94 @@
+#pragma once
+
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "DiskImage.h"	// ImageError_e
+
+struct ImageInfo;
+
+// Copy-on-write overlay for a base image that is shared (read-only) between many instances.
+// The overlay file only holds the 512-byte blocks of the base image's file that have been modified:
+//   OverlayHeader, followed by numBlocks x { UINT32 block; BYTE data[512] }
+// . 'block' is relative to the start of the base image's file (ie. it includes any 2IMG/WOZ header), so the same
+//   format is used for HDD blocks, floppy tracks (DSK/PO/NIB) and WOZ tracks (which are stored in 512-byte blocks)
+// . the block -> record index is rebuilt when the overlay is opened
+// . a re-written block is updated in-place; a new block is appended (then the header's numBlocks is updated)
+class CImageOverlay
+{
+public:
+	CImageOverlay(void);
+	~CImageOverlay(void);
+
+	ImageError_e Open(const std::string& pathname, ImageInfo* pImageInfo, const bool bImageBuffered);
+	void Close(void);
+
+	void Patch(BYTE* pImage, const UINT imageSize);
+	bool Read(ImageInfo* pImageInfo, LPBYTE pDst, const UINT size, const UINT offset);
+	bool Write(ImageInfo* pImageInfo, const BYTE* pSrc, const UINT size, const UINT offset);
+	bool Commit(ImageInfo* pImageInfo);
+	bool Discard(void);
+
+	const std::string& GetPathname(void) { return m_pathname; }
+	UINT GetImageSize(void) { return m_hdr.imageSize; }
+	UINT GetNumBlocks(void) { return m_hdr.numBlocks; }
+	bool IsImageBuffered(void) { return m_bImageBuffered; }
+	bool IsReadOnly(void) { return m_bReadOnly; }
+
+	static const UINT kBlockSize = 512;
+
+private:
+	bool ReadBaseBlock(ImageInfo* pImageInfo, const UINT block, BYTE* pBlock);
+	bool GetBlock(ImageInfo* pImageInfo, const UINT block, BYTE* pBlock);
+	bool PutBlock(const UINT block, const BYTE* pBlock);
+	bool ReadRecord(const UINT dataOffset, BYTE* pBlock);
+	bool ReadData(const UINT offset, void* pData, const UINT size);
+	bool WriteData(const UINT offset, const void* pData, const UINT size);
+	bool WriteHeader(void);
+
+#pragma pack(push)
+#pragma pack(1)
+	struct OverlayHeader
+	{
+		UINT32 id;			// 'AWOV'
+		USHORT version;
+		USHORT headerSize;
+		UINT32 baseSize;	// size of the base image's file (uncompressed)
+		UINT32 baseCRC;		// crc32 of the base image's 1st block: to catch a base+overlay mismatch
+		UINT32 imageSize;	// size of the image (ie. base + any appended blocks/tracks)
+		UINT32 numBlocks;	// number of block records following the header
+	};
+#pragma pack(pop)
+
+	static const UINT32 kID = 'VOWA';	// 'AWOV'
+	static const USHORT kVersion = 1;
+	static const UINT kRecordSize = sizeof(UINT32) + kBlockSize;
+
+	std::string m_pathname;
+	HANDLE m_hFile;
+	OverlayHeader m_hdr;
+	std::map<UINT, UINT> m_index;	// block -> file offset of the block's data (ordered, so Commit() writes in block order)
+	UINT m_baseSize;
+	bool m_bImageBuffered;			// pImageBuffer holds the whole (current) image, eg. floppy or zip/gzip
+	bool m_bReadOnly;
+};
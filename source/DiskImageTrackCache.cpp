@@ -0,0 +1,137 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: Nibblized track cache for DO & PO floppy images
+ *
+ * Each track step to a new track (in a seek-heavy loader, or with full-speed disk access)
+ * would otherwise 6-and-2 encode the track's 16 sectors again.
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "DiskImageTrackCache.h"
+
+CNibblizedTrackCache::CNibblizedTrackCache(ImageInfo* pImageInfo, const CImageBase::SectorOrder_e sectorOrder, const BYTE volumeNumber)
+	: m_pImageInfo(pImageInfo)
+	, m_sectorOrder(sectorOrder)
+	, m_volumeNumber(volumeNumber)
+	, m_stopWorker(false)
+{
+	m_tracks.resize(pImageInfo->uNumTracks);
+	for (UINT i = 0; i < m_tracks.size(); i++)
+	{
+		m_tracks[i].valid = false;
+		m_tracks[i].nibbles = 0;
+	}
+}
+
+CNibblizedTrackCache::~CNibblizedTrackCache(void)
+{
+	StopWorker();
+}
+
+//-----------------------------------------------------------------------------
+
+// Pre: the image buffer must remain valid until this object is destroyed
+void CNibblizedTrackCache::StartWorker(void)
+{
+	_ASSERT(!m_worker.joinable());
+	m_stopWorker = false;
+	m_worker = std::thread(&CNibblizedTrackCache::Worker, this);
+}
+
+void CNibblizedTrackCache::StopWorker(void)
+{
+	m_stopWorker = true;
+	if (m_worker.joinable())
+		m_worker.join();
+}
+
+// Nibblize all tracks that aren't already cached, one track per lock so the emulation thread is never blocked for long
+void CNibblizedTrackCache::Worker(void)
+{
+	for (UINT track = 0; track < m_tracks.size() && !m_stopWorker; track++)
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		Track& cachedTrack = m_tracks[track];
+		if (cachedTrack.valid)
+			continue;
+
+		const BYTE* pTrackData = &m_pImageInfo->pImageBuffer[m_pImageInfo->uOffset + track * TRACK_DENIBBLIZED_SIZE];
+		cachedTrack.nibbles = CImageBase::NibblizeTrack(pTrackData, cachedTrack.data, m_sectorOrder, track, m_volumeNumber);
+		cachedTrack.valid = true;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+bool CNibblizedTrackCache::Read(const UINT track, LPBYTE pTrackImageBuffer, int* pNibbles)
+{
+	if (track >= m_tracks.size())
+		return false;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	const Track& cachedTrack = m_tracks[track];
+	if (!cachedTrack.valid)
+		return false;
+
+	memcpy(pTrackImageBuffer, cachedTrack.data, cachedTrack.nibbles);
+	*pNibbles = cachedTrack.nibbles;
+	return true;
+}
+
+void CNibblizedTrackCache::Update(const UINT track, const BYTE* pTrackImageBuffer, const int nibbles)
+{
+	if (track >= m_tracks.size() || nibbles > NIBBLES_PER_TRACK)
+		return;
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	Track& cachedTrack = m_tracks[track];
+	memcpy(cachedTrack.data, pTrackImageBuffer, nibbles);
+	cachedTrack.nibbles = nibbles;
+	cachedTrack.valid = true;
+}
+
+//-----------------------------------------------------------------------------
+
+CNibblizedTrackCache::WriteLock::WriteLock(CNibblizedTrackCache* pCache, const UINT track)
+	: m_pCache(pCache)
+{
+	if (!m_pCache)
+		return;
+
+	m_pCache->m_mutex.lock();
+	if (track < m_pCache->m_tracks.size())
+		m_pCache->m_tracks[track].valid = false;
+}
+
+CNibblizedTrackCache::WriteLock::~WriteLock(void)
+{
+	if (m_pCache)
+		m_pCache->m_mutex.unlock();
+}
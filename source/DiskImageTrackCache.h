@@ -0,0 +1,77 @@
+#pragma once
+
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "DiskImageHelper.h"	// ImageInfo, CImageBase::SectorOrder_e
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+// Per-image cache of nibblized tracks, for sector-based (DO & PO) images
+// . a track is nibblized on its first read (or by the worker thread, which nibblizes all tracks after the image is opened)
+// . a write to a track invalidates it (it gets re-nibblized from the denibblized data on its next read)
+// . the cached tracks are unskewed: the caller applies any skew (see SkewTrack()) to its copy
+class CNibblizedTrackCache
+{
+public:
+	CNibblizedTrackCache(ImageInfo* pImageInfo, const CImageBase::SectorOrder_e sectorOrder, const BYTE volumeNumber);
+	~CNibblizedTrackCache(void);
+
+	void StartWorker(void);
+	bool Read(const UINT track, LPBYTE pTrackImageBuffer, int* pNibbles);
+	void Update(const UINT track, const BYTE* pTrackImageBuffer, const int nibbles);
+
+	// Hold while the track's data in the image buffer is being written:
+	// . invalidates the track, and stops the worker thread from reading the image buffer
+	// . kNoTrack: just stops the worker thread (eg. while the image buffer is being replaced)
+	static const UINT kNoTrack = (UINT)-1;
+	class WriteLock
+	{
+	public:
+		WriteLock(CNibblizedTrackCache* pCache, const UINT track);
+		~WriteLock(void);
+	private:
+		CNibblizedTrackCache* m_pCache;
+	};
+
+private:
+	void Worker(void);
+	void StopWorker(void);
+
+	struct Track
+	{
+		bool valid;
+		UINT nibbles;
+		BYTE data[NIBBLES_PER_TRACK];
+	};
+
+	ImageInfo* m_pImageInfo;
+	const CImageBase::SectorOrder_e m_sectorOrder;
+	const BYTE m_volumeNumber;
+	std::vector<Track> m_tracks;
+	std::mutex m_mutex;			// To guard /m_tracks/ and the image buffer (between the emulation & worker threads)
+	std::thread m_worker;
+	std::atomic<bool> m_stopWorker;
+};
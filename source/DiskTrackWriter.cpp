@@ -0,0 +1,203 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: Background (coalescing) writer for Disk II dirty tracks
+ *
+ * Write-heavy software (copy programs, INIT, save-game loops) steps off a dirty track many times,
+ * and each denibblize + write of the image file would otherwise stall the emulation thread.
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "DiskTrackWriter.h"
+#include "DiskImage.h"
+
+CDiskTrackWriter::CDiskTrackWriter(void)
+	: m_inProgress(NULL, 0)
+	, m_isInProgress(false)
+	, m_flushNow(false)
+	, m_stopWorker(false)
+{
+	m_worker = std::thread(&CDiskTrackWriter::Worker, this);
+}
+
+// Pre: all images have been Wait()'d for & closed (so the worker thread only has to stop)
+CDiskTrackWriter::~CDiskTrackWriter(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		_ASSERT(m_pending.empty() && m_unflushed.empty());
+		m_stopWorker = true;
+	}
+	m_workCV.notify_one();
+
+	if (m_worker.joinable())
+		m_worker.join();
+}
+
+//-----------------------------------------------------------------------------
+
+CDiskTrackWriter::Key CDiskTrackWriter::GetKey(ImageInfo* pImageInfo, const float phase)
+{
+	if (ImageIsWOZ(pImageInfo))
+		return Key(pImageInfo, (UINT)(phase * 2));	// each quarter-track can be a different WOZ track
+
+	return Key(pImageInfo, ImagePhaseToTrack(pImageInfo, phase, false));
+}
+
+// Pre: m_mutex is held
+bool CDiskTrackWriter::IsPending(const Key& key)
+{
+	return m_pending.find(key) != m_pending.end() || (m_isInProgress && m_inProgress == key);
+}
+
+// Pre: m_mutex is held
+// . includes tracks that have been written, but not yet flushed
+bool CDiskTrackWriter::IsPending(ImageInfo* pImageInfo)
+{
+	if (!pImageInfo)
+		return !m_pending.empty() || m_isInProgress || !m_unflushed.empty() || !m_flushing.empty();
+
+	std::map<Key, PendingTrack>::const_iterator it = m_pending.lower_bound(Key(pImageInfo, 0));
+	return (it != m_pending.end() && it->first.first == pImageInfo) || (m_isInProgress && m_inProgress.first == pImageInfo)
+		|| m_unflushed.count(pImageInfo) || m_flushing.count(pImageInfo);
+}
+
+// Pre: m_mutex is held
+// . just the tracks not yet written (ie. excludes the flush)
+bool CDiskTrackWriter::IsQueued(ImageInfo* pImageInfo)
+{
+	std::map<Key, PendingTrack>::const_iterator it = m_pending.lower_bound(Key(pImageInfo, 0));
+	return (it != m_pending.end() && it->first.first == pImageInfo) || (m_isInProgress && m_inProgress.first == pImageInfo);
+}
+
+// Pre: m_mutex is held (by lock)
+void CDiskTrackWriter::FlushImages(std::unique_lock<std::mutex>& lock)
+{
+	m_flushing.swap(m_unflushed);
+	m_flushNow = false;
+	lock.unlock();
+
+	for (std::set<ImageInfo*>::const_iterator it = m_flushing.begin(); it != m_flushing.end(); ++it)
+		ImageFlush(*it);
+
+	lock.lock();
+	m_flushing.clear();
+	m_doneCV.notify_all();
+}
+
+// Write the queued tracks, in (image, track) order, until told to stop (once the queue is empty)
+// . once idle for kFlushDelay_ms (or asked to by Wait()), flush the written tracks
+void CDiskTrackWriter::Worker(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		while (m_pending.empty() && !m_stopWorker)
+		{
+			if (m_unflushed.empty())
+				m_workCV.wait(lock);
+			else if (m_flushNow || m_workCV.wait_for(lock, std::chrono::milliseconds(kFlushDelay_ms)) == std::cv_status::timeout)
+				FlushImages(lock);
+		}
+
+		if (m_pending.empty())
+		{
+			if (!m_unflushed.empty())
+				FlushImages(lock);
+			break;
+		}
+
+		std::map<Key, PendingTrack>::iterator it = m_pending.begin();
+		const Key key = it->first;
+		PendingTrack track;
+		track.phase = it->second.phase;
+		track.nibbles = it->second.nibbles;
+		track.data.swap(it->second.data);
+		m_pending.erase(it);
+
+		m_inProgress = key;
+		m_isInProgress = true;
+		lock.unlock();
+
+		ImageWriteTrack(key.first, track.phase, &track.data[0], track.nibbles);
+
+		lock.lock();
+		m_isInProgress = false;
+		m_unflushed.insert(key.first);
+		m_doneCV.notify_all();
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+void CDiskTrackWriter::Write(ImageInfo* pImageInfo, const float phase, const BYTE* pTrackImageBuffer, const int nibbles)
+{
+	const Key key = GetKey(pImageInfo, phase);
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		std::map<Key, PendingTrack>::iterator it = m_pending.find(key);
+		if (it == m_pending.end())	// otherwise just replace the queued (not yet written) track
+			it = m_pending.insert(std::make_pair(key, PendingTrack())).first;
+
+		PendingTrack& track = it->second;
+		track.phase = phase;
+		track.nibbles = nibbles;
+		track.data.assign(pTrackImageBuffer, pTrackImageBuffer + nibbles);
+		track.data.resize(MAX(nibbles, NIBBLES_PER_TRACK), 0);	// NB. WOZ1 requires a track-sized buffer
+	}
+
+	m_workCV.notify_one();
+}
+
+void CDiskTrackWriter::ReadTrack(ImageInfo* pImageInfo, const float phase, LPBYTE pTrackImageBuffer, int* pNibbles, UINT* pBitCount, bool enhanceDisk)
+{
+	const Key key = GetKey(pImageInfo, phase);
+	const bool isWOZ = ImageIsWOZ(pImageInfo);
+
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		while (isWOZ ? IsQueued(pImageInfo) : IsPending(key))
+			m_doneCV.wait(lock);
+	}
+
+	ImageReadTrack(pImageInfo, phase, pTrackImageBuffer, pNibbles, pBitCount, enhanceDisk);
+}
+
+void CDiskTrackWriter::Wait(ImageInfo* pImageInfo /*=NULL*/)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	if (!IsPending(pImageInfo))
+		return;
+
+	m_flushNow = true;	// don't wait for kFlushDelay_ms
+	m_workCV.notify_one();
+
+	while (IsPending(pImageInfo))
+		m_doneCV.wait(lock);
+}
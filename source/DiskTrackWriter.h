@@ -0,0 +1,85 @@
+#pragma once
+
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "DiskImageHelper.h"	// ImageInfo
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+
+// Background writer for a Disk II card's dirty tracks, so that ImageWriteTrack() (denibblize + file write) isn't
+// done on the emulation thread each time the head steps off a dirty track:
+// . Write() copies the track and queues it; a queued track that's written again (eg. a save-game loop) is just replaced
+// . ReadTrack() waits for any queued write of that track (so a re-read sees the written data)
+// . WOZ: tracks are queued per quarter-track, and ReadTrack() waits for all of the image's queued writes, as a write can
+//   append a track (so change the TMAP of the neighbouring quarter-tracks)
+// . ImageInfo access by the emulation & worker threads is serialised by the Image*() accessors' lock (see DiskImage.cpp),
+//   which the worker doesn't hold while the flush writes the image file
+// . the written tracks are only journalled, so once the worker has been idle for kFlushDelay_ms it ImageFlush()'s them:
+//   a burst of track writes (eg. INIT or a copy program) is then a single journal commit
+// . Wait() is the flush barrier for eject, save-state & external tools (so it also flushes)
+class CDiskTrackWriter
+{
+public:
+	CDiskTrackWriter(void);
+	~CDiskTrackWriter(void);
+
+	void Write(ImageInfo* pImageInfo, const float phase, const BYTE* pTrackImageBuffer, const int nibbles);
+	void ReadTrack(ImageInfo* pImageInfo, const float phase, LPBYTE pTrackImageBuffer, int* pNibbles, UINT* pBitCount, bool enhanceDisk);
+	void Wait(ImageInfo* pImageInfo = NULL);	// NULL = all images
+
+private:
+	typedef std::pair<ImageInfo*, UINT> Key;	// image, track (WOZ: quarter-track)
+
+	struct PendingTrack
+	{
+		float phase;
+		int nibbles;
+		std::vector<BYTE> data;
+	};
+
+	static Key GetKey(ImageInfo* pImageInfo, const float phase);
+	void Worker(void);
+	void FlushImages(std::unique_lock<std::mutex>& lock);
+	bool IsPending(const Key& key);
+	bool IsPending(ImageInfo* pImageInfo);
+	bool IsQueued(ImageInfo* pImageInfo);
+
+	static const UINT kFlushDelay_ms = 250;
+
+	std::map<Key, PendingTrack> m_pending;
+	Key m_inProgress;
+	bool m_isInProgress;
+	std::set<ImageInfo*> m_unflushed;	// images with tracks written, but not yet flushed
+	std::set<ImageInfo*> m_flushing;
+	bool m_flushNow;
+	bool m_stopWorker;
+	std::mutex m_mutex;					// To guard all the above
+	std::condition_variable m_workCV;	// signalled when a track is queued (or to stop)
+	std::condition_variable m_doneCV;	// signalled when a track has been written
+	std::thread m_worker;
+};
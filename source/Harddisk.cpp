@@ -191,6 +191,8 @@ HarddiskInterfaceCard::~HarddiskInterfaceCard(void)
 
 void HarddiskInterfaceCard::Reset(const bool powerCycle)
 {
+	FlushBlockCaches();
+
 	for (UINT i = 0; i < NUM_HARDDISKS; i++)
 		m_hardDiskDrive[i].m_error = 0;
 
@@ -255,10 +257,13 @@ void HarddiskInterfaceCard::CleanupDriveInternal(const int iDrive)
 {
 	if (m_hardDiskDrive[iDrive].m_imagehandle)
 	{
+		m_hardDiskDrive[iDrive].m_blockCache.Flush(m_hardDiskDrive[iDrive].m_imagehandle);
 		ImageClose(m_hardDiskDrive[iDrive].m_imagehandle);
 		m_hardDiskDrive[iDrive].m_imagehandle = NULL;
 	}
 
+	m_hardDiskDrive[iDrive].m_blockCache.Invalidate();
+
 	m_hardDiskDrive[iDrive].m_imageloaded = false;
 
 	m_hardDiskDrive[iDrive].m_imagename.clear();
@@ -273,6 +278,34 @@ void HarddiskInterfaceCard::CleanupDrive(const int iDrive)
 	SaveLastDiskImage(iDrive);
 }
 
+// Write back any cached (dirty) blocks, eg. before a save-state or on a reset
+void HarddiskInterfaceCard::FlushBlockCaches(void)
+{
+	for (UINT i = 0; i < NUM_HARDDISKS; i++)
+	{
+		if (m_hardDiskDrive[i].m_imagehandle)
+			m_hardDiskDrive[i].m_blockCache.Flush(m_hardDiskDrive[i].m_imagehandle);
+	}
+}
+
+// Called once per emulation slice: write back dirty blocks that have been held for too long
+void HarddiskInterfaceCard::Update(const ULONG nExecutedCycles)
+{
+	for (UINT i = 0; i < NUM_HARDDISKS; i++)
+	{
+		if (m_hardDiskDrive[i].m_imagehandle && m_hardDiskDrive[i].m_blockCache.IsFlushDue())
+			m_hardDiskDrive[i].m_blockCache.Flush(m_hardDiskDrive[i].m_imagehandle);
+	}
+}
+
+void HarddiskInterfaceCard::SetBlockCacheCapacity(UINT numBlocks)
+{
+	FlushBlockCaches();
+
+	for (UINT i = 0; i < NUM_HARDDISKS; i++)
+		m_hardDiskDrive[i].m_blockCache.SetCapacity(numBlocks);
+}
+
 //===========================================================================
 
 void HarddiskInterfaceCard::NotifyInvalidImage(const std::string & szImageFilename)
@@ -326,7 +359,9 @@ void HarddiskInterfaceCard::SaveLastDiskImage(const int drive)
 	const std::string regKey = std::string(REGVALUE_LAST_HARDDISK_) + (char)('1' + drive);
 	const std::string& pathName = HarddiskGetFullPathName(drive);
 
-	RegSaveString(regSection.c_str(), regKey.c_str(), TRUE, pathName);
+	// Don't save a base image that has an overlay, as next time it would be opened without the overlay (ie. writable)
+	const bool hasOverlay = ImageHasOverlay(m_hardDiskDrive[drive].m_imagehandle);
+	RegSaveString(regSection.c_str(), regKey.c_str(), TRUE, hasOverlay ? "" : pathName);
 
 	//
 
@@ -401,7 +436,8 @@ void HarddiskInterfaceCard::Destroy(void)
 //===========================================================================
 
 // Pre: pathname likely to include path (but can also just be filename)
-bool HarddiskInterfaceCard::Insert(const int iDrive, const std::string& pathname)
+// . overlayPathname: optional copy-on-write overlay, so that pathname (the base image) is only read
+bool HarddiskInterfaceCard::Insert(const int iDrive, const std::string& pathname, const std::string& overlayPathname /*=""*/)
 {
 	if (pathname.empty())
 		return false;
@@ -409,13 +445,17 @@ bool HarddiskInterfaceCard::Insert(const int iDrive, const std::string& pathname
 	if (m_hardDiskDrive[iDrive].m_imageloaded)
 		Unplug(iDrive);
 
-	const DWORD dwAttributes = GetFileAttributes(pathname.c_str());
+	// With an overlay, the write-protect state comes from the overlay (which will be created if it doesn't exist)
+	const bool hasOverlay = !overlayPathname.empty();
+	const DWORD dwAttributes = GetFileAttributes(hasOverlay ? overlayPathname.c_str() : pathname.c_str());
 	if (dwAttributes == INVALID_FILE_ATTRIBUTES)
-		m_hardDiskDrive[iDrive].m_bWriteProtected = false;	// File doesn't exist - so ImageOpen() below will fail
+		m_hardDiskDrive[iDrive].m_bWriteProtected = false;	// File doesn't exist - so ImageOpen() below will fail (or the overlay will be created)
 	else
 		m_hardDiskDrive[iDrive].m_bWriteProtected = (dwAttributes & FILE_ATTRIBUTE_READONLY) ? true : false;
 
 	// Check if image is being used by the other HDD, and unplug it in order to be swapped
+	// . not when using an overlay, as a base image can be shared (read-only)
+	if (!hasOverlay)
 	{
 		const std::string & pszOtherPathname = HarddiskGetFullPathName(!iDrive);
 
@@ -439,7 +479,8 @@ bool HarddiskInterfaceCard::Insert(const int iDrive, const std::string& pathname
 		&m_hardDiskDrive[iDrive].m_bWriteProtected,
 		bCreateIfNecessary,
 		m_hardDiskDrive[iDrive].m_strFilenameInZip,	// TODO: Use this
-		bExpectFloppy);
+		bExpectFloppy,
+		overlayPathname);
 
 	m_hardDiskDrive[iDrive].m_imageloaded = (Error == eIMAGE_ERROR_NONE);
 
@@ -448,6 +489,7 @@ bool HarddiskInterfaceCard::Insert(const int iDrive, const std::string& pathname
 
 	if (Error == eIMAGE_ERROR_NONE)
 	{
+		m_hardDiskDrive[iDrive].m_blockCache.ResetStats();
 		GetImageTitle(pathname.c_str(), m_hardDiskDrive[iDrive].m_imagename, m_hardDiskDrive[iDrive].m_fullname);
 		Snapshot_UpdatePath();
 	}
@@ -457,6 +499,36 @@ bool HarddiskInterfaceCard::Insert(const int iDrive, const std::string& pathname
 	return m_hardDiskDrive[iDrive].m_imageloaded;
 }
 
+// Write the overlay's blocks back to the base image
+bool HarddiskInterfaceCard::CommitOverlay(const int iDrive)
+{
+	HardDiskDrive* pHDD = &m_hardDiskDrive[iDrive];
+	if (!ImageHasOverlay(pHDD->m_imagehandle))
+		return false;
+
+	if (!pHDD->m_blockCache.Flush(pHDD->m_imagehandle))
+		return false;
+
+	return ImageCommitOverlay(pHDD->m_imagehandle);
+}
+
+// Throw away the overlay's blocks, and re-insert so that the base image's data is used
+bool HarddiskInterfaceCard::DiscardOverlay(const int iDrive)
+{
+	HardDiskDrive* pHDD = &m_hardDiskDrive[iDrive];
+	if (!ImageHasOverlay(pHDD->m_imagehandle))
+		return false;
+
+	pHDD->m_blockCache.Invalidate();	// Drop any dirty blocks too
+
+	if (!ImageDiscardOverlay(pHDD->m_imagehandle))
+		return false;
+
+	const std::string pathname = ImageGetPathname(pHDD->m_imagehandle);		// copy, as Insert() closes the image
+	const std::string overlayPathname = ImageGetOverlayPathname(pHDD->m_imagehandle);
+	return Insert(iDrive, pathname, overlayPathname);
+}
+
 //-----------------------------------------------------------------------------
 
 bool HarddiskInterfaceCard::SelectImage(const int drive, LPCSTR pszFilename)
@@ -689,7 +761,7 @@ BYTE HarddiskInterfaceCard::CmdExecute(HardDiskDrive* pHDD, const ULONG nExecute
 		{
 			bool breakpointHit = false;
 
-			bool bRes = ImageReadBlock(pHDD->m_imagehandle, pHDD->m_diskblock, pHDD->m_buf);
+			bool bRes = pHDD->m_blockCache.ReadBlock(pHDD->m_imagehandle, pHDD->m_diskblock, pHDD->m_buf);
 			if (bRes)
 			{
 				pHDD->m_buf_ptr = 0;
@@ -816,7 +888,12 @@ BYTE HarddiskInterfaceCard::CmdExecute(HardDiskDrive* pHDD, const ULONG nExecute
 			}
 
 			if (bRes)
-				bRes = ImageWriteBlock(pHDD->m_imagehandle, pHDD->m_diskblock, pHDD->m_buf);
+			{
+				if (bAppendBlocks)
+					bRes = ImageWriteBlock(pHDD->m_imagehandle, pHDD->m_diskblock, pHDD->m_buf);
+				else
+					bRes = pHDD->m_blockCache.WriteBlock(pHDD->m_imagehandle, pHDD->m_diskblock, pHDD->m_buf);	// write-back
+			}
 
 			if (bRes)
 			{
@@ -849,6 +926,10 @@ BYTE HarddiskInterfaceCard::CmdExecute(HardDiskDrive* pHDD, const ULONG nExecute
 			bool res = false;
 			m_notBusyCycle = g_nCumulativeCycles;
 
+			// Every block gets overwritten, so write straight to the image & drop the cached blocks
+			pHDD->m_blockCache.Flush(pHDD->m_imagehandle);
+			pHDD->m_blockCache.Invalidate();
+
 			for (UINT block = 0; block < numBlocks; block++)
 			{
 				// Inefficient (especially for gzip/zip files!)
@@ -1231,7 +1312,8 @@ bool HarddiskInterfaceCard::ImageSwap(void)
 // 5: Added: SP Status Code, FIFO Index & 256-byte firmware
 //    Units are 1-based (up to v4 they were 0-based)
 // 6: Added: absolute path
-static const UINT kUNIT_VERSION = 6;
+// 7: Added: overlay path
+static const UINT kUNIT_VERSION = 7;
 
 #define SS_YAML_VALUE_CARD_HDD "Generic HDD"
 
@@ -1241,6 +1323,7 @@ static const UINT kUNIT_VERSION = 6;
 #define SS_YAML_KEY_HDDUNIT "Unit"
 #define SS_YAML_KEY_FILENAME "Filename"
 #define SS_YAML_KEY_ABSOLUTE_PATH "Absolute Path"
+#define SS_YAML_KEY_OVERLAY_PATH "Overlay Path"
 #define SS_YAML_KEY_ERROR "Error"
 #define SS_YAML_KEY_MEMBLOCK "MemBlock"
 #define SS_YAML_KEY_DISKBLOCK "DiskBlock"
@@ -1267,6 +1350,7 @@ void HarddiskInterfaceCard::SaveSnapshotHDDUnit(YamlSaveHelper& yamlSaveHelper,
 	YamlSaveHelper::Label label(yamlSaveHelper, "%s%d:\n", SS_YAML_KEY_HDDUNIT, baseUnitNum + unit);
 	yamlSaveHelper.SaveString(SS_YAML_KEY_FILENAME, m_hardDiskDrive[unit].m_fullname);
 	yamlSaveHelper.SaveString(SS_YAML_KEY_ABSOLUTE_PATH, ImageGetPathname(m_hardDiskDrive[unit].m_imagehandle));
+	yamlSaveHelper.SaveString(SS_YAML_KEY_OVERLAY_PATH, ImageGetOverlayPathname(m_hardDiskDrive[unit].m_imagehandle));
 	yamlSaveHelper.SaveHexUint8(SS_YAML_KEY_ERROR, m_hardDiskDrive[unit].m_error);
 	yamlSaveHelper.SaveHexUint16(SS_YAML_KEY_MEMBLOCK, m_hardDiskDrive[unit].m_memblock);
 	yamlSaveHelper.SaveHexUint32(SS_YAML_KEY_DISKBLOCK, m_hardDiskDrive[unit].m_diskblock);
@@ -1284,6 +1368,8 @@ void HarddiskInterfaceCard::SaveSnapshotHDDUnit(YamlSaveHelper& yamlSaveHelper,
 
 void HarddiskInterfaceCard::SaveSnapshot(YamlSaveHelper& yamlSaveHelper)
 {
+	FlushBlockCaches();	// so that the image file is consistent with the save-state
+
 	YamlSaveHelper::Slot slot(yamlSaveHelper, GetSnapshotCardName(), m_slot, kUNIT_VERSION);
 
 	YamlSaveHelper::Label state(yamlSaveHelper, "%s:\n", SS_YAML_KEY_STATE);
@@ -1312,16 +1398,39 @@ bool HarddiskInterfaceCard::LoadSnapshotHDDUnit(YamlLoadHelper& yamlLoadHelper,
 
 	std::string hddUnitName = std::string(SS_YAML_KEY_HDDUNIT) + (char)('0' + baseUnitNum + unit);
 	if (!yamlLoadHelper.GetSubMap(hddUnitName))
+	{
+		Unplug(unit);	// Only needed when restoring in place (see LoadSnapshot())
 		return false;	// No HDD plugged in for this unit#
+	}
+
+	const std::string simpleFilename = yamlLoadHelper.LoadString(SS_YAML_KEY_FILENAME);
+	const std::string absolutePath = version >= 6 ? yamlLoadHelper.LoadString(SS_YAML_KEY_ABSOLUTE_PATH) : "";
+	const std::string overlayPath = version >= 7 ? yamlLoadHelper.LoadString(SS_YAML_KEY_OVERLAY_PATH) : "";
 
-	m_hardDiskDrive[unit].m_fullname.clear();
-	m_hardDiskDrive[unit].m_imagename.clear();
-	m_hardDiskDrive[unit].m_imageloaded = false;	// Default to false (until image is successfully loaded below)
+	// Restoring in place (eg. rewind): keep the image open (and its block cache) if it's the snapshot's image, rather than re-open it
+	const bool bKeepImage = yamlLoadHelper.IsRestoreInPlace() && m_hardDiskDrive[unit].m_imageloaded
+		&& !simpleFilename.empty() && m_hardDiskDrive[unit].m_fullname == simpleFilename
+		&& ImageGetPathname(m_hardDiskDrive[unit].m_imagehandle) == absolutePath
+		&& ImageGetOverlayPathname(m_hardDiskDrive[unit].m_imagehandle) == overlayPath;
+
+	if (!bKeepImage)
+	{
+		Unplug(unit);
+
+		// Also unplug any other unit with this image, in case eg. HDD-2 is to be plugged in as HDD-1 (it'll be re-inserted when its unit is loaded)
+		for (UINT i = 0; i < NUM_HARDDISKS; i++)
+		{
+			if (i != unit && m_hardDiskDrive[i].m_imageloaded && !absolutePath.empty() && ImageGetPathname(m_hardDiskDrive[i].m_imagehandle) == absolutePath)
+				Unplug(i);
+		}
+
+		m_hardDiskDrive[unit].m_fullname.clear();
+		m_hardDiskDrive[unit].m_imagename.clear();
+		m_hardDiskDrive[unit].m_imageloaded = false;	// Default to false (until image is successfully loaded below)
+	}
 	m_hardDiskDrive[unit].m_status_next = DISK_STATUS_OFF;
 	m_hardDiskDrive[unit].m_status_prev = DISK_STATUS_OFF;
 
-	const std::string simpleFilename = yamlLoadHelper.LoadString(SS_YAML_KEY_FILENAME);
-	const std::string absolutePath = version >= 6 ? yamlLoadHelper.LoadString(SS_YAML_KEY_ABSOLUTE_PATH) : "";
 	m_hardDiskDrive[unit].m_error = yamlLoadHelper.LoadUint(SS_YAML_KEY_ERROR);
 	m_hardDiskDrive[unit].m_memblock = yamlLoadHelper.LoadUint(SS_YAML_KEY_MEMBLOCK);
 	m_hardDiskDrive[unit].m_diskblock = yamlLoadHelper.LoadUint(SS_YAML_KEY_DISKBLOCK);
@@ -1344,7 +1453,12 @@ bool HarddiskInterfaceCard::LoadSnapshotHDDUnit(YamlLoadHelper& yamlLoadHelper,
 	bool userSelectedImageFolder = false;
 
 	std::string filename = simpleFilename;
-	if (!filename.empty())
+	if (bKeepImage)
+	{
+		m_hardDiskDrive[unit].m_status_next = diskStatusNext;
+		m_hardDiskDrive[unit].m_status_prev = diskStatusPrev;
+	}
+	else if (!filename.empty())
 	{
 		DWORD dwAttributes = GetFileAttributes(filename.c_str());
 		if (dwAttributes == INVALID_FILE_ATTRIBUTES && !absolutePath.empty())
@@ -1367,7 +1481,7 @@ bool HarddiskInterfaceCard::LoadSnapshotHDDUnit(YamlLoadHelper& yamlLoadHelper,
 		bool bImageError = (dwAttributes == INVALID_FILE_ATTRIBUTES);
 		if (!bImageError)
 		{
-			if (!Insert(unit, filename.c_str()))
+			if (!Insert(unit, filename.c_str(), overlayPath))
 				bImageError = true;
 
 			// Insert() sets up:
@@ -1431,10 +1545,14 @@ bool HarddiskInterfaceCard::LoadSnapshot(YamlLoadHelper& yamlLoadHelper, UINT ve
 	}
 
 	// Unplug all HDDs first in case eg. HDD-2 is to be plugged in as HDD-1
-	for (UINT i = 0; i < NUM_HARDDISKS; i++)
+	// . except when restoring in place, where a unit keeps its image if it's the snapshot's (see LoadSnapshotHDDUnit())
+	if (!yamlLoadHelper.IsRestoreInPlace())
 	{
-		Unplug(i);
-		m_hardDiskDrive[i].clear();
+		for (UINT i = 0; i < NUM_HARDDISKS; i++)
+		{
+			Unplug(i);
+			m_hardDiskDrive[i].clear();
+		}
 	}
 
 	bool userSelectedImageFolder = false;
@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "Card.h"
 #include "DiskImage.h"
 #include "DiskImageHelper.h"
+#include "HarddiskBlockCache.h"
 #include "MemoryDefs.h"	// APPLE_SLOT_SIZE
 
 enum HardDrive_e
@@ -86,6 +87,7 @@ public:
 	WORD m_buf_ptr;
 	bool m_imageloaded;
 	BYTE m_buf[HD_BLOCK_SIZE];
+	HarddiskBlockCache m_blockCache;
 
 	Disk_Status_e m_status_next;
 	Disk_Status_e m_status_prev;
@@ -98,7 +100,7 @@ public:
 	virtual ~HarddiskInterfaceCard(void);
 
 	virtual void Reset(const bool powerCycle);
-	virtual void Update(const ULONG nExecutedCycles) {}
+	virtual void Update(const ULONG nExecutedCycles);
 
 	virtual void InitializeIO(LPBYTE pCxRomPeripheral);
 	virtual void Destroy(void);
@@ -106,13 +108,18 @@ public:
 	const std::string& HarddiskGetFullPathName(const int iDrive);
 	void GetFilenameAndPathForSaveState(std::string& filename, std::string& path);
 	bool Select(const int iDrive);
-	bool Insert(const int iDrive, const std::string& pathname);
+	bool Insert(const int iDrive, const std::string& pathname, const std::string& overlayPathname = std::string());
+	bool CommitOverlay(const int iDrive);
+	bool DiscardOverlay(const int iDrive);
 	void Unplug(const int iDrive);
 	void LoadLastDiskImage(const int iDrive);
 	void SetUserNumBlocks(UINT numBlocks) { m_userNumBlocks = numBlocks; }
 	void UseHdcFirmwareV1(void) { m_useHdcFirmwareV1 = true; }
 	void UseHdcFirmwareV2(void) { m_useHdcFirmwareV2 = true; }
 	void SetHdcFirmwareMode(HdcMode hdcMode) { m_useHdcFirmwareMode = hdcMode; }
+	void SetBlockCacheCapacity(UINT numBlocks);
+	const HarddiskBlockCache& GetBlockCache(const int iDrive) { return m_hardDiskDrive[iDrive].m_blockCache; }
+	bool IsImageLoaded(const int iDrive) { return m_hardDiskDrive[iDrive].m_imageloaded; }
 
 	void GetLightStatus(Disk_Status_e* pDisk1Status);
 	bool ImageSwap(void);
@@ -126,6 +133,7 @@ public:
 
 private:
 	void CleanupDriveInternal(const int iDrive);
+	void FlushBlockCaches(void);
 	void CleanupDrive(const int iDrive);
 	void NotifyInvalidImage(const std::string & szImageFilename);
 	void SaveLastDiskImage(const int drive);
@@ -0,0 +1,293 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: Block cache for the Generic HDD (ProDOS block & SmartPort) interface
+ *
+ * ProDOS loads files as runs of consecutive blocks, one block per read cmd. Without a cache
+ * each cmd is a seek+read (or zip decompress) of a single 512-byte block, which is slow when
+ * the image lives on network storage.
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "HarddiskBlockCache.h"
+#include "DiskImage.h"
+
+HarddiskBlockCache::HarddiskBlockCache(void)
+	: m_capacity(kDefaultCapacity)
+{
+	Invalidate();
+	ResetStats();
+}
+
+void HarddiskBlockCache::SetCapacity(UINT numBlocks)
+{
+	_ASSERT(m_numDirty == 0);	// Caller must Flush() first
+	Invalidate();
+	m_capacity = numBlocks;
+}
+
+void HarddiskBlockCache::Invalidate(void)
+{
+	m_entries.clear();
+	m_blockMap.clear();
+	m_head = m_tail = kNone;
+	m_numDirty = 0;
+	m_lastReadBlock = kNone;
+}
+
+void HarddiskBlockCache::ResetStats(void)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+//===========================================================================
+
+void HarddiskBlockCache::Unlink(const UINT idx)
+{
+	Entry& entry = m_entries[idx];
+
+	if (entry.prev != kNone) m_entries[entry.prev].next = entry.next;
+	else m_head = entry.next;
+
+	if (entry.next != kNone) m_entries[entry.next].prev = entry.prev;
+	else m_tail = entry.prev;
+
+	entry.prev = entry.next = kNone;
+}
+
+void HarddiskBlockCache::LinkAtHead(const UINT idx)
+{
+	Entry& entry = m_entries[idx];
+
+	entry.prev = kNone;
+	entry.next = m_head;
+	if (m_head != kNone)
+		m_entries[m_head].prev = idx;
+	m_head = idx;
+	if (m_tail == kNone)
+		m_tail = idx;
+}
+
+// Returns index of cached block (and makes it the MRU), or kNone
+UINT HarddiskBlockCache::Lookup(const UINT block)
+{
+	std::map<UINT, UINT>::const_iterator it = m_blockMap.find(block);
+	if (it == m_blockMap.end())
+		return kNone;
+
+	const UINT idx = it->second;
+	if (idx != m_head)
+	{
+		Unlink(idx);
+		LinkAtHead(idx);
+	}
+	return idx;
+}
+
+// Returns index of a (clean) entry for block, evicting the LRU entry if full, or kNone if the eviction's write-back failed
+UINT HarddiskBlockCache::Allocate(ImageInfo* const pImageInfo, const UINT block)
+{
+	UINT idx;
+
+	if (m_entries.size() < m_capacity)
+	{
+		m_entries.push_back(Entry());
+		idx = (UINT)m_entries.size() - 1;
+	}
+	else
+	{
+		idx = m_tail;
+		Entry& victim = m_entries[idx];
+		if (victim.dirty && !WriteBack(pImageInfo, victim))
+			return kNone;
+
+		m_blockMap.erase(victim.block);
+		Unlink(idx);
+	}
+
+	Entry& entry = m_entries[idx];
+	entry.block = block;
+	entry.dirty = false;
+	m_blockMap[block] = idx;
+	LinkAtHead(idx);
+	return idx;
+}
+
+bool HarddiskBlockCache::WriteBack(ImageInfo* const pImageInfo, Entry& entry)
+{
+	_ASSERT(entry.dirty);
+	if (!ImageWriteBlock(pImageInfo, entry.block, entry.data))
+		return false;
+
+	entry.dirty = false;
+	m_numDirty--;
+	m_stats.blocksWritten++;
+	return true;
+}
+
+//===========================================================================
+
+// Read the blocks following 'block' that aren't already cached
+// . bounded by the image size, and to a fraction of the cache so that read-ahead can't flush the working set
+void HarddiskBlockCache::ReadAhead(ImageInfo* const pImageInfo, const UINT block)
+{
+	const UINT numBlocksInImage = ImageGetImageSize(pImageInfo) / HD_BLOCK_SIZE;
+	const UINT readAhead = MIN(kMaxReadAhead, m_capacity / 4);
+
+	for (UINT i = 1; i <= readAhead; i++)
+	{
+		const UINT nextBlock = block + i;
+		if (nextBlock >= numBlocksInImage)
+			break;
+
+		if (m_blockMap.find(nextBlock) != m_blockMap.end())
+			continue;	// NB. Don't promote it to MRU
+
+		BYTE data[HD_BLOCK_SIZE];
+		if (!ImageReadBlock(pImageInfo, nextBlock, data))
+			break;
+
+		const UINT idx = Allocate(pImageInfo, nextBlock);
+		if (idx == kNone)
+			break;
+
+		memcpy(m_entries[idx].data, data, HD_BLOCK_SIZE);
+		m_stats.readAheadBlocks++;
+	}
+}
+
+bool HarddiskBlockCache::ReadBlock(ImageInfo* const pImageInfo, const UINT block, BYTE* pBlockBuffer)
+{
+	if (m_capacity == 0)
+		return ImageReadBlock(pImageInfo, block, pBlockBuffer);
+
+	const bool isSequential = (m_lastReadBlock != kNone) && (block == m_lastReadBlock + 1);
+	m_lastReadBlock = block;
+
+	UINT idx = Lookup(block);
+	if (idx != kNone)
+	{
+		m_stats.hits++;
+		memcpy(pBlockBuffer, m_entries[idx].data, HD_BLOCK_SIZE);
+
+		if (isSequential)
+			ReadAhead(pImageInfo, block);	// slide the window (normally reads just 1 new block)
+
+		return true;
+	}
+
+	m_stats.misses++;
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	if (!ImageReadBlock(pImageInfo, block, pBlockBuffer))
+		return false;
+
+	idx = Allocate(pImageInfo, block);
+	if (idx != kNone)
+	{
+		memcpy(m_entries[idx].data, pBlockBuffer, HD_BLOCK_SIZE);
+
+		if (isSequential)
+			ReadAhead(pImageInfo, block);
+	}
+
+	const UINT elapsed_us = (UINT)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	m_stats.missTime_us += elapsed_us;
+	if (elapsed_us > m_stats.missTimeMax_us)
+		m_stats.missTimeMax_us = elapsed_us;
+
+	return true;
+}
+
+// Pre: block is inside the image (appending blocks must go directly to the image)
+bool HarddiskBlockCache::WriteBlock(ImageInfo* const pImageInfo, const UINT block, const BYTE* pBlockBuffer)
+{
+	_ASSERT(block < ImageGetImageSize(pImageInfo) / HD_BLOCK_SIZE);
+
+	if (m_capacity == 0 || pImageInfo->bWriteProtected)
+		return ImageWriteBlock(pImageInfo, block, const_cast<BYTE*>(pBlockBuffer));
+
+	m_stats.writes++;
+
+	UINT idx = Lookup(block);
+	if (idx == kNone)
+	{
+		idx = Allocate(pImageInfo, block);
+		if (idx == kNone)
+			return false;
+	}
+
+	Entry& entry = m_entries[idx];
+	if (entry.dirty)
+	{
+		m_stats.writesCoalesced++;
+	}
+	else
+	{
+		if (m_numDirty == 0)
+			m_firstDirtyTime = std::chrono::steady_clock::now();
+		entry.dirty = true;
+		m_numDirty++;
+	}
+
+	memcpy(entry.data, pBlockBuffer, HD_BLOCK_SIZE);
+
+	if (m_numDirty >= kMaxDirty)
+		return Flush(pImageInfo);
+
+	return true;
+}
+
+bool HarddiskBlockCache::IsFlushDue(void) const
+{
+	if (m_numDirty == 0)
+		return false;
+
+	return std::chrono::steady_clock::now() - m_firstDirtyTime >= std::chrono::milliseconds(kMaxDirtyAge_ms);
+}
+
+// Write all dirty blocks back to the image, in block order
+bool HarddiskBlockCache::Flush(ImageInfo* const pImageInfo)
+{
+	if (m_numDirty == 0)
+		return true;
+
+	m_stats.flushes++;
+
+	bool res = true;
+	for (std::map<UINT, UINT>::const_iterator it = m_blockMap.begin(); it != m_blockMap.end(); ++it)
+	{
+		Entry& entry = m_entries[it->second];
+		if (entry.dirty && !WriteBack(pImageInfo, entry))
+			res = false;	// keep going, but leave this block dirty
+	}
+
+	if (m_numDirty)
+		m_firstDirtyTime = std::chrono::steady_clock::now();	// retry the failed blocks after another kMaxDirtyAge_ms
+
+	return res;
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "DiskImageHelper.h"	// ImageInfo, HD_BLOCK_SIZE
+
+#include <chrono>
+
+// Per-drive LRU cache of 512-byte blocks, sitting above ImageReadBlock()/ImageWriteBlock():
+// . sequential reads (block N followed by N+1) trigger read-ahead of the following blocks
+// . writes to blocks inside the image are held (dirty) until evicted or Flush()'d, but for no more than
+//   kMaxDirty blocks (then all are flushed, in block order) or kMaxDirtyAge_ms (see IsFlushDue())
+// . so works the same for file-backed and zip-backed images
+// NB. Uses indices (not iterators/pointers) so that HardDiskDrive remains copyable (see ImageSwap())
+class HarddiskBlockCache
+{
+public:
+	HarddiskBlockCache(void);
+	~HarddiskBlockCache(void) {}
+
+	struct Stats
+	{
+		UINT64 hits;
+		UINT64 misses;
+		UINT64 readAheadBlocks;
+		UINT64 writes;
+		UINT64 writesCoalesced;	// write to a block that was already dirty
+		UINT64 flushes;
+		UINT64 blocksWritten;	// to the image (ie. by Flush() or eviction)
+		UINT64 missTime_us;		// total host time spent servicing misses (incl. read-ahead)
+		UINT missTimeMax_us;
+	};
+
+	void SetCapacity(UINT numBlocks);	// 0 = disabled (reads & writes go straight to the image)
+	UINT GetCapacity(void) const { return m_capacity; }
+	UINT GetNumCached(void) const { return (UINT)m_blockMap.size(); }
+	UINT GetNumDirty(void) const { return m_numDirty; }
+
+	bool ReadBlock(ImageInfo* const pImageInfo, const UINT block, BYTE* pBlockBuffer);
+	bool WriteBlock(ImageInfo* const pImageInfo, const UINT block, const BYTE* pBlockBuffer);
+	bool Flush(ImageInfo* const pImageInfo);
+	bool IsFlushDue(void) const;	// dirty blocks have been held for kMaxDirtyAge_ms
+	void Invalidate(void);	// Pre: Flush()'d, otherwise any dirty blocks are lost
+
+	const Stats& GetStats(void) const { return m_stats; }
+	void ResetStats(void);
+
+	static const UINT kDefaultCapacity = 256;	// blocks (128KiB)
+	static const UINT kMaxReadAhead = 4;		// blocks: synchronous, so kept small to bound the stall on a miss
+	static const UINT kMaxDirty = 32;			// blocks
+	static const UINT kMaxDirtyAge_ms = 1000;
+
+private:
+	static const UINT kNone = (UINT)-1;
+
+	struct Entry
+	{
+		UINT block;
+		bool dirty;
+		UINT prev;	// towards MRU
+		UINT next;	// towards LRU
+		BYTE data[HD_BLOCK_SIZE];
+	};
+
+	UINT Lookup(const UINT block);
+	UINT Allocate(ImageInfo* const pImageInfo, const UINT block);
+	bool WriteBack(ImageInfo* const pImageInfo, Entry& entry);
+	void Unlink(const UINT idx);
+	void LinkAtHead(const UINT idx);
+	void ReadAhead(ImageInfo* const pImageInfo, const UINT block);
+
+	UINT m_capacity;
+	std::vector<Entry> m_entries;
+	std::map<UINT, UINT> m_blockMap;	// block -> index into m_entries (ordered, so Flush() writes in block order)
+	UINT m_head;	// MRU
+	UINT m_tail;	// LRU
+	UINT m_numDirty;
+	std::chrono::steady_clock::time_point m_firstDirtyTime;	// when m_numDirty last went from 0 to 1
+	UINT m_lastReadBlock;
+
+	Stats m_stats;
+};
@@ -0,0 +1,550 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: Cycle-stamped input recording & deterministic replay
+ *
+ * A recording (zlib-compressed) is:
+ *   RecordingHdr, snapshot's YAML, numBlobs x { UINT32 size; BYTE data[size] },
+ *   then a stream of EventHdr's (each optionally followed by a payload), terminated by EV_END
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "InputRecorder.h"
+#include "CardManager.h"
+#include "Core.h"
+#include "CPU.h"
+#include "Disk.h"
+#include "Interface.h"
+#include "Keyboard.h"
+#include "Log.h"
+#include "MouseInterface.h"
+#include "SaveState.h"
+#include "Utilities.h"
+#include "YamlHelper.h"
+
+#pragma pack(push)
+#pragma pack(1)
+struct RecordingHdr
+{
+	UINT32 id;									// 'AWIR'
+	UINT32 version;
+	UINT32 randSeed;							// for srand()
+	UINT32 weakBitSeed[NUM_SLOTS][NUM_DRIVES];	// Disk II weak-bit RNGs (not in the snapshot)
+	UINT32 yamlSize;
+	UINT32 numBlobs;
+};
+#pragma pack(pop)
+
+static const UINT32 kRecordingID = 'RIWA';	// 'AWIR'
+static const UINT32 kRecordingVersion = 1;
+static const UINT32 kMaxPayloadSize = 16*1024*1024;
+static const UINT kNoValue = (UINT)-1;
+
+static void GetWeakBitSeeds(UINT32 seeds[NUM_SLOTS][NUM_DRIVES])
+{
+	for (UINT slot = 0; slot < NUM_SLOTS; slot++)
+	{
+		for (UINT drive = 0; drive < NUM_DRIVES; drive++)
+			seeds[slot][drive] = (GetCardMgr().QuerySlot(slot) == CT_Disk2)
+				? dynamic_cast<Disk2InterfaceCard&>(GetCardMgr().GetRef(slot)).GetWeakBitSeed(drive)
+				: 0;
+	}
+}
+
+static void SetWeakBitSeeds(const UINT32 seeds[NUM_SLOTS][NUM_DRIVES])
+{
+	for (UINT slot = 0; slot < NUM_SLOTS; slot++)
+	{
+		if (GetCardMgr().QuerySlot(slot) != CT_Disk2)
+			continue;
+
+		for (UINT drive = 0; drive < NUM_DRIVES; drive++)
+			dynamic_cast<Disk2InterfaceCard&>(GetCardMgr().GetRef(slot)).SetWeakBitSeed(drive, seeds[slot][drive]);
+	}
+}
+
+//===========================================================================
+
+InputRecorder::InputRecorder(void)
+	: m_mode(MODE_OFF),
+	  m_hFile(NULL),
+	  m_bApplying(false),
+	  m_bEof(false),
+	  m_numDesyncs(0),
+	  m_startCycle(0),
+	  m_bExitOnEnd(false)
+{
+	memset(m_polled, 0, sizeof(m_polled));
+	memset(&m_next, 0, sizeof(m_next));
+}
+
+InputRecorder::~InputRecorder(void)
+{
+	Close();
+}
+
+void InputRecorder::SetPendingRecord(const std::string& pathname)
+{
+	m_pendingRecord = pathname;
+}
+
+void InputRecorder::SetPendingReplay(const std::string& pathname, const bool bExitOnEnd)
+{
+	m_pendingReplay = pathname;
+	m_bExitOnEnd = bExitOnEnd;
+}
+
+bool InputRecorder::WriteData(const void* pData, const UINT size)
+{
+	return size == 0 || gzwrite(m_hFile, pData, size) == (int)size;
+}
+
+bool InputRecorder::ReadData(void* pData, const UINT size)
+{
+	return size == 0 || gzread(m_hFile, pData, size) == (int)size;
+}
+
+void InputRecorder::Close(void)
+{
+	if (m_hFile)
+	{
+		gzclose(m_hFile);
+		m_hFile = NULL;
+	}
+
+	m_mode = MODE_OFF;
+	m_bApplying = false;
+	m_nextPayload.clear();
+}
+
+// crc32 of the whole machine state: the same as a save-state would contain
+UINT32 InputRecorder::GetStateCRC(void)
+{
+	MachineSnapshot snapshot;
+	Snapshot_Capture(snapshot);
+
+	uLong crc = crc32(0, (const Bytef*)snapshot.yaml.data(), (uInt)snapshot.yaml.size());
+	for (UINT i = 0; i < snapshot.blobs.size(); i++)
+	{
+		if (!snapshot.blobs[i].empty())
+			crc = crc32(crc, &snapshot.blobs[i][0], (uInt)snapshot.blobs[i].size());
+	}
+
+	return (UINT32)crc;
+}
+
+//===========================================================================
+
+bool InputRecorder::StartRecording(const std::string& pathname)
+{
+	Stop();
+
+	m_hFile = gzopen(pathname.c_str(), "wb1");	// fast: the snapshot's memory compresses well even at level 1
+	if (!m_hFile)
+	{
+		LogFileOutput("InputRecorder: failed to create %s\n", pathname.c_str());
+		return false;
+	}
+
+	MachineSnapshot snapshot;
+	Snapshot_Capture(snapshot);
+
+	RecordingHdr hdr;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.id = kRecordingID;
+	hdr.version = kRecordingVersion;
+	hdr.randSeed = (UINT32)time(NULL) ^ (UINT32)g_nCumulativeCycles;
+	GetWeakBitSeeds(hdr.weakBitSeed);
+	hdr.yamlSize = (UINT32)snapshot.yaml.size();
+	hdr.numBlobs = (UINT32)snapshot.blobs.size();
+
+	bool res = WriteData(&hdr, sizeof(hdr)) && WriteData(snapshot.yaml.data(), hdr.yamlSize);
+	for (UINT i = 0; res && i < hdr.numBlobs; i++)
+	{
+		const std::vector<BYTE>& blob = snapshot.blobs[i];
+		const UINT32 size = (UINT32)blob.size();
+		res = WriteData(&size, sizeof(size)) && WriteData(blob.empty() ? NULL : &blob[0], size);
+	}
+
+	if (!res)
+	{
+		LogFileOutput("InputRecorder: failed to write %s\n", pathname.c_str());
+		Close();
+		return false;
+	}
+
+	srand(hdr.randSeed);	// eg. for Disk II & memory init (MIP_RANDOM)
+
+	for (UINT i = 0; i < NUM_POLL_INPUTS; i++)
+		m_polled[i] = kNoValue;	// so the 1st poll of each input is recorded
+
+	m_mode = MODE_RECORD;
+	m_pathname = pathname;
+	m_startCycle = g_nCumulativeCycles;
+	m_startTime = std::chrono::steady_clock::now();
+
+	LogFileOutput("InputRecorder: recording to %s\n", pathname.c_str());
+	return true;
+}
+
+bool InputRecorder::StartReplay(const std::string& pathname)
+{
+	Stop();
+
+	m_hFile = gzopen(pathname.c_str(), "rb");
+	if (!m_hFile)
+	{
+		LogFileOutput("InputRecorder: failed to open %s\n", pathname.c_str());
+		return false;
+	}
+
+	RecordingHdr hdr;
+	MachineSnapshot snapshot;
+
+	bool res = ReadData(&hdr, sizeof(hdr)) && hdr.id == kRecordingID && hdr.version == kRecordingVersion;
+	if (res)
+	{
+		snapshot.yaml.resize(hdr.yamlSize);
+		res = ReadData(&snapshot.yaml[0], hdr.yamlSize);
+	}
+
+	if (res)
+	{
+		snapshot.blobs.resize(hdr.numBlobs);
+		for (UINT i = 0; res && i < hdr.numBlobs; i++)
+		{
+			UINT32 size = 0;
+			res = ReadData(&size, sizeof(size)) && size <= kMaxPayloadSize;
+			if (res && size)
+			{
+				snapshot.blobs[i].resize(size);
+				res = ReadData(&snapshot.blobs[i][0], size);
+			}
+		}
+	}
+
+	if (!res || !Snapshot_Restore(snapshot))
+	{
+		LogFileOutput("InputRecorder: not a valid recording: %s\n", pathname.c_str());
+		Close();
+		return false;
+	}
+
+	srand(hdr.randSeed);
+	SetWeakBitSeeds(hdr.weakBitSeed);
+
+	memset(m_polled, 0, sizeof(m_polled));
+
+	m_mode = MODE_REPLAY;
+	m_pathname = pathname;
+	m_bEof = false;
+	m_numDesyncs = 0;
+	m_startCycle = g_nCumulativeCycles;
+	m_startTime = std::chrono::steady_clock::now();
+
+	ReadNext();
+
+	LogFileOutput("InputRecorder: replaying %s\n", pathname.c_str());
+	return true;
+}
+
+void InputRecorder::Stop(void)
+{
+	if (m_mode == MODE_RECORD)
+	{
+		Record(EV_END, 0, GetStateCRC());
+		LogFileOutput("InputRecorder: recorded %llu cycles to %s\n", (unsigned long long)(g_nCumulativeCycles - m_startCycle), m_pathname.c_str());
+	}
+	else if (m_mode == MODE_REPLAY)
+	{
+		LogFileOutput("InputRecorder: replay of %s stopped\n", m_pathname.c_str());
+	}
+
+	Close();
+}
+
+void InputRecorder::EndReplay(const bool bEndEvent)
+{
+	const UINT64 cycles = g_nCumulativeCycles - m_startCycle;
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - m_startTime).count();
+	const char* pResult = !bEndEvent ? "recording is truncated"
+						: (GetStateCRC() == m_next.arg1) ? "final state matches"
+						: "final state MISMATCH";
+
+	LogFileOutput("InputRecorder: replayed %s: %llu cycles in %.3f secs (%.2f MHz), desyncs=%u, %s\n",
+		m_pathname.c_str(), (unsigned long long)cycles, seconds, seconds > 0.0 ? (double)cycles / seconds / 1.0e6 : 0.0,
+		m_numDesyncs, pResult);
+
+	Close();
+
+	if (m_bExitOnEnd)
+		PostMessage(GetFrame().g_hFrameWindow, WM_DESTROY, 0, 0);
+}
+
+//===========================================================================
+
+void InputRecorder::Record(const Event_e type, const UINT16 arg0/*=0*/, const UINT32 arg1/*=0*/, const void* pPayload/*=NULL*/, const UINT32 payloadSize/*=0*/)
+{
+	if (m_mode != MODE_RECORD)
+		return;
+
+	EventHdr event;
+	event.cycle = g_nCumulativeCycles;
+	event.type = (UINT16)type;
+	event.arg0 = arg0;
+	event.arg1 = HasPayload((UINT16)type) ? payloadSize : arg1;
+
+	if (!WriteData(&event, sizeof(event)) || !WriteData(pPayload, HasPayload((UINT16)type) ? payloadSize : 0))
+	{
+		LogFileOutput("InputRecorder: failed to write %s\n", m_pathname.c_str());
+		Close();
+	}
+}
+
+bool InputRecorder::ReadNext(void)
+{
+	m_nextPayload.clear();
+
+	bool res = ReadData(&m_next, sizeof(m_next));
+	if (res && HasPayload(m_next.type))
+	{
+		res = m_next.arg1 <= kMaxPayloadSize;
+		if (res && m_next.arg1)
+		{
+			m_nextPayload.resize(m_next.arg1);
+			res = ReadData(&m_nextPayload[0], m_next.arg1);
+		}
+	}
+
+	if (!res)
+		m_bEof = true;
+
+	return res;
+}
+
+// Polls are consumed by the emulation (ie. during a slice), so any that are left means the replay has diverged
+void InputRecorder::ApplyPolls(const bool bUpToNow)
+{
+	while (!m_bEof && m_next.type == EV_POLL && (!bUpToNow || m_next.cycle <= g_nCumulativeCycles))
+	{
+		if (m_next.arg0 < NUM_POLL_INPUTS)
+			m_polled[m_next.arg0] = m_next.arg1;
+		ReadNext();
+	}
+}
+
+void InputRecorder::CheckCycle(void)
+{
+	if (m_next.cycle == g_nCumulativeCycles)
+		return;
+
+	if (m_numDesyncs++ == 0)
+		LogFileOutput("InputRecorder: replay diverged at cycle %llu (expected event %u at cycle %llu)\n",
+			(unsigned long long)g_nCumulativeCycles, m_next.type, (unsigned long long)m_next.cycle);
+}
+
+void InputRecorder::ApplyEvent(void)
+{
+	m_bApplying = true;
+
+	CMouseInterface* pMouseCard = GetCardMgr().GetMouseCard();
+	const UINT slot = m_next.arg0 >> 8;
+	Disk2InterfaceCard* pDisk2Card = (slot < NUM_SLOTS && GetCardMgr().QuerySlot(slot) == CT_Disk2)
+		? dynamic_cast<Disk2InterfaceCard*>(GetCardMgr().GetObj(slot))
+		: NULL;
+
+	switch (m_next.type)
+	{
+	case EV_KEY:
+		KeybSetKeypress((BYTE)m_next.arg0);
+		break;
+	case EV_ANYKEYDOWN:
+		KeybAnyKeyDown((m_next.arg1 & 1) ? WM_KEYDOWN : WM_KEYUP, m_next.arg0, (m_next.arg1 & 2) ? true : false);
+		break;
+	case EV_PASTE:
+		ClipboardInitiatePaste();
+		break;
+	case EV_MOUSE_MOVE:
+		if (pMouseCard)
+		{
+			int outOfBoundsX, outOfBoundsY;
+			pMouseCard->SetPositionRel((INT16)(m_next.arg1 & 0xFFFF), (INT16)(m_next.arg1 >> 16), &outOfBoundsX, &outOfBoundsY);
+		}
+		break;
+	case EV_MOUSE_BUTTON:
+		if (pMouseCard)
+			pMouseCard->SetButton((eBUTTON)m_next.arg0, m_next.arg1 ? BUTTON_DOWN : BUTTON_UP);
+		break;
+	case EV_MOUSE_SETPOS:
+		if (pMouseCard)
+			pMouseCard->SetCursorPos((INT16)(m_next.arg1 & 0xFFFF), (INT16)(m_next.arg1 >> 16));
+		break;
+	case EV_DISK_INSERT:
+		if (pDisk2Card && !m_nextPayload.empty())
+		{
+			m_nextPayload.push_back(0);	// ensure both strings are terminated
+			m_nextPayload.push_back(0);
+			const std::string pathname(&m_nextPayload[0]);
+			const std::string overlayPathname(&m_nextPayload[pathname.size() + 1]);
+			pDisk2Card->InsertDisk(m_next.arg0 & 1, pathname, (m_next.arg0 & 2) ? true : false, (m_next.arg0 & 4) ? true : false, overlayPathname);
+		}
+		break;
+	case EV_DISK_EJECT:
+		if (pDisk2Card)
+			pDisk2Card->EjectDisk(m_next.arg0 & 1);
+		break;
+	case EV_DISK_SWAP:
+		if (pDisk2Card)
+			pDisk2Card->DriveSwap();
+		break;
+	case EV_CTRL_RESET:
+		CtrlReset();
+		break;
+	case EV_POWER_CYCLE:
+		ResetMachineState();
+		break;
+	default:	// eg. EV_PASTE_TEXT not consumed by a paste
+		m_numDesyncs++;
+		break;
+	}
+
+	m_bApplying = false;
+}
+
+//===========================================================================
+
+// Called before each execution slice: so async input (which arrives between slices) is applied at the same cycle
+UINT InputRecorder::GetSliceCycles(const UINT cycles)
+{
+	if (!m_pendingRecord.empty())
+	{
+		std::string pathname;
+		pathname.swap(m_pendingRecord);
+		StartRecording(pathname);
+	}
+
+	if (!m_pendingReplay.empty())
+	{
+		std::string pathname;
+		pathname.swap(m_pendingReplay);
+		if (!StartReplay(pathname) && m_bExitOnEnd)
+			PostMessage(GetFrame().g_hFrameWindow, WM_DESTROY, 0, 0);
+	}
+
+	if (m_mode == MODE_RECORD)
+	{
+		Record(EV_SLICE, 0, cycles);
+		return cycles;
+	}
+
+	if (m_mode != MODE_REPLAY)
+		return cycles;
+
+	while (!m_bEof && m_next.type != EV_SLICE)
+	{
+		if (m_next.type == EV_END)
+		{
+			EndReplay(true);
+			return cycles;
+		}
+
+		if (m_next.type == EV_POLL)
+		{
+			m_numDesyncs++;
+			ApplyPolls(false);
+			continue;
+		}
+
+		CheckCycle();
+		ApplyEvent();
+		ReadNext();
+	}
+
+	if (m_bEof)
+	{
+		EndReplay(false);
+		return cycles;
+	}
+
+	CheckCycle();
+	const UINT recordedCycles = m_next.arg1;
+	ReadNext();
+	return recordedCycles;
+}
+
+// Record the polled value (if changed), or replace it with the recorded value
+UINT InputRecorder::PollActive(const PollInput_e input, const UINT value, const ULONG nExecutedCycles)
+{
+	CpuCalcCycles(nExecutedCycles);
+
+	if (m_mode == MODE_RECORD)
+	{
+		if (value != m_polled[input])
+		{
+			m_polled[input] = value;
+			Record(EV_POLL, (UINT16)input, value);
+		}
+		return value;
+	}
+
+	ApplyPolls(true);
+	return m_polled[input];
+}
+
+// Record the clipboard's text, or replace it with the recorded text
+void InputRecorder::PasteText(std::string& text)
+{
+	if (m_mode == MODE_RECORD)
+	{
+		Record(EV_PASTE_TEXT, 0, 0, text.data(), (UINT32)text.size());
+		return;
+	}
+
+	if (m_mode != MODE_REPLAY)
+		return;
+
+	ApplyPolls(false);	// any polls recorded before the paste
+
+	if (!m_bEof && m_next.type == EV_PASTE_TEXT)
+	{
+		text.assign(m_nextPayload.begin(), m_nextPayload.end());
+		ReadNext();
+	}
+	else
+	{
+		text.clear();
+		m_numDesyncs++;
+	}
+}
+
+//===========================================================================
+
+static InputRecorder sg_InputRecorder;
+
+InputRecorder& GetInputRecorder(void)
+{
+	return sg_InputRecorder;
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "zlib.h"
+
+#include <chrono>
+
+// Records all external (host) input, so that a session can be re-executed bit-identically (eg. as a benchmark or regression test):
+// . a recording starts with an in-memory snapshot of the machine (see Snapshot_Capture()) and the seeds of the emulation's RNGs
+// . then a stream of events, each stamped with g_nCumulativeCycles:
+//   - the cycles requested for each execution slice (see ContinueExecution()), so replay executes the same slices
+//   - async input, applied between slices: keypresses, any-key-down, paste, mouse, disk insert/eject/swap, reset & power-cycle
+//   - polled input, recorded when the emulated machine reads it (and only when its value changes): buttons & paddles
+// . replay restores the snapshot & seeds, then feeds the events back (and ignores the host's input)
+// . on stop a hash of the machine's state is recorded, and replay checks it
+// NB. Not recorded: network (Uthernet, SSC-over-TCP), host clocks (eg. No-Slot Clock) & debugger changes. And any disk image
+// written to during the recording must be restored (eg. use a write-protected image or an overlay) before replaying it.
+class InputRecorder
+{
+public:
+	InputRecorder(void);
+	~InputRecorder(void);
+
+	enum Event_e
+	{
+		EV_SLICE,			// arg1 = cycles
+		EV_POLL,			// arg0 = PollInput_e, arg1 = value
+		EV_KEY,				// arg0 = Apple keycode
+		EV_ANYKEYDOWN,		// arg0 = virtual key, arg1 = (bIsExtended ? 2 : 0) | (keydown ? 1 : 0)
+		EV_PASTE,			// initiate paste
+		EV_PASTE_TEXT,		// payload = text
+		EV_MOUSE_MOVE,		// arg1 = (dY << 16) | (dX & 0xFFFF)
+		EV_MOUSE_BUTTON,	// arg0 = button, arg1 = down
+		EV_MOUSE_SETPOS,	// arg1 = (y << 16) | (x & 0xFFFF)
+		EV_DISK_INSERT,		// arg0 = DiskArg(), payload = pathname '\0' overlay pathname
+		EV_DISK_EJECT,		// arg0 = DiskArg()
+		EV_DISK_SWAP,		// arg0 = DiskArg()
+		EV_CTRL_RESET,
+		EV_POWER_CYCLE,
+		EV_END,				// arg1 = crc32 of the machine's state
+	};
+
+	enum PollInput_e { POLL_BUTTON0, POLL_BUTTON1, POLL_BUTTON2, POLL_PADDLE0, POLL_PADDLE1, POLL_PADDLE2, POLL_PADDLE3, NUM_POLL_INPUTS };
+
+	static UINT16 DiskArg(const UINT slot, const int drive, const bool bForceWriteProtected=false, const bool bCreateIfNecessary=false)
+	{
+		return (UINT16)((slot << 8) | (drive & 1) | (bForceWriteProtected ? 2 : 0) | (bCreateIfNecessary ? 4 : 0));
+	}
+
+	// From the cmd-line: start on the 1st execution slice (ie. after any -load-state & boot)
+	void SetPendingRecord(const std::string& pathname);
+	void SetPendingReplay(const std::string& pathname, const bool bExitOnEnd);
+
+	bool StartRecording(const std::string& pathname);
+	bool StartReplay(const std::string& pathname);
+	void Stop(void);
+
+	bool IsActive(void) const { return m_mode != MODE_OFF; }
+	bool IsRecording(void) const { return m_mode == MODE_RECORD; }
+	bool IsReplaying(void) const { return m_mode == MODE_REPLAY; }
+	bool IgnoreHostInput(void) const { return m_mode == MODE_REPLAY && !m_bApplying; }
+
+	UINT GetSliceCycles(const UINT cycles);	// Call before each execution slice
+
+	void Record(const Event_e type, const UINT16 arg0=0, const UINT32 arg1=0, const void* pPayload=NULL, const UINT32 payloadSize=0);
+	UINT Poll(const PollInput_e input, const UINT value, const ULONG nExecutedCycles)
+	{
+		return (m_mode == MODE_OFF) ? value : PollActive(input, value, nExecutedCycles);
+	}
+	void PasteText(std::string& text);
+
+private:
+	enum Mode_e { MODE_OFF, MODE_RECORD, MODE_REPLAY };
+
+#pragma pack(push)
+#pragma pack(1)
+	struct EventHdr
+	{
+		UINT64 cycle;
+		UINT16 type;
+		UINT16 arg0;
+		UINT32 arg1;	// or payload size
+	};
+#pragma pack(pop)
+
+	static bool HasPayload(const UINT16 type) { return type == EV_PASTE_TEXT || type == EV_DISK_INSERT; }
+	static UINT32 GetStateCRC(void);
+
+	UINT PollActive(const PollInput_e input, const UINT value, const ULONG nExecutedCycles);
+	bool WriteData(const void* pData, const UINT size);
+	bool ReadData(void* pData, const UINT size);
+	bool ReadNext(void);
+	void ApplyEvent(void);
+	void ApplyPolls(const bool bUpToNow);
+	void CheckCycle(void);
+	void EndReplay(const bool bEndEvent);
+	void Close(void);
+
+	Mode_e m_mode;
+	gzFile m_hFile;
+	std::string m_pathname;
+	bool m_bApplying;						// replay: applying an event (so the host input hooks don't ignore it)
+	UINT m_polled[NUM_POLL_INPUTS];			// record: last value recorded; replay: current value
+
+	EventHdr m_next;						// replay: the next event (lookahead)
+	std::vector<char> m_nextPayload;
+	bool m_bEof;
+	UINT m_numDesyncs;
+	UINT64 m_startCycle;
+	std::chrono::steady_clock::time_point m_startTime;
+	std::string m_pendingRecord;
+	std::string m_pendingReplay;
+	bool m_bExitOnEnd;
+};
+
+InputRecorder& GetInputRecorder(void);
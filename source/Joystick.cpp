@@ -41,6 +41,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "Joystick.h"
 #include "CPU.h"
+#include "InputRecorder.h"
 #include "Memory.h"
 #include "YamlHelper.h"
 #include "Interface.h"
@@ -569,6 +570,9 @@ BYTE __stdcall JoyportReadButton(WORD address, ULONG nExecutedCycles)
 
 	pressed = pressed ? 0 : 1;	// Invert as Joyport signals are active low
 
+	if (address >= 0x61 && address <= 0x63)
+		pressed = GetInputRecorder().Poll((InputRecorder::PollInput_e)(InputRecorder::POLL_BUTTON0 + (address - 0x61)), pressed, nExecutedCycles);
+
 	return MemReadFloatingBus(pressed, nExecutedCycles);
 }
 
@@ -654,6 +658,9 @@ BYTE __stdcall JoyReadButton(WORD pc, WORD address, BYTE, BYTE, ULONG nExecutedC
 			break;
 	}
 
+	if (address >= 0x61 && address <= 0x63)
+		pressed = GetInputRecorder().Poll((InputRecorder::PollInput_e)(InputRecorder::POLL_BUTTON0 + (address - 0x61)), pressed, nExecutedCycles);
+
 	return MemReadFloatingBus(pressed, nExecutedCycles);
 }
 
@@ -760,6 +767,8 @@ void JoyResetPosition(ULONG nExecutedCycles)
 		if (pdlPos >= 255)
 			pdlPos = 287;
 
+		pdlPos = GetInputRecorder().Poll((InputRecorder::PollInput_e)(InputRecorder::POLL_PADDLE0 + pdl), pdlPos, nExecutedCycles);
+
 		SetPaddleInactiveCycle(pdl, pdlPos);
 	}
 
@@ -32,6 +32,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "Windows/AppleWin.h"
 #include "Core.h"
 #include "Interface.h"
+#include "InputRecorder.h"
 #include "Utilities.h"
 #include "Pravets.h"
 #include "YamlHelper.h"
@@ -120,6 +121,9 @@ static bool IsVirtualKeyAnAppleIIKey(WPARAM wparam);
 
 void KeybQueueKeypress (WPARAM key, Keystroke_e bASCII)
 {
+	if (GetInputRecorder().IgnoreHostInput())
+		return;
+
 	if (bASCII == ASCII)	// WM_CHAR
 	{
 		if (GetFrame().g_bFreshReset && key == VK_CANCEL) // OLD HACK: 0x03
@@ -257,58 +261,74 @@ void KeybQueueKeypress (WPARAM key, Keystroke_e bASCII)
 	}
 
 	keywaiting = 1;
+	GetInputRecorder().Record(InputRecorder::EV_KEY, keycode);
+}
+
+// Replay a recorded keypress (ie. the Apple keycode that KeybQueueKeypress() produced)
+void KeybSetKeypress(BYTE key)
+{
+	keycode = key;
+	keywaiting = 1;
 }
 
 //===========================================================================
 
-static HGLOBAL hglb = NULL;
+static std::string g_strPaste;	// copy of the clipboard's text (so the clipboard isn't held open for the whole paste)
 static LPTSTR lptstr = NULL;
 static bool g_bPasteFromClipboard = false;
 static bool g_bClipboardActive = false;
 
 void ClipboardInitiatePaste()
 {
-	if (g_bClipboardActive)
+	if (g_bClipboardActive || GetInputRecorder().IgnoreHostInput())
 		return;
 
 	g_bPasteFromClipboard = true;
+	GetInputRecorder().Record(InputRecorder::EV_PASTE);
 }
 
 static void ClipboardDone()
 {
-	if (g_bClipboardActive)
-	{
-		g_bClipboardActive = false;
-		GlobalUnlock(hglb);
-		CloseClipboard();
-	}
+	g_bClipboardActive = false;
 }
 
-static void ClipboardInit()
+static void ClipboardGetText(std::string& text)
 {
-	ClipboardDone();
-
 	if (!IsClipboardFormatAvailable(CF_TEXT))
 		return;
 	
 	if (!OpenClipboard(GetFrame().g_hFrameWindow))
 		return;
 	
-	hglb = GetClipboardData(CF_TEXT);
-	if (hglb == NULL)
-	{	
-		CloseClipboard();
-		return;
+	HGLOBAL hglb = GetClipboardData(CF_TEXT);
+	if (hglb != NULL)
+	{
+		LPCSTR pText = (LPCSTR) GlobalLock(hglb);
+		if (pText != NULL)
+		{
+			text = pText;
+			GlobalUnlock(hglb);
+		}
 	}
 
-	lptstr = (char*) GlobalLock(hglb);
-	if (lptstr == NULL)
-	{	
-		CloseClipboard();
-		return;
-	}
+	CloseClipboard();
+}
+
+static void ClipboardInit()
+{
+	ClipboardDone();
 
 	g_bPasteFromClipboard = false;
+
+	g_strPaste.clear();
+	if (!GetInputRecorder().IsReplaying())
+		ClipboardGetText(g_strPaste);
+	GetInputRecorder().PasteText(g_strPaste);	// record it, or replace it with the recorded text
+
+	if (g_strPaste.empty())
+		return;
+
+	lptstr = &g_strPaste[0];
 	g_bClipboardActive = true;
 }
 
@@ -388,8 +408,13 @@ void KeybAnyKeyDown(UINT message, WPARAM wparam, bool bIsExtended)
 		return;
 	}
 
+	if (GetInputRecorder().IgnoreHostInput())
+		return;
+
 	if (IsVirtualKeyAnAppleIIKey(wparam))
 	{
+		GetInputRecorder().Record(InputRecorder::EV_ANYKEYDOWN, (UINT16)wparam, (bIsExtended ? 2 : 0) | (message == WM_KEYDOWN ? 1 : 0));
+
 		UINT offset = wparam >> 6;
 		UINT bit    = wparam & 0x3f;
 		UINT idx    = !bIsExtended ? 0 : 1;
@@ -36,6 +36,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "CardManager.h"
 #include "CopyProtectionDongles.h"
 #include "CPU.h"
+#include "InputRecorder.h"
 #include "Joystick.h"
 #include "Keyboard.h"
 #include "LanguageCard.h"
@@ -44,6 +45,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "NoSlotClock.h"
 #include "Pravets.h"
 #include "Registry.h"
+#include "Rewind.h"
 #include "Speaker.h"
 #include "Tape.h"
 #include "RGBMonitor.h"
@@ -188,6 +190,7 @@ SOFT SWITCH STATUS FLAGS
 // - 1 byte entry per 256-byte page
 // - set when a write occurs to a 256-byte page
 // - indicates that 'mem' (ie. the cache) is out-of-sync with the "physical" 64K backing-store memory
+// - bit0: used by UpdatePaging() & BackMainImage(), bit1: used by the rewind buffer (see MemGetRewindDirtyPages())
 // - NB. a page's dirty flag is only useful(valid) when 'mem' is used for both read & write for the corresponding page
 //   When they differ, then writes go directly to the backing-store.
 //   . In this case, the dirty flag will just force a memcpy() to the same address in backing-store.
@@ -277,6 +280,10 @@ static void FreeMemImage(void);
 static bool g_isMemCacheValid = true;	// flag for is 'mem' valid - set in UpdatePaging() and valid for regular (not alternate) CPU emulation
 static bool g_forceAltCpuEmulation = false;	// set by cmd line
 
+static const BYTE kMemDirtyRewind = 1<<1;	// memdirty bit: page written to since the last MemGetRewindDirtyPages()
+static bool g_bRewindDirtyTracking = false;
+static std::vector<LPBYTE> g_rewindDirtyPages;	// backing-store (ie. not 'mem') pages written to
+
 //=============================================================================
 
 // Default memory types on a VM restart
@@ -490,10 +497,11 @@ uint16_t ReadWordFromMemory(uint16_t addr)
 
 void WriteByteToMemory(uint16_t addr, uint8_t data)
 {
+	memdirty[addr >> 8] = 0xFF;
+
 	if (GetIsMemCacheValid())
 	{
 		mem[addr] = data;
-		memdirty[addr >> 8] = 1;
 		return;
 	}
 
@@ -1303,8 +1311,13 @@ void MemUpdatePaging(BOOL initialize)
 	UpdatePaging(initialize);
 }
 
+static void FlushRewindDirtyPages(void);
+
 static void UpdatePaging(BOOL initialize)
 {
+	if (!initialize)
+		FlushRewindDirtyPages();	// Before the paging tables change, as these determine which backing-store pages were written to
+
 	if (initialize)
 	{
 		// Importantly from:
@@ -1761,6 +1774,83 @@ LPBYTE MemGetBankPtr(const UINT nBank, const bool isSaveSnapshotOrDebugging/*=tr
 
 //===========================================================================
 
+// Convert the memdirty pages into the backing-store pages that were written to (using the current paging tables)
+// NB. Page1 (stack) writes don't set memdirty[1], so always treat ZP & stack as dirty (see UpdatePaging())
+static void FlushRewindDirtyPages(void)
+{
+	if (!g_bRewindDirtyTracking)
+		return;
+
+	for (UINT page = _6502_ZERO_PAGE; page < _6502_NUM_PAGES; page++)
+	{
+		if (!(*(memdirty + page) & kMemDirtyRewind) && page > _6502_STACK_PAGE)
+			continue;
+
+		*(memdirty + page) &= ~kMemDirtyRewind;
+
+		LPBYTE pPage = memwrite[page];
+		if (pPage == NULL)
+			continue;	// ROM or I/O
+
+		if (g_isMemCacheValid && pPage == mem + (page << 8))
+			pPage = memshadow[page];	// Written to 'mem', so use its backing-store page
+
+		g_rewindDirtyPages.push_back(pPage);
+
+		if (memVidHD)
+			g_rewindDirtyPages.push_back(memVidHD + (page << 8));	// GH#997
+	}
+}
+
+void MemSetRewindDirtyTracking(const bool enable)
+{
+	g_bRewindDirtyTracking = enable;
+	g_rewindDirtyPages.clear();
+
+	if (memdirty)
+	{
+		for (UINT page = 0; page < _6502_NUM_PAGES; page++)
+			*(memdirty + page) &= ~kMemDirtyRewind;
+	}
+}
+
+// Get the backing-store pages written to since the last call (sorted & unique)
+void MemGetRewindDirtyPages(std::vector<LPBYTE>& pages)
+{
+	FlushRewindDirtyPages();
+
+	std::sort(g_rewindDirtyPages.begin(), g_rewindDirtyPages.end());
+	g_rewindDirtyPages.erase(std::unique(g_rewindDirtyPages.begin(), g_rewindDirtyPages.end()), g_rewindDirtyPages.end());
+
+	pages.swap(g_rewindDirtyPages);
+	g_rewindDirtyPages.clear();	// NB. keeps the capacity of the caller's old vector
+}
+
+static bool IsInBank(const BYTE* pMem, const UINT size, const BYTE* pBank)
+{
+	return pBank && pMem >= pBank && pMem + size <= pBank + _6502_MEM_LEN;
+}
+
+// Is pMem in main or aux (inc. RamWorks) memory? ie. writes to it are tracked by MemGetRewindDirtyPages()
+bool MemIsRewindTracked(const BYTE* pMem, const UINT size)
+{
+	if (IsInBank(pMem, size, memmain))
+		return true;
+
+#ifdef RAMWORKS
+	for (UINT bank = 0; bank < g_uMaxExBanks; bank++)
+	{
+		if (IsInBank(pMem, size, RWpages[bank]))
+			return true;
+	}
+	return false;
+#else
+	return IsInBank(pMem, size, memaux);
+#endif
+}
+
+//===========================================================================
+
 LPBYTE MemGetCxRomPeripheral()
 {
 	return pCxRomPeripheral;
@@ -2238,6 +2328,9 @@ void MemInitializeFromSnapshot(void)
 
 inline uint32_t getRandomTime()
 {
+	if (GetInputRecorder().IsActive())
+		return rand();	// Recording or replaying: the RNG was seeded by InputRecorder, so don't mix in the host's time
+
 	return rand() ^ timeGetTime(); // We can't use g_nCumulativeCycles as it will be zero on a fresh execution.
 }
 
@@ -2264,6 +2357,7 @@ void MemReset()
 	g_uPeripheralRomSlot = 0;
 
 	memset(memdirty, 0, 0x100);
+	GetRewindBuffer().ForceKeyframe();	// The RAM images were re-initialised without setting memdirty
 
 	memVidHD = NULL;
 
@@ -90,6 +90,9 @@ bool    MemGetAnnunciator(UINT annunciator);
 bool    MemHasNoSlotClock(void);
 void    MemInsertNoSlotClock(void);
 void    MemRemoveNoSlotClock(void);
+void    MemSetRewindDirtyTracking(const bool enable);
+void    MemGetRewindDirtyPages(std::vector<LPBYTE>& pages);
+bool    MemIsRewindTracked(const BYTE* pMem, const UINT size);
 const std::string& MemGetSnapshotUnitAuxSlotName(void);
 void    MemSaveSnapshot(class YamlSaveHelper& yamlSaveHelper);
 bool    MemLoadSnapshot(class YamlLoadHelper& yamlLoadHelper, UINT unitVersion);
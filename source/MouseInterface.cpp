@@ -48,6 +48,7 @@ Etc.
 #include "Core.h"	// g_SynchronousEventMgr
 #include "CardManager.h"
 #include "CPU.h"
+#include "InputRecorder.h"
 #include "Interface.h"	// FrameSetCursorPosByMousePos()
 #include "Memory.h"
 #include "NTSC.h"	// NTSC_GetCyclesUntilVBlank()
@@ -586,6 +587,14 @@ void CMouseInterface::SetPositionAbs(int x, int y)
 
 void CMouseInterface::SetPositionRel(long dX, long dY, int* pOutOfBoundsX, int* pOutOfBoundsY)
 {
+	if (GetInputRecorder().IgnoreHostInput())
+	{
+		*pOutOfBoundsX = *pOutOfBoundsY = 0;
+		return;
+	}
+
+	GetInputRecorder().Record(InputRecorder::EV_MOUSE_MOVE, 0, ((UINT32)dY << 16) | ((UINT32)dX & 0xFFFF));
+
 	m_iX += dX;
 	*pOutOfBoundsX = ClampX();
 
@@ -597,10 +606,26 @@ void CMouseInterface::SetPositionRel(long dX, long dY, int* pOutOfBoundsX, int*
 
 void CMouseInterface::SetButton(eBUTTON Button, eBUTTONSTATE State)
 {
+	if (GetInputRecorder().IgnoreHostInput())
+		return;
+
+	GetInputRecorder().Record(InputRecorder::EV_MOUSE_BUTTON, (UINT16)Button, State == BUTTON_DOWN ? 1 : 0);
+
 	m_bButtons[Button] = (State == BUTTON_DOWN);
 	OnMouseEvent();
 }
 
+void CMouseInterface::SetCursorPos(int iX, int iY)
+{
+	if (GetInputRecorder().IgnoreHostInput())
+		return;
+
+	GetInputRecorder().Record(InputRecorder::EV_MOUSE_SETPOS, 0, ((UINT32)iY << 16) | ((UINT32)iX & 0xFFFF));
+
+	m_iX = iX;
+	m_iY = iY;
+}
+
 #define SS_YAML_VALUE_CARD_MOUSE "Mouse Card"
 
 #define SS_YAML_KEY_MC6821 "MC6821"
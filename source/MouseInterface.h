@@ -36,11 +36,7 @@ public:
 		iMinY = m_iMinY;
 		iMaxY = m_iMaxY;
 	}
-	void SetCursorPos(int iX, int iY)
-	{
-		m_iX = iX;
-		m_iY = iY;
-	}
+	void SetCursorPos(int iX, int iY);
 
 	static const std::string& GetSnapshotCardName(void);
 	virtual void SaveSnapshot(YamlSaveHelper& yamlSaveHelper);
@@ -0,0 +1,302 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: Rewind buffer: keyframes + per-frame page deltas
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "Rewind.h"
+#include "Common.h"
+#include "InputRecorder.h"
+#include "Memory.h"
+#include "SaveState.h"
+#include "Log.h"
+
+#include <chrono>
+
+static RewindBuffer sg_RewindBuffer;
+
+RewindBuffer& GetRewindBuffer(void)
+{
+	return sg_RewindBuffer;
+}
+
+RewindBuffer::RewindBuffer(void)
+	: m_maxFrames(0)
+	, m_maxBytes((size_t)kDefaultMaxMB << 20)
+	, m_bytesUsed(0)
+	, m_framesSinceKeyframe(0)
+	, m_bForceKeyframe(true)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+void RewindBuffer::SetSize(const UINT seconds, const UINT maxMB)
+{
+	m_maxFrames = seconds * kFramesPerSecond;
+	m_maxBytes = (size_t)maxMB << 20;
+	Reset();
+}
+
+void RewindBuffer::Reset(void)
+{
+	m_frames.clear();
+	m_bytesUsed = 0;
+	m_bForceKeyframe = true;
+	MemSetRewindDirtyTracking(IsEnabled());
+}
+
+size_t RewindBuffer::Frame::GetSize(void) const
+{
+	size_t size = snapshot.yaml.size() + pages.size() * sizeof(PageDelta) + pageData.size();
+	for (UINT i = 0; i < snapshot.blobs.size(); i++)
+		size += snapshot.blobs[i].size();
+	return size;
+}
+
+//===========================================================================
+
+void RewindBuffer::Capture(void)
+{
+	if (!IsEnabled())
+		return;
+
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	m_frames.push_back(Frame());
+	Frame& frame = m_frames.back();
+
+	try
+	{
+		// Pages written since the previous frame (NB. before the capture, as this flushes 'mem' to the backing-store)
+		MemGetRewindDirtyPages(m_dirtyPages);
+
+		bool isKeyframe = m_bForceKeyframe || m_framesSinceKeyframe >= kKeyframeInterval;
+		if (!isKeyframe)
+		{
+			Snapshot_Capture(m_capture, false);
+			isKeyframe = !IsSameLayout();	// eg. a card with memory was inserted
+		}
+
+		if (isKeyframe)
+			CaptureKeyframe(frame);
+		else
+			CaptureDelta(frame);
+	}
+	catch (const std::exception& e)
+	{
+		LogFileOutput("Rewind: Capture failed: %s\n", e.what());
+		m_frames.pop_back();
+		Reset();
+		return;
+	}
+
+	m_bytesUsed += frame.GetSize();
+	Trim();
+
+	const UINT elapsed_us = (UINT)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	m_stats.numCaptures++;
+	m_stats.captureTime_us += elapsed_us;
+	if (elapsed_us > m_stats.captureTimeMax_us)
+		m_stats.captureTimeMax_us = elapsed_us;
+}
+
+void RewindBuffer::CaptureKeyframe(Frame& frame)
+{
+	frame.isKeyframe = true;
+	Snapshot_Capture(frame.snapshot);
+
+	const MachineSnapshot& snapshot = frame.snapshot;
+	const UINT numBlobs = (UINT)snapshot.blobSrc.size();
+
+	m_keyBlobSrc = snapshot.blobSrc;
+	m_blobTracked.resize(numBlobs);
+	m_untracked.resize(numBlobs);
+
+	for (UINT i = 0; i < numBlobs; i++)
+	{
+		m_blobTracked[i] = MemIsRewindTracked(snapshot.blobSrc[i].first, snapshot.blobSrc[i].second);
+		if (m_blobTracked[i])
+			m_untracked[i].clear();
+		else
+			m_untracked[i] = snapshot.blobs[i];
+	}
+
+	m_framesSinceKeyframe = 0;
+	m_bForceKeyframe = false;
+	m_stats.numKeyframes++;
+}
+
+// Same blobs as the last keyframe? NB. an untracked blob's address can change between captures (eg. a temporary buffer)
+bool RewindBuffer::IsSameLayout(void) const
+{
+	const std::vector< std::pair<const BYTE*, UINT> >& blobSrc = m_capture.blobSrc;
+
+	if (blobSrc.size() != m_keyBlobSrc.size())
+		return false;
+
+	for (UINT i = 0; i < blobSrc.size(); i++)
+	{
+		if (blobSrc[i].second != m_keyBlobSrc[i].second)
+			return false;
+		if (m_blobTracked[i] && blobSrc[i].first != m_keyBlobSrc[i].first)
+			return false;
+	}
+
+	return true;
+}
+
+// Pre: m_capture holds this frame (without tracked memory), and m_dirtyPages holds the pages written since the previous frame
+void RewindBuffer::CaptureDelta(Frame& frame)
+{
+	frame.isKeyframe = false;
+	frame.snapshot.yaml.swap(m_capture.yaml);
+
+	for (UINT i = 0; i < m_capture.blobSrc.size(); i++)
+	{
+		const BYTE* pBlob = m_capture.blobSrc[i].first;
+		const UINT blobSize = m_capture.blobSrc[i].second;
+
+		if (m_blobTracked[i])
+		{
+			// Dirty pages that overlap this blob (NB. sorted, so just step back one for a page that straddles the blob's start)
+			std::vector<LPBYTE>::const_iterator it = std::lower_bound(m_dirtyPages.begin(), m_dirtyPages.end(), pBlob);
+			if (it != m_dirtyPages.begin() && *(it-1) + _6502_PAGE_SIZE > pBlob)
+				--it;
+
+			for (; it != m_dirtyPages.end() && *it < pBlob + blobSize; ++it)
+			{
+				const BYTE* pStart = MAX(*it, pBlob);
+				const BYTE* pEnd = MIN(*it + _6502_PAGE_SIZE, pBlob + blobSize);
+				AddPage(frame, i, (UINT)(pStart - pBlob), (UINT)(pEnd - pStart), pStart);
+			}
+		}
+		else
+		{
+			// Not tracked, so compare against the previous copy
+			const std::vector<BYTE>& blob = m_capture.blobs[i];
+			std::vector<BYTE>& prev = m_untracked[i];
+			_ASSERT(blob.size() == blobSize && prev.size() == blobSize);
+
+			for (UINT offset = 0; offset < blobSize; offset += _6502_PAGE_SIZE)
+			{
+				const UINT size = MIN(_6502_PAGE_SIZE, blobSize - offset);
+				if (memcmp(&blob[offset], &prev[offset], size) == 0)
+					continue;
+
+				memcpy(&prev[offset], &blob[offset], size);
+				AddPage(frame, i, offset, size, &blob[offset]);
+			}
+		}
+	}
+
+	m_framesSinceKeyframe++;
+}
+
+void RewindBuffer::AddPage(Frame& frame, const UINT blob, const UINT offset, const UINT size, const BYTE* pData)
+{
+	PageDelta page = { blob, offset, size };
+	frame.pages.push_back(page);
+	frame.pageData.insert(frame.pageData.end(), pData, pData + size);
+}
+
+// Drop the oldest keyframe (and its deltas) until within the max frames & memory
+// NB. the newest keyframe is never dropped, so may exceed the max memory if it's small
+void RewindBuffer::Trim(void)
+{
+	while (m_frames.size() > m_maxFrames || m_bytesUsed > m_maxBytes)
+	{
+		UINT nextKeyframe = 1;
+		while (nextKeyframe < m_frames.size() && !m_frames[nextKeyframe].isKeyframe)
+			nextKeyframe++;
+
+		if (nextKeyframe == m_frames.size())
+			break;
+
+		for (UINT i = 0; i < nextKeyframe; i++)
+		{
+			m_bytesUsed -= m_frames.front().GetSize();
+			m_frames.pop_front();
+		}
+	}
+}
+
+//===========================================================================
+
+// Restore the frame that's numFrames before the newest, and discard the newer frames
+bool RewindBuffer::StepBack(const UINT numFrames)
+{
+	if (m_frames.empty())
+		return false;
+
+	GetInputRecorder().Stop();	// Before stepping back, so that a recording ends with the current state
+
+	const UINT target = (UINT)m_frames.size() - 1 - MIN(numFrames, (UINT)m_frames.size() - 1);
+
+	UINT keyframe = target;
+	while (!m_frames[keyframe].isKeyframe)
+		keyframe--;	// NB. m_frames[0] is always a keyframe
+
+	// Keyframe's memory, then apply each frame's page deltas
+	const std::vector< std::vector<BYTE> >& keyBlobs = m_frames[keyframe].snapshot.blobs;
+	m_restore.blobs.resize(keyBlobs.size());
+	for (UINT i = 0; i < keyBlobs.size(); i++)
+		m_restore.blobs[i].assign(keyBlobs[i].begin(), keyBlobs[i].end());
+
+	for (UINT f = keyframe + 1; f <= target; f++)
+	{
+		const Frame& frame = m_frames[f];
+		const BYTE* pData = frame.pageData.empty() ? NULL : &frame.pageData[0];
+
+		for (UINT i = 0; i < frame.pages.size(); i++)
+		{
+			const PageDelta& page = frame.pages[i];
+			memcpy(&m_restore.blobs[page.blob][page.offset], pData, page.size);
+			pData += page.size;
+		}
+	}
+
+	m_restore.yaml = m_frames[target].snapshot.yaml;
+
+	const bool res = Snapshot_Restore(m_restore);
+
+	while (m_frames.size() > target + 1)
+	{
+		m_bytesUsed -= m_frames.back().GetSize();
+		m_frames.pop_back();
+	}
+
+	if (!res)
+	{
+		Reset();
+		return false;
+	}
+
+	// Restoring rewrote all memory, so the next frame must be a keyframe
+	MemGetRewindDirtyPages(m_dirtyPages);
+	m_bForceKeyframe = true;
+	return true;
+}
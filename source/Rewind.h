@@ -0,0 +1,107 @@
+#pragma once
+
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "YamlHelper.h"	// MachineSnapshot
+
+// Ring of the last N seconds of emulation, captured once per video frame:
+// . a keyframe is a full in-memory snapshot (see Snapshot_Capture()), taken every kKeyframeInterval frames
+// . other frames hold the snapshot's YAML text (CPU, soft-switches & cards), plus just the 256-byte pages written since
+//   the previous frame: main & aux (inc. RamWorks) pages come from memdirty (see MemGetRewindDirtyPages()), and any other
+//   memory (eg. a card's RAM) is compared against its previous copy
+// . stepping back to frame F restores F's nearest keyframe, then applies the page deltas up to F
+// . oldest keyframe+deltas groups are dropped to keep within the max number of frames & memory
+class RewindBuffer
+{
+public:
+	RewindBuffer(void);
+	~RewindBuffer(void) {}
+
+	struct Stats
+	{
+		UINT64 numCaptures;
+		UINT64 numKeyframes;
+		UINT64 captureTime_us;	// total host time spent in Capture()
+		UINT captureTimeMax_us;
+	};
+
+	void SetSize(const UINT seconds, const UINT maxMB);	// seconds=0: disabled
+	bool IsEnabled(void) const { return m_maxFrames != 0; }
+	void Reset(void);	// Discard all frames, eg. after loading a save-state
+	void ForceKeyframe(void) { m_bForceKeyframe = true; }	// Memory was written without setting memdirty (eg. MemReset()), so the next frame can't be a delta
+
+	void Capture(void);						// Call once per video frame
+	bool StepBack(const UINT numFrames);	// Clamped to the oldest frame
+
+	UINT GetNumFrames(void) const { return (UINT)m_frames.size(); }
+	size_t GetMemoryUsed(void) const { return m_bytesUsed; }
+	const Stats& GetStats(void) const { return m_stats; }
+
+	static const UINT kFramesPerSecond = 60;
+	static const UINT kKeyframeInterval = kFramesPerSecond;
+	static const UINT kDefaultMaxMB = 64;
+
+private:
+	struct PageDelta
+	{
+		UINT blob;
+		UINT offset;	// in the blob
+		UINT size;		// normally 256, but clipped to the blob
+	};
+
+	struct Frame
+	{
+		bool isKeyframe;
+		MachineSnapshot snapshot;		// keyframe: inc. all memory blobs; otherwise: just the YAML text
+		std::vector<PageDelta> pages;	// non-keyframe: memory written since the previous frame
+		std::vector<BYTE> pageData;
+
+		size_t GetSize(void) const;
+	};
+
+	void CaptureKeyframe(Frame& frame);
+	void CaptureDelta(Frame& frame);
+	void AddPage(Frame& frame, const UINT blob, const UINT offset, const UINT size, const BYTE* pData);
+	bool IsSameLayout(void) const;
+	void Trim(void);
+
+	UINT m_maxFrames;
+	size_t m_maxBytes;
+	size_t m_bytesUsed;
+	std::deque<Frame> m_frames;
+	UINT m_framesSinceKeyframe;
+	bool m_bForceKeyframe;
+
+	std::vector< std::pair<const BYTE*, UINT> > m_keyBlobSrc;	// blob layout of the last keyframe
+	std::vector<bool> m_blobTracked;							// per blob: written pages are from memdirty
+	std::vector< std::vector<BYTE> > m_untracked;				// per blob: previous copy, if not tracked
+
+	MachineSnapshot m_capture;			// Capture(): memory isn't copied (except for untracked blobs)
+	MachineSnapshot m_restore;			// StepBack(): keyframe + deltas
+	std::vector<LPBYTE> m_dirtyPages;
+
+	Stats m_stats;
+};
+
+RewindBuffer& GetRewindBuffer(void);
@@ -56,6 +56,8 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "SSI263.h"
 #include "SSI263Phonemes.h"
 
+#include "zlib.h"
+
 #include "YamlHelper.h"
 
 #define LOG_SSI263 0
@@ -338,6 +340,121 @@ void SSI263::Votrax_Write(BYTE value)
 
 //-----------------------------------------------------------------------------
 
+// Phoneme bank is decoded on first use (shared by all SSI263 instances)
+const short* SSI263::GetPhonemeBank(void)
+{
+	static std::vector<short> phonemeBank;
+
+	if (phonemeBank.empty())
+	{
+		std::vector<BYTE> planes(g_nPhonemeDataLength * 2);
+		uLongf planesSize = (uLongf)planes.size();
+		const int res = uncompress(&planes[0], &planesSize, g_nPhonemeDataCompressed, sizeof(g_nPhonemeDataCompressed));
+		if (res != Z_OK || planesSize != planes.size())
+		{
+			_ASSERT(0);
+			LogFileOutput("SSI263: Failed to decode phoneme data (res=%d)\n", res);
+			planes.assign(planes.size(), 0);	// Silence
+		}
+
+		// Undo the delta encoding
+		const BYTE* pLo = &planes[0];
+		const BYTE* pHi = &planes[g_nPhonemeDataLength];
+		phonemeBank.resize(g_nPhonemeDataLength);
+		USHORT sample = 0;
+		for (UINT i = 0; i < g_nPhonemeDataLength; i++)
+		{
+			sample += (USHORT)(pLo[i] | (pHi[i] << 8));
+			phonemeBank[i] = (short)sample;
+		}
+	}
+
+	return &phonemeBank[0];
+}
+
+// Cache of phonemes that have been rate-converted for a given DUR (shared by all SSI263 instances)
+struct RateConvertedPhoneme
+{
+	std::vector<short> samples;
+	UINT tailLength;	// 1 if there are trailing source samples that don't form a whole output sample
+};
+
+static const UINT kNumDurations = 4;
+static RateConvertedPhoneme g_rateConvertedPhonemes[kNumDurations][SSI263::kNumPhonemes];
+
+// Pre: phoneme = [$00,$02-$3F] ($00 is 'pause', and there's no sample for phoneme $01)
+// Post: length (in output samples) includes the tail
+const short* SSI263::GetRateConvertedPhoneme(UINT phoneme, BYTE DUR, UINT& length, UINT& tailLength)
+{
+	_ASSERT(phoneme != 1 && phoneme < kNumPhonemes && DUR < kNumDurations);
+
+	RateConvertedPhoneme& converted = g_rateConvertedPhonemes[DUR][phoneme];
+
+	if (converted.samples.empty())
+	{
+		// NB. 'pause' length is length of 1st phoneme (arbitrary choice, since don't know real length)
+		const PHONEME_INFO& info = g_nPhonemeInfo[(phoneme == 0) ? 0 : phoneme - 2];
+		const short* pSrc = (phoneme == 0) ? NULL : &GetPhonemeBank()[info.nOffset];
+
+		// Playback rate: DUR=0: 1:1, DUR=1: drop 1 in 4 samples, DUR=2: average pairs of samples, DUR=3: average 4 samples
+		const UINT numSamplesToAvg = (DUR <= 1) ? 1 :
+									 (DUR == 2) ? 2 :
+												  4;
+
+		converted.samples.reserve(info.nLength / numSamplesToAvg + 1);
+
+		int sampleSum = 0;
+		UINT numSamples = 0;
+		UINT sampleMod4 = 0;
+		bool lastSampleWritten = false;
+
+		for (UINT i = 0; i < info.nLength; i++)
+		{
+			sampleSum += pSrc ? pSrc[i] : 0;
+			numSamples++;
+
+			lastSampleWritten = (numSamples == numSamplesToAvg);
+			if (lastSampleWritten)
+			{
+				converted.samples.push_back((short)(sampleSum / (int)numSamplesToAvg));
+				sampleSum = 0;
+				numSamples = 0;
+			}
+
+			sampleMod4 = (sampleMod4 + 1) & 3;
+			if (DUR == 1 && sampleMod4 == 3 && i + 1 < info.nLength)
+				i++;	// skip sample
+		}
+
+		converted.tailLength = lastSampleWritten ? 0 : 1;
+	}
+
+	length = (UINT)converted.samples.size() + converted.tailLength;
+	tailLength = converted.tailLength;
+	return &converted.samples[0];
+}
+
+// Apply gain (fixed-point, where kUnityGain = 1.0)
+// NB. Simple loop over contiguous data, so that the compiler can vectorise it
+static void MixPhonemeWithGain(short* pDst, const short* pSrc, UINT numSamples, int gain)
+{
+	if (gain == 0)
+	{
+		memset(pDst, 0, numSamples * sizeof(short));
+	}
+	else if (gain == SSI263::kUnityGain)
+	{
+		memcpy(pDst, pSrc, numSamples * sizeof(short));
+	}
+	else
+	{
+		for (UINT i = 0; i < numSamples; i++)
+			pDst[i] = (short)((pSrc[i] * gain) >> SSI263::kGainShift);
+	}
+}
+
+//-----------------------------------------------------------------------------
+
 void SSI263::Play(unsigned int nPhoneme)
 {
 	if (m_dbgFirst)
@@ -354,42 +471,22 @@ void SSI263::Play(unsigned int nPhoneme)
 #endif
 	m_currentActivePhoneme = nPhoneme;
 
-	bool bPause = false;
+	// Phoneme playback rate is determined by DUR (and is fixed for the duration of this phoneme)
+	const BYTE DUR = (m_currentMode.function == (MODE_FRAME_IMMEDIATE_INFLECTION >> DURATION_MODE_SHIFT)) ? 3	// Frame timing mode
+					: m_durationPhoneme >> DURATION_MODE_SHIFT;	// Phoneme timing mode
 
 	if (nPhoneme == 1)
 		nPhoneme = 2;	// Missing this sample, so map to phoneme-2
 
-	if (nPhoneme == 0)
-		bPause = true;
-	else
-		nPhoneme-=2;	// Missing phoneme-1
+	// NB. 'pause' (phoneme-0) length is length of 1st phoneme (arbitrary choice, since don't know real length)
+	const UINT sourceLength = g_nPhonemeInfo[(nPhoneme == 0) ? 0 : nPhoneme - 2].nLength;	// Missing phoneme-1
 
-	m_phonemeLengthRemaining = g_nPhonemeInfo[nPhoneme].nLength;
+	m_pPhonemeData = GetRateConvertedPhoneme(nPhoneme, DUR, m_phonemeLengthRemaining, m_phonemeTailLength);
 
-	m_phonemeAccurateLengthRemaining = m_phonemeLengthRemaining;
+	m_phonemeAccurateLengthRemaining = sourceLength;
 	m_phonemePlaybackAndDebugger = (g_nAppMode == MODE_STEPPING || g_nAppMode == MODE_DEBUG);
 	m_phonemeCompleteByFullSpeed = false;
-	m_phonemeLeadoutLength = m_phonemeLengthRemaining / 10;	// Arbitrary! (TODO: determine a more accurate factor)
-
-	if (bPause)
-	{
-		if (!m_pPhonemeData00)
-		{
-			// 'pause' length is length of 1st phoneme (arbitrary choice, since don't know real length)
-			m_pPhonemeData00 = new short [m_phonemeLengthRemaining];
-			memset(m_pPhonemeData00, 0x00, m_phonemeLengthRemaining*sizeof(short));
-		}
-
-		m_pPhonemeData = m_pPhonemeData00;
-	}
-	else
-	{
-		m_pPhonemeData = (const short*) &g_nPhonemeData[g_nPhonemeInfo[nPhoneme].nOffset];
-	}
-
-	m_currSampleSum = 0;
-	m_currNumSamples = 0;
-	m_currSampleMod4 = 0;
+	m_phonemeLeadoutLength = sourceLength / 10;	// Arbitrary! (TODO: determine a more accurate factor)
 
 	// Set m_lastUpdateCycle, otherwise UpdateAccurateLength() can immediately complete phoneme! (GH#1104)
 	m_lastUpdateCycle = GetLastCumulativeCycles();
@@ -617,59 +714,36 @@ void SSI263::Update(void)
 
 	//-------------
 
-	const double amplitude = m_isVotraxPhoneme ? 1.0
-		: m_ctrlArtAmp & CONTROL_MASK ? 0.0		// Power-down / standby
-		: m_filterFreq == FILTER_FREQ_SILENCE ? 0.0
-		: (double)(m_ctrlArtAmp & AMPLITUDE_MASK) / (double)AMPLITUDE_MASK;
+	const int amplitude = m_isVotraxPhoneme ? kUnityGain
+		: m_ctrlArtAmp & CONTROL_MASK ? 0		// Power-down / standby
+		: m_filterFreq == FILTER_FREQ_SILENCE ? 0
+		: ((m_ctrlArtAmp & AMPLITUDE_MASK) * kUnityGain) / AMPLITUDE_MASK;
 
 	bool bSpeechIRQ = false;
 
 	{
-		const BYTE DUR = (m_currentMode.function == (MODE_FRAME_IMMEDIATE_INFLECTION >> DURATION_MODE_SHIFT)) ? 3	// Frame timing mode
-						: m_durationPhoneme >> DURATION_MODE_SHIFT;	// Phoneme timing mode
-		const BYTE numSamplesToAvg = (DUR <= 1) ? 1 :
-									 (DUR == 2) ? 2 :
-												  4;
-
 		short* pMixBuffer = &m_mixBufferSSI263[0];
 		UINT zeroSize = nNumSamples;
 
 		if (m_phonemeLengthRemaining && !prefillBufferOnInit)
 		{
-			UINT samplesWritten = 0;
-			while (samplesWritten < (UINT)nNumSamples)
-			{
-				double sample = (double)*m_pPhonemeData * amplitude;
-				m_currSampleSum += (int)sample;
-				m_currNumSamples++;
+			// Phoneme is already rate-converted (for DUR), so just copy with gain applied
+			const UINT phonemeSamples = m_phonemeLengthRemaining - m_phonemeTailLength;
+			const UINT samplesWritten = ((UINT)nNumSamples < phonemeSamples) ? (UINT)nNumSamples : phonemeSamples;
 
-				m_pPhonemeData++;
-				m_phonemeLengthRemaining--;
+			MixPhonemeWithGain(pMixBuffer, m_pPhonemeData, samplesWritten, amplitude);
+			pMixBuffer += samplesWritten;
+			m_pPhonemeData += samplesWritten;
+			m_phonemeLengthRemaining -= samplesWritten;
 
-				if (m_currNumSamples == numSamplesToAvg)
-				{
-					*pMixBuffer++ = (short)(m_currSampleSum / numSamplesToAvg);
-					samplesWritten++;
-					m_currSampleSum = 0;
-					m_currNumSamples = 0;
-				}
+			// Consume the phoneme's tail (source samples which don't form a whole output sample) if there's space for another output sample
+			if (m_phonemeLengthRemaining == m_phonemeTailLength && samplesWritten < (UINT)nNumSamples)
+				m_phonemeLengthRemaining = 0;
 
-				m_currSampleMod4 = (m_currSampleMod4 + 1) & 3;
-				if (DUR == 1 && m_currSampleMod4 == 3 && m_phonemeLengthRemaining)
-				{
-					m_pPhonemeData++;
-					m_phonemeLengthRemaining--;
-				}
-
-				if (!m_phonemeLengthRemaining)
-				{
-					bSpeechIRQ = true;
-					break;
-				}
-			}
+			if (!m_phonemeLengthRemaining)
+				bSpeechIRQ = true;
 
 			zeroSize = nNumSamples - samplesWritten;
-			_ASSERT(zeroSize >= 0);
 		}
 
 		if (zeroSize)
@@ -11,14 +11,9 @@ public:
 		m_device = -1;	// undefined
 		m_cardMode = PH_Mockingboard;
 		m_hasSC01 = true;	// only for m_device==0
-		m_pPhonemeData00 = NULL;
 
 		ResetState(true);
 	}
-	~SSI263(void)
-	{
-		delete [] m_pPhonemeData00;
-	}
 
 	void ResetState(const bool powerCycle)
 	{
@@ -38,6 +33,7 @@ public:
 
 		m_pPhonemeData = NULL;
 		m_phonemeLengthRemaining = 0;
+		m_phonemeTailLength = 0;
 		m_phonemeAccurateLengthRemaining = 0;
 		m_phonemePlaybackAndDebugger = false;
 		m_phonemeCompleteByFullSpeed = false;
@@ -47,9 +43,6 @@ public:
 
 		m_numSamplesError = 0;
 		m_byteOffset = (uint32_t)-1;
-		m_currSampleSum = 0;
-		m_currNumSamples = 0;
-		m_currSampleMod4 = 0;
 
 		//
 
@@ -106,6 +99,10 @@ public:
 	void SaveSnapshot(class YamlSaveHelper& yamlSaveHelper, UINT subunit);
 	void LoadSnapshot(class YamlLoadHelper& yamlLoadHelper, PHASOR_MODE mode, UINT version, UINT subunit);
 
+	static const UINT kNumPhonemes = 64;
+	static const int kGainShift = 15;
+	static const int kUnityGain = 1 << kGainShift;
+
 private:
 	void Play(unsigned int nPhoneme);
 	void Stop(void);
@@ -124,6 +121,9 @@ private:
 	void SC01_SaveSnapshot(YamlSaveHelper& yamlSaveHelper);
 	void SC01_LoadSnapshot(YamlLoadHelper& yamlLoadHelper, UINT version);
 
+	static const short* GetPhonemeBank(void);
+	static const short* GetRateConvertedPhoneme(UINT phoneme, BYTE DUR, UINT& length, UINT& tailLength);
+
 	static const BYTE m_Votrax2SSI263[/*64*/];
 
 	static const unsigned short m_kNumChannels = 1;
@@ -161,7 +161,6 @@ private:
 	BYTE m_device;	// SSI263 device# which is generating phoneme-complete IRQ (and only required whilst Mockingboard isn't a class)
 	PHASOR_MODE m_cardMode;
 	bool m_hasSC01;
-	short* m_pPhonemeData00;
 
 	// ctor/power-cycle: Set to -1
 	// Play(): Set to [$00-$3F] on a write to DURPHON register.
@@ -182,8 +181,9 @@ private:
 	UINT64 m_lastUpdateCycle;
 	bool m_updateWasFullSpeed;
 
-	const short* m_pPhonemeData;
-	UINT m_phonemeLengthRemaining;			// length in samples, decremented as space becomes available in the ring-buffer
+	const short* m_pPhonemeData;			// rate-converted phoneme (see GetRateConvertedPhoneme())
+	UINT m_phonemeLengthRemaining;			// length in rate-converted samples (+ tail), decremented as space becomes available in the ring-buffer
+	UINT m_phonemeTailLength;				// 0 or 1: phoneme has trailing source samples that don't form a whole rate-converted sample
 	UINT m_phonemeAccurateLengthRemaining;	// length in samples, decremented by cycles executed
 	bool m_phonemePlaybackAndDebugger;
 	bool m_phonemeCompleteByFullSpeed;
@@ -193,9 +193,6 @@ private:
 
 	int m_numSamplesError;
 	uint32_t m_byteOffset;
-	int m_currSampleSum;
-	int m_currNumSamples;
-	UINT m_currSampleMod4;
 
 	// Regs:
 	BYTE m_durationPhoneme;
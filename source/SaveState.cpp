@@ -42,10 +42,14 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "Speaker.h"
 #include "Speech.h"
 #include "Harddisk.h"
+#include "InputRecorder.h"
+#include "Rewind.h"
+#include "SaveStateWriter.h"
 
 #include "Configuration/Config.h"
 #include "Configuration/IPropertySheet.h"
 
+#include <chrono>
 
 #define DEFAULT_SNAPSHOT_NAME "SaveState.aws.yaml"
 
@@ -93,6 +97,16 @@ void Snapshot_SetIgnoreHdcFirmware(const bool ignoreHdcFirmware)
 
 //-----------------------------------------------------------------------------
 
+// Format for saving (loading auto-detects the format)
+static SnapshotFormat_e g_snapshotFormat = SNAPSHOT_FORMAT_YAML;
+
+void Snapshot_SetFormat(const SnapshotFormat_e format)
+{
+	g_snapshotFormat = format;
+}
+
+//-----------------------------------------------------------------------------
+
 static void Snapshot_SetPathname(const std::string& strPathname)
 {
 	if (strPathname.empty())
@@ -286,6 +300,8 @@ static void ParseSlots(YamlLoadHelper& yamlLoadHelper, UINT unitVersion)
 	if (unitVersion != UNIT_SLOTS_VER)
 		throw std::runtime_error(SS_YAML_KEY_UNIT ": Slots: Version mismatch");
 
+	bool slotLoaded[NUM_SLOTS] = {};
+
 	while (1)
 	{
 		std::string scalar = yamlLoadHelper.GetMapNextSlotNumber();
@@ -312,17 +328,27 @@ static void ParseSlots(YamlLoadHelper& yamlLoadHelper, UINT unitVersion)
 		{
 			SetExpansionMemType(type);	// calls GetCardMgr().Insert() & InsertAux()
 		}
-		else
+		else if (!yamlLoadHelper.IsRestoreInPlace() || GetCardMgr().QuerySlot(slot) != type)
 		{
 			GetCardMgr().Insert(slot, type);
 		}
 
 		bRes = GetCardMgr().GetRef(slot).LoadSnapshot(yamlLoadHelper, cardVersion);
+		slotLoaded[slot] = true;
 
 		yamlLoadHelper.PopMap();
 		yamlLoadHelper.PopMap();
 	}
 
+	// Restoring in place: the cards were kept (see Snapshot_LoadUnits()), so remove any that aren't in the snapshot
+	if (yamlLoadHelper.IsRestoreInPlace())
+	{
+		for (UINT slot = SLOT1; slot < NUM_SLOTS; slot++)
+		{
+			if (!slotLoaded[slot] && GetCardMgr().QuerySlot(slot) != CT_Empty)
+				GetCardMgr().Remove(slot);
+		}
+	}
 }
 
 //---
@@ -369,62 +395,75 @@ static void ParseUnit(void)
 	}
 }
 
-static void Snapshot_LoadState_v2(void)
+// Pre: yamlHelper.InitParser() has succeeded
+// Post: restart is set once any VM state has been changed
+static void Snapshot_LoadUnits(bool& restart)
 {
-	bool restart = false;	// Only need to restart if any VM state has change
-	HCURSOR oldcursor = SetCursor(LoadCursor(0,IDC_WAIT));
+	if (yamlHelper.ParseFileHdr(SS_YAML_VALUE_AWSS) != SS_FILE_VER)
+		throw std::runtime_error("Version mismatch");
 
-	FrameBase& frame = GetFrame();
+	//
 
-	try
-	{
-		if (!yamlHelper.InitParser(g_strSaveStatePathname.c_str()))
-			throw std::runtime_error("Failed to initialize parser or open file: " + g_strSaveStatePathname);
-
-		if (yamlHelper.ParseFileHdr(SS_YAML_VALUE_AWSS) != SS_FILE_VER)
-			throw std::runtime_error("Version mismatch");
-
-		//
+	restart = true;
 
-		restart = true;
-
-		//m_ConfigNew.m_bEnableTheFreezesF8Rom = ?;	// todo: when support saving config
+	//m_ConfigNew.m_bEnableTheFreezesF8Rom = ?;	// todo: when support saving config
 
+	// An in-memory snapshot (eg. rewind) is restored in place: a card of the same type is kept and just loads its
+	// state, so eg. a Disk II or HDD card keeps its open image, rather than closing & re-opening it (see ParseSlots())
+	if (!yamlHelper.IsInMemory())
+	{
 		for (UINT slot = SLOT0; slot < NUM_SLOTS; slot++)
 			GetCardMgr().Remove(slot);
-		GetCardMgr().RemoveAux();
+	}
+	GetCardMgr().RemoveAux();
 
-		SetCopyProtectionDongleType(DT_EMPTY);
+	SetCopyProtectionDongleType(DT_EMPTY);
 
-		MemReset();							// Also calls CpuInitialize()
-		GetPravets().Reset();
+	MemReset();							// Also calls CpuInitialize()
+	GetPravets().Reset();
 
-		KeybReset();
-		GetVideo().SetVidHD(false);			// Set true later only if VidHDCard is instantiated
-		GetVideo().VideoResetState();
-		GetVideo().SetVideoRefreshRate(VR_60HZ);	// Default to 60Hz as older save-states won't contain refresh rate
+	KeybReset();
+	GetVideo().SetVidHD(false);			// Set true later only if VidHDCard is instantiated
+	GetVideo().VideoResetState();
+	GetVideo().SetVideoRefreshRate(VR_60HZ);	// Default to 60Hz as older save-states won't contain refresh rate
 
-		MockingboardCardManager &mockingboardCardManager = GetCardMgr().GetMockingboardCardMgr();
-		mockingboardCardManager.InitializeForLoadingSnapshot(); // GH#609
+	MockingboardCardManager &mockingboardCardManager = GetCardMgr().GetMockingboardCardMgr();
+	mockingboardCardManager.InitializeForLoadingSnapshot(); // GH#609
 
 #ifdef USE_SPEECH_API
-		g_Speech.Reset();
+	g_Speech.Reset();
 #endif
 
-		std::string scalar;
-		while(yamlHelper.GetScalar(scalar))
-		{
-			if (scalar == SS_YAML_KEY_UNIT)
-				ParseUnit();
-			else
-				throw std::runtime_error("Unknown top-level scalar: " + scalar);
-		}
+	std::string scalar;
+	while(yamlHelper.GetScalar(scalar))
+	{
+		if (scalar == SS_YAML_KEY_UNIT)
+			ParseUnit();
+		else
+			throw std::runtime_error("Unknown top-level scalar: " + scalar);
+	}
+
+	// Refresh the volume of any new Mockingboard card (and its SSI263 or SC01 chips)
+	mockingboardCardManager.SetVolume(mockingboardCardManager.GetVolume(), GetPropertySheet().GetVolumeMax());
+	mockingboardCardManager.SetCumulativeCycles();
+}
+
+static void Snapshot_LoadState_v2(void)
+{
+	bool restart = false;	// Only need to restart if any VM state has change
+	HCURSOR oldcursor = SetCursor(LoadCursor(0,IDC_WAIT));
 
-		// Refresh the volume of any new Mockingboard card (and its SSI263 or SC01 chips)
-		mockingboardCardManager.SetVolume(mockingboardCardManager.GetVolume(), GetPropertySheet().GetVolumeMax());
-		mockingboardCardManager.SetCumulativeCycles();
+	FrameBase& frame = GetFrame();
+
+	try
+	{
+		if (!yamlHelper.InitParser(g_strSaveStatePathname.c_str()))
+			throw std::runtime_error("Failed to initialize parser or open file: " + g_strSaveStatePathname);
+
+		Snapshot_LoadUnits(restart);
 
 		frame.SetLoadedSaveStateFlag(true);
+		GetRewindBuffer().Reset();	// Frames before the load can't be stepped back to
 
 		// NB. The following disparity should be resolved:
 		// . A change in h/w via the Configuration property sheets results in a the VM completely restarting (via WM_USER_RESTART)
@@ -476,62 +515,77 @@ void Snapshot_LoadState()
 		return;
 	}
 
+	GetSaveStateWriter().Wait();	// Don't load a partially written save-state
+	GetInputRecorder().Stop();		// Recording or replay can't continue from a different state
+
 	LogFileOutput("Loading Save-State from %s\n", g_strSaveStatePathname.c_str());
 	Snapshot_LoadState_v2();
 }
 
 //-----------------------------------------------------------------------------
 
-void Snapshot_SaveState(void)
+static void Snapshot_SaveUnits(YamlSaveHelper& yamlSaveHelper)
 {
-	LogFileOutput("Saving Save-State to %s\n", g_strSaveStatePathname.c_str());
-	try
+	yamlSaveHelper.FileHdr(SS_FILE_VER);
+
+	// Unit: Apple2
 	{
-		YamlSaveHelper yamlSaveHelper(g_strSaveStatePathname);
-		yamlSaveHelper.FileHdr(SS_FILE_VER);
+		yamlSaveHelper.UnitHdr(GetSnapshotUnitApple2Name(), UNIT_APPLE2_VER);
+		YamlSaveHelper::Label state(yamlSaveHelper, "%s:\n", SS_YAML_KEY_STATE);
+
+		yamlSaveHelper.Save("%s: %s\n", SS_YAML_KEY_MODEL, GetApple2TypeAsString().c_str());
+		CpuSaveSnapshot(yamlSaveHelper);
+		JoySaveSnapshot(yamlSaveHelper);
+		KeybSaveSnapshot(yamlSaveHelper);
+		SpkrSaveSnapshot(yamlSaveHelper);
+		GetVideo().VideoSaveSnapshot(yamlSaveHelper);
+		MemSaveSnapshot(yamlSaveHelper);
+	}
 
-		// Unit: Apple2
-		{
-			yamlSaveHelper.UnitHdr(GetSnapshotUnitApple2Name(), UNIT_APPLE2_VER);
-			YamlSaveHelper::Label state(yamlSaveHelper, "%s:\n", SS_YAML_KEY_STATE);
-
-			yamlSaveHelper.Save("%s: %s\n", SS_YAML_KEY_MODEL, GetApple2TypeAsString().c_str());
-			CpuSaveSnapshot(yamlSaveHelper);
-			JoySaveSnapshot(yamlSaveHelper);
-			KeybSaveSnapshot(yamlSaveHelper);
-			SpkrSaveSnapshot(yamlSaveHelper);
-			GetVideo().VideoSaveSnapshot(yamlSaveHelper);
-			MemSaveSnapshot(yamlSaveHelper);
-		}
+	// Unit: Aux slot
+	MemSaveSnapshotAux(yamlSaveHelper);
 
-		// Unit: Aux slot
-		MemSaveSnapshotAux(yamlSaveHelper);
+	// Unit: Slots
+	{
+		yamlSaveHelper.UnitHdr(GetSnapshotUnitSlotsName(), UNIT_SLOTS_VER);
+		YamlSaveHelper::Label state(yamlSaveHelper, "%s:\n", SS_YAML_KEY_STATE);
 
-		// Unit: Slots
-		{
-			yamlSaveHelper.UnitHdr(GetSnapshotUnitSlotsName(), UNIT_SLOTS_VER);
-			YamlSaveHelper::Label state(yamlSaveHelper, "%s:\n", SS_YAML_KEY_STATE);
+		GetCardMgr().SaveSnapshot(yamlSaveHelper);
+	}
 
-			GetCardMgr().SaveSnapshot(yamlSaveHelper);
-		}
+	// Unit: Game I/O Connector
+	if (GetCopyProtectionDongleType() != DT_EMPTY)
+	{
+		yamlSaveHelper.UnitHdr(GetSnapshotUnitGameIOConnectorName(), UNIT_GAME_IO_CONNECTOR_VER);
+		YamlSaveHelper::Label unit(yamlSaveHelper, "%s:\n", SS_YAML_KEY_STATE);
 
-		// Unit: Game I/O Connector
-		if (GetCopyProtectionDongleType() != DT_EMPTY)
-		{
-			yamlSaveHelper.UnitHdr(GetSnapshotUnitGameIOConnectorName(), UNIT_GAME_IO_CONNECTOR_VER);
-			YamlSaveHelper::Label unit(yamlSaveHelper, "%s:\n", SS_YAML_KEY_STATE);
+		CopyProtectionDongleSaveSnapshot(yamlSaveHelper);
+	}
 
-			CopyProtectionDongleSaveSnapshot(yamlSaveHelper);
-		}
+	// Miscellaneous
+	if (MemHasNoSlotClock())
+	{
+		yamlSaveHelper.UnitHdr(GetSnapshotUnitMiscName(), UNIT_MISC_VER);
+		YamlSaveHelper::Label state(yamlSaveHelper, "%s:\n", SS_YAML_KEY_STATE);
 
-		// Miscellaneous
-		if (MemHasNoSlotClock())
-		{
-			yamlSaveHelper.UnitHdr(GetSnapshotUnitMiscName(), UNIT_MISC_VER);
-			YamlSaveHelper::Label state(yamlSaveHelper, "%s:\n", SS_YAML_KEY_STATE);
+		NoSlotClockSaveSnapshot(yamlSaveHelper);
+	}
+}
 
-			NoSlotClockSaveSnapshot(yamlSaveHelper);
-		}
+void Snapshot_SaveState(void)
+{
+	GetSaveStateWriter().Wait();	// Don't let an older (background) save overwrite this one
+
+	LogFileOutput("Saving Save-State to %s\n", g_strSaveStatePathname.c_str());
+	try
+	{
+		YamlSaveHelper yamlSaveHelper(g_strSaveStatePathname,
+			g_snapshotFormat != SNAPSHOT_FORMAT_YAML,
+			g_snapshotFormat == SNAPSHOT_FORMAT_BINARY_ZLIB);
+		Snapshot_SaveUnits(yamlSaveHelper);
+
+		if (!yamlSaveHelper.Finalise())
+			throw std::runtime_error("Save error: failed to write " + g_strSaveStatePathname);
 	}
 	catch(const std::exception & szMessage)
 	{
@@ -544,6 +598,151 @@ void Snapshot_SaveState(void)
 
 //-----------------------------------------------------------------------------
 
+// Background save-state: see SaveStateWriter
+// . g_strSaveStateStatus is shown in the frame's title (see GetAppleWindowTitle())
+
+static std::string g_strSaveStateStatus;
+static UINT g_uAutoSaveSeconds = 0;
+static std::chrono::steady_clock::time_point g_autoSaveTime;
+
+const std::string& Snapshot_GetStatus(void)
+{
+	return g_strSaveStateStatus;
+}
+
+static void Snapshot_SetStatus(const std::string& status)
+{
+	if (status == g_strSaveStateStatus)
+		return;
+
+	g_strSaveStateStatus = status;
+	GetFrame().FrameRefreshStatus(DRAW_TITLE);
+}
+
+static void Snapshot_SaveStateDone(const std::string& pathname, const std::string& error)
+{
+	if (error.empty())
+	{
+		if (!GetSaveStateWriter().IsBusy())
+			Snapshot_SetStatus("");
+		return;
+	}
+
+	Snapshot_SetStatus("Save failed");
+	GetFrame().FrameMessageBox(
+				error.c_str(),
+				"Save State",
+				MB_ICONEXCLAMATION | MB_SETFOREGROUND);
+}
+
+static void Snapshot_AutoSaveDone(const std::string& pathname, const std::string& error)
+{
+	if (error.empty())
+	{
+		if (g_strSaveStateStatus != "Save failed" && !GetSaveStateWriter().IsBusy())
+			Snapshot_SetStatus("");
+		return;
+	}
+
+	Snapshot_SetStatus("Autosave failed");	// NB. No message box, as the next autosave will retry
+}
+
+// Capture the VM now (at an opcode boundary), and write the save-state in the background
+void Snapshot_SaveStateAsync(void)
+{
+	LogFileOutput("Saving Save-State (background) to %s\n", g_strSaveStatePathname.c_str());
+	Snapshot_SetStatus("Saving...");
+
+	GetSaveStateWriter().Save(g_strSaveStatePathname,
+		g_snapshotFormat != SNAPSHOT_FORMAT_YAML,
+		g_snapshotFormat == SNAPSHOT_FORMAT_BINARY_ZLIB,
+		Snapshot_SaveStateDone);
+}
+
+// seconds=0: disabled
+void Snapshot_SetAutoSaveInterval(const UINT seconds)
+{
+	g_uAutoSaveSeconds = seconds;
+	g_autoSaveTime = std::chrono::steady_clock::now();
+}
+
+// Call once per video frame, and when idle: runs completion callbacks, and starts an autosave when it's due
+// NB. The interval is host time (not emulated time), so full-speed doesn't autosave any more often
+void Snapshot_Update(const bool bRunning)
+{
+	SaveStateWriter& saveStateWriter = GetSaveStateWriter();
+	saveStateWriter.Poll();
+
+	if (!g_uAutoSaveSeconds || !bRunning)
+		return;
+
+	const std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (now - g_autoSaveTime < std::chrono::seconds(g_uAutoSaveSeconds))
+		return;
+
+	g_autoSaveTime = now;
+
+	if (saveStateWriter.IsBusy())
+		return;		// Slow disk: skip this one, rather than queue up saves
+
+	saveStateWriter.Save(g_strSaveStatePathname,
+		g_snapshotFormat != SNAPSHOT_FORMAT_YAML,
+		g_snapshotFormat == SNAPSHOT_FORMAT_BINARY_ZLIB,
+		Snapshot_AutoSaveDone);
+}
+
+//-----------------------------------------------------------------------------
+
+// In-memory save-state: no file I/O, and memory is copied as raw blobs (not hex)
+// . re-using the same snapshot for each capture avoids re-allocating the memory blobs
+// . bCopyTrackedMemory=false: main & aux memory isn't copied, as the rewind buffer tracks its writes (see RewindBuffer)
+void Snapshot_Capture(MachineSnapshot& snapshot, const bool bCopyTrackedMemory/*=true*/)
+{
+	YamlSaveHelper yamlSaveHelper(snapshot, bCopyTrackedMemory ? NULL : MemIsRewindTracked);
+	Snapshot_SaveUnits(yamlSaveHelper);
+}
+
+// NB. Unlike Snapshot_LoadState(), doesn't apply the snapshot's config to the Registry (it's a snapshot of this VM)
+bool Snapshot_Restore(const MachineSnapshot& snapshot)
+{
+	bool restart = false;
+	const eApple2Type oldApple2Type = GetApple2Type();
+	FrameBase& frame = GetFrame();
+	bool res = true;
+
+	try
+	{
+		if (!yamlHelper.InitParser(snapshot))
+			throw std::runtime_error("Failed to initialize parser");
+
+		Snapshot_LoadUnits(restart);
+
+		MemInitializeFromSnapshot();
+
+		DebugReset();
+		if (g_nAppMode == MODE_DEBUG)
+			DebugDisplay(TRUE);
+
+		if (GetApple2Type() != oldApple2Type)
+			frame.FrameUpdateApple2Type();	// NB. Calls VideoRedrawScreen()
+		else
+			frame.VideoRedrawScreen();
+	}
+	catch(const std::exception & szMessage)
+	{
+		LogFileOutput("Restore Snapshot: %s\n", szMessage.what());
+		res = false;
+
+		if (restart)
+			frame.Restart();		// Power-cycle VM (undoing all the new state just loaded)
+	}
+
+	yamlHelper.FinaliseParser();
+	return res;
+}
+
+//-----------------------------------------------------------------------------
+
 void Snapshot_Startup()
 {
 	static bool bDone = false;
@@ -562,6 +761,9 @@ void Snapshot_Shutdown()
 
 	_ASSERT(!bDone);
 	_ASSERT(!g_bRestart);
+
+	GetSaveStateWriter().Wait();	// Finish any background save (or autosave)
+
 	if(!g_bSaveStateOnExit || bDone)
 		return;
 
@@ -2,6 +2,10 @@
 
 extern bool g_bSaveStateOnExit;
 
+struct MachineSnapshot;
+
+enum SnapshotFormat_e {SNAPSHOT_FORMAT_YAML, SNAPSHOT_FORMAT_BINARY, SNAPSHOT_FORMAT_BINARY_ZLIB};
+
 void Snapshot_SetFilename(const std::string& filename, const std::string& path="");
 const std::string& Snapshot_GetFilename(void);
 const std::string& Snapshot_GetPath(void);
@@ -10,8 +14,15 @@ void Snapshot_GetDefaultFilenameAndPath(std::string& defaultFilename, std::strin
 void Snapshot_UpdatePath(void);
 void Snapshot_LoadState();
 void Snapshot_SaveState();
+void Snapshot_SaveStateAsync(void);
+void Snapshot_SetAutoSaveInterval(const UINT seconds);
+void Snapshot_Update(const bool bRunning);
+const std::string& Snapshot_GetStatus(void);
+void Snapshot_Capture(MachineSnapshot& snapshot, const bool bCopyTrackedMemory=true);
+bool Snapshot_Restore(const MachineSnapshot& snapshot);
 void Snapshot_Startup();
 void Snapshot_Shutdown();
 
 bool Snapshot_GetIgnoreHdcFirmware();
 void Snapshot_SetIgnoreHdcFirmware(const bool ignoreHdcFirmware);
+void Snapshot_SetFormat(const SnapshotFormat_e format);
@@ -0,0 +1,291 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: Background save-state writer
+ *
+ * A save-state is captured in-memory (raw memory blobs, so just a copy) on the emulation thread,
+ * then formatted & written on a worker thread. So saving (inc. autosave) doesn't cause audio/video glitches.
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "SaveStateWriter.h"
+#include "Common.h"
+#include "SaveState.h"
+#include "Log.h"
+
+#include <chrono>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static SaveStateWriter sg_SaveStateWriter;
+
+SaveStateWriter& GetSaveStateWriter(void)
+{
+	return sg_SaveStateWriter;
+}
+
+static void SwapSnapshots(MachineSnapshot& a, MachineSnapshot& b)
+{
+	a.yaml.swap(b.yaml);
+	a.blobs.swap(b.blobs);
+	a.blobSrc.swap(b.blobSrc);
+}
+
+//-----------------------------------------------------------------------------
+
+SaveStateWriter::SaveStateWriter(void)
+	: m_isInProgress(false)
+	, m_stopWorker(false)
+{
+	memset(&m_stats, 0, sizeof(m_stats));
+}
+
+// Any queued saves are written before the worker thread stops
+SaveStateWriter::~SaveStateWriter(void)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stopWorker = true;
+	}
+	m_workCV.notify_one();
+
+	if (m_worker.joinable())
+		m_worker.join();
+}
+
+//-----------------------------------------------------------------------------
+
+// Write to a temp file, then rename it over the save-state: so a failed (or interrupted) write leaves any old save-state intact
+// . the temp file is only renamed once it's been completely written, closed & flushed to the disk without error
+bool SaveStateWriter::WriteSnapshotFile(const Request& request, std::string& error)
+{
+	const std::string tmpPathname = request.pathname + ".tmp";
+
+	try
+	{
+		YamlSaveHelper yamlSaveHelper(tmpPathname, request.bBinary, request.bCompress);
+		yamlSaveHelper.SaveSnapshot(request.snapshot);
+
+		if (!yamlSaveHelper.Finalise(true))
+			throw std::runtime_error("Save error: failed to write " + tmpPathname);
+	}
+	catch (const std::exception& e)
+	{
+		error = e.what();
+		DeleteFile(tmpPathname.c_str());
+		return false;
+	}
+
+#ifdef _WIN32
+	if (MoveFileEx(tmpPathname.c_str(), request.pathname.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH))
+		return true;
+#else
+	if (rename(tmpPathname.c_str(), request.pathname.c_str()) == 0)
+	{
+		// Flush the rename too (ie. the folder's entry), as MOVEFILE_WRITE_THROUGH does
+		const size_t pos = request.pathname.find_last_of(PATH_SEPARATOR);
+		const std::string folder = (pos == std::string::npos) ? "." : request.pathname.substr(0, pos + 1);
+		const int fd = open(folder.c_str(), O_RDONLY);
+		if (fd >= 0)
+		{
+			fsync(fd);
+			close(fd);
+		}
+		return true;
+	}
+#endif
+
+	error = "Save error: failed to replace " + request.pathname;
+	DeleteFile(tmpPathname.c_str());
+	return false;
+}
+
+// Write the queued saves, in order, until told to stop (once the queue is empty)
+void SaveStateWriter::Worker(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+
+	while (true)
+	{
+		while (m_pending.empty() && !m_stopWorker)
+			m_workCV.wait(lock);
+
+		if (m_pending.empty())
+			break;
+
+		Request request;
+		Request& front = m_pending.front();
+		request.pathname.swap(front.pathname);
+		request.bBinary = front.bBinary;
+		request.bCompress = front.bCompress;
+		request.pfnCompletion = front.pfnCompletion;
+		SwapSnapshots(request.snapshot, front.snapshot);
+		m_pending.pop_front();
+
+		m_isInProgress = true;
+		lock.unlock();
+
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+		Result result;
+		result.pathname = request.pathname;
+		result.pfnCompletion = request.pfnCompletion;
+		const bool res = WriteSnapshotFile(request, result.error);
+
+		const UINT elapsed_us = (UINT)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+		lock.lock();
+		m_isInProgress = false;
+
+		m_stats.writeTime_us += elapsed_us;
+		if (elapsed_us > m_stats.writeTimeMax_us)
+			m_stats.writeTimeMax_us = elapsed_us;
+		if (!res)
+			m_stats.numFailed++;
+
+		m_results.push_back(result);
+
+		if (m_spare.blobs.empty())
+			SwapSnapshots(m_spare, request.snapshot);
+
+		m_doneCV.notify_all();
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+// Pre: called from the emulation thread
+void SaveStateWriter::Save(const std::string& pathname, const bool bBinary, const bool bCompress, CompletionFn pfnCompletion/*=NULL*/)
+{
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		SwapSnapshots(m_capture, m_spare);
+
+		if (!m_worker.joinable())
+			m_worker = std::thread(&SaveStateWriter::Worker, this);
+	}
+
+	std::string error;
+	try
+	{
+		Snapshot_Capture(m_capture);
+	}
+	catch (const std::exception& e)
+	{
+		error = e.what();
+	}
+
+	const UINT elapsed_us = (UINT)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+
+		m_stats.numSaves++;
+		m_stats.captureTime_us += elapsed_us;
+		if (elapsed_us > m_stats.captureTimeMax_us)
+			m_stats.captureTimeMax_us = elapsed_us;
+
+		if (!error.empty())
+		{
+			m_stats.numFailed++;
+			Result result = { pathname, error, pfnCompletion };
+			m_results.push_back(result);
+			return;
+		}
+
+		std::deque<Request>::iterator it = m_pending.begin();
+		for (; it != m_pending.end(); ++it)
+		{
+			if (it->pathname == pathname && it->pfnCompletion == pfnCompletion)
+				break;
+		}
+
+		if (it != m_pending.end())
+		{
+			m_stats.numCoalesced++;
+		}
+		else
+		{
+			m_pending.push_back(Request());
+			it = m_pending.end() - 1;
+			it->pathname = pathname;
+			it->pfnCompletion = pfnCompletion;
+		}
+
+		it->bBinary = bBinary;
+		it->bCompress = bCompress;
+		SwapSnapshots(it->snapshot, m_capture);	// NB. m_capture gets any replaced snapshot, so its allocations are re-used
+	}
+
+	m_workCV.notify_one();
+}
+
+// Run the completion callbacks of the saves that have finished
+// Pre: called from the emulation thread (eg. once per video frame, and when idle)
+void SaveStateWriter::Poll(void)
+{
+	std::deque<Result> results;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_results.empty())
+			return;
+		results.swap(m_results);
+	}
+
+	for (std::deque<Result>::const_iterator it = results.begin(); it != results.end(); ++it)
+	{
+		if (!it->error.empty())
+			LogFileOutput("Save-State: failed to save %s: %s\n", it->pathname.c_str(), it->error.c_str());
+
+		if (it->pfnCompletion)
+			it->pfnCompletion(it->pathname, it->error);
+	}
+}
+
+// Wait for all queued saves to be written. NB. Their completion callbacks are still run by the next Poll()
+void SaveStateWriter::Wait(void)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (!m_pending.empty() || m_isInProgress)
+		m_doneCV.wait(lock);
+}
+
+bool SaveStateWriter::IsBusy(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return !m_pending.empty() || m_isInProgress;
+}
+
+SaveStateWriter::Stats SaveStateWriter::GetStats(void)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include "YamlHelper.h"	// MachineSnapshot
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+// Background writer for save-state files, so the emulation thread isn't stalled by the YAML/hex (or zlib) encoding & file I/O:
+// . Save() captures an in-memory snapshot (see Snapshot_Capture()) on the emulation thread, ie. between opcodes, so it's
+//   a consistent point-in-time image of the machine; the worker then writes it to a temp file & renames it over the save-state
+// . a queued (not yet started) save to the same file is just replaced, eg. a slow disk & a short autosave interval
+// . completion callbacks are run by Poll(), on the emulation thread (so they can safely use the frame & log)
+// . Wait() is the flush barrier for load-state & exit
+class SaveStateWriter
+{
+public:
+	SaveStateWriter(void);
+	~SaveStateWriter(void);
+
+	typedef void (*CompletionFn)(const std::string& pathname, const std::string& error);	// error is empty on success
+
+	struct Stats
+	{
+		UINT64 numSaves;
+		UINT64 numCoalesced;	// replaced a queued save to the same file
+		UINT64 numFailed;
+		UINT64 captureTime_us;	// total emulation thread time spent in Save()
+		UINT captureTimeMax_us;
+		UINT64 writeTime_us;	// total worker thread time spent writing
+		UINT writeTimeMax_us;
+	};
+
+	void Save(const std::string& pathname, const bool bBinary, const bool bCompress, CompletionFn pfnCompletion=NULL);
+	void Poll(void);
+	void Wait(void);
+	bool IsBusy(void);
+
+	Stats GetStats(void);
+
+private:
+	struct Request
+	{
+		std::string pathname;
+		bool bBinary;
+		bool bCompress;
+		CompletionFn pfnCompletion;
+		MachineSnapshot snapshot;
+	};
+
+	struct Result
+	{
+		std::string pathname;
+		std::string error;
+		CompletionFn pfnCompletion;
+	};
+
+	void Worker(void);
+	static bool WriteSnapshotFile(const Request& request, std::string& error);
+
+	MachineSnapshot m_capture;		// emulation thread only
+	MachineSnapshot m_spare;		// a written snapshot, to re-use its memory allocations
+
+	std::deque<Request> m_pending;
+	std::deque<Result> m_results;	// for Poll()
+	bool m_isInProgress;
+	bool m_stopWorker;
+	std::mutex m_mutex;					// To guard everything except m_capture
+	std::condition_variable m_workCV;	// signalled when a save is queued (or to stop)
+	std::condition_variable m_doneCV;	// signalled when a save has been written
+	std::thread m_worker;				// started by the 1st Save()
+
+	Stats m_stats;
+};
+
+SaveStateWriter& GetSaveStateWriter(void);
@@ -36,6 +36,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "StdAfx.h"
 
 #include "SerialComms.h"
+#include "SerialTcpPort.h"
+#include "CardManager.h"
+#include "Core.h"
 #include "CPU.h"
 #include "Interface.h"
 #include "Log.h"
@@ -45,8 +48,6 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "../resource/resource.h"
 
-#define TCP_SERIAL_PORT 1977
-
 const UINT CSuperSerialCard::SERIALPORTITEM_INVALID_COM_PORT = 0;
 
 // Default: 9600-8-N-1
@@ -71,8 +72,12 @@ CSuperSerialCard::CSuperSerialCard(UINT slot) :
 	m_strSerialPortChoices(1, '\0'), // Combo box friendly, just in case.
 	m_uTCPChoiceItemIdx(0),
 	m_bCfgSupportDCD(false),
-	m_pExpansionRom(NULL),
-	m_hFrameWindow(NULL)
+	m_uCfgTcpPort(TCP_SERIAL_PORT),
+	m_eCfgTcpPacing(TCP_PACING_UNTHROTTLED),
+	m_eCfgTcpFlowControl(FLOW_CONTROL_NONE),
+	m_tcpRxSyncEvent((slot << 4) + 0, 0, TcpRxSyncEventCallback),	// NB. Encode the slot# into the id (as for MockingboardCard)
+	m_tcpTxSyncEvent((slot << 4) + 1, 0, TcpTxSyncEventCallback),
+	m_pExpansionRom(NULL)
 {
 	if (m_slot != 2)	// fixme
 		ThrowErrorInvalidSlot();
@@ -80,8 +85,8 @@ CSuperSerialCard::CSuperSerialCard(UINT slot) :
 	m_dwSerialPortItem = 0;
 
 	m_hCommHandle = INVALID_HANDLE_VALUE;
-	m_hCommListenSocket = INVALID_SOCKET;
-	m_hCommAcceptSocket = INVALID_SOCKET;
+	m_bCommOpenFailed = false;
+	m_dwCommOpenFailedTime = 0;
 
 	m_hCommThread = NULL;
 
@@ -120,7 +125,7 @@ void CSuperSerialCard::InternalReset()
 	m_vuRxCurrBuffer = 0;
 	m_qComSerialBuffer[0].clear();
 	m_qComSerialBuffer[1].clear();
-	m_qTcpSerialBuffer.clear();
+	m_bTcpRxReady = false;
 
 	m_uDTR = DTR_CONTROL_DISABLE;
 	m_uRTS = RTS_CONTROL_DISABLE;
@@ -217,61 +222,18 @@ bool CSuperSerialCard::CheckComm()
 	if (IsActive())
 		return true;
 
+	// NB. Called on each access to the 6551, so after a failure don't retry (or log) until the interval has passed
+	if (m_bCommOpenFailed && GetTickCount() - m_dwCommOpenFailedTime < m_kCommOpenRetryInterval_ms)
+		return false;
+
 	if (m_dwSerialPortItem == m_uTCPChoiceItemIdx)
 	{
-		WSADATA wsaData;
-		if (WSAStartup(MAKEWORD(2, 2), &wsaData) == 0) // Winsock 2.2
+		m_pTcpPort.reset(new CSerialTcpPort);
+		if (!m_pTcpPort->Open(m_uCfgTcpPort))
 		{
-			if (wsaData.wVersion != 0x0202)
-			{
-				WSACleanup();
-				return false;
-			}
-
-			// initialized, so try to create a socket
-			m_hCommListenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-			if (m_hCommListenSocket == INVALID_SOCKET)
-			{
-				WSACleanup();
-				return false;
-			}
-
-			// have socket so attempt to bind it
-			SOCKADDR_IN saAddress;
-			memset(&saAddress, 0, sizeof(SOCKADDR_IN));
-			saAddress.sin_family = AF_INET;
-			saAddress.sin_port = htons(TCP_SERIAL_PORT); // TODO: get from registry / GUI
-			saAddress.sin_addr.s_addr = htonl(INADDR_ANY);
-			if (bind(m_hCommListenSocket, (LPSOCKADDR)&saAddress, sizeof(saAddress)) == SOCKET_ERROR)
-			{
-				closesocket(m_hCommListenSocket);
-				m_hCommListenSocket = INVALID_SOCKET;
-				WSACleanup();
-				return false;
-			}
-
-			// bound, so listen
-			if (listen(m_hCommListenSocket, 1) == SOCKET_ERROR)
-			{
-				closesocket(m_hCommListenSocket);
-				m_hCommListenSocket = INVALID_SOCKET;
-				WSACleanup();
-				return false;
-			}
-
-			// now send async events to our app's message handler
-			m_hFrameWindow = GetFrame().g_hFrameWindow;
-			if (WSAAsyncSelect(
-					/* SOCKET s */ m_hCommListenSocket,
-					/* HWND hWnd */ m_hFrameWindow,
-					/* unsigned int wMsg */ WM_USER_TCP_SERIAL,
-					/* long lEvent */ (FD_ACCEPT | FD_CONNECT | FD_READ | FD_CLOSE)) != 0)
-			{
-				closesocket(m_hCommListenSocket);
-				m_hCommListenSocket = INVALID_SOCKET;
-				WSACleanup();
-				return false;
-			}
+			m_pTcpPort.reset();
+			if (!m_bCommOpenFailed)
+				LogFileOutput("SSC: TCP port %u not available (retrying every %u ms)\n", m_uCfgTcpPort, m_kCommOpenRetryInterval_ms);
 		}
 	}
 	else if (m_dwSerialPortItem)
@@ -309,9 +271,15 @@ bool CSuperSerialCard::CheckComm()
 		else
 		{
 			DWORD uError = GetLastError();
+			if (!m_bCommOpenFailed)
+				LogFileOutput("SSC: %s not available, error: %u (retrying every %u ms)\n", portname.c_str() + 4, uError, m_kCommOpenRetryInterval_ms);
 		}
 	}
 
+	m_bCommOpenFailed = !IsActive() && m_dwSerialPortItem;
+	if (m_bCommOpenFailed)
+		m_dwCommOpenFailedTime = GetTickCount();
+
 	return IsActive();
 }
 
@@ -319,7 +287,13 @@ bool CSuperSerialCard::CheckComm()
 
 void CSuperSerialCard::CloseComm()
 {
-	CommTcpSerialCleanup();	// Shut down Winsock
+	if (m_tcpRxSyncEvent.m_active)
+		g_SynchronousEventMgr.Remove(m_tcpRxSyncEvent.m_id);
+	if (m_tcpTxSyncEvent.m_active)
+		g_SynchronousEventMgr.Remove(m_tcpTxSyncEvent.m_id);
+
+	m_pTcpPort.reset();	// Stops the I/O thread & closes the sockets
+	m_bTcpRxReady = false;
 
 	CommThUninit();		// Kill CommThread before closing COM handle
 
@@ -327,74 +301,97 @@ void CSuperSerialCard::CloseComm()
 		CloseHandle(m_hCommHandle);
 
 	m_hCommHandle = INVALID_HANDLE_VALUE;
+	m_bCommOpenFailed = false;	// eg. reset: try again straight away
 }
 
 //===========================================================================
 
-void CSuperSerialCard::CommTcpSerialCleanup()
+// Called once per emulation slice
+void CSuperSerialCard::Update(const ULONG /*nExecutedCycles*/)
 {
-	if (m_hCommListenSocket != INVALID_SOCKET)
-	{
-		WSAAsyncSelect(m_hCommListenSocket, m_hFrameWindow, 0, 0); // Stop event messages
-		closesocket(m_hCommListenSocket);
-		m_hCommListenSocket = INVALID_SOCKET;
+	if (!m_pTcpPort)
+		return;
 
-		CommTcpSerialClose();
+	m_pTcpPort->Flush();	// Send this slice's Tx bytes in one batch
 
-		WSACleanup();
-	}
+	// TCP_PACING_UNTHROTTLED: complete a transmit that was held back by CTS
+	if (!m_vbTxEmpty && !m_tcpTxSyncEvent.m_active && IsTcpCtsClear())
+		TransmitDone();
+
+	TcpRxPoll();
 }
 
 //===========================================================================
 
-void CSuperSerialCard::CommTcpSerialClose()
+// The time for one character on the line: start bit + data bits + parity bit + stop bits
+int CSuperSerialCard::GetTcpCharCycles(void)
+{
+	const double stopBits = (m_uStopBits == ONESTOPBIT) ? 1.0 : (m_uStopBits == ONE5STOPBITS) ? 1.5 : 2.0;
+	const double bits = 1 + m_uByteSize + (m_uParity != NOPARITY ? 1 : 0) + stopBits;
+	return std::max(1, (int)(g_fCurrentCLK6502 * bits / m_uBaudRate));
+}
+
+bool CSuperSerialCard::IsTcpCtsClear(void)
 {
-	if (m_hCommAcceptSocket != INVALID_SOCKET)
+	if (m_eCfgTcpFlowControl == FLOW_CONTROL_NONE || !m_pTcpPort)
+		return true;
+
+	return m_pTcpPort->GetTxUsed() < CByteRing::kSize / 2;
+}
+
+// Move the next byte from the port's Rx ring into the receive data register:
+// . TCP_PACING_UNTHROTTLED: straight away
+// . TCP_PACING_BAUD: after one character time
+void CSuperSerialCard::TcpRxPoll(void)
+{
+	if (m_bTcpRxReady || m_tcpRxSyncEvent.m_active)
+		return;
+
+	// RTS high: the remote's CTS is not clear, so it must hold off (and the bytes wait in the Rx ring, then in the socket)
+	if (m_eCfgTcpFlowControl == FLOW_CONTROL_RTS_CTS && m_uRTS == RTS_CONTROL_DISABLE)
+		return;
+
+	if (m_pTcpPort->IsRxEmpty())
+		return;
+
+	if (m_eCfgTcpPacing == TCP_PACING_BAUD)
 	{
-		shutdown(m_hCommAcceptSocket, 2 /* SD_BOTH */); // In case the client is waiting for data
-		closesocket(m_hCommAcceptSocket);
-		m_hCommAcceptSocket = INVALID_SOCKET;
+		m_tcpRxSyncEvent.m_cyclesRemaining = GetTcpCharCycles();
+		g_SynchronousEventMgr.Insert(&m_tcpRxSyncEvent);
+		return;
 	}
 
-	m_qTcpSerialBuffer.clear();
+	m_bTcpRxReady = true;
+	if (m_bRxIrqEnabled)
+	{
+		CpuIrqAssert(IS_SSC);
+		m_vbRxIrqPending = true;
+	}
 }
 
-//===========================================================================
-
-void CSuperSerialCard::CommTcpSerialAccept()
+int CSuperSerialCard::TcpRxSyncEventCallback(int /*id*/, int /*cycles*/, ULONG /*uExecutedCycles*/)
 {
-	// Valid listener socket and invalid accept socket?
-	if ((m_hCommListenSocket != INVALID_SOCKET) && (m_hCommAcceptSocket == INVALID_SOCKET))
+	CSuperSerialCard* pSSC = GetCardMgr().GetSSC();
+
+	pSSC->m_bTcpRxReady = true;
+	if (pSSC->m_bRxIrqEnabled)
 	{
-		// Y: accept the connection
-		m_hCommAcceptSocket = accept(m_hCommListenSocket, NULL, NULL);
+		CpuIrqAssert(IS_SSC);
+		pSSC->m_vbRxIrqPending = true;
 	}
-}
 
-//===========================================================================
+	return 0;	// Don't repeat event
+}
 
-// Called when there's a TCP event via the message pump
-// . Because it's via the message pump, then this call is synchronous to CommReceive(), so there's no need for a critical section
-void CSuperSerialCard::CommTcpSerialReceive()
+int CSuperSerialCard::TcpTxSyncEventCallback(int /*id*/, int /*cycles*/, ULONG /*uExecutedCycles*/)
 {
-	if (m_hCommAcceptSocket != INVALID_SOCKET)
-	{
-		char Data[0x80];
-		int nReceived = 0;
-		while ((nReceived = recv(m_hCommAcceptSocket, Data, sizeof(Data), 0)) > 0)
-		{
-			for (int i = 0; i < nReceived; i++)
-			{
-				m_qTcpSerialBuffer.push_back(Data[i]);
-			}
-		}
+	CSuperSerialCard* pSSC = GetCardMgr().GetSSC();
 
-		if (m_bRxIrqEnabled && !m_qTcpSerialBuffer.empty())
-		{
-			CpuIrqAssert(IS_SSC);
-			m_vbRxIrqPending = true;
-		}
-	}
+	if (!pSSC->IsTcpCtsClear())
+		return pSSC->GetTcpCharCycles();	// Repeat event: the transmitter waits for CTS
+
+	pSSC->TransmitDone();
+	return 0;	// Don't repeat event
 }
 
 //===========================================================================
@@ -658,22 +655,21 @@ BYTE __stdcall CSuperSerialCard::CommReceive(WORD, WORD, BYTE, BYTE, ULONG)
 
 	BYTE result = 0;
 
-	if (!m_qTcpSerialBuffer.empty())
+	if (m_pTcpPort)
 	{
-		// NB. See CommTcpSerialReceive() above, for a note explaining why there's no need for a critical section here
-
 		// If receiver is disabled then transmitting device should not send data
 		// . For COM serial connection this is handled by DTR/DTS flow-control (which enables the receiver)
 		if ((m_uCommandByte & CMD_DTR) == 0)	// Receiver disable, so prevent receiving data
 			return 0;
 
-		result = m_qTcpSerialBuffer.front();
-		m_qTcpSerialBuffer.pop_front();
+		TcpRxPoll();	// In case a byte arrived since the last Update()
 
-		if (m_bRxIrqEnabled && !m_qTcpSerialBuffer.empty())
+		if (m_bTcpRxReady)
 		{
-			CpuIrqAssert(IS_SSC);
-			m_vbRxIrqPending = true;
+			// NB. The Rx ring is single-consumer: only the emulation thread reads it, so there's no need for a critical section here
+			m_pTcpPort->Receive(result);
+			m_bTcpRxReady = false;
+			TcpRxPoll();	// Next byte (and its IRQ)
 		}
 	}
 	else if (m_hCommHandle != INVALID_HANDLE_VALUE)
@@ -725,7 +721,7 @@ void CSuperSerialCard::TransmitDone(void)
 	else
 	{
 		_ASSERT(m_vbTxEmpty == false);
-		m_vbTxEmpty = true;	// Transmit done (TCP)
+		m_vbTxEmpty = true;	// Transmit done (TCP): called from Update() or the Tx SyncEvent, both on the emulation thread
 	}
 
 	if (m_bTxIrqEnabled)	// GH#522
@@ -744,21 +740,33 @@ BYTE __stdcall CSuperSerialCard::CommTransmit(WORD, WORD, BYTE, BYTE value, ULON
 	if ((m_uCommandByte & CMD_TX_MASK) == CMD_TX_IRQ_DIS_RTS_HIGH)	// Transmitter disable, so just discard for now
 		return 0;
 
-	if (m_hCommAcceptSocket != INVALID_SOCKET)
+	if (m_pTcpPort)
 	{
 		BYTE data = value;
 		if (m_uByteSize < 8)
 		{
-			data &= ~(1 << m_uByteSize);
+			data &= (1 << m_uByteSize) - 1;
 		}
-		int sent = send(m_hCommAcceptSocket, (const char*)&data, 1, 0);
-		_ASSERT(sent == 1);
-		if (sent == 1)
+
+		// Batched: the port's I/O thread sends the Tx ring at the end of the emulation slice
+		// . if the ring is full (only possible without flow control) then the byte is dropped, and counted
+		m_pTcpPort->Transmit(data);
+		m_vbTxEmpty = false;
+
+		// NB. If the Tx SyncEvent is already active, then the guest didn't wait for TX_EMPTY: done when the current character is
+		if (m_eCfgTcpPacing == TCP_PACING_BAUD)
+		{
+			if (!m_tcpTxSyncEvent.m_active)
+			{
+				m_tcpTxSyncEvent.m_cyclesRemaining = GetTcpCharCycles();
+				g_SynchronousEventMgr.Insert(&m_tcpTxSyncEvent);
+			}
+		}
+		else if (IsTcpCtsClear())
 		{
-			m_vbTxEmpty = false;
-			// Assume that send() completes immediately
 			TransmitDone();
 		}
+		// else: Update() completes the transmit once CTS is clear
 	}
 	else if (m_hCommHandle != INVALID_HANDLE_VALUE)
 	{
@@ -831,11 +839,14 @@ BYTE __stdcall CSuperSerialCard::CommStatus(WORD, WORD, BYTE, BYTE, ULONG)
 				modemStatus |= MS_RLSD_ON;
 		}
 	}
-	else if (m_hCommListenSocket != INVALID_SOCKET && m_hCommAcceptSocket != INVALID_SOCKET)
+	else if (m_pTcpPort && m_pTcpPort->IsConnected())
 	{
-		modemStatus = MS_RLSD_ON | MS_DSR_ON | MS_CTS_ON;
+		modemStatus = MS_RLSD_ON | MS_DSR_ON | (IsTcpCtsClear() ? MS_CTS_ON : 0);
 	}
 
+	if (m_pTcpPort)
+		TcpRxPoll();	// So a polling loop sees a byte as soon as it has arrived
+
 	//
 
 	bool bComSerialBufferEmpty = true;	// Assume true, so if using TCP then logic below works
@@ -867,7 +878,7 @@ BYTE __stdcall CSuperSerialCard::CommStatus(WORD, WORD, BYTE, BYTE, ULONG)
 	//
 
 	BYTE TX_EMPTY = m_vbTxEmpty ? ST_TX_EMPTY : 0;
-	BYTE RX_FULL  = (!bComSerialBufferEmpty || !m_qTcpSerialBuffer.empty()) ? ST_RX_FULL : 0;
+	BYTE RX_FULL  = (!bComSerialBufferEmpty || m_bTcpRxReady) ? ST_RX_FULL : 0;
 
 	//
 
@@ -934,8 +945,8 @@ BYTE __stdcall CSuperSerialCard::CommDipSw(WORD, WORD addr, BYTE, BYTE, ULONG)
 		BYTE CTS = 1;	// Default to CTS being false. (Support CTS in DIPSW: GH#311)
 		if (CheckComm() && m_hCommHandle != INVALID_HANDLE_VALUE)
 			CTS = (m_dwModemStatus & MS_CTS_ON) ? 0 : 1;	// CTS active low (see SY6551 datasheet)
-		else if (m_hCommListenSocket != INVALID_SOCKET)
-			CTS = (m_hCommAcceptSocket != INVALID_SOCKET) ? 0 : 1;
+		else if (m_pTcpPort)
+			CTS = (m_pTcpPort->IsConnected() && IsTcpCtsClear()) ? 0 : 1;
 
 		// SSC-54:
 		sw =	SW2_1<<7 |	// b7 : SW2-1
@@ -998,6 +1009,7 @@ void CSuperSerialCard::CommSetSerialPort(DWORD dwNewSerialPortItem)
 		return;
 
 	m_dwSerialPortItem = dwNewSerialPortItem;
+	m_bCommOpenFailed = false;
 
 	if (m_dwSerialPortItem == m_uTCPChoiceItemIdx)
 	{
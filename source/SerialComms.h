@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Card.h"
+#include "SynchronousEventManager.h"
 
 enum {COMMEVT_WAIT=0, COMMEVT_ACK, COMMEVT_TERM, COMMEVT_MAX};
 enum eFWMODE {FWMODE_CIC=0, FWMODE_SIC_P8, FWMODE_PPC, FWMODE_SIC_P8A};	// NB. CIC = SSC
@@ -22,12 +23,21 @@ typedef struct
 #define TEXT_SERIAL_COM "COM"
 #define TEXT_SERIAL_TCP "TCP"
 
+#define TCP_SERIAL_PORT 1977
+
+// TCP: how fast the bytes are moved between the socket and the 6551
+enum eSSCTcpPacing {TCP_PACING_UNTHROTTLED=0, TCP_PACING_BAUD};	// As fast as the guest can go, or at the ACIA's baud rate
+
+// TCP: flow control
+// . RTS_CTS: the guest's RTS gates reception, and CTS is only clear while the Tx buffer to the socket is less than half full
+enum eSSCFlowControl {FLOW_CONTROL_NONE=0, FLOW_CONTROL_RTS_CTS};
+
 class CSuperSerialCard : public Card
 {
 public:
 	CSuperSerialCard(UINT slot);
 	virtual ~CSuperSerialCard();
-	virtual void Update(const ULONG nExecutedCycles) {}
+	virtual void Update(const ULONG nExecutedCycles);
 	virtual void InitializeIO(LPBYTE pCxRomPeripheral);
 	virtual void Reset(const bool powerCycle);
 	virtual void Destroy() {}
@@ -40,13 +50,11 @@ public:
 	std::string const& GetSerialPortChoices();
 	DWORD	GetSerialPort() { return m_dwSerialPortItem; }	// Drop-down list item
 	const std::string& GetSerialPortName() { return m_currentSerialPortName; }
-	bool	IsActive() { return (m_hCommHandle != INVALID_HANDLE_VALUE) || (m_hCommListenSocket != INVALID_SOCKET); }
+	bool	IsActive() { return (m_hCommHandle != INVALID_HANDLE_VALUE) || m_pTcpPort; }
 	void	SupportDCD(bool bEnable) { m_bCfgSupportDCD = bEnable; }	// Status
-
-	void	CommTcpSerialAccept();
-	void	CommTcpSerialReceive();
-	void	CommTcpSerialClose();
-	void	CommTcpSerialCleanup();
+	void	SetTcpPort(UINT port) { m_uCfgTcpPort = port; m_bCommOpenFailed = false; }	// Takes effect when the port is next opened
+	void	SetTcpPacing(eSSCTcpPacing pacing) { m_eCfgTcpPacing = pacing; }
+	void	SetTcpFlowControl(eSSCFlowControl flowControl) { m_eCfgTcpFlowControl = flowControl; }
 
 	static BYTE __stdcall SSC_IORead(WORD PC, WORD uAddr, BYTE bWrite, BYTE uValue, ULONG nExecutedCycles);
 	static BYTE __stdcall SSC_IOWrite(WORD PC, WORD uAddr, BYTE bWrite, BYTE uValue, ULONG nExecutedCycles);
@@ -69,6 +77,11 @@ private:
 	UINT	BaudRateToIndex(UINT uBaudRate);
 	void	UpdateCommState();
 	void	TransmitDone(void);
+	void	TcpRxPoll(void);
+	bool	IsTcpCtsClear(void);
+	int		GetTcpCharCycles(void);
+	static int TcpRxSyncEventCallback(int id, int cycles, ULONG uExecutedCycles);
+	static int TcpTxSyncEventCallback(int id, int cycles, ULONG uExecutedCycles);
 	bool	CheckComm();
 	void	CloseComm();
 	void	CheckCommEvent(DWORD dwEvtMask);
@@ -109,16 +122,24 @@ private:
 	//
 
 	HANDLE m_hCommHandle;
-	SOCKET m_hCommListenSocket;
-	SOCKET m_hCommAcceptSocket;
-	HWND m_hFrameWindow; // to avoid variable (de)-initialisation order issues
+	std::unique_ptr<class CSerialTcpPort> m_pTcpPort;
+
+	// The COM or TCP port couldn't be opened: CheckComm() only tries again after m_kCommOpenRetryInterval_ms,
+	// or once the port is changed (or closed), rather than on each access to the 6551
+	static const DWORD m_kCommOpenRetryInterval_ms = 1000;
+	bool	m_bCommOpenFailed;
+	DWORD	m_dwCommOpenFailedTime;
 
 	//
 
 	CRITICAL_SECTION	m_CriticalSection;	// To guard /m_vuRxCurrBuffer/ and /m_vbTxEmpty/
 	std::deque<BYTE>	m_qComSerialBuffer[2];
 	volatile UINT		m_vuRxCurrBuffer;	// Written to on COM recv. SSC reads from other one
-	std::deque<BYTE>	m_qTcpSerialBuffer;
+
+	// TCP: the receive data register holds the byte at the front of the port's Rx ring
+	bool		m_bTcpRxReady;
+	SyncEvent	m_tcpRxSyncEvent;	// TCP_PACING_BAUD: the next byte has been received
+	SyncEvent	m_tcpTxSyncEvent;	// TCP_PACING_BAUD: the byte has been transmitted
 
 	//
 
@@ -139,6 +160,9 @@ private:
 	BYTE* m_pExpansionRom;
 
 	bool m_bCfgSupportDCD;
+	UINT m_uCfgTcpPort;
+	eSSCTcpPacing m_eCfgTcpPacing;
+	eSSCFlowControl m_eCfgTcpFlowControl;
 	UINT m_uDTR;
 
 	static const DWORD m_kDefaultModemStatus = 0;	// MS_RLSD_OFF(=DCD_OFF), MS_DSR_OFF, MS_CTS_OFF
@@ -0,0 +1,487 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: TCP backend for the Super Serial Card
+ *
+ * The socket work is done by a dedicated I/O thread using select(), so no window message pump is needed
+ * and bulk transfers (eg. ADTPro) move whole buffers per system call, rather than one byte per send().
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "SerialTcpPort.h"
+#include "Log.h"
+
+#include <cinttypes>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#endif
+
+static_assert((CByteRing::kSize & (CByteRing::kSize - 1)) == 0, "the positions wrap around");
+
+//===========================================================================
+
+bool CByteRing::Put(const BYTE value)
+{
+	const size_t tail = m_tail.load(std::memory_order_relaxed);
+	if (tail - m_head.load(std::memory_order_acquire) == kSize)
+		return false;
+
+	m_data[tail & (kSize - 1)] = value;
+	m_tail.store(tail + 1, std::memory_order_release);
+	return true;
+}
+
+BYTE* CByteRing::GetWriteSpan(size_t& length)
+{
+	const size_t tail = m_tail.load(std::memory_order_relaxed);
+	const size_t free = kSize - (tail - m_head.load(std::memory_order_acquire));
+	const size_t offset = tail & (kSize - 1);
+	length = std::min(free, kSize - offset);
+	return &m_data[offset];
+}
+
+void CByteRing::CommitWrite(const size_t length)
+{
+	m_tail.store(m_tail.load(std::memory_order_relaxed) + length, std::memory_order_release);
+}
+
+bool CByteRing::Get(BYTE& value)
+{
+	const size_t head = m_head.load(std::memory_order_relaxed);
+	if (head == m_tail.load(std::memory_order_acquire))
+		return false;
+
+	value = m_data[head & (kSize - 1)];
+	m_head.store(head + 1, std::memory_order_release);
+	return true;
+}
+
+const BYTE* CByteRing::GetReadSpan(size_t& length)
+{
+	const size_t head = m_head.load(std::memory_order_relaxed);
+	const size_t used = m_tail.load(std::memory_order_acquire) - head;
+	const size_t offset = head & (kSize - 1);
+	length = std::min(used, kSize - offset);
+	return &m_data[offset];
+}
+
+void CByteRing::CommitRead(const size_t length)
+{
+	m_head.store(m_head.load(std::memory_order_relaxed) + length, std::memory_order_release);
+}
+
+void CByteRing::Discard(void)
+{
+	m_head.store(m_tail.load(std::memory_order_acquire), std::memory_order_release);
+}
+
+void CByteRing::DiscardTo(const size_t position)
+{
+	// NB. the positions wrap around, so compare their difference
+	const size_t head = m_head.load(std::memory_order_relaxed);
+	if (static_cast<ptrdiff_t>(position - head) > 0)
+		m_head.store(position, std::memory_order_release);
+}
+
+//===========================================================================
+
+static bool IsWouldBlock(void)
+{
+#ifdef _WIN32
+	return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+#endif
+}
+
+CSerialTcpPort::CSerialTcpPort(void)
+	: m_listenSocket(INVALID_SOCKET)
+	, m_clientSocket(INVALID_SOCKET)
+	, m_wakeSocket(INVALID_SOCKET)
+	, m_isWSAStarted(false)
+	, m_isConnected(false)
+	, m_stopIoThread(false)
+	, m_isWakePending(false)
+	, m_isRxStalled(false)
+	, m_rxDiscardTo(0)
+	, m_txDropped(0)
+{
+}
+
+CSerialTcpPort::~CSerialTcpPort(void)
+{
+	Close();
+}
+
+void CSerialTcpPort::CloseSocket(const socket_t fd)
+{
+#ifdef _WIN32
+	closesocket(fd);
+#else
+	close(fd);
+#endif
+}
+
+bool CSerialTcpPort::SetNonBlocking(const socket_t fd)
+{
+#ifdef _WIN32
+	u_long nonBlocking = 1;
+	return ioctlsocket(fd, FIONBIO, &nonBlocking) == 0;
+#else
+	return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0;
+#endif
+}
+
+//===========================================================================
+
+bool CSerialTcpPort::Open(const UINT port)
+{
+	_ASSERT(m_listenSocket == INVALID_SOCKET);
+
+#ifdef _WIN32
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+		return false;
+	m_isWSAStarted = true;
+#endif
+
+	m_listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (m_listenSocket == INVALID_SOCKET)
+	{
+		Close();
+		return false;
+	}
+
+#ifndef _WIN32
+	// re-open straight after a close, while the old connection is in TIME_WAIT (on Windows this would allow 2 listeners)
+	const int on = 1;
+	setsockopt(m_listenSocket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&on), sizeof(on));
+#endif
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = htons(static_cast<u_short>(port));
+	address.sin_addr.s_addr = htonl(INADDR_ANY);
+
+	if (!SetNonBlocking(m_listenSocket)
+		|| bind(m_listenSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+		|| listen(m_listenSocket, 1) != 0
+		|| !OpenWakeSocket())
+	{
+		Close();	// NB. the caller logs the failure (once, as it retries)
+		return false;
+	}
+
+	m_stopIoThread = false;
+	m_ioThread = std::thread(&CSerialTcpPort::IoThread, this);
+
+	LogFileOutput("SSC: listening on TCP port %u\n", port);
+	return true;
+}
+
+void CSerialTcpPort::Close(void)
+{
+	if (m_ioThread.joinable())
+	{
+		m_stopIoThread = true;
+		m_isWakePending = false;	// force the wake
+		Wake();
+		m_ioThread.join();
+	}
+
+	Disconnect();
+
+	if (m_wakeSocket != INVALID_SOCKET)
+	{
+		CloseSocket(m_wakeSocket);
+		m_wakeSocket = INVALID_SOCKET;
+	}
+
+	if (m_listenSocket != INVALID_SOCKET)
+	{
+		CloseSocket(m_listenSocket);
+		m_listenSocket = INVALID_SOCKET;
+	}
+
+#ifdef _WIN32
+	if (m_isWSAStarted)
+		WSACleanup();
+#endif
+	m_isWSAStarted = false;
+
+	if (m_txDropped)
+		LogFileOutput("SSC: TCP Tx bytes dropped = %" PRIu64 "\n", m_txDropped);
+	m_txDropped = 0;
+}
+
+// Winsock's select() only takes sockets, so the I/O thread is woken by a datagram to itself rather than by a pipe
+bool CSerialTcpPort::OpenWakeSocket(void)
+{
+	m_wakeSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+	if (m_wakeSocket == INVALID_SOCKET)
+		return false;
+
+	sockaddr_in address;
+	memset(&address, 0, sizeof(address));
+	address.sin_family = AF_INET;
+	address.sin_port = 0;	// any free port
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+#ifdef _WIN32
+	int length = sizeof(address);
+#else
+	socklen_t length = sizeof(address);
+#endif
+
+	return SetNonBlocking(m_wakeSocket)
+		&& bind(m_wakeSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0
+		&& getsockname(m_wakeSocket, reinterpret_cast<sockaddr*>(&address), &length) == 0
+		&& connect(m_wakeSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0;
+}
+
+// At most one datagram is in flight: the I/O thread clears m_isWakePending before it looks at the rings again
+void CSerialTcpPort::Wake(void)
+{
+	if (!m_isWakePending.exchange(true))
+	{
+		const char wake = 0;
+		send(m_wakeSocket, &wake, 1, 0);
+	}
+}
+
+//===========================================================================
+
+bool CSerialTcpPort::Receive(BYTE& value)
+{
+	DiscardStaleRx();
+	return m_rx.Get(value);
+}
+
+bool CSerialTcpPort::Transmit(const BYTE value)
+{
+	if (!m_isConnected)
+		return true;	// like a serial line with nothing plugged in
+
+	if (!m_tx.Put(value))
+	{
+		m_txDropped++;
+		return false;
+	}
+
+	// don't wait for the end of the emulation slice if the ring could fill up before then
+	if (m_tx.Used() >= CByteRing::kSize / 2)
+		Wake();
+
+	return true;
+}
+
+// Called once per emulation slice: send what the guest has written, and resume reading once the guest has made room
+void CSerialTcpPort::Flush(void)
+{
+	DiscardStaleRx();	// a new connection's bytes may be held back by the old one's
+	if (!m_tx.IsEmpty() || (m_isRxStalled && m_rx.Used() < CByteRing::kSize / 2))
+		Wake();
+}
+
+//===========================================================================
+
+void CSerialTcpPort::Accept(void)
+{
+	const socket_t fd = accept(m_listenSocket, NULL, NULL);
+	if (fd == INVALID_SOCKET)
+		return;
+
+	// the new connection takes over, as there's only one serial line: and what the old one sent, and the guest
+	// hasn't read yet, mustn't look as if it came from the new one
+	Disconnect();
+	m_rxDiscardTo.store(m_rx.GetWritePosition(), std::memory_order_release);
+
+	// the writes are already batched (per emulation slice), so don't let Nagle hold back the last few bytes
+	const int on = 1;
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&on), sizeof(on));
+
+	if (!SetNonBlocking(fd))
+	{
+		CloseSocket(fd);
+		return;
+	}
+
+	m_clientSocket = fd;
+	m_isConnected = true;
+}
+
+void CSerialTcpPort::Disconnect(void)
+{
+	if (m_clientSocket == INVALID_SOCKET)
+		return;
+
+	m_isConnected = false;
+	shutdown(m_clientSocket, 2 /* SD_BOTH */);	// in case the client is waiting for data
+	CloseSocket(m_clientSocket);
+	m_clientSocket = INVALID_SOCKET;
+
+	// the guest may still read what was received, but what it has written has nowhere to go
+	m_tx.Discard();
+	m_isRxStalled = false;
+}
+
+// Returns false if the connection has gone
+bool CSerialTcpPort::ReceiveFromSocket(void)
+{
+	while (true)
+	{
+		size_t length;
+		BYTE* const span = m_rx.GetWriteSpan(length);
+		if (length == 0)
+		{
+			m_isRxStalled = true;	// TCP's window now holds the sender back, until Flush() sees there's room again
+			return true;
+		}
+
+		const int received = recv(m_clientSocket, reinterpret_cast<char*>(span), static_cast<int>(length), 0);
+		if (received > 0)
+		{
+			m_rx.CommitWrite(received);
+			if (static_cast<size_t>(received) < length)
+				return true;	// drained
+		}
+		else if (received == 0)
+		{
+			return false;
+		}
+		else
+		{
+			return IsWouldBlock();
+		}
+	}
+}
+
+// Returns false if the connection has gone
+bool CSerialTcpPort::SendToSocket(void)
+{
+#ifdef MSG_NOSIGNAL
+	const int flags = MSG_NOSIGNAL;	// an EPIPE error rather than a SIGPIPE
+#else
+	const int flags = 0;
+#endif
+
+	while (true)
+	{
+		size_t length;
+		const BYTE* const span = m_tx.GetReadSpan(length);
+		if (length == 0)
+			return true;
+
+		const int sent = send(m_clientSocket, reinterpret_cast<const char*>(span), static_cast<int>(length), flags);
+		if (sent > 0)
+		{
+			m_tx.CommitRead(sent);
+			if (static_cast<size_t>(sent) < length)
+				return true;	// the socket's buffer is full: wait until it's writable
+		}
+		else
+		{
+			return sent < 0 && IsWouldBlock();
+		}
+	}
+}
+
+void CSerialTcpPort::IoThread(void)
+{
+	while (!m_stopIoThread)
+	{
+		fd_set readFds;
+		fd_set writeFds;
+		FD_ZERO(&readFds);
+		FD_ZERO(&writeFds);
+		FD_SET(m_listenSocket, &readFds);
+		FD_SET(m_wakeSocket, &readFds);
+		socket_t maxFd = std::max(m_listenSocket, m_wakeSocket);
+
+		if (m_clientSocket != INVALID_SOCKET)
+		{
+			if (!m_isRxStalled)
+				FD_SET(m_clientSocket, &readFds);
+			if (!m_tx.IsEmpty())
+				FD_SET(m_clientSocket, &writeFds);
+			maxFd = std::max(maxFd, m_clientSocket);
+		}
+
+		// the timeout is only a backstop: Flush() wakes the thread when there's work
+		timeval timeout;
+		timeout.tv_sec = 0;
+		timeout.tv_usec = 100 * 1000;
+		const int ready = select(static_cast<int>(maxFd + 1), &readFds, &writeFds, NULL, &timeout);
+		if (ready < 0)
+			continue;
+
+		if (FD_ISSET(m_wakeSocket, &readFds))
+		{
+			char drain[16];
+			while (recv(m_wakeSocket, drain, sizeof(drain), 0) > 0)
+				;
+		}
+		m_isWakePending = false;	// before looking at the rings, so a later Flush() sends another wake
+
+		if (m_stopIoThread)
+			break;
+
+		if (FD_ISSET(m_listenSocket, &readFds))
+			Accept();
+
+		if (m_clientSocket == INVALID_SOCKET)
+			continue;
+
+		if (m_isRxStalled && m_rx.Used() < CByteRing::kSize / 2)
+		{
+			m_isRxStalled = false;
+			if (!ReceiveFromSocket())	// don't wait for select(): the data is already there
+			{
+				Disconnect();
+				continue;
+			}
+		}
+
+		bool isConnected = true;
+		if (FD_ISSET(m_clientSocket, &readFds))
+			isConnected = ReceiveFromSocket();
+
+		if (isConnected && !m_tx.IsEmpty())
+			isConnected = SendToSocket();	// try now (rather than waiting for a select() for writability)
+
+		if (!isConnected)
+			Disconnect();
+	}
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+#include <atomic>
+#include <thread>
+
+// Single-producer / single-consumer byte ring: fixed size, no lock.
+// Each side can take a contiguous span, so the I/O thread recv()s into it and send()s from it directly.
+class CByteRing
+{
+public:
+	static const size_t kSize = 64*1024;	// must be a power of 2
+
+	CByteRing(void) : m_head(0), m_tail(0) {}
+
+	size_t Used(void) const { return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire); }
+	bool IsEmpty(void) const { return Used() == 0; }
+
+	// Producer
+	bool Put(const BYTE value);
+	BYTE* GetWriteSpan(size_t& length);		// the contiguous free space (0 if full)
+	void CommitWrite(const size_t length);
+	size_t GetWritePosition(void) const { return m_tail.load(std::memory_order_relaxed); }
+
+	// Consumer
+	bool Get(BYTE& value);
+	const BYTE* GetReadSpan(size_t& length);	// the contiguous bytes to read (0 if empty)
+	void CommitRead(const size_t length);
+	void Discard(void);
+	void DiscardTo(const size_t position);	// a GetWritePosition(): the bytes written before it are dropped, if not yet read
+
+private:
+	BYTE m_data[kSize];
+	alignas(64) std::atomic<size_t> m_head;	// next byte to read: written by the consumer
+	alignas(64) std::atomic<size_t> m_tail;	// next byte to write: written by the producer
+};
+
+// The Super Serial Card's TCP backend: a listening socket served by its own I/O thread (select(), no window message pump),
+// and the two byte rings between that thread and the emulation thread.
+// . Rx: the I/O thread recv()s straight into m_rx. When it is full it stops reading, and TCP holds the sender back.
+// . Tx: the emulation thread Put()s bytes into m_tx, and Flush() (once per emulation slice, or when it is half full)
+//   wakes the I/O thread to send() them in one batch.
+// . A new connection takes over from the current one, eg. when a client reconnects before the old socket has timed out.
+//   The bytes the guest hasn't yet read from the old one are dropped: the I/O thread publishes m_rx's write position
+//   in m_rxDiscardTo, and the emulation thread (m_rx's only consumer) skips up to it before its next read.
+class CSerialTcpPort
+{
+public:
+	CSerialTcpPort(void);
+	~CSerialTcpPort(void);
+
+	bool Open(const UINT port);
+	void Close(void);
+
+	bool IsConnected(void) const { return m_isConnected; }
+
+	// Emulation thread
+	bool IsRxEmpty(void) { DiscardStaleRx(); return m_rx.IsEmpty(); }
+	bool Receive(BYTE& value);
+	bool Transmit(const BYTE value);	// false if the Tx ring is full: the byte is lost
+	size_t GetTxUsed(void) const { return m_tx.Used(); }
+	void Flush(void);
+
+	UINT64 GetTxDropped(void) const { return m_txDropped; }
+
+private:
+#ifdef _WIN32
+	typedef SOCKET socket_t;
+#else
+	typedef int socket_t;
+#endif
+
+	static void CloseSocket(const socket_t fd);
+	static bool SetNonBlocking(const socket_t fd);
+	bool OpenWakeSocket(void);
+	void Wake(void);
+	void IoThread(void);
+	void Accept(void);
+	void Disconnect(void);
+	bool ReceiveFromSocket(void);
+	bool SendToSocket(void);
+	void DiscardStaleRx(void) { m_rx.DiscardTo(m_rxDiscardTo.load(std::memory_order_acquire)); }
+
+	CByteRing m_rx;
+	CByteRing m_tx;
+
+	socket_t m_listenSocket;
+	socket_t m_clientSocket;	// only used by the I/O thread
+	socket_t m_wakeSocket;		// a loopback UDP socket connected to itself: a datagram wakes the I/O thread's select()
+	bool m_isWSAStarted;
+
+	std::atomic<bool> m_isConnected;
+	std::atomic<bool> m_stopIoThread;
+	std::atomic<bool> m_isWakePending;		// a wake datagram has been sent and not yet drained
+	std::atomic<bool> m_isRxStalled;		// m_rx was full: the I/O thread stopped reading the socket
+	std::atomic<size_t> m_rxDiscardTo;		// m_rx's write position when the current connection was accepted
+	UINT64 m_txDropped;
+	std::thread m_ioThread;
+};
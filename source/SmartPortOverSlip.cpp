@@ -80,6 +80,7 @@ SmartPortOverSlip::~SmartPortOverSlip()
 void SmartPortOverSlip::Reset(const bool powerCycle)
 {
 	LogFileOutput("SmartPortOverSlip Bridge Initialization, reset called\n");
+	block_pipeline_.flush();
 }
 
 void SmartPortOverSlip::handle_smartport_call()
@@ -128,6 +129,23 @@ void SmartPortOverSlip::handle_smartport_call()
 	const auto device_id = id_and_connection.first;
 	const auto connection = id_and_connection.second.get();
 
+	if (command != CMD_READ_BLOCK && command != CMD_WRITE_BLOCK)
+	{
+		// e.g. a CONTROL could eject the media: what was read ahead may no longer be valid
+		block_pipeline_.invalidate(connection, device_id);
+
+		// A write-behind to the device failed: this command is not run, and returns that error
+		const uint8_t write_error = block_pipeline_.take_write_error(connection, device_id);
+		if (write_error != 0)
+		{
+			regs.a = write_error;
+			regs.x = 0;
+			regs.y = 0;
+			unset_processor_status(AF_ZERO);
+			return;
+		}
+	}
+
 	switch (command)
 	{
 	case CMD_STATUS:
@@ -135,11 +153,11 @@ void SmartPortOverSlip::handle_smartport_call()
 		break;
 	case CMD_READ_BLOCK:
 		// TODO: fix the fact params_loc has changed from +4 to +2
-		read_block(device_id, connection, sp_payload_loc, param_count, params_loc + 2);
+		read_block(device_id, id_and_connection.second, sp_payload_loc, param_count, params_loc + 2);
 		break;
 	case CMD_WRITE_BLOCK:
 		// TODO: fix the fact params_loc has changed from +4 to +2
-		write_block(device_id, connection, sp_payload_loc, param_count, params_loc + 2);
+		write_block(device_id, id_and_connection.second, sp_payload_loc, param_count, params_loc + 2);
 		break;
 	case CMD_FORMAT:
 		format(device_id, connection, param_count);
@@ -223,6 +241,28 @@ void SmartPortOverSlip::handle_prodos_call()
 	switch (command)
 	{
 	case 0x00:
+		// ProDOS asks when it looks for volumes: find the disks again, and do not trust what was read ahead
+		GetCommandListener().invalidate_disk_devices();
+		for (const int device : { disk_devices.first, disk_devices.second })
+		{
+			if (device != -1)
+			{
+				const auto id_connection = GetCommandListener().find_connection_with_device(device);
+				block_pipeline_.invalidate(id_connection.second.get(), id_connection.first);
+			}
+		}
+		{
+			// A write-behind to this drive failed: report it, rather than the status
+			const auto id_connection = GetCommandListener().find_connection_with_device(drive_num == 1 ? disk_devices.first : disk_devices.second);
+			const uint8_t write_error = block_pipeline_.take_write_error(id_connection.second.get(), id_connection.first);
+			if (write_error != 0)
+			{
+				regs.a = write_error;
+				regs.x = 0;
+				regs.y = 0;
+				break;
+			}
+		}
 		handle_prodos_status(drive_num, disk_devices);
 		break;
 	case 0x01:
@@ -320,10 +360,9 @@ void SmartPortOverSlip::handle_prodos_read(uint8_t drive_num, std::pair<int, int
 	auto id_connection = GetCommandListener().find_connection_with_device(device_id);
 
 	// Do a ReadRequest, and shove the 512 byte block into the required memory
-	ReadBlockRequest request(Requestor::next_request_number(), 3, id_connection.first);
 	// $46-47 = Block Number
-	request.set_block_number_from_bytes(mem[0x46], mem[0x47], 0);
-	auto response = Requestor::send_request(request, id_connection.second.get());
+	const uint32_t block_number = mem[0x46] | (mem[0x47] << 8);
+	auto response = block_pipeline_.read_block(id_connection.second, id_connection.first, 3, block_number);
 
 	handle_response<ReadBlockResponse>(
 		std::move(response),
@@ -346,15 +385,10 @@ void SmartPortOverSlip::handle_prodos_write(uint8_t drive_num, std::pair<int, in
 	auto device_id = drive_num == 1 ? disk_devices.first : disk_devices.second;
 	auto id_connection = GetCommandListener().find_connection_with_device(device_id);
 
-	WriteBlockRequest request(Requestor::next_request_number(), 3, id_connection.first);
 	// $46-47 = Block Number
-	request.set_block_number_from_bytes(mem[0x46], mem[0x47], 0);
-	// put data into the request we're sending
-	request.set_block_data_from_ptr(mem, buffer_location);
-	//int dirty_page_start = (buffer_location & 0xFF00) >> 8;
-	//memdirty[dirty_page_start] = 0xFF;
-	//memdirty[dirty_page_start + 1] = 0xFF;
-	auto response = Requestor::send_request(request, id_connection.second.get());
+	const uint32_t block_number = mem[0x46] | (mem[0x47] << 8);
+	// the data is copied into the request, which is sent without waiting for the device (write-behind)
+	auto response = block_pipeline_.write_block(id_connection.second, id_connection.first, 3, block_number, mem + buffer_location);
 
 	handle_response<WriteBlockResponse>(
 		std::move(response),
@@ -404,12 +438,11 @@ void SmartPortOverSlip::device_count(const WORD sp_payload_loc)
 	set_processor_status(AF_ZERO);
 }
 
-void SmartPortOverSlip::read_block(const BYTE unit_number, Connection *connection, const WORD buffer_location, const BYTE params_count, const WORD block_count_address)
+void SmartPortOverSlip::read_block(const BYTE unit_number, const std::shared_ptr<Connection> &connection, const WORD buffer_location, const BYTE params_count, const WORD block_count_address)
 {
-	ReadBlockRequest request(Requestor::next_request_number(), params_count, unit_number);
 	// Assume that (cmd_list_loc + 4 == block_count_address) holds 3 bytes for the block number. If it's in the payload, this is wrong and will have to be fixed.
-	request.set_block_number_from_ptr(mem, block_count_address);
-	auto response = Requestor::send_request(request, connection);
+	const uint32_t block_number = mem[block_count_address] | (mem[block_count_address + 1] << 8) | (mem[block_count_address + 2] << 16);
+	auto response = block_pipeline_.read_block(connection, unit_number, params_count, block_number);
 
 	handle_response<ReadBlockResponse>(std::move(response), [this, buffer_location](const ReadBlockResponse *rbr) {
 		memcpy(mem + buffer_location, rbr->get_block_data().data(), 512);
@@ -424,14 +457,11 @@ void SmartPortOverSlip::read_block(const BYTE unit_number, Connection *connectio
 	});
 }
 
-void SmartPortOverSlip::write_block(const BYTE unit_number, Connection *connection, const WORD sp_payload_loc, const BYTE params_count, const WORD params_loc)
+void SmartPortOverSlip::write_block(const BYTE unit_number, const std::shared_ptr<Connection> &connection, const WORD sp_payload_loc, const BYTE params_count, const WORD params_loc)
 {
-	WriteBlockRequest request(Requestor::next_request_number(), params_count, unit_number);
 	// Assume that (cmd_list_loc + 4 == params_loc) holds 3 bytes for the block number. The payload contains the data to write
-	request.set_block_number_from_ptr(mem, params_loc);
-	request.set_block_data_from_ptr(mem, sp_payload_loc);
-
-	auto response = Requestor::send_request(request, connection);
+	const uint32_t block_number = mem[params_loc] | (mem[params_loc + 1] << 8) | (mem[params_loc + 2] << 16);
+	auto response = block_pipeline_.write_block(connection, unit_number, params_count, block_number, mem + sp_payload_loc);
 	handle_simple_response<WriteBlockResponse>(std::move(response));
 }
 
@@ -628,7 +658,12 @@ void SmartPortOverSlip::Update(const ULONG nExecutedCycles)
 	// LogFileOutput("SmartPortOverSlip Update\n");
 }
 
-void SmartPortOverSlip::SaveSnapshot(YamlSaveHelper &yamlSaveHelper) { LogFileOutput("SmartPortOverSlip SaveSnapshot\n"); }
+void SmartPortOverSlip::SaveSnapshot(YamlSaveHelper &yamlSaveHelper)
+{
+	LogFileOutput("SmartPortOverSlip SaveSnapshot\n");
+	// The writes ProDOS was told had succeeded are on the devices before the snapshot is taken
+	block_pipeline_.drain();
+}
 
 bool SmartPortOverSlip::LoadSnapshot(YamlLoadHelper &yamlLoadHelper, UINT version)
 {
@@ -636,4 +671,7 @@ bool SmartPortOverSlip::LoadSnapshot(YamlLoadHelper &yamlLoadHelper, UINT versio
 	return true;
 }
 
-void SmartPortOverSlip::Destroy() {}
+void SmartPortOverSlip::Destroy()
+{
+	block_pipeline_.flush();
+}
@@ -6,6 +6,7 @@
 #include <memory>
 
 #include "CPU.h"
+#include "devrelay/service/BlockPipeline.h"
 #include "devrelay/service/Listener.h"
 #include "devrelay/types/Response.h"
 #include "devrelay/commands/Status.h"
@@ -38,8 +39,8 @@ public:
 	void close(BYTE unit_number, Connection *connection, BYTE params_count);
 	void format(BYTE unit_number, Connection *connection, BYTE params_count);
 	void reset(BYTE unit_number, Connection *connection, BYTE params_count);
-	void read_block(BYTE unit_number, Connection *connection, WORD sp_payload_loc, BYTE params_count, WORD params_loc);
-	void write_block(BYTE unit_number, Connection *connection, WORD sp_payload_loc, BYTE params_count, WORD params_loc);
+	void read_block(BYTE unit_number, const std::shared_ptr<Connection> &connection, WORD sp_payload_loc, BYTE params_count, WORD params_loc);
+	void write_block(BYTE unit_number, const std::shared_ptr<Connection> &connection, WORD sp_payload_loc, BYTE params_count, WORD params_loc);
 	void read(BYTE unit_number, Connection *connection, WORD sp_payload_loc, BYTE params_count, WORD params_loc);
 	void write(BYTE unit_number, Connection *connection, WORD sp_payload_loc, BYTE params_count, WORD params_loc);
 
@@ -113,4 +114,7 @@ public:
 private:
 	// Ensure no more than 1 card is active as it can cater for all connections to external devices
 	static int active_instances;
+
+	// read-ahead & write-behind of the block requests
+	BlockPipeline block_pipeline_;
 };
\ No newline at end of file
@@ -22,14 +22,20 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "DNS.h"
 
+#include <fstream>
+#include <sstream>
+
 #ifndef _WIN32
 #include <arpa/inet.h>
 #include <sys/socket.h>
 #include <netdb.h>
 #endif
 
+// NB. called from the DNSResolver worker threads, so it must be thread-safe
 uint32_t getHostByName(const std::string & name)
 {
+#ifdef _WIN32
+    // Winsock's gethostbyname() uses thread-local storage for the result
     const hostent * host = gethostbyname(name.c_str());
     if (host && host->h_addrtype == AF_INET && host->h_length == sizeof(uint32_t))
     {
@@ -40,6 +46,21 @@ uint32_t getHostByName(const std::string & name)
         }
     }
     return 0;
+#else
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    addrinfo * result = nullptr;
+    uint32_t address = 0;
+    if (getaddrinfo(name.c_str(), nullptr, &hints, &result) == 0)
+    {
+        if (result && result->ai_family == AF_INET)
+        {
+            address = reinterpret_cast<const sockaddr_in *>(result->ai_addr)->sin_addr.s_addr;
+        }
+        freeaddrinfo(result);
+    }
+    return address;
+#endif
 }
 
 const char * formatIP(const uint32_t address)
@@ -48,3 +69,216 @@ const char * formatIP(const uint32_t address)
     in.s_addr = address;
     return inet_ntoa(in);
 }
+
+DNSResolver::DNSResolver(const ResolveFunction & resolveFunction, const size_t numberOfThreads)
+    : myResolveFunction(resolveFunction)
+    , myNumberOfThreads(numberOfThreads)
+    , myNumberOfWorkers(0)
+    , myState(std::make_shared<State>())
+{
+    myState->positiveTTL = std::chrono::seconds(300);
+    myState->negativeTTL = std::chrono::seconds(30);
+    myState->permanentEntries = 0;
+    myState->stop = false;
+}
+
+DNSResolver::~DNSResolver()
+{
+    {
+        std::lock_guard<std::mutex> lock(myState->mutex);
+        myState->stop = true;
+        myState->queue.clear();
+    }
+    myState->condition.notify_all();
+
+    // NB. the workers were detached when started: one that is blocked in the system resolver
+    // (which can take many seconds) exits once it returns, so it isn't waited for here
+}
+
+void DNSResolver::setTTL(const std::chrono::seconds positive, const std::chrono::seconds negative)
+{
+    std::lock_guard<std::mutex> lock(myState->mutex);
+    myState->positiveTTL = positive;
+    myState->negativeTTL = negative;
+}
+
+void DNSResolver::clear()
+{
+    std::lock_guard<std::mutex> lock(myState->mutex);
+    myState->queue.clear();
+    myState->cache.clear();  // a result from a worker that is still busy is dropped
+    myState->permanentEntries = 0;
+}
+
+DNSResolver::Status DNSResolver::resolve(const std::string & name, uint32_t & address)
+{
+    const Clock::time_point now = Clock::now();
+
+    std::lock_guard<std::mutex> lock(myState->mutex);
+
+    const std::map<std::string, Entry>::const_iterator it = myState->cache.find(name);
+    if (it != myState->cache.end())
+    {
+        const Entry & entry = it->second;
+        if (entry.pending)
+        {
+            return PENDING;
+        }
+        if (entry.permanent || now < entry.expiry)
+        {
+            address = entry.address;
+            return RESOLVED;
+        }
+    }
+
+    // NB. an expired entry for this name is re-used, so only a new name needs room
+    if (it == myState->cache.end() && myState->cache.size() - myState->permanentEntries >= ourMaxEntries)
+    {
+        if (!evict(*myState, now))
+        {
+            return PENDING;  // every entry is a lookup in flight: the caller retries once some have completed
+        }
+    }
+
+    Entry & entry = myState->cache[name];
+    entry.address = 0;
+    entry.pending = true;
+    entry.permanent = false;
+    myState->queue.push_back(name);
+
+    if (myNumberOfWorkers < myNumberOfThreads)
+    {
+        std::thread(&DNSResolver::worker, myState, myResolveFunction).detach();
+        ++myNumberOfWorkers;
+    }
+
+    myState->condition.notify_one();
+
+    return PENDING;
+}
+
+// Evicts all the expired entries or, if none has expired, the one that expires first
+// Returns false if there was nothing to evict (all the entries are pending or permanent)
+// Pre: state.mutex is locked
+bool DNSResolver::evict(State & state, const Clock::time_point now)
+{
+    bool evicted = false;
+    std::map<std::string, Entry>::iterator first = state.cache.end();
+
+    std::map<std::string, Entry>::iterator it = state.cache.begin();
+    while (it != state.cache.end())
+    {
+        const Entry & entry = it->second;
+        if (entry.pending || entry.permanent)
+        {
+            ++it;
+        }
+        else if (now >= entry.expiry)
+        {
+            it = state.cache.erase(it);
+            evicted = true;
+        }
+        else
+        {
+            if (first == state.cache.end() || entry.expiry < first->second.expiry)
+            {
+                first = it;
+            }
+            ++it;
+        }
+    }
+
+    if (!evicted && first != state.cache.end())
+    {
+        state.cache.erase(first);
+        evicted = true;
+    }
+
+    return evicted;
+}
+
+// NB. holds its own reference to the state (and a copy of the resolve function), as it can outlive the DNSResolver
+void DNSResolver::worker(const std::shared_ptr<State> state, const ResolveFunction resolveFunction)
+{
+    std::unique_lock<std::mutex> lock(state->mutex);
+    while (true)
+    {
+        state->condition.wait(lock, [&state] { return state->stop || !state->queue.empty(); });
+        if (state->stop)
+        {
+            break;
+        }
+
+        const std::string name = state->queue.front();
+        state->queue.pop_front();
+
+        lock.unlock();
+        const uint32_t address = resolveFunction(name);
+        lock.lock();
+
+        if (state->stop)
+        {
+            break;
+        }
+
+        const std::map<std::string, Entry>::iterator it = state->cache.find(name);
+        if (it != state->cache.end() && it->second.pending)
+        {
+            Entry & entry = it->second;
+            entry.address = address;
+            entry.pending = false;
+            entry.expiry = Clock::now() + (address ? state->positiveTTL : state->negativeTTL);
+        }
+    }
+}
+
+size_t DNSResolver::loadHostsFile(const std::string & filename)
+{
+    std::ifstream file(filename.c_str());
+    if (!file)
+    {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(myState->mutex);
+
+    size_t count = 0;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        const size_t comment = line.find('#');
+        if (comment != std::string::npos)
+        {
+            line.erase(comment);
+        }
+
+        std::istringstream fields(line);
+        std::string ip;
+        if (!(fields >> ip))
+        {
+            continue;
+        }
+
+        const uint32_t address = inet_addr(ip.c_str());
+        if (address == INADDR_NONE)
+        {
+            continue;  // IPv6 or malformed
+        }
+
+        std::string name;
+        while (fields >> name)
+        {
+            Entry & entry = myState->cache[name];
+            if (!entry.permanent)
+            {
+                ++myState->permanentEntries;  // NB. a new entry is value-initialised, i.e. not permanent
+            }
+            entry.address = address;
+            entry.pending = false;
+            entry.permanent = true;
+            ++count;
+        }
+    }
+
+    return count;
+}
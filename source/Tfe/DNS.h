@@ -1,4 +1,77 @@
 #pragma once
 
+#include <condition_variable>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 uint32_t getHostByName(const std::string & name);
 const char * formatIP(const uint32_t address);
+
+// Asynchronous resolver with a cache, for the Uthernet II Virtual DNS
+// . lookups that miss the cache are queued to a small pool of worker threads (started on first use)
+// . resolve() never blocks the caller (the emulation thread): it returns PENDING until a worker has the result
+// . results are cached with a TTL (shorter for failures, i.e. negative caching)
+// . the cache holds at most ourMaxEntries lookups: when it's full, the expired entries are evicted, or else the one
+//   that expires first; if every entry is still pending, resolve() returns PENDING without queuing the name
+// . entries loaded from a hosts-style file never expire (and don't count towards ourMaxEntries)
+// . the resolve function can be replaced (e.g. by a stub resolver for testing)
+// . the workers share the cache & queue with the resolver, so on destruction a worker that is blocked in
+//   the system resolver is detached (not joined): it exits (and frees the shared state) once the lookup returns
+class DNSResolver
+{
+public:
+    typedef std::function<uint32_t(const std::string &)> ResolveFunction;
+
+    enum Status { RESOLVED, PENDING };
+
+    static const size_t ourMaxEntries = 1024;
+
+    explicit DNSResolver(const ResolveFunction & resolveFunction = getHostByName, const size_t numberOfThreads = 2);
+    ~DNSResolver();
+
+    // RESOLVED: address is valid (0.0.0.0 = failed), PENDING: try again later
+    Status resolve(const std::string & name, uint32_t & address);
+
+    // "address name [aliases...]" per line, '#' starts a comment. Returns the number of names loaded
+    size_t loadHostsFile(const std::string & filename);
+
+    void clear();
+    void setTTL(const std::chrono::seconds positive, const std::chrono::seconds negative);
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry
+    {
+        uint32_t address;
+        bool pending;
+        bool permanent;
+        Clock::time_point expiry;
+    };
+
+    struct State
+    {
+        std::mutex mutex;  // guards all the members below
+        std::condition_variable condition;  // work queued (or stop)
+        std::chrono::seconds positiveTTL;
+        std::chrono::seconds negativeTTL;
+        std::map<std::string, Entry> cache;
+        size_t permanentEntries;  // in cache, from loadHostsFile()
+        std::deque<std::string> queue;
+        bool stop;
+    };
+
+    const ResolveFunction myResolveFunction;
+    const size_t myNumberOfThreads;
+    size_t myNumberOfWorkers;  // only accessed by the owner's thread
+
+    const std::shared_ptr<State> myState;  // shared with the workers
+
+    static void worker(const std::shared_ptr<State> state, const ResolveFunction resolveFunction);
+    static bool evict(State & state, const Clock::time_point now);
+};
@@ -76,21 +76,6 @@ namespace
         return sum;
     }
 
-    uint16_t checksum(const void *addr, int count)
-    {
-        /* Compute Internet Checksum for "count" bytes
-         *         beginning at location "addr".
-         * Taken from https://tools.ietf.org/html/rfc1071
-         */
-        uint32_t sum = sum_every_16bits(addr, count);
-
-        /*  Fold 32-bit sum to 16 bits */
-        while (sum >> 16)
-            sum = (sum & 0xffff) + (sum >> 16);
-
-        return ~sum;
-    }
-
     // get the minimum size of a ETH Frame that contains a IP payload
     // 34 = 14 bytes for ETH2 + 20 bytes IPv4 (minimum)
     int getIPMinimumSize()
@@ -101,33 +86,63 @@ namespace
 
 }
 
-std::vector<uint8_t> createETH2Frame(const std::vector<uint8_t> &data,
-                                     const MACAddress *sourceMac, const MACAddress *destinationMac,
-                                     const uint8_t ttl, const uint8_t tos, const uint8_t protocol,
-                                     const uint32_t sourceAddress, const uint32_t destinationAddress)
+uint16_t internetChecksum(const void *addr, int count)
 {
-    const size_t total = sizeof(ETH2Frame) + sizeof(IP4Header) + data.size();
-    std::vector<uint8_t> frame(total);
-    ETH2Frame *eth2frame = reinterpret_cast<ETH2Frame *>(frame.data() + 0);
+    /* Compute Internet Checksum for "count" bytes
+     *         beginning at location "addr".
+     * Taken from https://tools.ietf.org/html/rfc1071
+     */
+    uint32_t sum = sum_every_16bits(addr, count);
+
+    /*  Fold 32-bit sum to 16 bits */
+    while (sum >> 16)
+        sum = (sum & 0xffff) + (sum >> 16);
+
+    return ~sum;
+}
+
+size_t getETH2FrameHeaderSize()
+{
+    return sizeof(ETH2Frame) + sizeof(IP4Header);
+}
+
+size_t writeETH2FrameHeader(uint8_t *frame, const size_t lengthOfPayload,
+                            const MACAddress *sourceMac, const MACAddress *destinationMac,
+                            const uint8_t ttl, const uint8_t tos, const uint8_t protocol,
+                            const uint32_t sourceAddress, const uint32_t destinationAddress)
+{
+    ETH2Frame *eth2frame = reinterpret_cast<ETH2Frame *>(frame + 0);
     memcpy(eth2frame->destinationMac, destinationMac, sizeof(eth2frame->destinationMac));
     memcpy(eth2frame->sourceMac, sourceMac, sizeof(eth2frame->destinationMac));
     eth2frame->type = htons(0x0800);
-    IP4Header *ip4header = reinterpret_cast<IP4Header *>(frame.data() + sizeof(ETH2Frame));
+    IP4Header *ip4header = reinterpret_cast<IP4Header *>(frame + sizeof(ETH2Frame));
 
     ip4header->version = IPV4;
     ip4header->ihl = 0x05;  // minimum size = 20 bytes, without any extra option
     ip4header->tos = tos;
-    ip4header->len = htons(static_cast<uint16_t>(sizeof(IP4Header) + data.size()));
+    ip4header->len = htons(static_cast<uint16_t>(sizeof(IP4Header) + lengthOfPayload));
     ip4header->id = 0;
+    ip4header->flags = 0;
     ip4header->fragmentOffset = 0;
     ip4header->ttl = ttl;
     ip4header->proto = protocol;
     ip4header->sourceAddress = sourceAddress;
     ip4header->destinationAddress = destinationAddress;
-    ip4header->checksum = checksum(ip4header, sizeof(IP4Header));
+    ip4header->checksum = 0;  // the buffer may be reused
+    ip4header->checksum = internetChecksum(ip4header, sizeof(IP4Header));
 
-    memcpy(frame.data() + sizeof(ETH2Frame) + sizeof(IP4Header), data.data(), data.size());
+    return sizeof(ETH2Frame) + sizeof(IP4Header) + lengthOfPayload;
+}
 
+std::vector<uint8_t> createETH2Frame(const std::vector<uint8_t> &data,
+                                     const MACAddress *sourceMac, const MACAddress *destinationMac,
+                                     const uint8_t ttl, const uint8_t tos, const uint8_t protocol,
+                                     const uint32_t sourceAddress, const uint32_t destinationAddress)
+{
+    const size_t headerSize = getETH2FrameHeaderSize();
+    std::vector<uint8_t> frame(headerSize + data.size());
+    memcpy(frame.data() + headerSize, data.data(), data.size());
+    writeETH2FrameHeader(frame.data(), data.size(), sourceMac, destinationMac, ttl, tos, protocol, sourceAddress, destinationAddress);
     return frame;
 }
 
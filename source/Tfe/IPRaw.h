@@ -2,6 +2,18 @@
 
 struct MACAddress;
 
+uint16_t internetChecksum(const void *addr, int count);
+
+// size of the ETH2 + IPv4 headers that precede the payload in a frame
+size_t getETH2FrameHeaderSize();
+
+// write the ETH2 + IPv4 headers in front of a payload which is already at frame + getETH2FrameHeaderSize()
+// returns the size of the whole frame
+size_t writeETH2FrameHeader(uint8_t *frame, const size_t lengthOfPayload,
+                            const MACAddress *sourceMac, const MACAddress *destinationMac,
+                            const uint8_t ttl, const uint8_t tos, const uint8_t protocol,
+                            const uint32_t sourceAddress, const uint32_t destinationAddress);
+
 std::vector<uint8_t> createETH2Frame(const std::vector<uint8_t> &data,
                                      const MACAddress *sourceMac, const MACAddress *destinationMac,
                                      const uint8_t ttl, const uint8_t tos, const uint8_t protocol,
@@ -0,0 +1,518 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: Capture of the emulated network traffic to a pcapng file
+ *
+ * Format: https://www.ietf.org/archive/id/draft-ietf-opsawg-pcapng-01.html
+ * (written in host byte order, as allowed by the Section Header Block's byte-order magic)
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "NetworkCapture.h"
+#include "IPRaw.h"
+#include "../CPU.h"
+#include "../Log.h"
+
+#include <cinttypes>
+#include <chrono>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+#define IP_PROTO_TCP 6
+#define IP_PROTO_UDP 17
+
+#define TCP_FIN 0x01
+#define TCP_SYN 0x02
+#define TCP_PSH 0x08
+#define TCP_ACK 0x10
+
+namespace
+{
+
+    // pcapng blocks & options
+    const uint32_t BLOCK_SHB = 0x0A0D0D0A;
+    const uint32_t BLOCK_IDB = 0x00000001;
+    const uint32_t BLOCK_EPB = 0x00000006;
+    const uint32_t BYTE_ORDER_MAGIC = 0x1A2B3C4D;
+    const uint16_t LINKTYPE_ETHERNET = 1;
+
+    const uint16_t OPT_ENDOFOPT = 0;
+    const uint16_t OPT_COMMENT = 1;
+    const uint16_t SHB_USERAPPL = 4;
+    const uint16_t IF_NAME = 2;
+    const uint16_t EPB_FLAGS = 2;
+
+#pragma pack(push)
+#pragma pack(1) // Ensure struct is packed
+    struct TCPHeader
+    {
+        uint16_t sourcePort;
+        uint16_t destinationPort;
+        uint32_t seq;
+        uint32_t ack;
+        uint8_t offset;  // in 32-bit words, upper nibble
+        uint8_t flags;
+        uint16_t window;
+        uint16_t checksum;
+        uint16_t urgent;
+    };
+
+    struct UDPHeader
+    {
+        uint16_t sourcePort;
+        uint16_t destinationPort;
+        uint16_t length;
+        uint16_t checksum;
+    };
+
+    // prepended to the TCP or UDP header to compute its checksum
+    struct PseudoHeader
+    {
+        uint32_t sourceAddress;
+        uint32_t destinationAddress;
+        uint8_t zero;
+        uint8_t protocol;
+        uint16_t length;
+    };
+#pragma pack(pop)
+
+    // TCP segments are split as they would be on an Ethernet network
+    const size_t TCP_MSS = 1460;
+
+    void append(std::vector<uint8_t> & block, const void * data, const size_t length)
+    {
+        const uint8_t * bytes = reinterpret_cast<const uint8_t *>(data);
+        block.insert(block.end(), bytes, bytes + length);
+        // blocks & options are padded to 32 bits
+        block.resize((block.size() + 3) & ~size_t(3), 0);
+    }
+
+    template <typename T>
+    void appendValue(std::vector<uint8_t> & block, const T & value)
+    {
+        append(block, &value, sizeof(T));
+    }
+
+    void appendOption(std::vector<uint8_t> & block, const uint16_t code, const void * data, const size_t length)
+    {
+        const uint16_t header[2] = { code, static_cast<uint16_t>(length) };
+        block.insert(block.end(), reinterpret_cast<const uint8_t *>(header), reinterpret_cast<const uint8_t *>(header + 2));
+        append(block, data, length);
+    }
+
+    std::shared_ptr<NetworkCapture> & getInstance()
+    {
+        static std::shared_ptr<NetworkCapture> instance;
+        return instance;
+    }
+
+}
+
+NetworkCapture::NetworkCapture(FILE * file)
+    : myRecords(ourCapacity)
+    , myHead(0)
+    , myTail(0)
+    , myStop(false)
+    , myFile(file)
+    , myNumberOfInterfaces(0)
+{
+    memset(&myStats, 0, sizeof(myStats));
+    writeSectionHeader();
+    myWorker = std::thread(&NetworkCapture::run, this);
+}
+
+NetworkCapture::~NetworkCapture()
+{
+    stop();
+}
+
+void NetworkCapture::stop()
+{
+    if (myWorker.joinable())
+    {
+        myStop.store(true, std::memory_order_release);
+        myWorker.join();
+        fclose(myFile);
+        myFile = NULL;
+        LogFileOutput("Capture: %" PRIu64 " frames written, %" PRIu64 " dropped\n", myStats.frames, myStats.dropped);
+    }
+}
+
+bool NetworkCapture::open(const std::string & filename)
+{
+    FILE * file = fopen(filename.c_str(), "wb");
+    if (!file)
+    {
+        LogFileOutput("Capture: cannot create %s\n", filename.c_str());
+        return false;
+    }
+
+    getInstance() = std::make_shared<NetworkCapture>(file);
+    LogFileOutput("Capture: writing to %s\n", filename.c_str());
+    return true;
+}
+
+void NetworkCapture::close()
+{
+    // the backends might still hold a reference: stop the worker & close the file now
+    std::shared_ptr<NetworkCapture> & instance = getInstance();
+    if (instance)
+    {
+        instance->stop();
+        instance.reset();
+    }
+}
+
+const std::shared_ptr<NetworkCapture> & NetworkCapture::get()
+{
+    return getInstance();
+}
+
+std::shared_ptr<NetworkBackend> NetworkCapture::wrap(const std::shared_ptr<NetworkBackend> & backend)
+{
+    const std::shared_ptr<NetworkCapture> & capture = get();
+    if (!capture || !backend)
+    {
+        return backend;
+    }
+    return std::make_shared<CaptureBackend>(backend, capture);
+}
+
+uint32_t NetworkCapture::addInterface(const std::string & name)
+{
+    const uint32_t interfaceID = myNumberOfInterfaces++;
+    const uint8_t * data = reinterpret_cast<const uint8_t *>(name.c_str());
+
+    // the following packets refer to this interface by its position: it cannot be dropped
+    while (!myStop.load(std::memory_order_relaxed) && !push(INTERFACE, interfaceID, OUTBOUND, data, name.size()))
+    {
+        std::this_thread::yield();
+    }
+    return interfaceID;
+}
+
+void NetworkCapture::write(const uint32_t interfaceID, const Direction direction, const uint8_t * frame, const size_t length)
+{
+    if (!push(PACKET, interfaceID, direction, frame, length))
+    {
+        ++myStats.dropped;
+    }
+}
+
+bool NetworkCapture::push(const RecordType type, const uint32_t interfaceID, const Direction direction, const uint8_t * data, const size_t length)
+{
+    if (myStop.load(std::memory_order_relaxed))
+    {
+        return true;  // closed: silently ignored
+    }
+
+    const size_t tail = myTail.load(std::memory_order_relaxed);
+    if (tail - myHead.load(std::memory_order_acquire) == ourCapacity)
+    {
+        return false;  // full
+    }
+
+    Record & record = myRecords[tail & (ourCapacity - 1)];
+    record.type = type;
+    record.direction = direction;
+    record.interfaceID = interfaceID;
+    record.timestamp_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    record.cycles = g_nCumulativeCycles;
+    record.length = static_cast<uint32_t>(length);
+    record.captured = static_cast<uint32_t>(std::min(length, ourSnapLength));
+    memcpy(record.data, data, record.captured);
+
+    myTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+void NetworkCapture::run()
+{
+    bool unflushed = false;
+    while (true)
+    {
+        // read myStop 1st: once it is set, nothing else will be pushed
+        const bool stop = myStop.load(std::memory_order_acquire);
+        const size_t head = myHead.load(std::memory_order_relaxed);
+        if (head == myTail.load(std::memory_order_acquire))
+        {
+            if (stop)
+            {
+                break;
+            }
+            if (unflushed)
+            {
+                fflush(myFile);
+                unflushed = false;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        writeRecord(myRecords[head & (ourCapacity - 1)]);
+        myHead.store(head + 1, std::memory_order_release);
+        unflushed = true;
+    }
+    fflush(myFile);
+}
+
+void NetworkCapture::writeSectionHeader()
+{
+    static const char application[] = "AppleWin";
+
+    myBlock.clear();
+    appendValue(myBlock, BYTE_ORDER_MAGIC);
+    appendValue(myBlock, uint16_t(1));   // major version
+    appendValue(myBlock, uint16_t(0));   // minor version
+    appendValue(myBlock, int64_t(-1));   // section length: unspecified
+    appendOption(myBlock, SHB_USERAPPL, application, sizeof(application) - 1);
+    appendOption(myBlock, OPT_ENDOFOPT, NULL, 0);
+    writeBlock(BLOCK_SHB);
+}
+
+void NetworkCapture::writeRecord(const Record & record)
+{
+    myBlock.clear();
+    switch (record.type)
+    {
+    case INTERFACE:
+        appendValue(myBlock, LINKTYPE_ETHERNET);
+        appendValue(myBlock, uint16_t(0));  // reserved
+        appendValue(myBlock, uint32_t(ourSnapLength));
+        appendOption(myBlock, IF_NAME, record.data, record.captured);
+        appendOption(myBlock, OPT_ENDOFOPT, NULL, 0);
+        writeBlock(BLOCK_IDB);
+        break;
+    case PACKET:
+        {
+            // default timestamp resolution: microseconds
+            const uint32_t flags = record.direction;
+            char comment[32];
+            const int commentLength = snprintf(comment, sizeof(comment), "cycle %" PRIu64, record.cycles);
+
+            appendValue(myBlock, record.interfaceID);
+            appendValue(myBlock, static_cast<uint32_t>(record.timestamp_us >> 32));
+            appendValue(myBlock, static_cast<uint32_t>(record.timestamp_us));
+            appendValue(myBlock, record.captured);
+            appendValue(myBlock, record.length);
+            append(myBlock, record.data, record.captured);
+            appendOption(myBlock, EPB_FLAGS, &flags, sizeof(flags));
+            appendOption(myBlock, OPT_COMMENT, comment, commentLength);
+            appendOption(myBlock, OPT_ENDOFOPT, NULL, 0);
+            writeBlock(BLOCK_EPB);
+            ++myStats.frames;
+        }
+        break;
+    }
+}
+
+void NetworkCapture::writeBlock(const uint32_t type)
+{
+    // type, total length, body, total length
+    const uint32_t total = static_cast<uint32_t>(myBlock.size() + 3 * sizeof(uint32_t));
+    fwrite(&type, sizeof(type), 1, myFile);
+    fwrite(&total, sizeof(total), 1, myFile);
+    fwrite(myBlock.data(), 1, myBlock.size(), myFile);
+    fwrite(&total, sizeof(total), 1, myFile);
+}
+
+//===========================================================================
+
+CaptureBackend::CaptureBackend(const std::shared_ptr<NetworkBackend> & backend, const std::shared_ptr<NetworkCapture> & capture)
+    : myBackend(backend)
+    , myCapture(capture)
+    , myInterfaceID(capture->addInterface(backend->getInterfaceName()))
+{
+}
+
+void CaptureBackend::transmit(const int txlength, uint8_t *txframe)
+{
+    myCapture->write(myInterfaceID, NetworkCapture::OUTBOUND, txframe, txlength);
+    myBackend->transmit(txlength, txframe);
+}
+
+int CaptureBackend::receive(const int size, uint8_t * rxframe)
+{
+    const int length = myBackend->receive(size, rxframe);
+    if (length > 0)
+    {
+        myCapture->write(myInterfaceID, NetworkCapture::INBOUND, rxframe, length);
+    }
+    return length;
+}
+
+void CaptureBackend::update(const ULONG nExecutedCycles)
+{
+    myBackend->update(nExecutedCycles);
+}
+
+void CaptureBackend::getMACAddress(const uint32_t address, MACAddress & mac)
+{
+    myBackend->getMACAddress(address, mac);
+}
+
+bool CaptureBackend::isValid()
+{
+    return myBackend->isValid();
+}
+
+const std::string & CaptureBackend::getInterfaceName()
+{
+    return myBackend->getInterfaceName();
+}
+
+//===========================================================================
+
+const MACAddress CaptureStream::ourRemoteMAC = { { 0x02, 0x41, 0x57, 0x43, 0x50, 0x01 } };
+
+CaptureStream::CaptureStream()
+{
+    reset();
+}
+
+void CaptureStream::reset()
+{
+    // the initial sequence numbers are arbitrary (Wireshark shows relative ones)
+    myOpen = false;
+    myLocalSeq = 0;
+    myRemoteSeq = 0;
+}
+
+void CaptureStream::data(NetworkCapture & capture, const uint32_t interfaceID, const bool tcp, const NetworkCapture::Direction direction,
+                         const Endpoint & local, const Endpoint & remote, const uint8_t * data, const size_t length)
+{
+    if (!tcp)
+    {
+        writeUDP(capture, interfaceID, direction, local, remote, data, length);
+        return;
+    }
+
+    if (!myOpen)
+    {
+        // the guest is always the client (the W5100 emulation does not listen)
+        writeTCP(capture, interfaceID, NetworkCapture::OUTBOUND, local, remote, TCP_SYN, NULL, 0);
+        writeTCP(capture, interfaceID, NetworkCapture::INBOUND, local, remote, TCP_SYN | TCP_ACK, NULL, 0);
+        writeTCP(capture, interfaceID, NetworkCapture::OUTBOUND, local, remote, TCP_ACK, NULL, 0);
+        myOpen = true;
+    }
+
+    for (size_t offset = 0; offset < length; offset += TCP_MSS)
+    {
+        const size_t segment = std::min(length - offset, TCP_MSS);
+        writeTCP(capture, interfaceID, direction, local, remote, TCP_PSH | TCP_ACK, data + offset, segment);
+    }
+}
+
+void CaptureStream::close(NetworkCapture & capture, const uint32_t interfaceID, const NetworkCapture::Direction direction,
+                          const Endpoint & local, const Endpoint & remote)
+{
+    if (myOpen)
+    {
+        const NetworkCapture::Direction other = (direction == NetworkCapture::OUTBOUND) ? NetworkCapture::INBOUND : NetworkCapture::OUTBOUND;
+        writeTCP(capture, interfaceID, direction, local, remote, TCP_FIN | TCP_ACK, NULL, 0);
+        writeTCP(capture, interfaceID, other, local, remote, TCP_ACK, NULL, 0);
+        myOpen = false;
+    }
+}
+
+void CaptureStream::writeTCP(NetworkCapture & capture, const uint32_t interfaceID, const NetworkCapture::Direction direction,
+                             const Endpoint & local, const Endpoint & remote, const uint8_t flags, const uint8_t * data, const size_t length)
+{
+    const bool outbound = direction == NetworkCapture::OUTBOUND;
+    const Endpoint & source = outbound ? local : remote;
+    const Endpoint & destination = outbound ? remote : local;
+    uint32_t & seq = outbound ? myLocalSeq : myRemoteSeq;
+    const uint32_t ack = outbound ? myRemoteSeq : myLocalSeq;
+
+    const size_t headerSize = getETH2FrameHeaderSize();
+    const size_t segmentSize = sizeof(TCPHeader) + length;
+    myFrame.resize(headerSize + segmentSize);
+    uint8_t * frame = myFrame.data();
+
+    TCPHeader * tcp = reinterpret_cast<TCPHeader *>(frame + headerSize);
+    tcp->sourcePort = source.port;
+    tcp->destinationPort = destination.port;
+    tcp->seq = htonl(seq);
+    tcp->ack = (flags & TCP_ACK) ? htonl(ack) : 0;
+    tcp->offset = (sizeof(TCPHeader) / 4) << 4;
+    tcp->flags = flags;
+    tcp->window = htons(0xFFFF);
+    tcp->checksum = 0;
+    tcp->urgent = 0;
+    if (length)
+    {
+        memcpy(frame + headerSize + sizeof(TCPHeader), data, length);
+    }
+
+    // the pseudo header is temporarily written in place of the end of the IPv4 header, which is written afterwards
+    PseudoHeader * pseudo = reinterpret_cast<PseudoHeader *>(frame + headerSize - sizeof(PseudoHeader));
+    pseudo->sourceAddress = source.address;
+    pseudo->destinationAddress = destination.address;
+    pseudo->zero = 0;
+    pseudo->protocol = IP_PROTO_TCP;
+    pseudo->length = htons(static_cast<uint16_t>(segmentSize));
+    tcp->checksum = internetChecksum(pseudo, static_cast<int>(sizeof(PseudoHeader) + segmentSize));
+
+    const size_t frameSize = writeETH2FrameHeader(frame, segmentSize, &source.mac, &destination.mac, 64, 0, IP_PROTO_TCP, source.address, destination.address);
+    capture.write(interfaceID, direction, frame, frameSize);
+
+    seq += static_cast<uint32_t>(length) + ((flags & (TCP_SYN | TCP_FIN)) ? 1 : 0);
+}
+
+void CaptureStream::writeUDP(NetworkCapture & capture, const uint32_t interfaceID, const NetworkCapture::Direction direction,
+                             const Endpoint & local, const Endpoint & remote, const uint8_t * data, const size_t length)
+{
+    const bool outbound = direction == NetworkCapture::OUTBOUND;
+    const Endpoint & source = outbound ? local : remote;
+    const Endpoint & destination = outbound ? remote : local;
+
+    const size_t headerSize = getETH2FrameHeaderSize();
+    const size_t datagramSize = sizeof(UDPHeader) + length;
+    myFrame.resize(headerSize + datagramSize);
+    uint8_t * frame = myFrame.data();
+
+    UDPHeader * udp = reinterpret_cast<UDPHeader *>(frame + headerSize);
+    udp->sourcePort = source.port;
+    udp->destinationPort = destination.port;
+    udp->length = htons(static_cast<uint16_t>(datagramSize));
+    udp->checksum = 0;
+    memcpy(frame + headerSize + sizeof(UDPHeader), data, length);
+
+    // see writeTCP()
+    PseudoHeader * pseudo = reinterpret_cast<PseudoHeader *>(frame + headerSize - sizeof(PseudoHeader));
+    pseudo->sourceAddress = source.address;
+    pseudo->destinationAddress = destination.address;
+    pseudo->zero = 0;
+    pseudo->protocol = IP_PROTO_UDP;
+    pseudo->length = udp->length;
+    const uint16_t checksum = internetChecksum(pseudo, static_cast<int>(sizeof(PseudoHeader) + datagramSize));
+    udp->checksum = checksum ? checksum : 0xFFFF;  // 0 means "no checksum"
+
+    const size_t frameSize = writeETH2FrameHeader(frame, datagramSize, &source.mac, &destination.mac, 64, 0, IP_PROTO_UDP, source.address, destination.address);
+    capture.write(interfaceID, direction, frame, frameSize);
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include "NetworkBackend.h"
+
+#include <atomic>
+#include <thread>
+
+/*
+ Capture of the emulated network traffic to a pcapng file (for Wireshark & co.), enabled with -net-capture <file>
+ . every backend created by FrameBase::CreateNetworkBackend() is wrapped in a CaptureBackend (a tap on transmit() & receive())
+ . the Uthernet II TCP & UDP sockets are carried by host sockets: their data is synthesised into Ethernet frames (see CaptureStream)
+ . each record has the host time (the packet's timestamp) and the emulated cycle (g_nCumulativeCycles, as a packet comment)
+ . the emulation thread only copies the frame into a lock-free queue, a worker thread writes the file
+   (if the worker falls behind, frames are dropped rather than stalling the emulation)
+*/
+class NetworkCapture
+{
+public:
+    enum Direction { INBOUND = 1, OUTBOUND = 2 };  // as the pcapng epb_flags
+
+    struct Stats
+    {
+        uint64_t frames;   // written to the file
+        uint64_t dropped;  // the queue was full
+    };
+
+    explicit NetworkCapture(FILE * file);
+    ~NetworkCapture();
+
+    // these must be called by the emulation thread (the single producer)
+    uint32_t addInterface(const std::string & name);
+    void write(const uint32_t interfaceID, const Direction direction, const uint8_t * frame, const size_t length);
+
+    // -net-capture
+    static bool open(const std::string & filename);
+    static void close();
+    static const std::shared_ptr<NetworkCapture> & get();  // nullptr if not capturing
+
+    // a tap around the backend (or the backend itself, if not capturing)
+    static std::shared_ptr<NetworkBackend> wrap(const std::shared_ptr<NetworkBackend> & backend);
+
+private:
+    enum RecordType { INTERFACE, PACKET };
+
+    static const size_t ourCapacity = 1024;  // records, must be a power of 2
+    static const size_t ourSnapLength = 1536;
+
+    struct Record
+    {
+        RecordType type;
+        Direction direction;
+        uint32_t interfaceID;
+        uint64_t timestamp_us;  // since 1970
+        uint64_t cycles;
+        uint32_t length;        // of the frame (or of the interface's name)
+        uint32_t captured;      // <= ourSnapLength
+        uint8_t data[ourSnapLength];
+    };
+
+    std::vector<Record> myRecords;
+    std::atomic<size_t> myHead;  // next record to write (worker)
+    std::atomic<size_t> myTail;  // next record to fill (emulation thread)
+    std::atomic<bool> myStop;
+    std::thread myWorker;
+
+    FILE * myFile;
+    uint32_t myNumberOfInterfaces;
+    Stats myStats;                // frames: worker only, dropped: emulation thread only
+    std::vector<uint8_t> myBlock; // worker only
+
+    bool push(const RecordType type, const uint32_t interfaceID, const Direction direction, const uint8_t * data, const size_t length);
+    void run();
+    void stop();
+
+    void writeSectionHeader();
+    void writeRecord(const Record & record);
+    void writeBlock(const uint32_t type);
+};
+
+// the NetworkBackend tap
+class CaptureBackend : public NetworkBackend
+{
+public:
+    CaptureBackend(const std::shared_ptr<NetworkBackend> & backend, const std::shared_ptr<NetworkCapture> & capture);
+
+    virtual void transmit(const int txlength, uint8_t *txframe);
+    virtual int receive(const int size, uint8_t * rxframe);
+    virtual void update(const ULONG nExecutedCycles);
+    virtual void getMACAddress(const uint32_t address, MACAddress & mac);
+    virtual bool isValid();
+    virtual const std::string & getInterfaceName();
+
+private:
+    const std::shared_ptr<NetworkBackend> myBackend;
+    const std::shared_ptr<NetworkCapture> myCapture;
+    const uint32_t myInterfaceID;
+};
+
+// Synthesises the Ethernet frames of a TCP or UDP stream carried by a host socket
+// . TCP: the 3-way handshake is written before the first segment, sequence numbers follow the data, FIN on close
+// . the remote MAC is a made-up one (the host's network is not visible to the emulated card)
+class CaptureStream
+{
+public:
+    struct Endpoint
+    {
+        MACAddress mac;
+        uint32_t address;  // network order
+        uint16_t port;     // network order
+    };
+
+    CaptureStream();
+
+    void data(NetworkCapture & capture, const uint32_t interfaceID, const bool tcp, const NetworkCapture::Direction direction,
+              const Endpoint & local, const Endpoint & remote, const uint8_t * data, const size_t length);
+    void close(NetworkCapture & capture, const uint32_t interfaceID, const NetworkCapture::Direction direction,
+               const Endpoint & local, const Endpoint & remote);
+    void reset();
+
+    static const MACAddress ourRemoteMAC;
+
+private:
+    bool myOpen;           // TCP: the handshake has been written
+    uint32_t myLocalSeq;   // next sequence number sent by the guest
+    uint32_t myRemoteSeq;  // next sequence number sent by the remote
+    std::vector<uint8_t> myFrame;
+
+    void writeTCP(NetworkCapture & capture, const uint32_t interfaceID, const NetworkCapture::Direction direction,
+                  const Endpoint & local, const Endpoint & remote, const uint8_t flags, const uint8_t * data, const size_t length);
+    void writeUDP(NetworkCapture & capture, const uint32_t interfaceID, const NetworkCapture::Direction direction,
+                  const Endpoint & local, const Endpoint & remote, const uint8_t * data, const size_t length);
+};
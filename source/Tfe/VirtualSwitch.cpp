@@ -0,0 +1,867 @@
+/*
+AppleWin : An Apple //e emulator for Windows
+
+Copyright (C) 1994-1996, Michael O'Brien
+Copyright (C) 1999-2001, Oliver Schmidt
+Copyright (C) 2002-2005, Tom Charlesworth
+Copyright (C) 2006-2010, Tom Charlesworth, Michael Pohoreski
+
+AppleWin is free software; you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation; either version 2 of the License, or
+(at your option) any later version.
+
+AppleWin is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with AppleWin; if not, write to the Free Software
+Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+*/
+
+/* Description: In-process virtual Ethernet switch (a NetworkBackend for Uthernet I & II)
+ *
+ * Author: Various
+ */
+
+#include "StdAfx.h"
+
+#include "VirtualSwitch.h"
+#include "IPRaw.h"
+#include "../Common.h"
+#include "../Log.h"
+#include "../Registry.h"
+
+#include <cinttypes>
+#include <random>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <fcntl.h>
+#else
+typedef int socklen_t;
+#endif
+
+#define ETH_TYPE_IP4 0x0800
+#define ETH_TYPE_ARP 0x0806
+
+#define IP_PROTO_ICMP 1
+#define IP_PROTO_UDP 17
+
+#define DHCP_SERVER_PORT 67
+#define DHCP_CLIENT_PORT 68
+
+namespace
+{
+
+#pragma pack(push)
+#pragma pack(1) // Ensure struct is packed
+    struct ETH2Header
+    {
+        uint8_t destinationMac[6];
+        uint8_t sourceMac[6];
+        uint16_t type;
+    };
+
+    struct ARPPacket
+    {
+        uint16_t hardwareType;
+        uint16_t protocolType;
+        uint8_t hardwareSize;
+        uint8_t protocolSize;
+        uint16_t operation;
+        uint8_t senderMac[6];
+        uint32_t senderAddress;
+        uint8_t targetMac[6];
+        uint32_t targetAddress;
+    };
+
+    struct IP4Header
+    {
+        uint8_t versionAndLength;
+        uint8_t tos;
+        uint16_t len;
+        uint16_t id;
+        uint16_t fragment;
+        uint8_t ttl;
+        uint8_t proto;
+        uint16_t checksum;
+        uint32_t sourceAddress;
+        uint32_t destinationAddress;
+    };
+
+    struct UDPHeader
+    {
+        uint16_t sourcePort;
+        uint16_t destinationPort;
+        uint16_t len;
+        uint16_t checksum;
+    };
+
+    struct BOOTPPacket
+    {
+        uint8_t op;
+        uint8_t htype;
+        uint8_t hlen;
+        uint8_t hops;
+        uint32_t xid;
+        uint16_t secs;
+        uint16_t flags;
+        uint32_t ciaddr;
+        uint32_t yiaddr;
+        uint32_t siaddr;
+        uint32_t giaddr;
+        uint8_t chaddr[16];
+        uint8_t sname[64];
+        uint8_t file[128];
+        uint32_t cookie;
+    };
+
+    struct UplinkHeader
+    {
+        uint32_t id;
+        uint32_t instance;
+    };
+#pragma pack(pop)
+
+    enum { DHCP_DISCOVER = 1, DHCP_OFFER = 2, DHCP_REQUEST = 3, DHCP_ACK = 5, DHCP_NAK = 6 };
+
+    const uint32_t DHCP_COOKIE = 0x63538263;  // 99.130.83.99 in network order
+
+    // built-in host: 192.168.65.1/24, and a locally administered MAC
+    const uint8_t HOST_MAC[6] = { 0x02, 0x41, 0x57, 0x56, 0x53, 0x01 };
+    const uint32_t HOST_NETWORK = 0xC0A84100;  // host order
+    const uint32_t HOST_NETMASK = 0xFFFFFF00;
+    const uint32_t HOST_ADDRESS = HOST_NETWORK | 1;
+    const uint32_t LEASE_TIME = 24 * 60 * 60;
+
+    // uplink: UDP multicast, restricted to the loopback interface
+    const uint32_t UPLINK_ID = 'SVWA';  // 'AWVS'
+    const uint32_t UPLINK_GROUP = 0xEFFF4102;  // 239.255.65.2 (host order)
+    const uint16_t UPLINK_PORT = 46502;
+
+    const int ETH_MINIMUM_FRAME = 60;  // without FCS
+
+    uint64_t getMACKey(const uint8_t * mac)
+    {
+        uint64_t key = 0;
+        for (size_t i = 0; i < 6; ++i)
+        {
+            key = (key << 8) | mac[i];
+        }
+        return key;
+    }
+
+    uint32_t read32(const void * ptr)
+    {
+        uint32_t value;
+        memcpy(&value, ptr, sizeof(value));
+        return value;
+    }
+
+    void appendOption(std::vector<uint8_t> & options, const uint8_t code, const uint32_t value)
+    {
+        options.push_back(code);
+        options.push_back(sizeof(value));
+        const uint8_t * data = reinterpret_cast<const uint8_t *>(&value);
+        options.insert(options.end(), data, data + sizeof(value));
+    }
+
+}
+
+//===========================================================================
+
+FrameQueue::FrameQueue()
+    : myHead(0)
+    , myTail(0)
+{
+}
+
+bool FrameQueue::push(const uint8_t * frame, const int length, const Clock::time_point timestamp)
+{
+    const size_t tail = myTail.load(std::memory_order_relaxed);
+    if (tail - myHead.load(std::memory_order_acquire) == ourCapacity)
+    {
+        return false;  // full
+    }
+
+    Slot & slot = mySlots[tail & (ourCapacity - 1)];
+    memcpy(slot.data, frame, length);
+    slot.length = length;
+    slot.timestamp = timestamp;
+    myTail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+int FrameQueue::pop(uint8_t * frame, const int size, Clock::time_point & timestamp)
+{
+    const size_t head = myHead.load(std::memory_order_relaxed);
+    if (head == myTail.load(std::memory_order_acquire))
+    {
+        return -1;  // empty
+    }
+
+    const Slot & slot = mySlots[head & (ourCapacity - 1)];
+    const int length = std::min(slot.length, size);
+    memcpy(frame, slot.data, length);
+    timestamp = slot.timestamp;
+    myHead.store(head + 1, std::memory_order_release);
+    return length;
+}
+
+//===========================================================================
+
+std::shared_ptr<VirtualSwitch> VirtualSwitch::get()
+{
+    static std::weak_ptr<VirtualSwitch> instance;
+
+    std::shared_ptr<VirtualSwitch> virtualSwitch = instance.lock();
+    if (!virtualSwitch)
+    {
+        uint32_t responder = 1;
+        uint32_t uplink = 0;  // off by default: it's a UDP port that's open (albeit only to this host)
+        REGLOAD_DEFAULT(REGVALUE_VIRTUAL_SWITCH_RESPONDER, &responder, 1);
+        REGLOAD_DEFAULT(REGVALUE_VIRTUAL_SWITCH_UPLINK, &uplink, 0);
+
+        virtualSwitch = std::make_shared<VirtualSwitch>(responder != 0, uplink != 0);
+        instance = virtualSwitch;
+    }
+    return virtualSwitch;
+}
+
+VirtualSwitch::VirtualSwitch(const bool responder, const bool uplink)
+    : myResponder(responder)
+    , myUplink(INVALID_SOCKET)
+    , myInstanceID(std::random_device()())
+{
+    memset(&myStats, 0, sizeof(myStats));
+
+#ifdef _WIN32
+    WSADATA wsaData;
+    myWSAStartup = WSAStartup(MAKEWORD(2, 2), &wsaData);
+#endif
+
+    if (myResponder)
+    {
+        myMACTable[getMACKey(HOST_MAC)] = ourHostPort;
+        MACAddress & mac = myARPTable[htonl(HOST_ADDRESS)];
+        memcpy(mac.address, HOST_MAC, sizeof(mac.address));
+    }
+
+    if (uplink)
+    {
+        openUplink();
+    }
+
+    LogFileOutput("VSwitch: started (responder: %d, uplink: %d)\n", myResponder ? 1 : 0, myUplink != INVALID_SOCKET ? 1 : 0);
+}
+
+VirtualSwitch::~VirtualSwitch()
+{
+    if (myUplink != INVALID_SOCKET)
+    {
+        closeSocket(myUplink);
+    }
+
+#ifdef _WIN32
+    if (myWSAStartup == 0)
+    {
+        WSACleanup();
+    }
+#endif
+
+    const uint64_t latencyAverage_us = myStats.delivered ? myStats.latencyTotal_us / myStats.delivered : 0;
+    LogFileOutput("VSwitch: frames = %" PRIu64 ", flooded = %" PRIu64 ", delivered = %" PRIu64 ", dropped = %" PRIu64 ", responses = %" PRIu64 ", latency avg/max = %" PRIu64 "/%" PRIu64 " us\n",
+        myStats.frames, myStats.flooded, myStats.delivered, myStats.dropped, myStats.responses, latencyAverage_us, myStats.latencyMax_us);
+}
+
+const VirtualSwitch::Stats & VirtualSwitch::getStats() const
+{
+    return myStats;
+}
+
+size_t VirtualSwitch::addPort()
+{
+    size_t port = 0;
+    while (port < myPorts.size() && myPorts[port])
+    {
+        ++port;
+    }
+    if (port == myPorts.size())
+    {
+        myPorts.resize(port + 1);
+    }
+
+    myPorts[port].reset(new FrameQueue());
+    return port;
+}
+
+void VirtualSwitch::removePort(const size_t port)
+{
+    myPorts[port].reset();
+
+    // forget the MACs learnt on this port
+    std::map<uint64_t, size_t>::iterator it = myMACTable.begin();
+    while (it != myMACTable.end())
+    {
+        if (it->second == port)
+        {
+            it = myMACTable.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+void VirtualSwitch::transmit(const size_t port, const uint8_t * frame, const int length)
+{
+    if (length < static_cast<int>(sizeof(ETH2Header)) || length > MAX_RXLENGTH)
+    {
+        return;
+    }
+
+    ++myStats.frames;
+    forward(port, frame, length);
+}
+
+int VirtualSwitch::receive(const size_t port, uint8_t * frame, const int size)
+{
+    FrameQueue::Clock::time_point timestamp;
+    const int length = myPorts[port]->pop(frame, size, timestamp);
+    if (length >= 0)
+    {
+        const uint64_t latency_us = std::chrono::duration_cast<std::chrono::microseconds>(FrameQueue::Clock::now() - timestamp).count();
+        ++myStats.delivered;
+        myStats.latencyTotal_us += latency_us;
+        myStats.latencyMax_us = std::max(myStats.latencyMax_us, latency_us);
+    }
+    return length;
+}
+
+void VirtualSwitch::update()
+{
+    if (myUplink == INVALID_SOCKET)
+    {
+        return;
+    }
+
+    uint8_t buffer[sizeof(UplinkHeader) + MAX_RXLENGTH];
+    for (size_t i = 0; i < FrameQueue::ourCapacity; ++i)
+    {
+        sockaddr_in source = {};
+        socklen_t sourceLength = sizeof(source);
+        const int length = recvfrom(myUplink, reinterpret_cast<char *>(buffer), sizeof(buffer), 0,
+            reinterpret_cast<sockaddr *>(&source), &sourceLength);
+        if (length <= 0)
+        {
+            break;  // nothing (else) pending
+        }
+
+        if ((ntohl(source.sin_addr.s_addr) >> 24) != IN_LOOPBACKNET)
+        {
+            continue;  // only from the AppleWin processes on this host
+        }
+
+        const UplinkHeader * header = reinterpret_cast<const UplinkHeader *>(buffer);
+        const int frameLength = length - static_cast<int>(sizeof(UplinkHeader));
+        if (frameLength >= static_cast<int>(sizeof(ETH2Header)) && header->id == UPLINK_ID && header->instance != myInstanceID)
+        {
+            ++myStats.frames;
+            forward(ourUplinkPort, buffer + sizeof(UplinkHeader), frameLength);
+        }
+    }
+}
+
+bool VirtualSwitch::getMACAddress(const uint32_t address, MACAddress & mac) const
+{
+    const std::map<uint32_t, MACAddress>::const_iterator it = myARPTable.find(address);
+    if (it == myARPTable.end())
+    {
+        return false;
+    }
+    mac = it->second;
+    return true;
+}
+
+//===========================================================================
+
+void VirtualSwitch::learn(const size_t fromPort, const uint8_t * frame, const int length)
+{
+    const ETH2Header * eth = reinterpret_cast<const ETH2Header *>(frame);
+    if (eth->sourceMac[0] & 0x01)
+    {
+        return;  // not a valid source
+    }
+
+    myMACTable[getMACKey(eth->sourceMac)] = fromPort;
+
+    const uint16_t type = ntohs(eth->type);
+    uint32_t address = 0;
+    if (type == ETH_TYPE_ARP && length >= static_cast<int>(sizeof(ETH2Header) + sizeof(ARPPacket)))
+    {
+        address = reinterpret_cast<const ARPPacket *>(frame + sizeof(ETH2Header))->senderAddress;
+    }
+    else if (type == ETH_TYPE_IP4 && length >= static_cast<int>(sizeof(ETH2Header) + sizeof(IP4Header)))
+    {
+        address = reinterpret_cast<const IP4Header *>(frame + sizeof(ETH2Header))->sourceAddress;
+    }
+
+    if (address != 0 && address != INADDR_BROADCAST)
+    {
+        memcpy(myARPTable[address].address, eth->sourceMac, sizeof(MACAddress::address));
+    }
+}
+
+void VirtualSwitch::forward(const size_t fromPort, const uint8_t * frame, const int length)
+{
+    learn(fromPort, frame, length);
+
+    const FrameQueue::Clock::time_point now = FrameQueue::Clock::now();
+    const ETH2Header * eth = reinterpret_cast<const ETH2Header *>(frame);
+    const bool isLocal = fromPort != ourUplinkPort && fromPort != ourHostPort;
+
+    if (!(eth->destinationMac[0] & 0x01))
+    {
+        const std::map<uint64_t, size_t>::const_iterator it = myMACTable.find(getMACKey(eth->destinationMac));
+        if (it != myMACTable.end())
+        {
+            const size_t toPort = it->second;
+            if (toPort == fromPort)
+            {
+                // nothing to do: destination is on the same port
+            }
+            else if (toPort == ourHostPort)
+            {
+                respond(frame, length);
+            }
+            else if (toPort == ourUplinkPort)
+            {
+                sendUplink(frame, length);
+            }
+            else
+            {
+                deliver(toPort, frame, length, now);
+            }
+            return;
+        }
+    }
+
+    // broadcast, multicast or unknown destination
+    ++myStats.flooded;
+    for (size_t port = 0; port < myPorts.size(); ++port)
+    {
+        if (port != fromPort && myPorts[port])
+        {
+            deliver(port, frame, length, now);
+        }
+    }
+
+    // only local traffic goes to the uplink & the built-in host (every process has its own built-in host)
+    if (isLocal)
+    {
+        sendUplink(frame, length);
+        if (myResponder)
+        {
+            respond(frame, length);
+        }
+    }
+}
+
+void VirtualSwitch::deliver(const size_t toPort, const uint8_t * frame, const int length, const FrameQueue::Clock::time_point timestamp)
+{
+    if (!myPorts[toPort]->push(frame, length, timestamp))
+    {
+        ++myStats.dropped;
+    }
+}
+
+//===========================================================================
+
+void VirtualSwitch::closeSocket(const socket_t fd)
+{
+#ifdef _WIN32
+    closesocket(fd);
+#else
+    close(fd);
+#endif
+}
+
+void VirtualSwitch::openUplink()
+{
+    const socket_t fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (fd == INVALID_SOCKET)
+    {
+        return;
+    }
+
+    // all the processes must be able to bind the same port
+    const int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&on), sizeof(on));
+#ifdef SO_REUSEPORT
+    setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, reinterpret_cast<const char *>(&on), sizeof(on));
+#endif
+
+    // not INADDR_ANY, else any host on the network could inject frames by sending (unicast) datagrams to the port
+    // . Windows: bind to the loopback interface, which is the one that joins the group
+    // . otherwise: bind to the group's address, so only datagrams sent to the group are received
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+#ifdef _WIN32
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+#else
+    address.sin_addr.s_addr = htonl(UPLINK_GROUP);
+#endif
+    address.sin_port = htons(UPLINK_PORT);
+
+    ip_mreq group = {};
+    group.imr_multiaddr.s_addr = htonl(UPLINK_GROUP);
+    group.imr_interface.s_addr = htonl(INADDR_LOOPBACK);
+
+    in_addr loopback = {};
+    loopback.s_addr = htonl(INADDR_LOOPBACK);
+    const int ttl = 1;
+
+#ifdef _WIN32
+    u_long nonBlocking = 1;
+    const bool nonBlockingSet = ioctlsocket(fd, FIONBIO, &nonBlocking) == 0;
+#else
+    const bool nonBlockingSet = fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) == 0;
+#endif
+
+    if (!nonBlockingSet
+        || bind(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0
+        || setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, reinterpret_cast<const char *>(&group), sizeof(group)) != 0
+        || setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, reinterpret_cast<const char *>(&loopback), sizeof(loopback)) != 0
+        || setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, reinterpret_cast<const char *>(&on), sizeof(on)) != 0
+        || setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, reinterpret_cast<const char *>(&ttl), sizeof(ttl)) != 0)
+    {
+        LogFileOutput("VSwitch: uplink not available\n");
+        closeSocket(fd);
+        return;
+    }
+
+#ifdef IP_MULTICAST_ALL
+    // Linux: only receive the groups joined by this socket (the default is all the groups joined on the host)
+    const int off = 0;
+    setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, reinterpret_cast<const char *>(&off), sizeof(off));
+#endif
+
+    myUplink = fd;
+}
+
+void VirtualSwitch::sendUplink(const uint8_t * frame, const int length)
+{
+    if (myUplink == INVALID_SOCKET)
+    {
+        return;
+    }
+
+    uint8_t buffer[sizeof(UplinkHeader) + MAX_RXLENGTH];
+    UplinkHeader * header = reinterpret_cast<UplinkHeader *>(buffer);
+    header->id = UPLINK_ID;
+    header->instance = myInstanceID;
+    memcpy(buffer + sizeof(UplinkHeader), frame, length);
+
+    sockaddr_in destination = {};
+    destination.sin_family = AF_INET;
+    destination.sin_addr.s_addr = htonl(UPLINK_GROUP);
+    destination.sin_port = htons(UPLINK_PORT);
+
+    sendto(myUplink, reinterpret_cast<const char *>(buffer), sizeof(UplinkHeader) + length, 0,
+        reinterpret_cast<const sockaddr *>(&destination), sizeof(destination));
+}
+
+//===========================================================================
+
+void VirtualSwitch::respond(const uint8_t * frame, const int length)
+{
+    const ETH2Header * eth = reinterpret_cast<const ETH2Header *>(frame);
+    switch (ntohs(eth->type))
+    {
+    case ETH_TYPE_ARP:
+        respondARP(frame, length);
+        break;
+    case ETH_TYPE_IP4:
+        {
+            size_t lengthOfPayload;
+            const uint8_t * payload;
+            uint32_t source;
+            uint8_t protocol;
+            getIPPayload(length, frame, lengthOfPayload, payload, source, protocol);
+            if (protocol == IP_PROTO_ICMP)
+            {
+                respondICMP(frame, length);
+            }
+            else if (protocol == IP_PROTO_UDP)
+            {
+                respondDHCP(frame, length);
+            }
+        }
+        break;
+    }
+}
+
+void VirtualSwitch::sendFromHost(std::vector<uint8_t> & frame)
+{
+    if (frame.size() < ETH_MINIMUM_FRAME)
+    {
+        frame.resize(ETH_MINIMUM_FRAME, 0);
+    }
+    ++myStats.responses;
+    forward(ourHostPort, frame.data(), static_cast<int>(frame.size()));
+}
+
+void VirtualSwitch::respondARP(const uint8_t * frame, const int length)
+{
+    if (length < static_cast<int>(sizeof(ETH2Header) + sizeof(ARPPacket)))
+    {
+        return;
+    }
+
+    const ETH2Header * eth = reinterpret_cast<const ETH2Header *>(frame);
+    const ARPPacket * request = reinterpret_cast<const ARPPacket *>(frame + sizeof(ETH2Header));
+    if (ntohs(request->operation) != 1 || request->targetAddress != htonl(HOST_ADDRESS))
+    {
+        return;
+    }
+
+    std::vector<uint8_t> reply(sizeof(ETH2Header) + sizeof(ARPPacket));
+    ETH2Header * replyEth = reinterpret_cast<ETH2Header *>(reply.data());
+    memcpy(replyEth->destinationMac, eth->sourceMac, sizeof(replyEth->destinationMac));
+    memcpy(replyEth->sourceMac, HOST_MAC, sizeof(replyEth->sourceMac));
+    replyEth->type = htons(ETH_TYPE_ARP);
+
+    ARPPacket * arp = reinterpret_cast<ARPPacket *>(reply.data() + sizeof(ETH2Header));
+    *arp = *request;
+    arp->operation = htons(2);
+    memcpy(arp->senderMac, HOST_MAC, sizeof(arp->senderMac));
+    arp->senderAddress = request->targetAddress;
+    memcpy(arp->targetMac, request->senderMac, sizeof(arp->targetMac));
+    arp->targetAddress = request->senderAddress;
+
+    sendFromHost(reply);
+}
+
+void VirtualSwitch::respondICMP(const uint8_t * frame, const int length)
+{
+    const IP4Header * ip = reinterpret_cast<const IP4Header *>(frame + sizeof(ETH2Header));
+    const int ipHeaderLength = (ip->versionAndLength & 0x0F) * 4;
+    const int ipLength = ntohs(ip->len);
+    const int icmpOffset = sizeof(ETH2Header) + ipHeaderLength;
+
+    // echo request to the built-in host
+    if (ip->destinationAddress != htonl(HOST_ADDRESS) || ipLength <= ipHeaderLength + 4 || frame[icmpOffset] != 8)
+    {
+        return;
+    }
+
+    std::vector<uint8_t> reply(frame, frame + sizeof(ETH2Header) + ipLength);
+    ETH2Header * replyEth = reinterpret_cast<ETH2Header *>(reply.data());
+    memcpy(replyEth->destinationMac, replyEth->sourceMac, sizeof(replyEth->destinationMac));
+    memcpy(replyEth->sourceMac, HOST_MAC, sizeof(replyEth->sourceMac));
+
+    IP4Header * replyIP = reinterpret_cast<IP4Header *>(reply.data() + sizeof(ETH2Header));
+    replyIP->destinationAddress = ip->sourceAddress;
+    replyIP->sourceAddress = ip->destinationAddress;
+    replyIP->ttl = 64;
+    replyIP->checksum = 0;
+    replyIP->checksum = internetChecksum(replyIP, ipHeaderLength);
+
+    uint8_t * icmp = reply.data() + icmpOffset;
+    icmp[0] = 0;  // echo reply
+    icmp[2] = icmp[3] = 0;
+    const uint16_t icmpChecksum = internetChecksum(icmp, ipLength - ipHeaderLength);
+    memcpy(icmp + 2, &icmpChecksum, sizeof(icmpChecksum));
+
+    sendFromHost(reply);
+}
+
+uint32_t VirtualSwitch::getLease(const uint64_t mac)
+{
+    const std::map<uint64_t, uint32_t>::const_iterator it = myLeases.find(mac);
+    if (it != myLeases.end())
+    {
+        return it->second;
+    }
+
+    // derive the address from the MAC, so that a card gets the same address in all the processes (on the uplink)
+    const uint32_t firstHost = 2;
+    const uint32_t numberOfHosts = 250;
+    const uint32_t start = static_cast<uint32_t>((mac ^ (mac >> 24)) % numberOfHosts);
+    for (uint32_t i = 0; i < numberOfHosts; ++i)
+    {
+        const uint32_t address = htonl(HOST_NETWORK | (firstHost + (start + i) % numberOfHosts));
+        bool used = false;
+        for (std::map<uint64_t, uint32_t>::const_iterator lease = myLeases.begin(); lease != myLeases.end(); ++lease)
+        {
+            used = used || lease->second == address;
+        }
+        if (!used)
+        {
+            myLeases[mac] = address;
+            return address;
+        }
+    }
+    return 0;  // pool exhausted
+}
+
+void VirtualSwitch::respondDHCP(const uint8_t * frame, const int length)
+{
+    const IP4Header * ip = reinterpret_cast<const IP4Header *>(frame + sizeof(ETH2Header));
+    const int udpOffset = sizeof(ETH2Header) + (ip->versionAndLength & 0x0F) * 4;
+    const int bootpOffset = udpOffset + sizeof(UDPHeader);
+    if (length < bootpOffset + static_cast<int>(sizeof(BOOTPPacket)))
+    {
+        return;
+    }
+
+    const UDPHeader * udp = reinterpret_cast<const UDPHeader *>(frame + udpOffset);
+    const BOOTPPacket * request = reinterpret_cast<const BOOTPPacket *>(frame + bootpOffset);
+    if (ntohs(udp->destinationPort) != DHCP_SERVER_PORT || request->op != 1 || request->hlen != 6 || request->cookie != DHCP_COOKIE)
+    {
+        return;
+    }
+
+    // options
+    uint8_t messageType = 0;
+    uint32_t requestedAddress = request->ciaddr;
+    const uint8_t * option = frame + bootpOffset + sizeof(BOOTPPacket);
+    const uint8_t * end = frame + length;
+    while (option < end && *option != 255)
+    {
+        if (*option == 0)
+        {
+            ++option;  // pad
+            continue;
+        }
+        if (option + 2 > end || option + 2 + option[1] > end)
+        {
+            break;
+        }
+        if (option[0] == 53 && option[1] == 1)
+        {
+            messageType = option[2];
+        }
+        else if (option[0] == 50 && option[1] == 4)
+        {
+            requestedAddress = read32(option + 2);
+        }
+        option += 2 + option[1];
+    }
+
+    const uint32_t lease = getLease(getMACKey(request->chaddr));
+    uint8_t replyType;
+    if (messageType == DHCP_DISCOVER)
+    {
+        replyType = DHCP_OFFER;
+    }
+    else if (messageType == DHCP_REQUEST)
+    {
+        replyType = (requestedAddress == 0 || requestedAddress == lease) ? DHCP_ACK : DHCP_NAK;
+    }
+    else
+    {
+        return;  // RELEASE, DECLINE, INFORM: ignored
+    }
+
+    if (lease == 0)
+    {
+        return;
+    }
+
+    std::vector<uint8_t> options;
+    options.push_back(53);
+    options.push_back(1);
+    options.push_back(replyType);
+    appendOption(options, 54, htonl(HOST_ADDRESS));  // server identifier
+    if (replyType != DHCP_NAK)
+    {
+        appendOption(options, 51, htonl(LEASE_TIME));
+        appendOption(options, 1, htonl(HOST_NETMASK));
+        appendOption(options, 3, htonl(HOST_ADDRESS));  // router
+    }
+    options.push_back(255);
+
+    std::vector<uint8_t> udpPayload(sizeof(UDPHeader) + sizeof(BOOTPPacket));
+    UDPHeader * replyUDP = reinterpret_cast<UDPHeader *>(udpPayload.data());
+    replyUDP->sourcePort = htons(DHCP_SERVER_PORT);
+    replyUDP->destinationPort = htons(DHCP_CLIENT_PORT);
+    replyUDP->len = htons(static_cast<uint16_t>(udpPayload.size() + options.size()));
+    replyUDP->checksum = 0;  // optional for IPv4
+
+    BOOTPPacket * reply = reinterpret_cast<BOOTPPacket *>(udpPayload.data() + sizeof(UDPHeader));
+    reply->op = 2;
+    reply->htype = request->htype;
+    reply->hlen = request->hlen;
+    reply->xid = request->xid;
+    reply->flags = request->flags;
+    reply->yiaddr = replyType == DHCP_NAK ? 0 : lease;
+    reply->siaddr = htonl(HOST_ADDRESS);
+    memcpy(reply->chaddr, request->chaddr, sizeof(reply->chaddr));
+    reply->cookie = DHCP_COOKIE;
+    udpPayload.insert(udpPayload.end(), options.begin(), options.end());
+
+    // the client has no address yet: broadcast the reply
+    const MACAddress broadcast = { { 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF } };
+    MACAddress source;
+    memcpy(source.address, HOST_MAC, sizeof(source.address));
+    std::vector<uint8_t> replyFrame = createETH2Frame(udpPayload, &source, &broadcast, 64, 0, IP_PROTO_UDP, htonl(HOST_ADDRESS), INADDR_BROADCAST);
+
+    sendFromHost(replyFrame);
+}
+
+//===========================================================================
+
+const std::string & VirtualSwitchBackend::getName()
+{
+    static const std::string name("VirtualSwitch");
+    return name;
+}
+
+VirtualSwitchBackend::VirtualSwitchBackend()
+    : mySwitch(VirtualSwitch::get())
+    , myPort(mySwitch->addPort())
+{
+}
+
+VirtualSwitchBackend::~VirtualSwitchBackend()
+{
+    mySwitch->removePort(myPort);
+}
+
+void VirtualSwitchBackend::transmit(const int txlength, uint8_t *txframe)
+{
+    mySwitch->transmit(myPort, txframe, txlength);
+}
+
+int VirtualSwitchBackend::receive(const int size, uint8_t * rxframe)
+{
+    return mySwitch->receive(myPort, rxframe, size);
+}
+
+void VirtualSwitchBackend::update(const ULONG /* nExecutedCycles */)
+{
+    mySwitch->update();
+}
+
+void VirtualSwitchBackend::getMACAddress(const uint32_t address, MACAddress & mac)
+{
+    mySwitch->getMACAddress(address, mac);  // unknown: mac is not changed (i.e. the caller's broadcast fallback)
+}
+
+bool VirtualSwitchBackend::isValid()
+{
+    return true;
+}
+
+const std::string & VirtualSwitchBackend::getInterfaceName()
+{
+    return getName();
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include "NetworkBackend.h"
+
+#include <atomic>
+#include <chrono>
+
+/*
+ An in-process Ethernet switch, so that emulated cards can be networked without pcap, a NIC or a network:
+ . all the cards using the "VirtualSwitch" interface are connected to the process' switch
+ . MAC learning: unicast frames go to the port of the destination (or are flooded if it is unknown)
+ . an optional built-in host (gateway 192.168.65.1) answers ARP, ICMP echo and DHCP requests
+ . an optional uplink (off by default) connects the switches of all the AppleWin processes on this host
+   (IP multicast on the loopback interface, and only datagrams from the loopback network are accepted)
+ . each port has a bounded queue of frames: when it is full, frames are dropped (as a real switch does)
+*/
+
+// Bounded single-producer / single-consumer queue of frames (fixed slots, no allocation after construction)
+class FrameQueue
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    static const size_t ourCapacity = 64;  // frames, must be a power of 2
+
+    FrameQueue();
+
+    bool push(const uint8_t * frame, const int length, const Clock::time_point timestamp);
+    int pop(uint8_t * frame, const int size, Clock::time_point & timestamp);  // -1 if empty
+
+private:
+    struct Slot
+    {
+        int length;
+        Clock::time_point timestamp;
+        uint8_t data[MAX_RXLENGTH];
+    };
+
+    Slot mySlots[ourCapacity];
+    std::atomic<size_t> myHead;  // next slot to pop
+    std::atomic<size_t> myTail;  // next slot to push
+};
+
+class VirtualSwitch
+{
+public:
+    struct Stats
+    {
+        uint64_t frames;        // transmitted to the switch
+        uint64_t flooded;       // sent to all ports (broadcast, multicast or unknown destination)
+        uint64_t delivered;     // received from a port's queue
+        uint64_t dropped;       // a port's queue was full
+        uint64_t responses;     // sent by the built-in host
+        uint64_t latencyTotal_us;
+        uint64_t latencyMax_us;
+    };
+
+    VirtualSwitch(const bool responder, const bool uplink);
+    ~VirtualSwitch();
+
+    size_t addPort();
+    void removePort(const size_t port);
+
+    void transmit(const size_t port, const uint8_t * frame, const int length);
+    int receive(const size_t port, uint8_t * frame, const int size);
+    void update();
+
+    bool getMACAddress(const uint32_t address, MACAddress & mac) const;
+    const Stats & getStats() const;
+
+    // the switch is shared by all the VirtualSwitchBackends of the process
+    static std::shared_ptr<VirtualSwitch> get();
+
+private:
+    static const size_t ourUplinkPort = size_t(-2);
+    static const size_t ourHostPort = size_t(-3);
+
+    std::vector<std::unique_ptr<FrameQueue>> myPorts;  // nullptr: free port
+    std::map<uint64_t, size_t> myMACTable;             // MAC -> port
+    std::map<uint32_t, MACAddress> myARPTable;         // IP -> MAC (learnt from ARP & IPv4 traffic)
+    std::map<uint64_t, uint32_t> myLeases;             // MAC -> IP (DHCP)
+    Stats myStats;
+
+    const bool myResponder;
+#ifdef _WIN32
+    typedef SOCKET socket_t;
+    int myWSAStartup;
+#else
+    typedef int socket_t;
+#endif
+    socket_t myUplink;
+    uint32_t myInstanceID;
+
+    void forward(const size_t fromPort, const uint8_t * frame, const int length);
+    void deliver(const size_t toPort, const uint8_t * frame, const int length, const FrameQueue::Clock::time_point timestamp);
+    void learn(const size_t fromPort, const uint8_t * frame, const int length);
+
+    static void closeSocket(const socket_t fd);
+    void openUplink();
+    void sendUplink(const uint8_t * frame, const int length);
+
+    void respond(const uint8_t * frame, const int length);
+    void respondARP(const uint8_t * frame, const int length);
+    void respondICMP(const uint8_t * frame, const int length);
+    void respondDHCP(const uint8_t * frame, const int length);
+    void sendFromHost(std::vector<uint8_t> & frame);
+    uint32_t getLease(const uint64_t mac);
+};
+
+class VirtualSwitchBackend : public NetworkBackend
+{
+public:
+    static const std::string & getName();  // the interface name, to select this backend
+
+    VirtualSwitchBackend();
+    virtual ~VirtualSwitchBackend();
+
+    virtual void transmit(const int txlength, uint8_t *txframe);
+    virtual int receive(const int size, uint8_t * rxframe);
+    virtual void update(const ULONG nExecutedCycles);
+    virtual void getMACAddress(const uint32_t address, MACAddress & mac);
+    virtual bool isValid();
+    virtual const std::string & getInterfaceName();
+
+private:
+    std::shared_ptr<VirtualSwitch> mySwitch;
+    const size_t myPort;
+};
@@ -202,6 +202,8 @@ void Uthernet1::Init(void)
     tfe_recv_promiscuous = 0;
     tfe_recv_hashfilter  = 0;
 
+    tfe_hash_needed      = 0;
+
 #ifdef TFE_DEBUG_WARN
     tfe_started_tx       = 0;
 #endif
@@ -344,6 +346,8 @@ void Uthernet1::tfe_sideeffects_write_pp(WORD ppaddress, int oddaddress)
         tfe_recv_promiscuous = content & 0x0080; /* promiscuous mode */
         tfe_recv_hashfilter  = content & 0x0040; /* accept if IA passes the hash filter */
 
+        tfe_update_hash_needed();
+
         tfe_arch_recv_ctl( tfe_recv_broadcast,
                            tfe_recv_mac,
                            tfe_recv_multicast,
@@ -417,6 +421,7 @@ void Uthernet1::tfe_sideeffects_write_pp(WORD ppaddress, int oddaddress)
 			*p &= ~(0xFF << pos); /* clear out relevant bits */
 			*p |= GET_PP_8(ppaddress+oddaddress) << pos;
 
+			tfe_update_hash_needed();
 			tfe_arch_set_hashfilter(tfe_hash_mask);
 		}
 		break;
@@ -432,6 +437,17 @@ void Uthernet1::tfe_sideeffects_write_pp(WORD ppaddress, int oddaddress)
     }
 }
 
+/*
+ The CRC of the DA is only needed if the hash filter can change the outcome
+ (or the status reported for an accepted frame): precompute this whenever
+ the hash mask or RXCTL changes, so that tfe_should_accept() can skip it.
+*/
+void Uthernet1::tfe_update_hash_needed(void)
+{
+    tfe_hash_needed = (tfe_hash_mask[0] || tfe_hash_mask[1])
+        && (tfe_recv_multicast || tfe_recv_hashfilter || tfe_recv_promiscuous);
+}
+
 /*
  This is called *before* the relevant octets are read
 */
@@ -833,6 +849,11 @@ int Uthernet1::tfe_should_accept(unsigned char *buffer, int length, int *phashed
             return((tfe_recv_broadcast || tfe_recv_promiscuous) ? 1 : 0);
     }
 
+    if (!tfe_hash_needed) {
+        /* the DA cannot pass the hash filter (or it would not matter) */
+        return(tfe_recv_promiscuous ? 1 : 0);
+    }
+
 	/* now check if DA passes the hash filter */
 	/* RGJ added (const char *) for AppleWin */
 	hashreg = (~crc32_buf((const char *)buffer,6) >> 26) & 0x3F;
@@ -863,11 +884,16 @@ int Uthernet1::tfe_should_accept(unsigned char *buffer, int length, int *phashed
 #endif
 
 
+static_assert(TFE_PP_ADDR_RX_FRAMELOC + MAX_RXLENGTH <= TFE_PP_ADDR_TX_FRAMELOC, "RX frame area too small");
+
 WORD Uthernet1::tfe_receive(void)
 {
     WORD ret_val = 0x0004;
 
-    BYTE buffer[MAX_RXLENGTH];
+    /* frames are received in place, straight into the RX frame area of the PP:
+       reading RXEVENT performs an "implied skip" of the previous frame anyway,
+       so it does not matter if a rejected frame overwrites it */
+    BYTE *buffer = &tfe_packetpage[TFE_PP_ADDR_RX_FRAMELOC];
 
     int  multicast = 0;
 
@@ -881,7 +907,7 @@ WORD Uthernet1::tfe_receive(void)
         ready = 1 ; /* assume we will find a good frame */
 
         int len = networkBackend->receive(
-            sizeof(buffer), /* size of buffer */
+            MAX_RXLENGTH,   /* size of buffer */
             buffer          /* where to store a frame */
             );
 
@@ -934,15 +960,10 @@ WORD Uthernet1::tfe_receive(void)
             }
 
             if (rx_ok) {
-                int i;
-
-                /* set relevant parts of the PP area to correct values */
+                /* set relevant parts of the PP area to correct values
+                   (the frame itself is already in place) */
                 SET_PP_16(TFE_PP_ADDR_RXLENGTH, len);
 
-                for (i=0;i<len; i++) {
-                    SET_PP_8(TFE_PP_ADDR_RX_FRAMELOC+i, buffer[i]);
-                }
-
                 /* set rx_buffer to where start reading *
                  * According to 4.10.9 (pp. 76-77), we start with RxStatus and RxLength!
                  */
@@ -143,6 +143,7 @@ private:
 	void tfe_sideeffects_write_pp(WORD ppaddress, int oddaddress);
 	void tfe_sideeffects_read_pp(WORD ppaddress);
 	void tfe_proceed_rx_buffer(int oddaddress);
+	void tfe_update_hash_needed(void);
 
 	WORD tfe_receive(void);
 	int tfe_should_accept(unsigned char *buffer, int length, int *phashed, int *phash_index,
@@ -184,6 +185,10 @@ private:
 	int  tfe_recv_promiscuous;	/* promiscuous mode */
 	int  tfe_recv_hashfilter;	/* accept if IA passes the hash filter */
 
+	/* precomputed from the above: the DA's hash has to be computed
+	   (some bit of the hash mask is set, and a mode uses it) */
+	int  tfe_hash_needed;
+
 #ifdef TFE_DEBUG_WARN
 	/* remember if the TXCMD has been completed before a new one is issued */
 	int tfe_started_tx;
@@ -26,6 +26,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "Tfe/PCapBackend.h"
 #include "Tfe/IPRaw.h"
 #include "Tfe/DNS.h"
+#include "Tfe/NetworkCapture.h"
 #include "W5100.h"
 #include "../Registry.h"
 
@@ -132,12 +133,16 @@ namespace
         write8(socket, memory, getIByte(value, 0)); // low
     }
 
+    // the caller has checked there is room for len bytes (see Socket::isThereRoomFor())
     void writeData(Socket &socket, std::vector<uint8_t> &memory, const uint8_t *data, const size_t len)
     {
-        for (size_t c = 0; c < len; ++c)
-        {
-            write8(socket, memory, data[c]);
-        }
+        // the RX buffer is circular: copy in (at most) 2 chunks
+        const uint16_t base = socket.receiveBase;
+        const size_t first = std::min<size_t>(len, socket.receiveSize - socket.sn_rx_wr);
+        memcpy(memory.data() + base + socket.sn_rx_wr, data, first);
+        memcpy(memory.data() + base, data + first, len - first);
+        socket.sn_rx_wr = (socket.sn_rx_wr + len) % socket.receiveSize;
+        socket.sn_rx_rsr += static_cast<uint16_t>(len);
     }
 
     // no byte reversal
@@ -164,6 +169,18 @@ namespace
         writeData(socket, memory, data, len);
     }
 
+    // the guest's end comes from the common registers, the remote's from the socket's destination
+    void getCaptureEndpoints(const Socket &socket, const std::vector<uint8_t> &memory, CaptureStream::Endpoint &local, CaptureStream::Endpoint &remote)
+    {
+        memcpy(&local.mac, memory.data() + W5100_SHAR0, sizeof(local.mac));
+        local.address = readAddress(memory.data() + W5100_SIPR0);
+        local.port = *reinterpret_cast<const uint16_t *>(memory.data() + socket.registerAddress + W5100_SN_PORT0);
+
+        remote.mac = CaptureStream::ourRemoteMAC;
+        remote.address = readAddress(memory.data() + socket.registerAddress + W5100_SN_DIPR0);
+        remote.port = *reinterpret_cast<const uint16_t *>(memory.data() + socket.registerAddress + W5100_SN_DPORT0);
+    }
+
     void writeDataForProtocol(Socket &socket, std::vector<uint8_t> &memory, const uint8_t *data, const size_t len, const sockaddr_in &source)
     {
         if (socket.getStatus() == W5100_SN_SR_SOCK_UDP)
@@ -189,6 +206,7 @@ Socket::Socket()
     , registerAddress(0)
     , sn_rx_wr(0)
     , sn_rx_rsr(0)
+    , rxReady(false)
     , mySocketStatus(W5100_SN_SR_CLOSED)
     , myFD(INVALID_SOCKET)
     , myHeaderSize(0)
@@ -206,6 +224,8 @@ void Socket::clearFD()
 #endif
     }
     myFD = INVALID_SOCKET;
+    rxReady = false;
+    pendingDNSName.clear();
     setStatus(W5100_SN_SR_CLOSED);
 }
 
@@ -266,42 +286,27 @@ bool Socket::isOpen() const
         ((mySocketStatus == W5100_SN_SR_ESTABLISHED) || (mySocketStatus == W5100_SN_SR_SOCK_UDP));
 }
 
-void Socket::process()
+// called once the pending connect() has been reported as writable (or in error)
+void Socket::checkConnection()
 {
-    if (myFD != INVALID_SOCKET && mySocketStatus == W5100_SN_SR_SOCK_SYNSENT)
-    {
-#ifdef _WIN32
-        FD_SET writefds, exceptfds;
-        FD_ZERO(&writefds);
-        FD_ZERO(&exceptfds);
-        FD_SET(myFD, &writefds);
-        FD_SET(myFD, &exceptfds);
-        const timeval timeout = {0, 0};
-        if (select(0, NULL, &writefds, &exceptfds, &timeout) > 0)
-#else
-        pollfd pfd = {.fd = myFD, .events = POLLOUT};
-        if (poll(&pfd, 1, 0) > 0)
-#endif
-        {
-            int err = 0;
-            socklen_t elen = sizeof(err);
-            const int res = getsockopt(myFD, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&err), &elen);
+    int err = 0;
+    socklen_t elen = sizeof(err);
+    const int res = getsockopt(myFD, SOL_SOCKET, SO_ERROR, reinterpret_cast<char *>(&err), &elen);
 
-            if (res == 0 && err == 0)
-            {
-                setStatus(W5100_SN_SR_ESTABLISHED);
+    if (res == 0 && err == 0)
+    {
+        setStatus(W5100_SN_SR_ESTABLISHED);
+        rxReady = true;  // the peer might have sent something already
 #ifdef U2_LOG_STATE
-                LogFileOutput("U2: TCP[]: Connected\n");
+        LogFileOutput("U2: TCP[]: Connected\n");
 #endif
-            }
-            else
-            {
-                clearFD();
+    }
+    else
+    {
+        clearFD();
 #ifdef U2_LOG_STATE
-                LogFileOutput("U2: TCP[]: Connection error: %d - %" ERROR_FMT "\n", res, STRERROR(err));
+        LogFileOutput("U2: TCP[]: Connection error: %d - %" ERROR_FMT "\n", res, STRERROR(err));
 #endif
-            }
-        }
     }
 }
 
@@ -381,6 +386,10 @@ Uthernet2::Uthernet2(UINT slot) : Card(CT_Uthernet2, slot)
 #endif
 
     myVirtualDNSEnabled = GetRegistryVirtualDNS(slot);
+    myDNSResolver.reset(new DNSResolver());
+    myReceiveBuffer.resize(W5100_MEM_SIZE - W5100_RX_BASE);
+    myTransmitBuffer.resize(getETH2FrameHeaderSize() + W5100_RX_BASE - W5100_TX_BASE);
+    myIPRawSockets.resize(256, -1);
     Reset(true);
 }
 
@@ -589,6 +598,22 @@ int Uthernet2::receiveForMacAddress(const bool acceptAll, const int size, uint8_
     return len;
 }
 
+// rebuild the protocol -> IPRAW socket index
+// to be called whenever a socket's status or Sn_PROTO changes (the lowest socket wins, as in the W5100)
+void Uthernet2::updateIPRawSockets()
+{
+    std::fill(myIPRawSockets.begin(), myIPRawSockets.end(), -1);
+    for (size_t i = mySockets.size(); i-- > 0; )
+    {
+        const Socket & socket = mySockets[i];
+        if (socket.getStatus() == W5100_SN_SR_SOCK_IPRAW)
+        {
+            const uint8_t socketProtocol = myMemory[socket.registerAddress + W5100_SN_PROTO];
+            myIPRawSockets[socketProtocol] = static_cast<int>(i);
+        }
+    }
+}
+
 void Uthernet2::receiveOnePacketRaw()
 {
     bool acceptAll = false;
@@ -619,27 +644,10 @@ void Uthernet2::receiveOnePacketRaw()
         uint8_t packetProtocol;
         getIPPayload(len, buffer, lengthOfPayload, payload, source, packetProtocol);
 
-        // see if there is a IPRAW socket that should accept thi spacket
-        int ipRawSocket = -1;
-        if (packetDestination != OTHER)  // IPRaw always filters (HOST or BROADCAST, never OTHER)
-        {
-            for (size_t i = 0; i < mySockets.size(); ++i)
-            {
-                Socket & socket = mySockets[i];
-
-                if (socket.getStatus() == W5100_SN_SR_SOCK_IPRAW)
-                {
-                    // IP only accepts by protocol & always filters MAC
-                    const uint8_t socketProtocol = myMemory[socket.registerAddress + W5100_SN_PROTO];
-                    if (payload && packetProtocol == socketProtocol)
-                    {
-                        ipRawSocket = i;
-                        break; // a valid IPRAW socket has been found
-                    }
-                }
-                // we should probably check for UDP & TCP sockets and filter these packets too
-            }
-        }
+        // see if there is a IPRAW socket that should accept this packet
+        // IP only accepts by protocol & always filters MAC (HOST or BROADCAST, never OTHER)
+        // we should probably check for UDP & TCP sockets and filter these packets too
+        const int ipRawSocket = (payload && packetDestination != OTHER) ? myIPRawSockets[packetProtocol] : -1;
 
         // priority to IPRAW
         if (ipRawSocket >= 0)
@@ -701,21 +709,30 @@ void Uthernet2::receiveOnePacketIPRaw(const size_t i, const size_t lengthOfPaylo
 void Uthernet2::receiveOnePacketFromSocket(const size_t i)
 {
     Socket &socket = mySockets[i];
-    if (socket.isOpen())
+    // only call recvfrom() if the last pollSockets() said there is something to read
+    if (socket.isOpen() && socket.rxReady)
     {
         const uint16_t freeRoom = socket.getFreeRoom();
         if (freeRoom > 32) // avoid meaningless reads
         {
-            std::vector<uint8_t> buffer(freeRoom - 1); // do not fill the buffer completely
+            const size_t size = freeRoom - 1; // do not fill the buffer completely
+            uint8_t * buffer = myReceiveBuffer.data();
             sockaddr_in source = {0};
             socklen_t len = sizeof(sockaddr_in);
-            const ssize_t data = recvfrom(socket.getFD(), reinterpret_cast<char *>(buffer.data()), buffer.size(), 0, (struct sockaddr *)&source, &len);
+            const ssize_t data = recvfrom(socket.getFD(), reinterpret_cast<char *>(buffer), size, 0, (struct sockaddr *)&source, &len);
 #ifdef U2_LOG_TRAFFIC
             const char *proto = socket.getStatus() == W5100_SN_SR_SOCK_UDP ? "UDP" : "TCP";
 #endif
             if (data > 0)
             {
-                writeDataForProtocol(socket, myMemory, buffer.data(), data, source);
+                // a short TCP read means the socket has been drained
+                // (UDP keeps going until EAGAIN, as there might be more datagrams queued)
+                if (socket.getStatus() == W5100_SN_SR_ESTABLISHED && static_cast<size_t>(data) < size)
+                {
+                    socket.rxReady = false;
+                }
+                writeDataForProtocol(socket, myMemory, buffer, data, source);
+                captureSocketData(i, false, buffer, data, source.sin_addr.s_addr, source.sin_port);
 #ifdef U2_LOG_TRAFFIC
                 LogFileOutput("U2: Read %s[%" SIZE_T_FMT "]: +%d+%" SIZE_T_FMT " -> %d bytes\n", proto, i, socket.getHeaderSize(),
                     data, socket.sn_rx_rsr);
@@ -724,12 +741,17 @@ void Uthernet2::receiveOnePacketFromSocket(const size_t i)
             else if (data == 0)
             {
                 // gracefull termination
+                captureSocketClose(i, false);
                 socket.clearFD();
             }
             else // data < 0;
             {
                 const int error = sock_error();
-                if (error != SOCK_EAGAIN && error != SOCK_EWOULDBLOCK)
+                if (error == SOCK_EAGAIN || error == SOCK_EWOULDBLOCK)
+                {
+                    socket.rxReady = false;
+                }
+                else
                 {
 #ifdef U2_LOG_TRAFFIC
                     LogFileOutput("U2: %s[%" SIZE_T_FMT "]: recvfrom error %" ERROR_FMT "\n", proto, i, STRERROR(error));
@@ -766,7 +788,7 @@ void Uthernet2::receiveOnePacket(const size_t i)
     };
 }
 
-void Uthernet2::sendDataIPRaw(const size_t i, std::vector<uint8_t> &payload)
+void Uthernet2::sendDataIPRaw(const size_t i, uint8_t * frame, const size_t size)
 {
     const Socket &socket = mySockets[i];
 
@@ -780,33 +802,33 @@ void Uthernet2::sendDataIPRaw(const size_t i, std::vector<uint8_t> &payload)
     const MACAddress * destinationMac;
     getMACAddress(dest, destinationMac);
 
-    std::vector<uint8_t> packet = createETH2Frame(payload, sourceMac, destinationMac, ttl, tos, protocol, source, dest);
+    // the payload is already in place, only the headers are written in front of it
+    const size_t length = writeETH2FrameHeader(frame, size, sourceMac, destinationMac, ttl, tos, protocol, source, dest);
 
 #ifdef U2_LOG_TRAFFIC
-    LogFileOutput("U2: Send IPRAW[%" SIZE_T_FMT "]: %" SIZE_T_FMT " (%" SIZE_T_FMT ") bytes\n", i, payload.size(), packet.size());
+    LogFileOutput("U2: Send IPRAW[%" SIZE_T_FMT "]: %" SIZE_T_FMT " (%" SIZE_T_FMT ") bytes\n", i, size, length);
 #endif
 
-    myNetworkBackend->transmit(packet.size(), packet.data());
+    myNetworkBackend->transmit(static_cast<int>(length), frame);
 }
 
-void Uthernet2::sendDataMacRaw(const size_t i, std::vector<uint8_t> &packet) const
+void Uthernet2::sendDataMacRaw(const size_t i, uint8_t * data, const size_t size) const
 {
 #ifdef U2_LOG_TRAFFIC
-    if (packet.size() >= 12)
+    if (size >= 12)
     {
-        const uint8_t * data = packet.data();
-        LogFileOutput("U2: Send MACRAW[%" SIZE_T_FMT "]: " MAC_FMT " -> " MAC_FMT ": %" SIZE_T_FMT " bytes\n", i, MAC_SOURCE(data), MAC_DEST(data), packet.size());
+        LogFileOutput("U2: Send MACRAW[%" SIZE_T_FMT "]: " MAC_FMT " -> " MAC_FMT ": %" SIZE_T_FMT " bytes\n", i, MAC_SOURCE(data), MAC_DEST(data), size);
     }
     else
     {
         // this is not a valid Ethernet Frame
-        LogFileOutput("U2: Send MACRAW[%" SIZE_T_FMT "]: XX:XX:XX:XX:XX:XX -> XX:XX:XX:XX:XX:XX: %" SIZE_T_FMT " bytes\n", i, packet.size());
+        LogFileOutput("U2: Send MACRAW[%" SIZE_T_FMT "]: XX:XX:XX:XX:XX:XX -> XX:XX:XX:XX:XX:XX: %" SIZE_T_FMT " bytes\n", i, size);
     }
 #endif
-    myNetworkBackend->transmit(packet.size(), packet.data());
+    myNetworkBackend->transmit(static_cast<int>(size), data);
 }
 
-void Uthernet2::sendDataToSocket(const size_t i, std::vector<uint8_t> &data)
+void Uthernet2::sendDataToSocket(const size_t i, const uint8_t * data, const size_t size)
 {
     Socket &socket = mySockets[i];
     if (socket.isOpen())
@@ -819,10 +841,14 @@ void Uthernet2::sendDataToSocket(const size_t i, std::vector<uint8_t> &data)
         destination.sin_addr.s_addr = dest;
         destination.sin_port = *reinterpret_cast<const uint16_t *>(myMemory.data() + socket.registerAddress + W5100_SN_DPORT0);
 
-        const ssize_t res = sendto(socket.getFD(), reinterpret_cast<const char *>(data.data()), data.size(), 0, (const struct sockaddr *)&destination, sizeof(destination));
+        const ssize_t res = sendto(socket.getFD(), reinterpret_cast<const char *>(data), size, 0, (const struct sockaddr *)&destination, sizeof(destination));
+        if (res > 0)
+        {
+            captureSocketData(i, true, data, res, destination.sin_addr.s_addr, destination.sin_port);
+        }
 #ifdef U2_LOG_TRAFFIC
         const char *proto = socket.getStatus() == W5100_SN_SR_SOCK_UDP ? "UDP" : "TCP";
-        LogFileOutput("U2: Send %s[%" SIZE_T_FMT "]: %" SIZE_T_FMT " of %" SIZE_T_FMT " bytes\n", proto, i, res, data.size());
+        LogFileOutput("U2: Send %s[%" SIZE_T_FMT "]: %" SIZE_T_FMT " of %" SIZE_T_FMT " bytes\n", proto, i, res, size);
 #endif
         if (res < 0)
         {
@@ -851,16 +877,23 @@ void Uthernet2::sendData(const size_t i)
     const uint16_t rr_address = base + sn_tx_rr;
     const uint16_t wr_address = base + sn_tx_wr;
 
-    std::vector<uint8_t> data;
+    // unwrap the circular TX buffer into the scratch buffer (no allocation per packet)
+    // leaving room in front for the headers of an IPRAW frame
+    uint8_t * frame = myTransmitBuffer.data();
+    uint8_t * data = frame + getETH2FrameHeaderSize();
+    size_t length;
     if (rr_address < wr_address)
     {
-        data.assign(myMemory.begin() + rr_address, myMemory.begin() + wr_address);
+        length = wr_address - rr_address;
+        memcpy(data, myMemory.data() + rr_address, length);
     }
     else
     {
         const uint16_t end = base + size;
-        data.assign(myMemory.begin() + rr_address, myMemory.begin() + end);
-        data.insert(data.end(), myMemory.begin() + base, myMemory.begin() + wr_address);
+        const size_t first = end - rr_address;
+        memcpy(data, myMemory.data() + rr_address, first);
+        memcpy(data + first, myMemory.data() + base, wr_address - base);
+        length = first + wr_address - base;
     }
 
     // move read pointer to writer
@@ -870,14 +903,14 @@ void Uthernet2::sendData(const size_t i)
     switch (socket.getStatus())
     {
     case W5100_SN_SR_SOCK_MACRAW:
-        sendDataMacRaw(i, data);
+        sendDataMacRaw(i, data, length);
         break;
     case W5100_SN_SR_SOCK_IPRAW:
-        sendDataIPRaw(i, data);
+        sendDataIPRaw(i, frame, length);
         break;
     case W5100_SN_SR_ESTABLISHED:
     case W5100_SN_SR_SOCK_UDP:
-        sendDataToSocket(i, data);
+        sendDataToSocket(i, data, length);
         break;
     case W5100_SN_SR_CLOSED:
 #ifdef U2_LOG_STATE
@@ -945,6 +978,8 @@ void Uthernet2::openSocket(const size_t i)
 {
     Socket &socket = mySockets[i];
     socket.clearFD();
+    myCaptureStreams[i].reset();
+    myMemory[socket.registerAddress + W5100_SN_CR] = 0;
 
     const uint8_t mr = myMemory[socket.registerAddress + W5100_SN_MR];
     const uint8_t protocol = mr & W5100_SN_MR_PROTO_MASK;
@@ -959,6 +994,30 @@ void Uthernet2::openSocket(const size_t i)
         return;
     }
 
+    switch (protocol)
+    {
+    case W5100_SN_MR_IPRAW_DNS:
+    case W5100_SN_MR_TCP_DNS:
+    case W5100_SN_MR_UDP_DNS:
+        if (!resolveDNS(i))
+        {
+            // the OPEN completes once the name is resolved (see updatePendingDNS())
+            // until then, as per a real W5100 processing a command, Sn_CR reads non-zero and Sn_SR reads SOCK_CLOSED
+            myMemory[socket.registerAddress + W5100_SN_CR] = W5100_SN_CR_OPEN;
+            return;
+        }
+        break;
+    }
+
+    completeOpenSocket(i);
+}
+
+void Uthernet2::completeOpenSocket(const size_t i)
+{
+    Socket &socket = mySockets[i];
+    const uint8_t mr = myMemory[socket.registerAddress + W5100_SN_MR];
+    const uint8_t protocol = mr & W5100_SN_MR_PROTO_MASK;
+
     switch (protocol)
     {
     case W5100_SN_MR_IPRAW:
@@ -982,16 +1041,8 @@ void Uthernet2::openSocket(const size_t i)
 #endif
     }
 
-    switch (protocol)
-    {
-    case W5100_SN_MR_IPRAW_DNS:
-    case W5100_SN_MR_TCP_DNS:
-    case W5100_SN_MR_UDP_DNS:
-        resolveDNS(i);
-        break;
-    }
-
     resetRXTXBuffers(i); // needed?
+    updateIPRawSockets();
 #ifdef U2_LOG_STATE
     LogFileOutput("U2: Open[%" SIZE_T_FMT "]: SR = %02x\n", i, socket.getStatus());
 #endif
@@ -1000,13 +1051,57 @@ void Uthernet2::openSocket(const size_t i)
 void Uthernet2::closeSocket(const size_t i)
 {
     Socket &socket = mySockets[i];
-    socket.clearFD();
+    captureSocketClose(i, true);
+    socket.clearFD();  // NB. also abandons a Virtual DNS OPEN that's in progress
+    myMemory[socket.registerAddress + W5100_SN_CR] = 0;
+    updateIPRawSockets();
 #ifdef U2_LOG_STATE
     LogFileOutput("U2: Close[%" SIZE_T_FMT "]\n", i);
 #endif
 }
 
-void Uthernet2::resolveDNS(const size_t i)
+void Uthernet2::captureSocketData(const size_t i, const bool outbound, const uint8_t * data, const size_t length, const uint32_t remoteAddress, const uint16_t remotePort)
+{
+    if (!myCapture)
+    {
+        return;
+    }
+
+    const Socket &socket = mySockets[i];
+    const bool tcp = socket.getStatus() == W5100_SN_SR_ESTABLISHED;
+
+    CaptureStream::Endpoint local;
+    CaptureStream::Endpoint remote;
+    getCaptureEndpoints(socket, myMemory, local, remote);
+    if (!tcp)
+    {
+        // recvfrom() only reports the peer of a UDP socket (and each datagram might have a different one)
+        remote.address = remoteAddress;
+        remote.port = remotePort;
+    }
+
+    const NetworkCapture::Direction direction = outbound ? NetworkCapture::OUTBOUND : NetworkCapture::INBOUND;
+    myCaptureStreams[i].data(*myCapture, myCaptureInterface, tcp, direction, local, remote, data, length);
+}
+
+void Uthernet2::captureSocketClose(const size_t i, const bool outbound)
+{
+    const Socket &socket = mySockets[i];
+    if (!myCapture || socket.getStatus() != W5100_SN_SR_ESTABLISHED)
+    {
+        return;
+    }
+
+    CaptureStream::Endpoint local;
+    CaptureStream::Endpoint remote;
+    getCaptureEndpoints(socket, myMemory, local, remote);
+
+    const NetworkCapture::Direction direction = outbound ? NetworkCapture::OUTBOUND : NetworkCapture::INBOUND;
+    myCaptureStreams[i].close(*myCapture, myCaptureInterface, direction, local, remote);
+}
+
+// Returns false if the lookup is pending (Sn_DIPR is written by updatePendingDNS())
+bool Uthernet2::resolveDNS(const size_t i)
 {
     Socket &socket = mySockets[i];
     uint32_t *dest = reinterpret_cast<uint32_t *>(myMemory.data() + socket.registerAddress + W5100_SN_DIPR0);
@@ -1017,18 +1112,43 @@ void Uthernet2::resolveDNS(const size_t i)
     {
         const uint8_t * start = myMemory.data() + socket.registerAddress + W5100_SN_DNS_NAME_BEGIN;
         const std::string name(start, start + length);
-        const std::map<std::string, uint32_t>::iterator it = myDNSCache.find(name);
-        if (it != myDNSCache.end())
+
+        // NB. never waits: a lookup that isn't cached is done by the resolver's worker threads
+        uint32_t address;
+        if (myDNSResolver->resolve(name, address) == DNSResolver::PENDING)
         {
-            *dest = it->second;
+            socket.pendingDNSName = name;
+#ifdef U2_LOG_STATE
+            LogFileOutput("U2: DNS[%" SIZE_T_FMT "]: %s pending\n", i, name.c_str());
+#endif
+            return false;
         }
-        else
+
+        *dest = address;
+#ifdef U2_LOG_STATE
+        LogFileOutput("U2: DNS[%" SIZE_T_FMT "]: %s = %s\n", i, name.c_str(), formatIP(*dest));
+#endif
+    }
+
+    return true;
+}
+
+void Uthernet2::updatePendingDNS()
+{
+    for (size_t i = 0; i < mySockets.size(); ++i)
+    {
+        Socket &socket = mySockets[i];
+        uint32_t address;
+        if (!socket.pendingDNSName.empty() && myDNSResolver->resolve(socket.pendingDNSName, address) == DNSResolver::RESOLVED)
         {
-            *dest = getHostByName(name);
-            myDNSCache[name] = *dest;
+            uint32_t *dest = reinterpret_cast<uint32_t *>(myMemory.data() + socket.registerAddress + W5100_SN_DIPR0);
+            *dest = address;
 #ifdef U2_LOG_STATE
-            LogFileOutput("U2: DNS[%" SIZE_T_FMT "]: %s = %s\n", i, name.c_str(), formatIP(*dest));
+            LogFileOutput("U2: DNS[%" SIZE_T_FMT "]: %s = %s\n", i, socket.pendingDNSName.c_str(), formatIP(address));
 #endif
+            socket.pendingDNSName.clear();
+            myMemory[socket.registerAddress + W5100_SN_CR] = 0;  // the deferred OPEN is done
+            completeOpenSocket(i);
         }
     }
 }
@@ -1073,6 +1193,15 @@ void Uthernet2::connectSocket(const size_t i)
 
 void Uthernet2::setCommandRegister(const size_t i, const uint8_t value)
 {
+    // a Virtual DNS OPEN is still in progress (Sn_CR is non-zero): only CLOSE can interrupt it
+    if (!mySockets[i].pendingDNSName.empty() && value != W5100_SN_CR_CLOSE && value != W5100_SN_CR_DISCON)
+    {
+#ifdef U2_LOG_STATE
+        LogFileOutput("U2: Command[%" SIZE_T_FMT "]: %02x rejected, DNS pending\n", i, value);
+#endif
+        return;
+    }
+
     switch (value)
     {
     case W5100_SN_CR_OPEN:
@@ -1206,6 +1335,7 @@ uint8_t Uthernet2::readValue()
 void Uthernet2::setIPProtocol(const size_t i, const uint16_t address, const uint8_t value)
 {
     myMemory[address] = value;
+    updateIPRawSockets();
 #ifdef U2_LOG_STATE
     LogFileOutput("U2: IP PROTO[%" SIZE_T_FMT "] = %d\n", i, value);
 #endif
@@ -1368,11 +1498,24 @@ void Uthernet2::Reset(const bool powerCycle)
         const std::string interfaceName = PCapBackend::GetRegistryInterface(m_slot);
         myNetworkBackend = GetFrame().CreateNetworkBackend(interfaceName);
         myARPCache.clear();
-        myDNSCache.clear();
+        myDNSResolver->clear();
+        myCapture = NetworkCapture::get();
+        if (myCapture)
+        {
+            myCaptureInterface = myCapture->addInterface(StrFormat("Uthernet II slot %u sockets", m_slot));
+        }
+        const std::string hosts = GetRegistryVirtualDNSHosts(m_slot);
+        if (!hosts.empty())
+        {
+            const size_t count = myDNSResolver->loadHostsFile(hosts);
+            LogFileOutput("U2: DNS: %" SIZE_T_FMT " names loaded from %s\n", count, hosts.c_str());
+        }
     }
 
     mySockets.clear();
     mySockets.resize(4);
+    myCaptureStreams.clear();
+    myCaptureStreams.resize(mySockets.size());
     myMemory.clear();
     myMemory.resize(W5100_MEM_SIZE, 0);
 
@@ -1403,6 +1546,8 @@ void Uthernet2::Reset(const bool powerCycle)
         // this is 0 if we support Virtual DNS
         myMemory[W5100_PTIMER]  = 0x28;
     }
+
+    updateIPRawSockets();
 }
 
 BYTE Uthernet2::IO_C0(WORD programcounter, WORD address, BYTE write, BYTE value, ULONG nCycles)
@@ -1521,13 +1666,134 @@ void Uthernet2::getMACAddress(const uint32_t address, const MACAddress * & mac)
     }
 }
 
-void Uthernet2::Update(const ULONG nExecutedCycles)
+// A single non-blocking readiness check of all the open sockets, once per Update():
+// . completes pending TCP connections (SYNSENT -> ESTABLISHED / CLOSED)
+// . flags the sockets with data (or a close / error) to read
+// so that the (frequent) reads of Sn_RX_RSR don't issue a recvfrom() each time.
+// NB. a plain poll() / select() is used: epoll / IOCP would need a syscall to (un)register each fd,
+// which is not worth it for at most 4 sockets.
+void Uthernet2::pollSockets()
 {
-    myNetworkBackend->update(nExecutedCycles);
+    const size_t maxSockets = 4;
+    _ASSERT(mySockets.size() <= maxSockets);
+
+#ifdef _WIN32
+    FD_SET readfds, writefds, exceptfds;
+    FD_ZERO(&readfds);
+    FD_ZERO(&writefds);
+    FD_ZERO(&exceptfds);
+    size_t count = 0;
+
+    for (const Socket &socket : mySockets)
+    {
+        const Socket::socket_t fd = socket.getFD();
+        if (fd == INVALID_SOCKET)
+        {
+            continue;
+        }
+        if (socket.getStatus() == W5100_SN_SR_SOCK_SYNSENT)
+        {
+            FD_SET(fd, &writefds);
+            FD_SET(fd, &exceptfds);
+            ++count;
+        }
+        else if (socket.isOpen() && !socket.rxReady)
+        {
+            FD_SET(fd, &readfds);
+            ++count;
+        }
+    }
+
+    if (count == 0)
+    {
+        return;  // select() fails if all sets are empty
+    }
+
+    const timeval timeout = {0, 0};
+    if (select(0, &readfds, &writefds, &exceptfds, &timeout) <= 0)
+    {
+        return;
+    }
+
     for (Socket &socket : mySockets)
     {
-        socket.process();
+        const Socket::socket_t fd = socket.getFD();
+        if (fd == INVALID_SOCKET)
+        {
+            continue;
+        }
+        if (socket.getStatus() == W5100_SN_SR_SOCK_SYNSENT)
+        {
+            if (FD_ISSET(fd, &writefds) || FD_ISSET(fd, &exceptfds))
+            {
+                socket.checkConnection();
+            }
+        }
+        else if (FD_ISSET(fd, &readfds))
+        {
+            socket.rxReady = true;
+        }
+    }
+#else
+    pollfd pfds[maxSockets];
+    size_t indices[maxSockets];
+    nfds_t count = 0;
+
+    for (size_t i = 0; i < mySockets.size(); ++i)
+    {
+        const Socket &socket = mySockets[i];
+        const Socket::socket_t fd = socket.getFD();
+        if (fd == INVALID_SOCKET)
+        {
+            continue;
+        }
+        if (socket.getStatus() == W5100_SN_SR_SOCK_SYNSENT)
+        {
+            pfds[count].events = POLLOUT;
+        }
+        else if (socket.isOpen() && !socket.rxReady)
+        {
+            pfds[count].events = POLLIN;
+        }
+        else
+        {
+            continue;
+        }
+        pfds[count].fd = fd;
+        pfds[count].revents = 0;
+        indices[count] = i;
+        ++count;
+    }
+
+    if (count == 0 || poll(pfds, count, 0) <= 0)
+    {
+        return;
+    }
+
+    for (nfds_t j = 0; j < count; ++j)
+    {
+        if (pfds[j].revents == 0)
+        {
+            continue;
+        }
+        Socket &socket = mySockets[indices[j]];
+        if (socket.getStatus() == W5100_SN_SR_SOCK_SYNSENT)
+        {
+            socket.checkConnection();
+        }
+        else
+        {
+            socket.rxReady = true;  // POLLIN, POLLHUP or POLLERR: recvfrom() will tell
+        }
     }
+#endif
+}
+
+void Uthernet2::Update(const ULONG nExecutedCycles)
+{
+    myNetworkBackend->update(nExecutedCycles);
+    pollSockets();
+    updatePendingDNS();
 }
 
 // Unit version history:
@@ -1648,8 +1914,16 @@ bool Uthernet2::LoadSnapshot(YamlLoadHelper &yamlLoadHelper, UINT version)
             mySockets[i].LoadSnapshot(yamlLoadHelper);
             yamlLoadHelper.PopMap();
         }
+
+        // a Virtual DNS OPEN was in progress: restart it, as the lookup isn't saved
+        if (myMemory[mySockets[i].registerAddress + W5100_SN_CR] == W5100_SN_CR_OPEN)
+        {
+            openSocket(i);
+        }
     }
 
+    updateIPRawSockets();
+
     return true;
 }
 
@@ -1671,3 +1945,12 @@ bool Uthernet2::GetRegistryVirtualDNS(UINT slot)
     RegLoadValue(regSection.c_str(), REGVALUE_UTHERNET_VIRTUAL_DNS, TRUE, &enabled);
     return enabled != 0;
 }
+
+// Optional hosts-style file to preload the Virtual DNS cache (entries never expire)
+std::string Uthernet2::GetRegistryVirtualDNSHosts(UINT slot)
+{
+    char filename[MAX_PATH];
+    const std::string regSection = RegGetConfigSlotSection(slot);
+    RegLoadString(regSection.c_str(), REGVALUE_UTHERNET_VIRTUAL_DNS_HOSTS, TRUE, filename, sizeof(filename), "");
+    return filename;
+}
@@ -6,6 +6,9 @@
 #include <map>
 
 class NetworkBackend;
+class NetworkCapture;
+class CaptureStream;
+class DNSResolver;
 struct MACAddress;
 
 struct Socket
@@ -25,11 +28,17 @@ struct Socket
     uint16_t sn_rx_wr;
     uint16_t sn_rx_rsr;
 
+    // cached readiness: set by Uthernet2::pollSockets(), cleared once recvfrom() has drained the socket
+    bool rxReady;
+
+    // Virtual DNS: name being resolved for an OPEN (which completes, and Sn_CR reads 0, once it's done)
+    std::string pendingDNSName;
+
     bool isOpen() const;
     void clearFD();
     void setStatus(const uint8_t status);
     void setFD(const socket_t fd, const uint8_t status);
-    void process();
+    void checkConnection();
 
     socket_t getFD() const;
     uint8_t getStatus() const;
@@ -81,6 +90,7 @@ public:
     // global registry functions
     static void SetRegistryVirtualDNS(UINT slot, const bool enabled);
     static bool GetRegistryVirtualDNS(UINT slot);
+    static std::string GetRegistryVirtualDNSHosts(UINT slot);
 
 private:
     bool myVirtualDNSEnabled; // extended virtualisation of DNS (not present in the real U II card)
@@ -91,6 +101,9 @@ private:
 
     std::vector<uint8_t> myMemory;
     std::vector<Socket> mySockets;
+    std::vector<uint8_t> myReceiveBuffer;  // scratch for recvfrom(), sized for the largest socket RX buffer
+    std::vector<uint8_t> myTransmitBuffer; // scratch for sendData(), room for the ETH2 + IPv4 headers and the largest socket TX buffer
+    std::vector<int> myIPRawSockets;       // IP protocol -> IPRAW socket receiving it (or -1), see updateIPRawSockets()
     uint8_t myModeRegister;
     uint16_t myDataAddress;
     std::shared_ptr<NetworkBackend> myNetworkBackend;
@@ -99,10 +112,19 @@ private:
     // but in the interest of speeding up the emulator
     // we introduce one
     std::map<uint32_t, MACAddress> myARPCache;
-    std::map<std::string, uint32_t> myDNSCache;
+    std::unique_ptr<DNSResolver> myDNSResolver;
+
+    // -net-capture: the data of the TCP & UDP sockets, synthesised into frames
+    std::shared_ptr<NetworkCapture> myCapture;
+    uint32_t myCaptureInterface;
+    std::vector<CaptureStream> myCaptureStreams;
 
     void getMACAddress(const uint32_t address, const MACAddress * & mac);
-    void resolveDNS(const size_t i);
+    bool resolveDNS(const size_t i);
+    void updatePendingDNS();
+
+    void captureSocketData(const size_t i, const bool outbound, const uint8_t * data, const size_t length, const uint32_t remoteAddress, const uint16_t remotePort);
+    void captureSocketClose(const size_t i, const bool outbound);
 
     void setSocketModeRegister(const size_t i, const uint16_t address, const uint8_t value);
     void setTXSizes(const uint16_t address, uint8_t value);
@@ -111,16 +133,19 @@ private:
     uint8_t getTXFreeSizeRegister(const size_t i, const size_t shift) const;
     uint8_t getRXDataSizeRegister(const size_t i, const size_t shift) const;
 
+    void updateIPRawSockets();
     void receiveOnePacketRaw();
     void receiveOnePacketIPRaw(const size_t i, const size_t lengthOfPayload, const uint8_t * payload, const uint32_t source, const uint8_t protocol, const int len);
     void receiveOnePacketMacRaw(const size_t i, const int size, uint8_t * data);
     void receiveOnePacketFromSocket(const size_t i);
     void receiveOnePacket(const size_t i);
+    void pollSockets();
     int receiveForMacAddress(const bool acceptAll, const int size, uint8_t * data, PacketDestination & packetDestination);
 
-    void sendDataIPRaw(const size_t i, std::vector<uint8_t> &data);
-    void sendDataMacRaw(const size_t i, std::vector<uint8_t> &data) const;
-    void sendDataToSocket(const size_t i, std::vector<uint8_t> &data);
+    // data is in myTransmitBuffer, after getETH2FrameHeaderSize() bytes reserved for the IPRAW headers
+    void sendDataIPRaw(const size_t i, uint8_t * frame, const size_t size);
+    void sendDataMacRaw(const size_t i, uint8_t * data, const size_t size) const;
+    void sendDataToSocket(const size_t i, const uint8_t * data, const size_t size);
     void sendData(const size_t i);
 
     void resetRXTXBuffers(const size_t i);
@@ -128,6 +153,7 @@ private:
 
     void openSystemSocket(const size_t i, const int type, const int protocol, const int status);
     void openSocket(const size_t i);
+    void completeOpenSocket(const size_t i);
     void closeSocket(const size_t i);
     void connectSocket(const size_t i);
 
@@ -37,6 +37,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "CardManager.h"
 #include "CPU.h"
 #include "Joystick.h"
+#include "InputRecorder.h"
 #include "Log.h"
 #include "ParallelPrinter.h"
 #include "Registry.h"
@@ -431,7 +432,7 @@ static void SetCurrentDir(const std::string & pathname)
 	SetCurrentImageDir(path);
 }
 
-static bool DoDiskInsert(const UINT slot, const int nDrive, LPCSTR szFileName)
+static bool DoDiskInsert(const UINT slot, const int nDrive, LPCSTR szFileName, LPCSTR szOverlayName)
 {
 	Disk2InterfaceCard& disk2Card = dynamic_cast<Disk2InterfaceCard&>(GetCardMgr().GetRef(slot));
 
@@ -444,14 +445,21 @@ static bool DoDiskInsert(const UINT slot, const int nDrive, LPCSTR szFileName)
 	std::string strPathName = GetFullPath(szFileName);
 	if (strPathName.empty()) return false;
 
-	ImageError_e Error = disk2Card.InsertDisk(nDrive, strPathName, IMAGE_USE_FILES_WRITE_PROTECT_STATUS, IMAGE_DONT_CREATE);
+	std::string strOverlayPathName;
+	if (szOverlayName && szOverlayName[0] != '\0')
+	{
+		strOverlayPathName = GetFullPath(szOverlayName);
+		if (strOverlayPathName.empty()) return false;
+	}
+
+	ImageError_e Error = disk2Card.InsertDisk(nDrive, strPathName, IMAGE_USE_FILES_WRITE_PROTECT_STATUS, IMAGE_DONT_CREATE, strOverlayPathName);
 	bool res = (Error == eIMAGE_ERROR_NONE);
 	if (res)
 		SetCurrentDir(strPathName);
 	return res;
 }
 
-static bool DoHardDiskInsert(const UINT slot, const int nDrive, LPCSTR szFileName)
+static bool DoHardDiskInsert(const UINT slot, const int nDrive, LPCSTR szFileName, LPCSTR szOverlayName)
 {
 	_ASSERT(GetCardMgr().QuerySlot(slot) == CT_GenericHDD);
 	if (GetCardMgr().QuerySlot(slot) != CT_GenericHDD)
@@ -466,14 +474,21 @@ static bool DoHardDiskInsert(const UINT slot, const int nDrive, LPCSTR szFileNam
 	std::string strPathName = GetFullPath(szFileName);
 	if (strPathName.empty()) return false;
 
-	BOOL bRes = dynamic_cast<HarddiskInterfaceCard&>(GetCardMgr().GetRef(slot)).Insert(nDrive, strPathName);
+	std::string strOverlayPathName;
+	if (szOverlayName && szOverlayName[0] != '\0')
+	{
+		strOverlayPathName = GetFullPath(szOverlayName);
+		if (strOverlayPathName.empty()) return false;
+	}
+
+	BOOL bRes = dynamic_cast<HarddiskInterfaceCard&>(GetCardMgr().GetRef(slot)).Insert(nDrive, strPathName, strOverlayPathName);
 	bool res = (bRes == TRUE);
 	if (res)
 		SetCurrentDir(strPathName);
 	return res;
 }
 
-void InsertFloppyDisks(const UINT slot, LPCSTR szImageName_drive[NUM_DRIVES], bool driveConnected[NUM_DRIVES], bool& bBoot)
+void InsertFloppyDisks(const UINT slot, LPCSTR szImageName_drive[NUM_DRIVES], LPCSTR szOverlayName_drive[NUM_DRIVES], bool driveConnected[NUM_DRIVES], bool& bBoot)
 {
 	_ASSERT(slot == 5 || slot == 6);
 
@@ -485,7 +500,7 @@ void InsertFloppyDisks(const UINT slot, LPCSTR szImageName_drive[NUM_DRIVES], bo
 	}
 	else if (szImageName_drive[DRIVE_1])
 	{
-		bRes = DoDiskInsert(slot, DRIVE_1, szImageName_drive[DRIVE_1]);
+		bRes = DoDiskInsert(slot, DRIVE_1, szImageName_drive[DRIVE_1], szOverlayName_drive[DRIVE_1]);
 		LogFileOutput("Init: S%d, DoDiskInsert(D1), res=%d\n", slot, bRes);
 		GetFrame().FrameRefreshStatus(DRAW_LEDS | DRAW_BUTTON_DRIVES | DRAW_DISK_STATUS);	// floppy activity LEDs and floppy buttons
 		bBoot = true;
@@ -497,7 +512,7 @@ void InsertFloppyDisks(const UINT slot, LPCSTR szImageName_drive[NUM_DRIVES], bo
 	}
 	else if (szImageName_drive[DRIVE_2])
 	{
-		bRes &= DoDiskInsert(slot, DRIVE_2, szImageName_drive[DRIVE_2]);
+		bRes &= DoDiskInsert(slot, DRIVE_2, szImageName_drive[DRIVE_2], szOverlayName_drive[DRIVE_2]);
 		LogFileOutput("Init: S%d, DoDiskInsert(D2), res=%d\n", slot, bRes);
 	}
 
@@ -505,7 +520,7 @@ void InsertFloppyDisks(const UINT slot, LPCSTR szImageName_drive[NUM_DRIVES], bo
 		GetFrame().FrameMessageBox("Failed to insert floppy disk(s) - see log file", "Warning", MB_ICONASTERISK | MB_OK);
 }
 
-void InsertHardDisks(const UINT slot, LPCSTR szImageName_harddisk[NUM_HARDDISKS], bool& bBoot)
+void InsertHardDisks(const UINT slot, LPCSTR szImageName_harddisk[NUM_HARDDISKS], LPCSTR szOverlayName_harddisk[NUM_HARDDISKS], bool& bBoot)
 {
 	_ASSERT(slot == 5 || slot == 7);
 
@@ -524,7 +539,7 @@ void InsertHardDisks(const UINT slot, LPCSTR szImageName_harddisk[NUM_HARDDISKS]
 	{
 		if (szImageName_harddisk[i])
 		{
-			res &= DoHardDiskInsert(slot, i, szImageName_harddisk[i]);
+			res &= DoHardDiskInsert(slot, i, szImageName_harddisk[i], szOverlayName_harddisk[i]);
 			LogFileOutput("Init: DoHardDiskInsert(HDD-%d), res=%d\n", i, res);
 
 			if (i == HARDDISK_1)
@@ -583,6 +598,9 @@ void GetAppleWindowTitle()
 	case MODE_PAUSED: g_pAppTitle += std::string(" [") + TITLE_PAUSED + "]"; break;
 	case MODE_STEPPING: g_pAppTitle += std::string(" [") + TITLE_STEPPING + "]"; break;
 	}
+
+	if (!Snapshot_GetStatus().empty())
+		g_pAppTitle += " [" + Snapshot_GetStatus() + "]";
 }
 
 //===========================================================================
@@ -600,6 +618,8 @@ void ResetMachineState()
 {
 	LogFileOutput("Apple II power-cycle\n");
 
+	GetInputRecorder().Record(InputRecorder::EV_POWER_CYCLE);
+
 	GetCardMgr().Reset(true);
 	g_bFullSpeed = 0;	// Might've hit reset in middle of InternalCpuExecute() - so beep may get (partially) muted
 
@@ -631,6 +651,8 @@ void ResetMachineState()
  // todo: consolidate CtrlReset() and ResetMachineState()
 void CtrlReset()
 {
+	GetInputRecorder().Record(InputRecorder::EV_CTRL_RESET);
+
 	if (IsAppleIIeOrAbove(GetApple2Type()))
 	{
 		// NB. RamWorks III manual (v1.41, pg 45):
@@ -5,8 +5,8 @@
 
 
 void LoadConfiguration(bool loadImages);
-void InsertFloppyDisks(const UINT slot, LPCSTR szImageName_drive[NUM_DRIVES], bool driveConnected[NUM_DRIVES], bool& bBoot);
-void InsertHardDisks(const UINT slot, LPCSTR szImageName_harddisk[NUM_HARDDISKS], bool& bBoot);
+void InsertFloppyDisks(const UINT slot, LPCSTR szImageName_drive[NUM_DRIVES], LPCSTR szOverlayName_drive[NUM_DRIVES], bool driveConnected[NUM_DRIVES], bool& bBoot);
+void InsertHardDisks(const UINT slot, LPCSTR szImageName_harddisk[NUM_HARDDISKS], LPCSTR szOverlayName_harddisk[NUM_HARDDISKS], bool& bBoot);
 void GetAppleWindowTitle();
 
 void CtrlReset();
@@ -34,6 +34,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "Utilities.h"
 #include "CmdLine.h"
 #include "Debug.h"
+#include "InputRecorder.h"
 #include "Keyboard.h"
 #include "Log.h"
 #include "Memory.h"
@@ -41,7 +42,9 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "MouseInterface.h"
 #include "ParallelPrinter.h"
 #include "Registry.h"
+#include "Rewind.h"
 #include "Riff.h"
+#include "Tfe/NetworkCapture.h"
 #include "SaveState.h"
 #include "SerialComms.h"
 #include "Speaker.h"
@@ -181,7 +184,8 @@ static void ContinueExecution(void)
 	g_bFullSpeed =	 (g_dwSpeed == SPEED_MAX) || 
 					 bScrollLock_FullSpeed ||
 					 (GetCardMgr().GetDisk2CardMgr().IsConditionForFullSpeed() && !Spkr_IsActive() && !GetCardMgr().GetMockingboardCardMgr().IsActiveToPreventFullSpeed()) ||
-					 IsDebugSteppingAtFullSpeed();
+					 IsDebugSteppingAtFullSpeed() ||
+					 GetInputRecorder().IsReplaying();
 
 	if (g_bFullSpeed)
 	{
@@ -220,8 +224,11 @@ static void ContinueExecution(void)
 	const UINT uCyclesToExecuteWithFeedback = (nCyclesWithFeedback >= 0) ? nCyclesWithFeedback
 																		 : 0;
 
-	const uint32_t uCyclesToExecute = (g_nAppMode == MODE_RUNNING)		? uCyclesToExecuteWithFeedback
-												/* MODE_STEPPING */ : 0;
+	uint32_t uCyclesToExecute = (g_nAppMode == MODE_RUNNING)		? uCyclesToExecuteWithFeedback
+										/* MODE_STEPPING */ : 0;
+
+	if (g_nAppMode == MODE_RUNNING)
+		uCyclesToExecute = GetInputRecorder().GetSliceCycles(uCyclesToExecute);	// replay: the recorded slice
 
 	const bool bVideoUpdate = !g_bFullSpeed;
 	const uint32_t uActualCyclesExecuted = CpuExecute(uCyclesToExecute, bVideoUpdate);
@@ -261,6 +268,9 @@ static void ContinueExecution(void)
 #endif
 		g_dwCyclesThisFrame -= dwClksPerFrame;
 
+		GetRewindBuffer().Capture();
+		Snapshot_Update(true);
+
 		if (g_bFullSpeed)
 			GetFrame().VideoRedrawScreenDuringFullSpeed(g_dwCyclesThisFrame);
 		else
@@ -330,6 +340,8 @@ void EnterMessageLoop(void)
 		}
 		else
 		{
+			Snapshot_Update(false);
+
 			if (g_nAppMode == MODE_DEBUG)
 				DebuggerUpdate();
 			else if (g_nAppMode == MODE_PAUSED)
@@ -637,6 +649,10 @@ static void OneTimeInitialization(HINSTANCE passinstance)
 			GetCardMgr().GetMockingboardCardMgr().OutputToRiff();
 	}
 
+	// Before the cards create their network backends
+	if (!g_cmdLine.netCaptureFile.empty())
+		NetworkCapture::open(g_cmdLine.netCaptureFile);
+
 	// Initialize COM - so we can use CoCreateInstance
 	// . DSInit() & DIMouse::DirectInputInit are done when g_hFrameWindow is created (WM_CREATE)
 	// . DDInit() is done in RepeatInitialization() by GetVideo().Initialize()
@@ -761,6 +777,13 @@ static void RepeatInitialization(void)
 		GetCardMgr().Insert(SLOT2, g_cmdLine.slotInsert[SLOT2]);
 	}
 
+	if (GetCardMgr().IsSSCInstalled())
+	{
+		GetCardMgr().GetSSC()->SetTcpPort(g_cmdLine.uSscTcpPort);
+		GetCardMgr().GetSSC()->SetTcpPacing(g_cmdLine.sscTcpPacing);
+		GetCardMgr().GetSSC()->SetTcpFlowControl(g_cmdLine.sscFlowControl);
+	}
+
 	if (g_cmdLine.enableDumpToRealPrinter && GetCardMgr().IsParallelPrinterCardInstalled())
 	{
 		GetCardMgr().GetParallelPrinterCard()->SetEnableDumpToRealPrinter(true);
@@ -805,6 +828,7 @@ static void RepeatInitialization(void)
 		else if (GetCardMgr().QuerySlot(i) == CT_GenericHDD)
 		{
 			dynamic_cast<HarddiskInterfaceCard&>(GetCardMgr().GetRef(i)).SetUserNumBlocks(g_cmdLine.uHarddiskNumBlocks);
+			dynamic_cast<HarddiskInterfaceCard&>(GetCardMgr().GetRef(i)).SetBlockCacheCapacity(g_cmdLine.uHarddiskCacheBlocks);
 			if (g_cmdLine.useHdcFirmwareV1)
 				dynamic_cast<HarddiskInterfaceCard&>(GetCardMgr().GetRef(i)).UseHdcFirmwareV1();
 			if (g_cmdLine.useHdcFirmwareV2)
@@ -892,18 +916,21 @@ static void RepeatInitialization(void)
 	// Pre: may need g_hFrameWindow for MessageBox errors
 	// Post: may enable HDD, required for MemInitialize()->MemInitializeIO()
 	{
+		if (!g_cmdLine.strImageCacheDir.empty())
+			ImageSetExtractCacheDir(g_cmdLine.strImageCacheDir);
+
 		bool temp = false;
-		InsertFloppyDisks(SLOT5, g_cmdLine.szImageName_drive[SLOT5], g_cmdLine.driveConnected[SLOT5], temp);
+		InsertFloppyDisks(SLOT5, g_cmdLine.szImageName_drive[SLOT5], g_cmdLine.szOverlayName_drive[SLOT5], g_cmdLine.driveConnected[SLOT5], temp);
 		g_cmdLine.szImageName_drive[SLOT5][DRIVE_1] = g_cmdLine.szImageName_drive[SLOT5][DRIVE_2] = NULL;	// Don't insert on a restart
 
-		InsertFloppyDisks(SLOT6, g_cmdLine.szImageName_drive[SLOT6], g_cmdLine.driveConnected[SLOT6], g_cmdLine.bBoot);
+		InsertFloppyDisks(SLOT6, g_cmdLine.szImageName_drive[SLOT6], g_cmdLine.szOverlayName_drive[SLOT6], g_cmdLine.driveConnected[SLOT6], g_cmdLine.bBoot);
 		g_cmdLine.szImageName_drive[SLOT6][DRIVE_1] = g_cmdLine.szImageName_drive[SLOT6][DRIVE_2] = NULL;	// Don't insert on a restart
 
-		InsertHardDisks(SLOT5, g_cmdLine.szImageName_harddisk[SLOT5], temp);
+		InsertHardDisks(SLOT5, g_cmdLine.szImageName_harddisk[SLOT5], g_cmdLine.szOverlayName_harddisk[SLOT5], temp);
 		for (UINT i = 0; i < NUM_HARDDISKS; i++)
 			g_cmdLine.szImageName_harddisk[SLOT5][i] = NULL;	// Don't insert on a restart
 
-		InsertHardDisks(SLOT7, g_cmdLine.szImageName_harddisk[SLOT7], g_cmdLine.bBoot);
+		InsertHardDisks(SLOT7, g_cmdLine.szImageName_harddisk[SLOT7], g_cmdLine.szOverlayName_harddisk[SLOT7], g_cmdLine.bBoot);
 		for (UINT i = 0; i < NUM_HARDDISKS; i++)
 			g_cmdLine.szImageName_harddisk[SLOT7][i] = NULL;	// Don't insert on a restart
 
@@ -937,6 +964,8 @@ static void RepeatInitialization(void)
 	MemInitialize();
 	LogFileOutput("Main: MemInitialize()\n");
 
+	GetRewindBuffer().SetSize(g_cmdLine.uRewindSeconds, g_cmdLine.uRewindMaxMB);
+
 	// Show About dialog after creating main window (need g_hFrameWindow)
 	if (bShowAboutDlg)
 	{
@@ -982,6 +1011,17 @@ static void RepeatInitialization(void)
 		g_cmdLine.bShutdown = true;
 	}
 
+	Snapshot_SetFormat(g_cmdLine.snapshotFormat);
+	Snapshot_SetAutoSaveInterval(g_cmdLine.uAutoSaveSeconds);
+
+	if (g_cmdLine.szRecordFilename)
+		GetInputRecorder().SetPendingRecord(g_cmdLine.szRecordFilename);
+	else if (g_cmdLine.szReplayFilename)
+	{
+		GetInputRecorder().SetPendingReplay(g_cmdLine.szReplayFilename, g_cmdLine.bReplayExit);
+		g_cmdLine.bBoot = true;	// Replay starts from the recording's snapshot on the 1st execution slice
+	}
+
 	if (g_cmdLine.szSnapshotName)
 	{
 		std::string strPathname(g_cmdLine.szSnapshotName);
@@ -1044,6 +1084,8 @@ static void Shutdown(void)
 	CoUninitialize();
 	LogFileOutput("Exit: CoUninitialize()\n");
 
+	NetworkCapture::close();	// before LogDone(), as it logs its stats
+
 	LogDone();
 
 	RiffFinishWriteFile();
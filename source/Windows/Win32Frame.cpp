@@ -10,6 +10,8 @@
 #include "CardManager.h"
 #include "Debugger/Debug.h"
 #include "Tfe/PCapBackend.h"
+#include "Tfe/VirtualSwitch.h"
+#include "Tfe/NetworkCapture.h"
 #include "DXSoundBuffer.h"
 #include "../resource/resource.h"
 
@@ -633,8 +635,13 @@ std::string Win32Frame::Video_GetScreenShotFolder() const
 
 std::shared_ptr<NetworkBackend> Win32Frame::CreateNetworkBackend(const std::string & interfaceName)
 {
-	std::shared_ptr<NetworkBackend> backend(new PCapBackend(interfaceName));
-	return backend;
+	std::shared_ptr<NetworkBackend> backend;
+	if (interfaceName == VirtualSwitchBackend::getName())
+		backend = std::make_shared<VirtualSwitchBackend>();
+	else
+		backend.reset(new PCapBackend(interfaceName));
+
+	return NetworkCapture::wrap(backend);	// -net-capture
 }
 
 std::shared_ptr<SoundBuffer> Win32Frame::CreateSoundBuffer(uint32_t dwBufferSize, uint32_t nSampleRate, int nChannels, const char* pszVoiceName)
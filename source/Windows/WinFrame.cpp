@@ -36,6 +36,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "Windows/Win32Frame.h"
 #include "Windows/AppleWin.h"
 #include "CmdLine.h"
+#include "InputRecorder.h"
 #include "Interface.h"
 #include "Keyboard.h"
 #include "Log.h"
@@ -48,6 +49,7 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "ParallelPrinter.h"
 #include "Pravets.h"
 #include "Registry.h"
+#include "Rewind.h"
 #include "SaveState.h"
 #include "SerialComms.h"
 #include "Uthernet1.h"
@@ -1081,6 +1083,7 @@ LRESULT Win32Frame::WndProc(
       LogFileOutput("WM_DESTROY\n");
       GetCommandListener().stop();
       DragAcceptFiles(window,0);
+	  GetInputRecorder().Stop();	// Before the VM is destroyed (as a recording ends with the final state's crc)
 	  if (!g_bRestart)	// GH#564: Only save-state on shutdown (not on a restart)
 		Snapshot_Shutdown();
       DebugDestroy();
@@ -1161,11 +1164,25 @@ LRESULT Win32Frame::WndProc(
 
     case WM_DROPFILES:
 	{
-		if (GetCardMgr().QuerySlot(SLOT6) == CT_Disk2)
+		char filename[MAX_PATH];
+		DragQueryFile((HDROP)wparam,0,filename,sizeof(filename));
+
+		// A hard disk image goes to the hard disk card's 1st drive, rather than failing as an unsupported floppy image
+		// . NB. just reads the image's header (or gets the cached type if it's been opened before)
+		eImageType imageType = eImageUNKNOWN;
+		ImageSniffFloppyOrHarddisk(filename, imageType);
+
+		if (imageType == eImageHDV && GetCardMgr().QuerySlot(SLOT7) == CT_GenericHDD)
+		{
+			HarddiskInterfaceCard& hddCard = dynamic_cast<HarddiskInterfaceCard&>(GetCardMgr().GetRef(SLOT7));
+			if (hddCard.Insert(HARDDISK_1, filename))
+				FrameRefreshStatus(DRAW_LEDS | DRAW_DISK_STATUS);
+			else
+				FrameMessageBox("Failed to insert harddisk - see log file", "Warning", MB_ICONASTERISK | MB_OK);
+		}
+		else if (GetCardMgr().QuerySlot(SLOT6) == CT_Disk2)
 		{
 			Disk2InterfaceCard& disk2Card = dynamic_cast<Disk2InterfaceCard&>(GetCardMgr().GetRef(SLOT6));
-			char filename[MAX_PATH];
-			DragQueryFile((HDROP)wparam,0,filename,sizeof(filename));
 			POINT point;
 			DragQueryPoint((HDROP)wparam,&point);
 			RECT rect;
@@ -1285,10 +1302,15 @@ LRESULT Win32Frame::WndProc(
 			SoundCore_SetFade(FADE_OUT);
 			if(GetPropertySheet().SaveStateSelectImage(window, true))
 			{
-				Snapshot_SaveState();
+				Snapshot_SaveStateAsync();
 			}
 			SoundCore_SetFade(FADE_IN);
 		}
+		else if (wparam == VK_F11 && KeybGetCtrlStatus())	// Rewind 1 second (Ctrl+F11)
+		{
+			if (GetRewindBuffer().IsEnabled() && (g_nAppMode == MODE_RUNNING || g_nAppMode == MODE_PAUSED))
+				GetRewindBuffer().StepBack(RewindBuffer::kFramesPerSecond);
+		}
 		else if (wparam == VK_F12)					// Load state (F12 or Ctrl+F12)
 		{
 			SoundCore_SetFade(FADE_OUT);
@@ -1879,60 +1901,13 @@ LRESULT Win32Frame::WndProc(
     }
 
     case WM_USER_SAVESTATE:		// Save state
-		Snapshot_SaveState();
+		Snapshot_SaveStateAsync();
 		break;
 
     case WM_USER_LOADSTATE:		// Load state
 		Snapshot_LoadState();
 		break;
 
-	case WM_USER_TCP_SERIAL:	// TCP serial events
-	{
-		WORD error = WSAGETSELECTERROR(lparam);
-		if (error != 0)
-		{
-			LogOutput("TCP Serial Winsock error 0x%X (%d)\r", error, error);
-			switch (error)
-			{
-			case WSAENETRESET:
-			case WSAECONNABORTED:
-			case WSAECONNRESET:
-			case WSAENOTCONN:
-			case WSAETIMEDOUT:
-				if (GetCardMgr().IsSSCInstalled())
-					GetCardMgr().GetSSC()->CommTcpSerialClose();
-				break;
-
-			default:
-				if (GetCardMgr().IsSSCInstalled())
-					GetCardMgr().GetSSC()->CommTcpSerialCleanup();
-				break;
-			}
-		}
-		else
-		{
-			WORD wSelectEvent = WSAGETSELECTEVENT(lparam);
-			switch(wSelectEvent)
-			{
-				case FD_ACCEPT:
-					if (GetCardMgr().IsSSCInstalled())
-						GetCardMgr().GetSSC()->CommTcpSerialAccept();
-					break;
-
-				case FD_CLOSE:
-					if (GetCardMgr().IsSSCInstalled())
-						GetCardMgr().GetSSC()->CommTcpSerialClose();
-					break;
-
-				case FD_READ:
-					if (GetCardMgr().IsSSCInstalled())
-						GetCardMgr().GetSSC()->CommTcpSerialReceive();
-					break;
-			}
-		}
-		break;
-	}
-
 	// Message posted by: WM_DDE_EXECUTE & Cmd-line boot
 	case WM_USER_BOOT:
 	{
@@ -2311,7 +2286,7 @@ void Win32Frame::ProcessDiskPopupMenu(HWND hwnd, POINT pt, const int iDrive)
 													"Please install CiderPress.\n"
 													"Otherwise set the path to CiderPress from Configuration->Disk.";
 
-		disk2Card.FlushCurrentTrack(iDrive);
+		disk2Card.FlushCurrentTrack(iDrive, true);
 
 		//if(!filename1.compare("\"\"") == false) //Do not use this, for some reason it does not work!!!
 		if(!filename1.compare(sFileNameEmpty) )
@@ -26,27 +26,122 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 #include "YamlHelper.h"
 #include "Log.h"
 
+#include "zlib.h"
+
 #include <sstream>
 
+#ifdef _WIN32
+#include <io.h>		// _commit()
+#else
+#include <unistd.h>	// fsync()
+#endif
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define YAML_HEX_SSE2
+#include <emmintrin.h>
+#endif
+
 int YamlHelper::InitParser(const char* pPathname)
 {
-	m_hFile = fopen(pPathname, "r");
+	m_hFile = fopen(pPathname, "rb");
 	if (m_hFile == NULL)
 	{
 		return 0;
 	}
 
+	UINT32 id = 0;
+	m_bBinary = (fread(&id, sizeof(id), 1, m_hFile) == 1) && (id == kYamlBinaryID);
+
+	if (m_bBinary)
+	{
+		if (!InitBinary())
+			return 0;
+	}
+	else
+	{
+		// Re-open as text
+		fclose(m_hFile);
+		m_hFile = fopen(pPathname, "r");
+		if (m_hFile == NULL)
+		{
+			return 0;
+		}
+	}
+
 	if (!yaml_parser_initialize(&m_parser))
 	{
 		return 0;
 	}
 
 	// Note: C/C++ > Pre-Processor: YAML_DECLARE_STATIC;
-	yaml_parser_set_input_file(&m_parser, m_hFile);
+	if (m_bBinary)
+	{
+		yaml_parser_set_input_string(&m_parser, (const unsigned char*)m_yamlText.data(), m_yamlText.size());
+	}
+	else
+	{
+		m_pMemoryBlobs = &m_textBlobs;
+		yaml_parser_set_input(&m_parser, FilterReadHandler, this);
+	}
+
+	return 1;
+}
+
+// Parse an in-memory save-state (see Snapshot_Capture())
+// Pre: snapshot is unchanged until FinaliseParser()
+int YamlHelper::InitParser(const MachineSnapshot& snapshot)
+{
+	m_bBinary = true;
+	m_bInMemory = true;
+	m_pMemoryBlobs = &snapshot.blobs;
+
+	if (!yaml_parser_initialize(&m_parser))
+	{
+		return 0;
+	}
+
+	yaml_parser_set_input_string(&m_parser, (const unsigned char*)snapshot.yaml.data(), snapshot.yaml.size());
 
 	return 1;
 }
 
+// Read the binary save-state's YAML text & blob directory (the blobs are read by LoadMemory())
+// . the header & directory are checked against the file's size, so a truncated or corrupt file can't size a huge allocation
+bool YamlHelper::InitBinary(void)
+{
+	if (fseek(m_hFile, 0, SEEK_END) != 0)
+		return false;
+
+	const long fileSize = ftell(m_hFile);
+
+	YamlBinaryHdr hdr;
+	if (fileSize < 0 || fseek(m_hFile, 0, SEEK_SET) != 0 || fread(&hdr, sizeof(hdr), 1, m_hFile) != 1)
+		return false;
+
+	if (hdr.version != kYamlBinaryVersion)
+		return false;
+
+	if ((UINT64)hdr.yamlOffset + hdr.yamlSize > (UINT64)fileSize
+		|| (UINT64)hdr.dirOffset + (UINT64)hdr.numBlobs * sizeof(YamlBinaryBlob) > (UINT64)fileSize)
+		return false;
+
+	m_yamlText.resize(hdr.yamlSize);
+	if (hdr.yamlSize && (fseek(m_hFile, hdr.yamlOffset, SEEK_SET) != 0 || fread(&m_yamlText[0], 1, hdr.yamlSize, m_hFile) != hdr.yamlSize))
+		return false;
+
+	m_blobs.resize(hdr.numBlobs);
+	if (hdr.numBlobs && (fseek(m_hFile, hdr.dirOffset, SEEK_SET) != 0 || fread(&m_blobs[0], sizeof(YamlBinaryBlob), hdr.numBlobs, m_hFile) != hdr.numBlobs))
+		return false;
+
+	for (UINT i = 0; i < hdr.numBlobs; i++)
+	{
+		if ((UINT64)m_blobs[i].offset + m_blobs[i].size > (UINT64)fileSize)
+			return false;
+	}
+
+	return true;
+}
+
 void YamlHelper::FinaliseParser(void)
 {
 	if (m_hFile)
@@ -54,6 +149,18 @@ void YamlHelper::FinaliseParser(void)
 
 	m_hFile = NULL;
 
+	m_bBinary = false;
+	m_bInMemory = false;
+	m_yamlText.clear();
+	m_blobs.clear();
+	m_pMemoryBlobs = NULL;
+
+	m_textBlobs.clear();
+	m_memoryBlock.blob = -1;
+	m_filterOut.clear();
+	m_filterPos = 0;
+	m_bFilterEof = false;
+
 	yaml_event_delete(&m_newEvent);
 	yaml_parser_delete(&m_parser);
 }
@@ -272,6 +379,61 @@ void YamlHelper::MakeAsciiToHexTable(void)
 		m_AsciiToHex[i] = i - 'a' + 0xA;
 }
 
+#ifdef YAML_HEX_SSE2
+// 16 hex chars to 16 nibbles (either case). Returns false if any char isn't a hex digit
+static inline bool HexCharsToNibbles(const __m128i chars, __m128i& nibbles)
+{
+	const __m128i lower = _mm_or_si128(chars, _mm_set1_epi8(0x20));	// NB. only used for 'A'-'F' & 'a'-'f'
+	const __m128i isDigit = _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('0'-1)), _mm_cmplt_epi8(chars, _mm_set1_epi8('9'+1)));
+	const __m128i isAlpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a'-1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('f'+1)));
+
+	if (_mm_movemask_epi8(_mm_or_si128(isDigit, isAlpha)) != 0xFFFF)
+		return false;
+
+	nibbles = _mm_or_si128(_mm_and_si128(isDigit, _mm_sub_epi8(chars, _mm_set1_epi8('0'))),
+						   _mm_and_si128(isAlpha, _mm_sub_epi8(lower, _mm_set1_epi8('a'-10))));
+	return true;
+}
+
+// 16 nibbles (hi,lo,hi,lo...) to 8 bytes, in the low byte of each 16-bit lane
+static inline __m128i NibblesToBytes(const __m128i nibbles)
+{
+	const __m128i hi = _mm_slli_epi16(_mm_and_si128(nibbles, _mm_set1_epi16(0x00FF)), 4);
+	const __m128i lo = _mm_srli_epi16(nibbles, 8);
+	return _mm_or_si128(hi, lo);
+}
+#endif
+
+// Decode size bytes from 2*size hex chars. Returns false if any char isn't a hex digit
+bool YamlHelper::HexDecode(BYTE* pDst, const char* pSrc, const UINT size)
+{
+	UINT i = 0;
+
+#ifdef YAML_HEX_SSE2
+	for (; i + 16 <= size; i += 16)
+	{
+		__m128i nibbles0, nibbles1;
+		if (!HexCharsToNibbles(_mm_loadu_si128((const __m128i*)(pSrc + i*2)), nibbles0) ||
+			!HexCharsToNibbles(_mm_loadu_si128((const __m128i*)(pSrc + i*2 + 16)), nibbles1))
+			return false;
+
+		_mm_storeu_si128((__m128i*)(pDst + i), _mm_packus_epi16(NibblesToBytes(nibbles0), NibblesToBytes(nibbles1)));
+	}
+#endif
+
+	for (; i < size; i++)
+	{
+		const BYTE ah = m_AsciiToHex[ (BYTE)pSrc[i*2] ];
+		const BYTE al = m_AsciiToHex[ (BYTE)pSrc[i*2+1] ];
+		if ((ah | al) & 0x80)
+			return false;
+
+		pDst[i] = (ah<<4) | al;
+	}
+
+	return true;
+}
+
 UINT YamlHelper::LoadMemory(MapYaml& mapYaml, const LPBYTE pMemBase, const size_t kAddrSpaceSize, const UINT offset)
 {
 	UINT bytes = 0;
@@ -290,23 +452,24 @@ UINT YamlHelper::LoadMemory(MapYaml& mapYaml, const LPBYTE pMemBase, const size_
 			throw std::runtime_error("Memory: unexpected sub-map");
 
 		const char* pValue = it->second.value.c_str();
+
+		if (*pValue == '$')
+		{
+			bytes += ReadBlob(pValue, pDst, pDstEnd - pDst);
+			continue;
+		}
+
 		size_t len = strlen(pValue);
 		if (len & 1)
 			throw std::runtime_error("Memory: hex data must be an even number of nibbles on line address: " + it->first);
 
-		for (UINT i = 0; i<len; i+=2)
-		{
-			if (pDst >= pDstEnd)
-				throw std::runtime_error("Memory: hex data overflowed address space on line address: " + it->first);
+		if (pDst + len/2 > pDstEnd)
+			throw std::runtime_error("Memory: hex data overflowed address space on line address: " + it->first);
 
-			BYTE ah = m_AsciiToHex[ (BYTE)(*pValue++) ];
-			BYTE al = m_AsciiToHex[ (BYTE)(*pValue++) ];
-			if ((ah | al) & 0x80)
-				throw std::runtime_error("Memory: hex data contains illegal character on line address: " + it->first);
+		if (!HexDecode(pDst, pValue, (UINT)(len/2)))
+			throw std::runtime_error("Memory: hex data contains illegal character on line address: " + it->first);
 
-			*pDst++ = (ah<<4) | al;
-			bytes++;
-		}
+		bytes += (UINT)(len/2);
 	}
 
 	mapYaml.clear();
@@ -316,6 +479,183 @@ UINT YamlHelper::LoadMemory(MapYaml& mapYaml, const LPBYTE pMemBase, const size_
 
 //-------------------------------------
 
+// YAML save-state: libyaml's input handler
+// . memory lines ("AAAA: <hex>") are decoded here, so libyaml doesn't have to scan them and ParseMap() doesn't have to store them
+// . contiguous lines are merged into one blob, and replaced by a single "AAAA: $<blob#>" line (as per a binary save-state)
+// . anything else (inc. a malformed memory line) is passed through unchanged, so LoadMemory() reports any errors as before
+int YamlHelper::FilterReadHandler(void* pData, unsigned char* pBuffer, size_t size, size_t* pSizeRead)
+{
+	return ((YamlHelper*)pData)->FilterRead(pBuffer, size, pSizeRead);
+}
+
+int YamlHelper::FilterRead(unsigned char* pBuffer, size_t size, size_t* pSizeRead)
+{
+	m_filterOut.erase(0, m_filterPos);
+	m_filterPos = 0;
+
+	while (m_filterOut.size() < size && !m_bFilterEof)
+	{
+		if (!ReadLine(m_line))
+		{
+			if (ferror(m_hFile))
+				return 0;
+
+			FlushMemoryBlock();
+			m_bFilterEof = true;
+			break;
+		}
+
+		if (!AddMemoryLine(m_line))
+		{
+			FlushMemoryBlock();
+			m_filterOut += m_line;
+		}
+	}
+
+	const size_t n = (m_filterOut.size() < size) ? m_filterOut.size() : size;
+	memcpy(pBuffer, m_filterOut.data(), n);
+	m_filterPos = n;
+	*pSizeRead = n;
+	return 1;
+}
+
+bool YamlHelper::ReadLine(std::string& line)
+{
+	line.clear();
+
+	char buffer[256];
+	while (fgets(buffer, sizeof(buffer), m_hFile))
+	{
+		line += buffer;
+		if (line[line.size()-1] == '\n')
+			break;
+	}
+
+	return !line.empty();
+}
+
+static inline bool IsUpperHexDigit(const char c)
+{
+	return (c >= '0' && c <= '9') || (c >= 'A' && c <= 'F');
+}
+
+// Returns false if not a memory line, ie. "<indent>AAAA: <hex>" as written by YamlSaveHelper::SaveMemory()
+bool YamlHelper::AddMemoryLine(const std::string& line)
+{
+	size_t i = 0;
+	while (i < line.size() && line[i] == ' ')
+		i++;
+	const UINT indent = (UINT)i;
+
+	while (i < line.size() && IsUpperHexDigit(line[i]))
+		i++;
+	const size_t keyEnd = i;
+	if (keyEnd - indent < 4 || keyEnd - indent > 8 || line.compare(keyEnd, 2, ": ") != 0)
+		return false;
+
+	const size_t valueStart = keyEnd + 2;
+	size_t valueEnd = line.size();
+	if (valueEnd > valueStart && line[valueEnd-1] == '\n') valueEnd--;
+	if (valueEnd > valueStart && line[valueEnd-1] == '\r') valueEnd--;
+
+	const size_t len = valueEnd - valueStart;
+	if (len < 16 || (len & 1))	// NB. SaveMemory() writes multiples of 8 bytes
+		return false;
+
+	const UINT addr = strtoul(line.c_str() + indent, NULL, 16);
+
+	if (m_memoryBlock.blob >= 0 &&
+		(indent != m_memoryBlock.indent || addr != m_memoryBlock.addr + m_textBlobs[m_memoryBlock.blob].size()))
+		FlushMemoryBlock();
+
+	if (m_memoryBlock.blob < 0)
+	{
+		m_memoryBlock.key = line.substr(0, keyEnd);
+		m_memoryBlock.indent = indent;
+		m_memoryBlock.addr = addr;
+		m_memoryBlock.blob = (int)m_textBlobs.size();
+		m_textBlobs.push_back(std::vector<BYTE>());
+	}
+
+	std::vector<BYTE>& blob = m_textBlobs[m_memoryBlock.blob];
+	const size_t oldSize = blob.size();
+	blob.resize(oldSize + len/2);
+
+	if (!HexDecode(&blob[oldSize], line.c_str() + valueStart, (UINT)(len/2)))
+	{
+		blob.resize(oldSize);
+		if (oldSize == 0)
+		{
+			m_textBlobs.pop_back();
+			m_memoryBlock.blob = -1;
+		}
+		return false;
+	}
+
+	return true;
+}
+
+void YamlHelper::FlushMemoryBlock(void)
+{
+	if (m_memoryBlock.blob < 0)
+		return;
+
+	m_filterOut += StrFormat("%s: $%d\n", m_memoryBlock.key.c_str(), m_memoryBlock.blob);
+	m_memoryBlock.blob = -1;
+}
+
+//-------------------------------------
+
+// Read a binary save-state's blob (value is "$<blob#>") directly into the memory
+UINT YamlHelper::ReadBlob(const char* pValue, const LPBYTE pDst, const size_t dstSize)
+{
+	const UINT idx = strtoul(pValue+1, NULL, 10);
+
+	if (m_pMemoryBlobs)
+	{
+		if (idx >= m_pMemoryBlobs->size())
+			throw std::runtime_error(std::string("Memory: bad binary data reference: ") + pValue);
+
+		const std::vector<BYTE>& data = (*m_pMemoryBlobs)[idx];
+		if (data.size() > dstSize)
+			throw std::runtime_error(std::string(m_bBinary ? "Memory: binary data overflowed address space: " : "Memory: hex data overflowed address space: ") + pValue);
+
+		memcpy(pDst, &data[0], data.size());
+		return (UINT)data.size();
+	}
+
+	if (idx >= m_blobs.size())
+		throw std::runtime_error(std::string("Memory: bad binary data reference: ") + pValue);
+
+	const YamlBinaryBlob& blob = m_blobs[idx];
+	if (blob.rawSize > dstSize)
+		throw std::runtime_error(std::string("Memory: binary data overflowed address space: ") + pValue);
+
+	if (fseek(m_hFile, blob.offset, SEEK_SET) != 0)
+		throw std::runtime_error(std::string("Memory: failed to read binary data: ") + pValue);
+
+	if (blob.flags & kYamlBinaryBlobZlib)
+	{
+		std::vector<BYTE> packed(blob.size);
+		uLongf rawSize = blob.rawSize;
+		if (fread(&packed[0], 1, blob.size, m_hFile) != blob.size ||
+			uncompress(pDst, &rawSize, &packed[0], blob.size) != Z_OK || rawSize != blob.rawSize)
+			throw std::runtime_error(std::string("Memory: failed to inflate binary data: ") + pValue);
+	}
+	else
+	{
+		if (blob.size != blob.rawSize || fread(pDst, 1, blob.size, m_hFile) != blob.size)
+			throw std::runtime_error(std::string("Memory: failed to read binary data: ") + pValue);
+	}
+
+	if (crc32(0, pDst, blob.rawSize) != blob.crc)
+		throw std::runtime_error(std::string("Memory: binary data CRC mismatch: ") + pValue);
+
+	return blob.rawSize;
+}
+
+//-------------------------------------
+
 INT YamlLoadHelper::LoadInt(const std::string key)
 {
 	bool bFound;
@@ -420,13 +760,29 @@ void YamlLoadHelper::LoadMemory(std::vector<BYTE>& memory, const size_t size, co
 
 //-------------------------------------
 
+void YamlSaveHelper::Write(const char* pData, const size_t size)
+{
+	if (m_hFile)
+		fwrite(pData, 1, size, m_hFile);
+	else
+		m_pSnapshot->yaml.append(pData, size);
+}
+
+void YamlSaveHelper::VPrintf(const char* format, va_list vl)
+{
+	if (m_hFile)
+		vfprintf(m_hFile, format, vl);
+	else
+		m_pSnapshot->yaml.append(StrFormatV(format, vl));
+}
+
 void YamlSaveHelper::Save(const char* format, ...)
 {
-	fwrite(m_szIndent, 1, m_indent, m_hFile);
+	Write(m_szIndent, m_indent);
 
 	va_list vl;
 	va_start(vl, format);
-	vfprintf(m_hFile, format, vl);
+	VPrintf(format, vl);
 	va_end(vl);
 }
 
@@ -543,11 +899,50 @@ void YamlSaveHelper::SaveDouble(const char* key, double value)
 }
 
 // Pre: uMemSize must be multiple of 8
+// Encode size bytes as 2*size (uppercase) hex chars. NB. No null terminator
+static void HexEncode(char* pDst, const BYTE* pSrc, const UINT size)
+{
+	static const char szHex[] = "0123456789ABCDEF";
+	UINT i = 0;
+
+#ifdef YAML_HEX_SSE2
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	const __m128i nine = _mm_set1_epi8(9);
+	const __m128i ascii0 = _mm_set1_epi8('0');
+	const __m128i alphaAdjust = _mm_set1_epi8('A'-'0'-10);
+
+	for (; i + 16 <= size; i += 16)
+	{
+		const __m128i data = _mm_loadu_si128((const __m128i*)(pSrc + i));
+		const __m128i hi = _mm_and_si128(_mm_srli_epi16(data, 4), mask);
+		const __m128i lo = _mm_and_si128(data, mask);
+
+		__m128i hiChars = _mm_add_epi8(hi, ascii0);
+		__m128i loChars = _mm_add_epi8(lo, ascii0);
+		hiChars = _mm_add_epi8(hiChars, _mm_and_si128(_mm_cmpgt_epi8(hi, nine), alphaAdjust));
+		loChars = _mm_add_epi8(loChars, _mm_and_si128(_mm_cmpgt_epi8(lo, nine), alphaAdjust));
+
+		_mm_storeu_si128((__m128i*)(pDst + i*2), _mm_unpacklo_epi8(hiChars, loChars));
+		_mm_storeu_si128((__m128i*)(pDst + i*2 + 16), _mm_unpackhi_epi8(hiChars, loChars));
+	}
+#endif
+
+	for (; i < size; i++)
+	{
+		const BYTE d = pSrc[i];
+		pDst[i*2] = szHex[d>>4];
+		pDst[i*2+1] = szHex[d&0xf];
+	}
+}
+
 void YamlSaveHelper::SaveMemory(const LPBYTE pMemBase, const UINT uMemSize, const UINT offset/*=0*/)
 {
 	if (uMemSize & 7)
 		throw std::runtime_error("Memory: size must be multiple of 8");
 
+	if (m_bBinary)
+		return SaveMemoryBlob(pMemBase, uMemSize, offset);
+
 	const UINT kIndent = m_indent;
 
 	const UINT kStride = 64;
@@ -568,40 +963,213 @@ void YamlSaveHelper::SaveMemory(const LPBYTE pMemBase, const UINT uMemSize, cons
 		*pDst++ = ':';
 		*pDst++ = ' ';
 
-		LPBYTE pMem = pMemBase + addr;
-
-		for (UINT i=0; i<kStride; i+=8)
+		UINT stride = kStride;
+		if (addr + kStride > (uMemSize + offset))	// Support short final line (still multiple of 8 bytes)
 		{
-			if (addr + i >= (uMemSize + offset))	// Support short final line (still multiple of 8 bytes)
-			{
-				lineSize = lineSize - 2*kStride + 2*i;
-				break;
-			}
-
-			BYTE d;
-			d = *pMem++; *pDst++ = szHex[d>>4]; *pDst++ = szHex[d&0xf];
-			d = *pMem++; *pDst++ = szHex[d>>4]; *pDst++ = szHex[d&0xf];
-			d = *pMem++; *pDst++ = szHex[d>>4]; *pDst++ = szHex[d&0xf];
-			d = *pMem++; *pDst++ = szHex[d>>4]; *pDst++ = szHex[d&0xf];
-
-			d = *pMem++; *pDst++ = szHex[d>>4]; *pDst++ = szHex[d&0xf];
-			d = *pMem++; *pDst++ = szHex[d>>4]; *pDst++ = szHex[d&0xf];
-			d = *pMem++; *pDst++ = szHex[d>>4]; *pDst++ = szHex[d&0xf];
-			d = *pMem++; *pDst++ = szHex[d>>4]; *pDst++ = szHex[d&0xf];
+			stride = (uMemSize + offset) - addr;
+			lineSize = lineSize - 2*kStride + 2*stride;
 		}
 
+		HexEncode(pDst, pMemBase + addr, stride);
+		pDst += 2*stride;
+
 		*pDst++ = '\n';
 		*pDst = 0;	// For debugger
 
-		fwrite(pLine, 1, lineSize-1, m_hFile);	// -1 so don't write null terminator
+		Write(pLine, lineSize-1);	// -1 so don't write null terminator
 	}
 
 	delete [] pLine;
 }
 
+// Binary save-state: the memory is written after the YAML text (see FinaliseBinary()), so just reference it
+void YamlSaveHelper::SaveMemoryBlob(const LPBYTE pMemBase, const UINT uMemSize, const UINT offset)
+{
+	if (uMemSize == 0)
+		return;
+
+	Save("%04X: $%u\n", offset, m_numBlobs);
+
+	const LPBYTE pMem = pMemBase + offset;
+
+	if (m_pSnapshot)
+	{
+		std::vector< std::pair<const BYTE*, UINT> >& blobSrc = m_pSnapshot->blobSrc;
+		if (m_numBlobs == blobSrc.size())
+			blobSrc.push_back(std::make_pair((const BYTE*)pMem, uMemSize));
+		else
+			blobSrc[m_numBlobs] = std::make_pair((const BYTE*)pMem, uMemSize);
+	}
+
+	std::vector< std::vector<BYTE> >& blobs = m_pSnapshot ? m_pSnapshot->blobs : m_blobs;
+	if (m_numBlobs == blobs.size())
+		blobs.push_back(std::vector<BYTE>());
+
+	if (m_pfnIsTracked && m_pfnIsTracked(pMem, uMemSize))
+		blobs[m_numBlobs++].clear();
+	else
+		blobs[m_numBlobs++].assign(pMem, pMem + uMemSize);
+}
+
+// Parse an in-memory save-state's "<indent><addr>: $<blob#>" line (see SaveMemoryBlob())
+static bool ParseBlobLine(const char* pLine, const char* pEnd, UINT& indent, UINT& addr, UINT& blob)
+{
+	const char* p = pLine;
+	while (p < pEnd && *p == ' ')
+		p++;
+	indent = (UINT)(p - pLine);
+
+	const char* pAddr = p;
+	while (p < pEnd && IsUpperHexDigit(*p))
+		p++;
+	if (p - pAddr < 4 || pEnd - p < 4 || p[0] != ':' || p[1] != ' ' || p[2] != '$')
+		return false;
+	addr = strtoul(pAddr, NULL, 16);
+
+	p += 3;
+	const char* pBlob = p;
+	while (p < pEnd && *p >= '0' && *p <= '9')
+		p++;
+	if (p == pBlob || p != pEnd-1 || *p != '\n')
+		return false;
+	blob = strtoul(pBlob, NULL, 10);
+
+	return true;
+}
+
+// Write an in-memory save-state (see Snapshot_Capture()) to this file, in this file's format (YAML or binary)
+// . the YAML text is copied as-is, except that each memory blob is re-saved by SaveMemory()
+// . so the emulation thread only pays for the capture, and the (slow) hex or zlib encoding can be done on another thread
+// Pre: snapshot was captured with all memory copied (ie. no tracked blobs)
+void YamlSaveHelper::SaveSnapshot(const MachineSnapshot& snapshot)
+{
+	_ASSERT(m_hFile);
+	const std::string& yaml = snapshot.yaml;
+
+	// Skip the in-memory document's start & end markers, as this file's ctor & dtor write their own
+	size_t pos = (yaml.compare(0, 4, "---\n") == 0) ? 4 : 0;
+	size_t end = yaml.size();
+	if (end >= pos + 4 && yaml.compare(end - 4, 4, "...\n") == 0)
+		end -= 4;
+
+	while (pos < end)
+	{
+		size_t eol = yaml.find('\n', pos);
+		eol = (eol == std::string::npos || eol >= end) ? end : eol + 1;
+
+		const char* pLine = yaml.data() + pos;
+		UINT indent, addr, blob;
+		if (!ParseBlobLine(pLine, yaml.data() + eol, indent, addr, blob))
+		{
+			Write(pLine, eol - pos);
+		}
+		else
+		{
+			if (blob >= snapshot.blobs.size() || snapshot.blobs[blob].empty())
+				throw std::runtime_error("Save error: memory not captured");
+
+			const std::vector<BYTE>& data = snapshot.blobs[blob];
+			const int oldIndent = m_indent;
+			m_indent = indent;
+			SaveMemory(const_cast<LPBYTE>(&data[0]) - addr, (UINT)data.size(), addr);
+			m_indent = oldIndent;
+		}
+
+		pos = eol;
+	}
+
+	if (ferror(m_hFile))
+		throw std::runtime_error("Save error");
+}
+
+// File only: write the YAML trailer (& for binary: the blobs & directory, then the header), then close the file
+// . doesn't throw: a failed write is just returned (and the dtor doesn't call this, see ~YamlSaveHelper())
+// . bSync: also flush the file to the disk (eg. before it's renamed over an old file)
+// . returns false if any of this (or any earlier write to the file) failed
+bool YamlSaveHelper::Finalise(const bool bSync /*=false*/)
+{
+	_ASSERT(m_hFile);
+	if (!m_hFile)
+		return false;
+
+	fprintf(m_hFile, "...\n");
+
+	bool bRes = m_bBinary ? FinaliseBinary() : true;
+	bRes = (fflush(m_hFile) == 0) && !ferror(m_hFile) && bRes;
+
+	if (bRes && bSync)
+	{
+#ifdef _WIN32
+		bRes = _commit(_fileno(m_hFile)) == 0;	// ie. FlushFileBuffers()
+#else
+		bRes = fsync(fileno(m_hFile)) == 0;
+#endif
+	}
+
+	bRes = (fclose(m_hFile) == 0) && bRes;
+	m_hFile = NULL;
+
+	return bRes;
+}
+
+bool YamlSaveHelper::FinaliseBinary(void)
+{
+	YamlBinaryHdr hdr;
+	hdr.id = kYamlBinaryID;
+	hdr.version = kYamlBinaryVersion;
+	hdr.yamlOffset = sizeof(hdr);
+	hdr.yamlSize = ftell(m_hFile) - sizeof(hdr);
+	hdr.numBlobs = (UINT32)m_blobs.size();
+
+	std::vector<YamlBinaryBlob> dir(m_blobs.size());
+	std::vector<BYTE> packed;
+	const BYTE zeros[kYamlBinaryAlign] = {0};
+
+	for (UINT i = 0; i < m_blobs.size(); i++)
+	{
+		const std::vector<BYTE>& raw = m_blobs[i];
+		YamlBinaryBlob& blob = dir[i];
+
+		blob.rawSize = (UINT32)raw.size();
+		blob.crc = crc32(0, &raw[0], blob.rawSize);
+		blob.flags = 0;
+
+		const BYTE* pData = &raw[0];
+		UINT32 size = blob.rawSize;
+
+		if (m_bCompress)
+		{
+			uLongf packedSize = compressBound(size);
+			packed.resize(packedSize);
+			if (compress2(&packed[0], &packedSize, pData, size, Z_BEST_SPEED) == Z_OK && packedSize < size)
+			{
+				pData = &packed[0];
+				size = (UINT32)packedSize;
+				blob.flags |= kYamlBinaryBlobZlib;
+			}
+		}
+
+		// Align uncompressed blobs, so they can be read directly into place (or mapped)
+		const long pos = ftell(m_hFile);
+		const UINT pad = (blob.flags & kYamlBinaryBlobZlib) ? 0 : (kYamlBinaryAlign - (pos % kYamlBinaryAlign)) % kYamlBinaryAlign;
+
+		blob.offset = pos + pad;
+		blob.size = size;
+		if (fwrite(zeros, 1, pad, m_hFile) != pad || fwrite(pData, 1, size, m_hFile) != size)
+			return false;
+	}
+
+	hdr.dirOffset = ftell(m_hFile);
+	if (!dir.empty() && fwrite(&dir[0], sizeof(YamlBinaryBlob), dir.size(), m_hFile) != dir.size())
+		return false;
+
+	return fseek(m_hFile, 0, SEEK_SET) == 0
+		&& fwrite(&hdr, sizeof(hdr), 1, m_hFile) == 1;
+}
+
 void YamlSaveHelper::FileHdr(UINT version)
 {
-	fprintf(m_hFile, "%s:\n", SS_YAML_KEY_FILEHDR);
+	Write(SS_YAML_KEY_FILEHDR ":\n", sizeof(SS_YAML_KEY_FILEHDR ":\n")-1);
 	m_indent = 2;
 	SaveString(SS_YAML_KEY_TAG, SS_YAML_VALUE_AWSS);
 	SaveInt(SS_YAML_KEY_VERSION, version);
@@ -609,7 +1177,7 @@ void YamlSaveHelper::FileHdr(UINT version)
 
 void YamlSaveHelper::UnitHdr(const std::string& type, UINT version)
 {
-	fprintf(m_hFile, "\n%s:\n", SS_YAML_KEY_UNIT);
+	Write("\n" SS_YAML_KEY_UNIT ":\n", sizeof("\n" SS_YAML_KEY_UNIT ":\n")-1);
 	m_indent = 2;
 	SaveString(SS_YAML_KEY_TYPE, type.c_str());
 	SaveInt(SS_YAML_KEY_VERSION, version);
@@ -15,6 +15,46 @@
 
 #define SS_YAML_VALUE_AWSS "AppleWin Save State"
 
+// Binary save-state container
+// . the YAML document is the same, except each SaveMemory() block is a single "<addr>: $<blob#>" line
+// . layout: YamlBinaryHdr, YAML text, blob data (each 4KiB aligned), then numBlobs x YamlBinaryBlob
+// . uncompressed blobs are read directly into place (eg. a RamWorks bank is a single read)
+#pragma pack(push)
+#pragma pack(1)
+struct YamlBinaryHdr
+{
+	UINT32 id;			// 'AWSB'
+	UINT32 version;
+	UINT32 yamlOffset;
+	UINT32 yamlSize;
+	UINT32 numBlobs;
+	UINT32 dirOffset;	// file offset of the blob directory
+};
+
+struct YamlBinaryBlob
+{
+	UINT32 offset;		// file offset of the blob's data
+	UINT32 size;		// stored size
+	UINT32 rawSize;
+	UINT32 crc;			// crc32 of the raw data
+	UINT32 flags;
+};
+#pragma pack(pop)
+
+// In-memory save-state (see Snapshot_Capture()): as per the binary save-state, but with no container
+struct MachineSnapshot
+{
+	std::string yaml;
+	std::vector< std::vector<BYTE> > blobs;
+	std::vector< std::pair<const BYTE*, UINT> > blobSrc;	// VM address & size of each blob (only valid until the VM's memory is reallocated)
+																// NB. a tracked blob (see YamlSaveHelper) has an empty blobs[] entry
+};
+
+const UINT32 kYamlBinaryID = 'A' | ('W' << 8) | ('S' << 16) | ((UINT32)'B' << 24);	// "AWSB" (as stored, ie. little-endian)
+const UINT32 kYamlBinaryVersion = 1;
+const UINT32 kYamlBinaryBlobZlib = 1<<0;
+const UINT kYamlBinaryAlign = 4096;
+
 struct MapValue;
 typedef std::map<std::string, MapValue> MapYaml;
 
@@ -30,10 +70,16 @@ friend class YamlLoadHelper;	// YamlLoadHelper can access YamlHelper's private m
 
 public:
 	YamlHelper(void) :
-		m_hFile(NULL)
+		m_hFile(NULL),
+		m_bBinary(false),
+		m_bInMemory(false),
+		m_pMemoryBlobs(NULL),
+		m_filterPos(0),
+		m_bFilterEof(false)
 	{
 		memset(&m_parser, 0, sizeof(m_parser));
 		memset(&m_newEvent, 0, sizeof(m_newEvent));
+		m_memoryBlock.blob = -1;
 		MakeAsciiToHexTable();
 	}
 
@@ -42,8 +88,11 @@ public:
 		FinaliseParser();
 	}
 
-	int InitParser(const char* pPathname);
+	int InitParser(const char* pPathname);	// NB. auto-detects a binary save-state
+	int InitParser(const MachineSnapshot& snapshot);
 	void FinaliseParser(void);
+	bool IsBinary(void) { return m_bBinary; }
+	bool IsInMemory(void) { return m_bInMemory; }
 
 	UINT ParseFileHdr(const char* tag);
 
@@ -59,6 +108,15 @@ private:
 	void GetMapRemainder(std::string& mapName, MapYaml& mapYaml);
 
 	void MakeAsciiToHexTable(void);
+	bool HexDecode(BYTE* pDst, const char* pSrc, const UINT size);
+	bool InitBinary(void);
+	UINT ReadBlob(const char* pValue, const LPBYTE pDst, const size_t dstSize);
+
+	static int FilterReadHandler(void* pData, unsigned char* pBuffer, size_t size, size_t* pSizeRead);
+	int FilterRead(unsigned char* pBuffer, size_t size, size_t* pSizeRead);
+	bool ReadLine(std::string& line);
+	bool AddMemoryLine(const std::string& line);
+	void FlushMemoryBlock(void);
 
 	yaml_parser_t m_parser;
 	yaml_event_t m_newEvent;
@@ -68,6 +126,27 @@ private:
 	FILE* m_hFile;
 	char m_AsciiToHex[256];
 
+	bool m_bBinary;
+	bool m_bInMemory;						// parsing a MachineSnapshot (see Snapshot_Restore())
+	std::string m_yamlText;					// binary only: the parser's input
+	std::vector<YamlBinaryBlob> m_blobs;	// binary only
+	const std::vector< std::vector<BYTE> >* m_pMemoryBlobs;	// in-memory, or decoded from a YAML save-state's memory lines
+
+	// YAML save-state: memory lines are decoded by FilterRead() (so libyaml doesn't parse them)
+	struct MemoryBlock
+	{
+		std::string key;	// indent & hex address of the block's 1st line
+		UINT indent;
+		UINT addr;
+		int blob;			// index into m_textBlobs, or -1 if no block
+	};
+	std::vector< std::vector<BYTE> > m_textBlobs;
+	MemoryBlock m_memoryBlock;
+	std::string m_filterOut;	// filtered YAML text, not yet read by libyaml
+	size_t m_filterPos;
+	bool m_bFilterEof;
+	std::string m_line;
+
 	MapYaml m_mapYaml;
 };
 
@@ -132,6 +211,10 @@ public:
 		m_currentMapName = item.mapName;
 	}
 
+	// In-memory snapshot (see Snapshot_Restore()): the VM is restored in place, so a card should keep its
+	// current host resources (eg. an open disk image) if they match the snapshot's, rather than re-create them
+	bool IsRestoreInPlace(void) { return m_yamlHelper.IsInMemory(); }
+
 	std::string GetMapNextSlotNumber(void)
 	{
 		if (!m_bIteratingOverMap)
@@ -175,15 +258,20 @@ private:
 class YamlSaveHelper
 {
 public:
-	YamlSaveHelper(const std::string & pathname) :
+	YamlSaveHelper(const std::string & pathname, const bool bBinary=false, const bool bCompress=false) :
 		m_hFile(NULL),
 		m_indent(0),
 		m_pWcStr(NULL),
 		m_wcStrSize(0),
 		m_pMbStr(NULL),
-		m_mbStrSize(0)
+		m_mbStrSize(0),
+		m_bBinary(bBinary),
+		m_bCompress(bCompress),
+		m_pSnapshot(NULL),
+		m_pfnIsTracked(NULL),
+		m_numBlobs(0)
 	{
-		m_hFile = fopen(pathname.c_str(), "wt");
+		m_hFile = fopen(pathname.c_str(), bBinary ? "wb" : "wt");
 
 		// todo: handle ERROR_ALREADY_EXISTS - ask if user wants to replace existing file
 		// - at this point any old file will have been truncated to zero
@@ -191,6 +279,12 @@ public:
 		if(m_hFile == NULL)
 			throw std::runtime_error("Save error");
 
+		if (m_bBinary)
+		{
+			YamlBinaryHdr hdr = {0};	// rewritten by FinaliseBinary()
+			fwrite(&hdr, sizeof(hdr), 1, m_hFile);
+		}
+
 		_tzset();
 		time_t ltime;
 		time(&ltime);
@@ -205,18 +299,47 @@ public:
 		memset(m_szIndent, ' ', kMaxIndent);
 	}
 
+	// In-memory: NB. re-using a snapshot re-uses its memory blobs' allocations
+	// . pfnIsTracked: don't copy blobs that it returns true for (eg. the rewind buffer tracks their writes instead)
+	YamlSaveHelper(MachineSnapshot& snapshot, bool (*pfnIsTracked)(const BYTE* pMem, const UINT size)=NULL) :
+		m_hFile(NULL),
+		m_indent(0),
+		m_pWcStr(NULL),
+		m_wcStrSize(0),
+		m_pMbStr(NULL),
+		m_mbStrSize(0),
+		m_bBinary(true),
+		m_bCompress(false),
+		m_pSnapshot(&snapshot),
+		m_pfnIsTracked(pfnIsTracked),
+		m_numBlobs(0)
+	{
+		m_pSnapshot->yaml.clear();
+		Write("---\n", 4);
+
+		memset(m_szIndent, ' ', kMaxIndent);
+	}
+
+	// NB. A file that hasn't been Finalise()'d (eg. an exception was thrown) is just closed: it's incomplete
 	~YamlSaveHelper()
 	{
 		if (m_hFile)
 		{
-			fprintf(m_hFile, "...\n");
 			fclose(m_hFile);
 		}
+		else if (m_pSnapshot)
+		{
+			Write("...\n", 4);
+			m_pSnapshot->blobs.resize(m_numBlobs);
+			m_pSnapshot->blobSrc.resize(m_numBlobs);
+		}
 
 		delete[] m_pWcStr;
 		delete[] m_pMbStr;
 	}
 
+	bool Finalise(const bool bSync=false);
+
 	void Save(const char* format, ...) ATTRIBUTE_FORMAT_PRINTF(2, 3); // 1 is "this"
 
 	void SaveInt(const char* key, int value);
@@ -234,6 +357,7 @@ public:
 	void SaveFloat(const char* key, float value);
 	void SaveDouble(const char* key, double value);
 	void SaveMemory(const LPBYTE pMemBase, const UINT uMemSize, const UINT offset=0);
+	void SaveSnapshot(const MachineSnapshot& snapshot);
 
 	class Label
 	{
@@ -241,11 +365,11 @@ public:
 		Label(YamlSaveHelper& rYamlSaveHelper, const char* format, ...)  ATTRIBUTE_FORMAT_PRINTF(3, 4) :  // 1 is "this"
 			yamlSaveHelper(rYamlSaveHelper)
 		{
-			fwrite(yamlSaveHelper.m_szIndent, 1, yamlSaveHelper.m_indent, yamlSaveHelper.m_hFile);
+			yamlSaveHelper.Write(yamlSaveHelper.m_szIndent, yamlSaveHelper.m_indent);
 
 			va_list vl;
 			va_start(vl, format);
-			vfprintf(yamlSaveHelper.m_hFile, format, vl);
+			yamlSaveHelper.VPrintf(format, vl);
 			va_end(vl);
 
 			yamlSaveHelper.m_indent += 2;
@@ -278,6 +402,11 @@ public:
 	void UnitHdr(const std::string & type, UINT version);
 
 private:
+	void Write(const char* pData, const size_t size);
+	void VPrintf(const char* format, va_list vl);
+	void SaveMemoryBlob(const LPBYTE pMemBase, const UINT uMemSize, const UINT offset);
+	bool FinaliseBinary(void);
+
 	FILE* m_hFile;
 
 	int m_indent;
@@ -288,4 +417,11 @@ private:
 	int m_wcStrSize;
 	LPSTR m_pMbStr;
 	int m_mbStrSize;
+
+	const bool m_bBinary;
+	const bool m_bCompress;
+	MachineSnapshot* m_pSnapshot;				// in-memory only
+	bool (* const m_pfnIsTracked)(const BYTE* pMem, const UINT size);	// in-memory only
+	std::vector< std::vector<BYTE> > m_blobs;	// binary only: written after the YAML text by FinaliseBinary()
+	UINT m_numBlobs;
 };
@@ -5,15 +5,14 @@
 
 CloseRequest::CloseRequest(const uint8_t request_sequence_number, const uint8_t param_count, const uint8_t device_id) : Request(request_sequence_number, CMD_CLOSE, param_count, device_id) {}
 
-std::vector<uint8_t> CloseRequest::serialize() const
+void CloseRequest::serialize_into(std::vector<uint8_t> &request_data) const
 {
-	std::vector<uint8_t> request_data;
+	request_data.clear();
 	request_data.push_back(this->get_request_sequence_number());
 	request_data.push_back(this->get_command_number());
 	request_data.push_back(this->get_param_count());
 	request_data.push_back(this->get_device_id());
 	request_data.resize(11);
-	return request_data;
 }
 
 std::unique_ptr<Response> CloseRequest::deserialize(const std::vector<uint8_t> &data) const
@@ -42,12 +41,11 @@ std::unique_ptr<Response> CloseRequest::create_response(uint8_t source, uint8_t
 
 CloseResponse::CloseResponse(const uint8_t request_sequence_number, const uint8_t status) : Response(request_sequence_number, status) {}
 
-std::vector<uint8_t> CloseResponse::serialize() const
+void CloseResponse::serialize_into(std::vector<uint8_t> &data) const
 {
-	std::vector<uint8_t> data;
+	data.clear();
 	data.push_back(this->get_request_sequence_number());
 	data.push_back(this->get_status());
-	return data;
 }
 
 
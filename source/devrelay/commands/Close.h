@@ -10,7 +10,7 @@ class CloseRequest : public Request
 {
 public:
 	CloseRequest(uint8_t request_sequence_number, uint8_t param_count, uint8_t device_id);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 	std::unique_ptr<Response> deserialize(const std::vector<uint8_t> &data) const override;
 	void create_command(uint8_t* output_data) const override;
 	void copy_payload(uint8_t* data) const override {}
@@ -22,5 +22,5 @@ class CloseResponse : public Response
 {
 public:
 	explicit CloseResponse(uint8_t request_sequence_number, uint8_t status);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 };
\ No newline at end of file
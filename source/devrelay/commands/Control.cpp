@@ -8,9 +8,9 @@ ControlRequest::ControlRequest(const uint8_t request_sequence_number, const uint
 {
 }
 
-std::vector<uint8_t> ControlRequest::serialize() const
+void ControlRequest::serialize_into(std::vector<uint8_t> &request_data) const
 {
-	std::vector<uint8_t> request_data;
+	request_data.clear();
 	request_data.push_back(this->get_request_sequence_number());
 	request_data.push_back(this->get_command_number());
 	request_data.push_back(this->get_param_count());
@@ -20,7 +20,6 @@ std::vector<uint8_t> ControlRequest::serialize() const
 	request_data.push_back(this->get_network_unit());
 	request_data.resize(11);
 	request_data.insert(request_data.end(), get_data().begin(), get_data().end());
-	return request_data;
 }
 
 std::unique_ptr<Response> ControlRequest::deserialize(const std::vector<uint8_t> &data) const
@@ -59,12 +58,11 @@ std::unique_ptr<Response> ControlRequest::create_response(uint8_t source, uint8_
 
 ControlResponse::ControlResponse(const uint8_t request_sequence_number, const uint8_t status) : Response(request_sequence_number, status) {}
 
-std::vector<uint8_t> ControlResponse::serialize() const
+void ControlResponse::serialize_into(std::vector<uint8_t> &data) const
 {
-	std::vector<uint8_t> data;
+	data.clear();
 	data.push_back(this->get_request_sequence_number());
 	data.push_back(this->get_status());
-	return data;
 }
 
 
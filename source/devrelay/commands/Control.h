@@ -10,7 +10,7 @@ class ControlRequest : public Request
 {
 public:
 	ControlRequest(const uint8_t request_sequence_number, const uint8_t param_count, const uint8_t device_id, const uint8_t control_code, const uint8_t network_unit, std::vector<uint8_t> &data);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 	std::unique_ptr<Response> deserialize(const std::vector<uint8_t> &data) const override;
 
 	const std::vector<uint8_t> &get_data() const { return data_; }
@@ -31,5 +31,5 @@ class ControlResponse : public Response
 {
 public:
 	explicit ControlResponse(uint8_t request_sequence_number, uint8_t status);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 };
\ No newline at end of file
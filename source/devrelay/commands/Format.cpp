@@ -5,15 +5,14 @@
 
 FormatRequest::FormatRequest(const uint8_t request_sequence_number, const uint8_t param_count, const uint8_t device_id) : Request(request_sequence_number, CMD_FORMAT, param_count, device_id) {}
 
-std::vector<uint8_t> FormatRequest::serialize() const
+void FormatRequest::serialize_into(std::vector<uint8_t> &request_data) const
 {
-	std::vector<uint8_t> request_data;
+	request_data.clear();
 	request_data.push_back(this->get_request_sequence_number());
 	request_data.push_back(this->get_command_number());
 	request_data.push_back(this->get_param_count());
 	request_data.push_back(this->get_device_id());
 	request_data.resize(11);
-	return request_data;
 }
 
 std::unique_ptr<Response> FormatRequest::deserialize(const std::vector<uint8_t> &data) const
@@ -30,12 +29,11 @@ std::unique_ptr<Response> FormatRequest::deserialize(const std::vector<uint8_t>
 
 FormatResponse::FormatResponse(const uint8_t request_sequence_number, const uint8_t status) : Response(request_sequence_number, status) {}
 
-std::vector<uint8_t> FormatResponse::serialize() const
+void FormatResponse::serialize_into(std::vector<uint8_t> &data) const
 {
-	std::vector<uint8_t> data;
+	data.clear();
 	data.push_back(this->get_request_sequence_number());
 	data.push_back(this->get_status());
-	return data;
 }
 
 void FormatRequest::create_command(uint8_t* cmd_data) const
@@ -5,15 +5,14 @@
 
 OpenRequest::OpenRequest(const uint8_t request_sequence_number, const uint8_t param_count, const uint8_t device_id) : Request(request_sequence_number, CMD_OPEN, param_count, device_id) {}
 
-std::vector<uint8_t> OpenRequest::serialize() const
+void OpenRequest::serialize_into(std::vector<uint8_t> &request_data) const
 {
-	std::vector<uint8_t> request_data;
+	request_data.clear();
 	request_data.push_back(this->get_request_sequence_number());
 	request_data.push_back(this->get_command_number());
 	request_data.push_back(this->get_param_count());
 	request_data.push_back(this->get_device_id());
 	request_data.resize(11);
-	return request_data;
 }
 
 std::unique_ptr<Response> OpenRequest::deserialize(const std::vector<uint8_t> &data) const
@@ -42,12 +41,11 @@ std::unique_ptr<Response> OpenRequest::create_response(uint8_t source, uint8_t s
 
 OpenResponse::OpenResponse(const uint8_t request_sequence_number, const uint8_t status) : Response(request_sequence_number, status) {}
 
-std::vector<uint8_t> OpenResponse::serialize() const
+void OpenResponse::serialize_into(std::vector<uint8_t> &data) const
 {
-	std::vector<uint8_t> data;
+	data.clear();
 	data.push_back(this->get_request_sequence_number());
 	data.push_back(this->get_status());
-	return data;
 }
 
 
@@ -5,9 +5,9 @@
 
 ReadRequest::ReadRequest(const uint8_t request_sequence_number, const uint8_t param_count, const uint8_t device_id) : Request(request_sequence_number, CMD_READ, param_count, device_id), byte_count_(), address_() {}
 
-std::vector<uint8_t> ReadRequest::serialize() const
+void ReadRequest::serialize_into(std::vector<uint8_t> &request_data) const
 {
-	std::vector<uint8_t> request_data;
+	request_data.clear();
 	request_data.push_back(this->get_request_sequence_number());
 	request_data.push_back(this->get_command_number());
 	request_data.push_back(this->get_param_count());
@@ -16,7 +16,6 @@ std::vector<uint8_t> ReadRequest::serialize() const
 	request_data.insert(request_data.end(), get_byte_count().begin(), get_byte_count().end());
 	request_data.insert(request_data.end(), get_address().begin(), get_address().end());
 	request_data.resize(11);
-	return request_data;
 }
 
 std::unique_ptr<Response> ReadRequest::deserialize(const std::vector<uint8_t> &data) const
@@ -64,13 +63,12 @@ std::unique_ptr<Response> ReadRequest::create_response(uint8_t source, uint8_t s
 
 ReadResponse::ReadResponse(const uint8_t request_sequence_number, const uint8_t status) : Response(request_sequence_number, status) {}
 
-std::vector<uint8_t> ReadResponse::serialize() const
+void ReadResponse::serialize_into(std::vector<uint8_t> &data) const
 {
-	std::vector<uint8_t> data;
+	data.clear();
 	data.push_back(this->get_request_sequence_number());
 	data.push_back(this->get_status());
 	data.insert(data.end(), get_data().begin(), get_data().end());
-	return data;
 }
 
 void ReadResponse::set_data(const std::vector<uint8_t>::const_iterator &begin, const std::vector<uint8_t>::const_iterator &end)
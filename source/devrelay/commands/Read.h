@@ -13,7 +13,7 @@ class ReadRequest : public Request
 {
 public:
 	ReadRequest(uint8_t request_sequence_number, uint8_t param_count, uint8_t device_id);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 	std::unique_ptr<Response> deserialize(const std::vector<uint8_t> &data) const override;
 
 	const std::array<uint8_t, 2> &get_byte_count() const;
@@ -35,7 +35,7 @@ class ReadResponse : public Response
 {
 public:
 	explicit ReadResponse(uint8_t request_sequence_number, uint8_t status);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 
 	const std::vector<uint8_t> &get_data() const { return data_; }
 	void set_data(const std::vector<uint8_t>::const_iterator &begin, const std::vector<uint8_t>::const_iterator &end);
@@ -5,9 +5,9 @@
 
 ReadBlockRequest::ReadBlockRequest(const uint8_t request_sequence_number, const uint8_t param_count, const uint8_t device_id) : Request(request_sequence_number, CMD_READ_BLOCK, param_count, device_id), block_number_{} {}
 
-std::vector<uint8_t> ReadBlockRequest::serialize() const
+void ReadBlockRequest::serialize_into(std::vector<uint8_t> &request_data) const
 {
-	std::vector<uint8_t> request_data;
+	request_data.clear();
 	request_data.push_back(this->get_request_sequence_number());
 	request_data.push_back(this->get_command_number());
 	request_data.push_back(this->get_param_count());
@@ -15,7 +15,6 @@ std::vector<uint8_t> ReadBlockRequest::serialize() const
 	request_data.resize(6);
 	request_data.insert(request_data.end(), block_number_.begin(), block_number_.end());
 	request_data.resize(11);
-	return request_data;
 }
 
 std::unique_ptr<Response> ReadBlockRequest::deserialize(const std::vector<uint8_t> &data) const
@@ -63,13 +62,12 @@ std::unique_ptr<Response> ReadBlockRequest::create_response(uint8_t source, uint
 
 ReadBlockResponse::ReadBlockResponse(const uint8_t request_sequence_number, const uint8_t status) : Response(request_sequence_number, status), block_data_{} {}
 
-std::vector<uint8_t> ReadBlockResponse::serialize() const
+void ReadBlockResponse::serialize_into(std::vector<uint8_t> &data) const
 {
-	std::vector<uint8_t> data;
+	data.clear();
 	data.push_back(this->get_request_sequence_number());
 	data.push_back(this->get_status());
 	data.insert(data.end(), block_data_.begin(), block_data_.end());
-	return data;
 }
 
 void ReadBlockResponse::set_block_data(std::vector<uint8_t>::const_iterator begin, std::vector<uint8_t>::const_iterator end)
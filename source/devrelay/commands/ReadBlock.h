@@ -12,7 +12,7 @@ class ReadBlockRequest : public Request
 {
 public:
 	ReadBlockRequest(uint8_t request_sequence_number, uint8_t param_count, uint8_t device_id);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 	std::unique_ptr<Response> deserialize(const std::vector<uint8_t> &data) const override;
 	const std::array<uint8_t, 3> &get_block_number() const;
 	void set_block_number_from_ptr(const uint8_t *ptr, size_t offset);
@@ -32,7 +32,7 @@ class ReadBlockResponse : public Response
 {
 public:
 	explicit ReadBlockResponse(uint8_t request_sequence_number, uint8_t status);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 
 	void set_block_data(std::vector<uint8_t>::const_iterator begin, std::vector<uint8_t>::const_iterator end);
 	const std::array<uint8_t, 512>& get_block_data() const;
@@ -9,9 +9,9 @@ StatusRequest::StatusRequest(const uint8_t request_sequence_number, const uint8_
 {
 }
 
-std::vector<uint8_t> StatusRequest::serialize() const
+void StatusRequest::serialize_into(std::vector<uint8_t> &request_data) const
 {
-	std::vector<uint8_t> request_data;
+	request_data.clear();
 	request_data.push_back(this->get_request_sequence_number());
 	request_data.push_back(this->get_command_number());
 	request_data.push_back(this->get_param_count());
@@ -20,7 +20,6 @@ std::vector<uint8_t> StatusRequest::serialize() const
 	request_data.push_back(this->get_status_code());
 	request_data.push_back(this->get_network_unit());
 	request_data.resize(11);
-	return request_data;
 }
 
 std::unique_ptr<Response> StatusRequest::deserialize(const std::vector<uint8_t> &data) const
@@ -77,9 +76,9 @@ void StatusResponse::set_data(const std::vector<uint8_t>::const_iterator& begin,
 	std::copy(begin, end, data_.begin()); // NOLINT(performance-unnecessary-value-param)
 }
 
-std::vector<uint8_t> StatusResponse::serialize() const
+void StatusResponse::serialize_into(std::vector<uint8_t> &data) const
 {
-	std::vector<uint8_t> data;
+	data.clear();
 	data.push_back(this->get_request_sequence_number());
 	data.push_back(this->get_status());
 
@@ -87,7 +86,6 @@ std::vector<uint8_t> StatusResponse::serialize() const
 	{
 		data.push_back(b);
 	}
-	return data;
 }
 
 
@@ -10,7 +10,7 @@ class StatusRequest : public Request
 {
 public:
 	StatusRequest(uint8_t request_sequence_number, uint8_t param_count, uint8_t device_id, uint8_t status_code, uint8_t network_unit);
-	virtual std::vector<uint8_t> serialize() const override;
+	virtual void serialize_into(std::vector<uint8_t> &data) const override;
 	std::unique_ptr<Response> deserialize(const std::vector<uint8_t> &data) const override;
 
 	uint8_t get_status_code() const { return status_code_; }
@@ -31,7 +31,7 @@ class StatusResponse : public Response
 {
 public:
 	explicit StatusResponse(uint8_t request_sequence_number, uint8_t status);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 
 	const std::vector<uint8_t> &get_data() const;
 	void add_data(uint8_t d);
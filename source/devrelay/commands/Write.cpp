@@ -5,9 +5,9 @@
 
 WriteRequest::WriteRequest(const uint8_t request_sequence_number, const uint8_t param_count, const uint8_t device_id) : Request(request_sequence_number, CMD_WRITE, param_count, device_id), byte_count_(), address_() {}
 
-std::vector<uint8_t> WriteRequest::serialize() const
+void WriteRequest::serialize_into(std::vector<uint8_t> &request_data) const
 {
-	std::vector<uint8_t> request_data;
+	request_data.clear();
 	request_data.push_back(this->get_request_sequence_number());
 	request_data.push_back(this->get_command_number());
 	request_data.push_back(this->get_param_count());
@@ -17,7 +17,6 @@ std::vector<uint8_t> WriteRequest::serialize() const
 	request_data.insert(request_data.end(), get_address().begin(), get_address().end());
 	request_data.resize(11);
 	request_data.insert(request_data.end(), get_data().begin(), get_data().end());
-	return request_data;
 }
 
 std::unique_ptr<Response> WriteRequest::deserialize(const std::vector<uint8_t> &data) const
@@ -70,12 +69,11 @@ std::unique_ptr<Response> WriteRequest::create_response(uint8_t source, uint8_t
 
 WriteResponse::WriteResponse(const uint8_t request_sequence_number, const uint8_t status) : Response(request_sequence_number, status) {}
 
-std::vector<uint8_t> WriteResponse::serialize() const
+void WriteResponse::serialize_into(std::vector<uint8_t> &data) const
 {
-	std::vector<uint8_t> data;
+	data.clear();
 	data.push_back(this->get_request_sequence_number());
 	data.push_back(this->get_status());
-	return data;
 }
 
 
@@ -12,7 +12,7 @@ class WriteRequest : public Request
 {
 public:
 	WriteRequest(const uint8_t request_sequence_number, const uint8_t param_count, const uint8_t device_id);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 	std::unique_ptr<Response> deserialize(const std::vector<uint8_t> &data) const override;
 
 	const std::array<uint8_t, 2> &get_byte_count() const;
@@ -39,5 +39,5 @@ class WriteResponse : public Response
 {
 public:
 	explicit WriteResponse(uint8_t request_sequence_number, uint8_t status);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 };
@@ -6,9 +6,9 @@
 
 WriteBlockRequest::WriteBlockRequest(const uint8_t request_sequence_number, const uint8_t param_count, const uint8_t device_id) : Request(request_sequence_number, CMD_WRITE_BLOCK, param_count, device_id), block_number_{}, block_data_{} {}
 
-std::vector<uint8_t> WriteBlockRequest::serialize() const
+void WriteBlockRequest::serialize_into(std::vector<uint8_t> &request_data) const
 {
-	std::vector<uint8_t> request_data;
+	request_data.clear();
 	request_data.push_back(this->get_request_sequence_number());
 	request_data.push_back(this->get_command_number());
 	request_data.push_back(this->get_param_count());
@@ -17,7 +17,6 @@ std::vector<uint8_t> WriteBlockRequest::serialize() const
 	request_data.insert(request_data.end(), block_number_.begin(), block_number_.end());
 	request_data.resize(11);
 	request_data.insert(request_data.end(), block_data_.begin(), block_data_.end());
-	return request_data;
 }
 
 std::unique_ptr<Response> WriteBlockRequest::deserialize(const std::vector<uint8_t> &data) const
@@ -69,12 +68,11 @@ std::unique_ptr<Response> WriteBlockRequest::create_response(uint8_t source, uin
 
 WriteBlockResponse::WriteBlockResponse(const uint8_t request_sequence_number, const uint8_t status) : Response(request_sequence_number, status) {}
 
-std::vector<uint8_t> WriteBlockResponse::serialize() const
+void WriteBlockResponse::serialize_into(std::vector<uint8_t> &data) const
 {
-	std::vector<uint8_t> data;
+	data.clear();
 	data.push_back(this->get_request_sequence_number());
 	data.push_back(this->get_status());
-	return data;
 }
 
 
@@ -12,7 +12,7 @@ class WriteBlockRequest : public Request
 {
 public:
 	WriteBlockRequest(uint8_t request_sequence_number, uint8_t param_count, uint8_t device_id);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 	std::unique_ptr<Response> deserialize(const std::vector<uint8_t> &data) const override;
 	const std::array<uint8_t, 3> &get_block_number() const;
 	void set_block_number_from_ptr(const uint8_t *ptr, size_t offset);
@@ -35,5 +35,5 @@ class WriteBlockResponse : public Response
 {
 public:
 	explicit WriteBlockResponse(uint8_t request_sequence_number, uint8_t status);
-	std::vector<uint8_t> serialize() const override;
+	void serialize_into(std::vector<uint8_t> &data) const override;
 };
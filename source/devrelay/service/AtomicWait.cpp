@@ -0,0 +1,82 @@
+#ifdef DEV_RELAY_SLIP
+
+#include "AtomicWait.h"
+
+#if defined(WIN32) && !defined(_USING_V110_SDK71_)
+	#define ATOMIC_WAIT_ON_ADDRESS
+	#include <windows.h>
+	#include <synchapi.h>
+	#pragma comment(lib, "Synchronization.lib")
+#elif defined(__linux__)
+	#define ATOMIC_WAIT_FUTEX
+	#include <linux/futex.h>
+	#include <sys/syscall.h>
+	#include <time.h>
+	#include <unistd.h>
+#else
+	#include <condition_variable>
+	#include <mutex>
+#endif
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+	"the kernel waits on the atomic's own word");
+
+namespace atomic_wait
+{
+#if defined(ATOMIC_WAIT_ON_ADDRESS)
+
+	void wait_for(const std::atomic<uint32_t> &value, uint32_t expected, const std::chrono::microseconds timeout)
+	{
+		// rounded up: a 0 ms wait would not sleep at all
+		const DWORD milliseconds = static_cast<DWORD>((timeout.count() + 999) / 1000);
+		WaitOnAddress(const_cast<std::atomic<uint32_t> *>(&value), &expected, sizeof(expected), milliseconds);
+	}
+
+	void wake_all(std::atomic<uint32_t> &value)
+	{
+		WakeByAddressAll(&value);
+	}
+
+#elif defined(ATOMIC_WAIT_FUTEX)
+
+	void wait_for(const std::atomic<uint32_t> &value, const uint32_t expected, const std::chrono::microseconds timeout)
+	{
+		timespec relative;
+		relative.tv_sec = static_cast<time_t>(timeout.count() / 1000000);
+		relative.tv_nsec = static_cast<long>((timeout.count() % 1000000) * 1000);
+		syscall(SYS_futex, reinterpret_cast<const uint32_t *>(&value), FUTEX_WAIT_PRIVATE, expected, &relative, nullptr, 0);
+	}
+
+	void wake_all(std::atomic<uint32_t> &value)
+	{
+		syscall(SYS_futex, reinterpret_cast<uint32_t *>(&value), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+	}
+
+#else
+
+	// One condition variable for all the words: a wake-up may be for another word, which the callers tolerate
+	static std::mutex wait_mutex;
+	static std::condition_variable wait_cv;
+
+	void wait_for(const std::atomic<uint32_t> &value, const uint32_t expected, const std::chrono::microseconds timeout)
+	{
+		std::unique_lock<std::mutex> lock(wait_mutex);
+		if (value.load() == expected)
+		{
+			wait_cv.wait_for(lock, timeout);
+		}
+	}
+
+	void wake_all(std::atomic<uint32_t> &value)
+	{
+		// taking the mutex orders the change of value before a waiter's check, or after its wait has started
+		{
+			std::lock_guard<std::mutex> lock(wait_mutex);
+		}
+		wait_cv.notify_all();
+	}
+
+#endif
+}
+
+#endif
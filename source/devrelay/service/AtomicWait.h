@@ -0,0 +1,20 @@
+#pragma once
+#ifdef DEV_RELAY_SLIP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Futex style waiting on a 32 bit atomic: WaitOnAddress() on Windows 8 and later, futex() on Linux, and a shared
+// condition variable elsewhere (and with the XP toolset). Unlike std::atomic::wait(), the wait has a timeout.
+namespace atomic_wait
+{
+	// Returns when value is no longer expected, when woken, or when the timeout expires. It may also return spuriously:
+	// the caller checks the value again.
+	void wait_for(const std::atomic<uint32_t> &value, uint32_t expected, std::chrono::microseconds timeout);
+
+	// Wakes the threads waiting on value. Change the value first.
+	void wake_all(std::atomic<uint32_t> &value);
+}
+
+#endif
@@ -0,0 +1,247 @@
+#ifdef DEV_RELAY_SLIP
+
+#include <iterator>
+
+#include "BlockPipeline.h"
+
+#include "Log.h"
+#include "Requestor.h"
+
+namespace
+{
+	// SmartPort & ProDOS: I/O error
+	constexpr uint8_t io_error = 0x27;
+
+	template <typename T>
+	void set_block_number(T &request, const uint32_t block_number)
+	{
+		request.set_block_number_from_bytes(block_number & 0xff, (block_number >> 8) & 0xff, (block_number >> 16) & 0xff);
+	}
+}
+
+BlockPipeline::~BlockPipeline()
+{
+	flush();
+	if (stats_.reads || stats_.writes)
+	{
+		LogFileOutput("BlockPipeline: %u block reads (%u from read-ahead, %u read-ahead discarded), %u block writes (%u failed)\n",
+			stats_.reads, stats_.read_ahead_hits, stats_.read_ahead_wasted, stats_.writes, stats_.write_errors);
+	}
+}
+
+BlockPipeline::Device &BlockPipeline::get_device(const std::shared_ptr<Connection> &connection, const uint8_t device_id)
+{
+	Device &device = devices_[std::make_pair(connection.get(), device_id)];
+	device.connection = connection;
+	return device;
+}
+
+std::unique_ptr<Response> BlockPipeline::read_block(const std::shared_ptr<Connection> &connection, const uint8_t device_id, const uint8_t param_count, const uint32_t block_number)
+{
+	Device &device = get_device(connection, device_id);
+	++stats_.reads;
+
+	collect_writes(device, max_pending_writes);
+	if (device.write_error != 0)
+	{
+		// Not read: the earlier write's failure is this call's error
+		return std::make_unique<ReadBlockResponse>(0, take_write_error(device));
+	}
+
+	bool sequential = block_number == device.next_block;
+	device.next_block = block_number + 1;
+
+	std::unique_ptr<Response> response;
+	const auto it = device.reads.find(block_number);
+	if (it != device.reads.end())
+	{
+		// Requested ahead: its response has arrived, or is on its way
+		const std::unique_ptr<ReadBlockRequest> request = std::move(it->second);
+		device.reads.erase(it);
+		response = Requestor::receive_response(*request, connection.get());
+		if (response)
+		{
+			++stats_.read_ahead_hits;
+			sequential = true;
+		}
+	}
+
+	if (sequential)
+	{
+		// The reader has gone past these
+		drop_read_ahead(device, block_number);
+	}
+
+	if (!response)
+	{
+		// Not requested ahead (or that failed, e.g. past the end of the device): this read gets the device's own answer
+		ReadBlockRequest request(Requestor::next_request_number(), param_count, device_id);
+		set_block_number(request, block_number);
+		Requestor::send_request_async(request, connection.get());
+		if (sequential)
+		{
+			// sent after this read, so they do not delay it
+			request_read_ahead(device, device_id, param_count, block_number);
+		}
+		return Requestor::receive_response(request, connection.get());
+	}
+
+	request_read_ahead(device, device_id, param_count, block_number);
+	return response;
+}
+
+std::unique_ptr<Response> BlockPipeline::write_block(const std::shared_ptr<Connection> &connection, const uint8_t device_id, const uint8_t param_count, const uint32_t block_number, const uint8_t *data)
+{
+	Device &device = get_device(connection, device_id);
+
+	collect_writes(device, max_pending_writes);
+	if (device.write_error != 0)
+	{
+		// Not written: the earlier write's failure is this call's error
+		return std::make_unique<WriteBlockResponse>(0, take_write_error(device));
+	}
+
+	++stats_.writes;
+
+	// A read-ahead of this block was sent before the write: it would return the old data
+	const auto it = device.reads.find(block_number);
+	if (it != device.reads.end())
+	{
+		Requestor::abandon_request(*it->second, connection.get());
+		device.reads.erase(it);
+		++stats_.read_ahead_wasted;
+	}
+
+	auto request = std::make_unique<WriteBlockRequest>(Requestor::next_request_number(), param_count, device_id);
+	set_block_number(*request, block_number);
+	request->set_block_data_from_ptr(data, 0);
+	Requestor::send_request_async(*request, connection.get());
+	const uint8_t request_number = request->get_request_sequence_number();
+	device.writes.push_back(std::move(request));
+
+	collect_writes(device, max_pending_writes);
+
+	// This write is assumed to succeed: if it fails, the device's next call says so
+	return std::make_unique<WriteBlockResponse>(request_number, 0);
+}
+
+void BlockPipeline::invalidate(const Connection *connection, const uint8_t device_id)
+{
+	const auto it = devices_.find(std::make_pair(connection, device_id));
+	if (it != devices_.end())
+	{
+		drop_read_ahead(it->second, UINT32_MAX);
+	}
+}
+
+uint8_t BlockPipeline::take_write_error(const Connection *connection, const uint8_t device_id)
+{
+	const auto it = devices_.find(std::make_pair(connection, device_id));
+	if (it == devices_.end())
+	{
+		return 0;
+	}
+
+	collect_writes(it->second, 0);
+	return take_write_error(it->second);
+}
+
+void BlockPipeline::drain()
+{
+	for (auto &key_and_device : devices_)
+	{
+		collect_writes(key_and_device.second, 0);
+	}
+}
+
+void BlockPipeline::flush()
+{
+	for (auto &key_and_device : devices_)
+	{
+		Device &device = key_and_device.second;
+		drop_read_ahead(device, UINT32_MAX);
+		collect_writes(device, 0);
+	}
+	devices_.clear();
+}
+
+void BlockPipeline::request_read_ahead(Device &device, const uint8_t device_id, const uint8_t param_count, const uint32_t block_number)
+{
+	// Keep the next read_ahead_depth blocks requested: usually only the last one is new
+	for (uint32_t next = block_number + 1; next <= block_number + read_ahead_depth && next <= 0xFFFFFF; ++next)
+	{
+		if (device.reads.count(next) == 0)
+		{
+			auto request = std::make_unique<ReadBlockRequest>(Requestor::next_request_number(), param_count, device_id);
+			set_block_number(*request, next);
+			Requestor::send_request_async(*request, device.connection.get());
+			device.reads[next] = std::move(request);
+		}
+	}
+
+	// The windows of readers that have moved elsewhere: drop the farthest ones
+	while (device.reads.size() > 2 * read_ahead_depth)
+	{
+		const auto first = device.reads.begin();
+		const auto last = std::prev(device.reads.end());
+		const auto farthest = first->first < block_number && (block_number - first->first) > (last->first - block_number) ? first : last;
+		Requestor::abandon_request(*farthest->second, device.connection.get());
+		device.reads.erase(farthest);
+		++stats_.read_ahead_wasted;
+	}
+}
+
+void BlockPipeline::collect_writes(Device &device, const size_t max_pending)
+{
+	Connection *connection = device.connection.get();
+	while (!device.writes.empty())
+	{
+		const WriteBlockRequest &request = *device.writes.front();
+		uint8_t status;
+		if (!connection->is_connected())
+		{
+			Requestor::abandon_request(request, connection);
+			status = io_error;
+		}
+		else if (device.writes.size() > max_pending || Requestor::is_response_ready(request, connection))
+		{
+			const auto response = Requestor::receive_response(request, connection);
+			status = response ? response->get_status() : io_error;
+		}
+		else
+		{
+			// in flight: responses arrive in order, so the later writes are too
+			break;
+		}
+
+		if (status != 0)
+		{
+			const auto &block = request.get_block_number();
+			LogFileOutput("BlockPipeline: write of block %u failed, status: 0x%02x\n", block[0] | (block[1] << 8) | (block[2] << 16), status);
+			++stats_.write_errors;
+			if (device.write_error == 0)
+			{
+				device.write_error = status;
+			}
+		}
+		device.writes.pop_front();
+	}
+}
+
+uint8_t BlockPipeline::take_write_error(Device &device)
+{
+	const uint8_t status = device.write_error;
+	device.write_error = 0;
+	return status;
+}
+
+void BlockPipeline::drop_read_ahead(Device &device, const uint32_t below)
+{
+	for (auto it = device.reads.begin(); it != device.reads.end() && it->first < below; it = device.reads.erase(it))
+	{
+		Requestor::abandon_request(*it->second, device.connection.get());
+		++stats_.read_ahead_wasted;
+	}
+}
+
+#endif
@@ -0,0 +1,78 @@
+#pragma once
+#ifdef DEV_RELAY_SLIP
+
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <memory>
+#include <utility>
+
+#include "Connection.h"
+#include "../commands/ReadBlock.h"
+#include "../commands/WriteBlock.h"
+
+// Pipelined ReadBlock / WriteBlock requests, so a block transfer does not always cost a network round-trip with the 6502 frozen:
+// - read-ahead: when a device is read sequentially, ReadBlockRequests for the following blocks are sent without waiting,
+//   and the next reads are served from their responses.
+// - write-behind: a WriteBlockRequest is sent without waiting for its response, which is collected later.
+//   ProDOS has already been told that write succeeded, so a failure is kept until the next call for the device, whatever it is
+//   (STATUS, READ, ...): that call is not run, and returns the write's error instead.
+// Ordering: the requests to a device go down one Connection in order, and the device processes them in order, so a request
+// sent after a write sees the written data. A read-ahead sent before a write to the same block is discarded.
+class BlockPipeline
+{
+public:
+	BlockPipeline() = default;
+	~BlockPipeline();
+
+	BlockPipeline(const BlockPipeline &) = delete;
+	BlockPipeline &operator=(const BlockPipeline &) = delete;
+
+	// These return the device's response (nullptr if there was none), as Requestor::send_request() would
+	std::unique_ptr<Response> read_block(const std::shared_ptr<Connection> &connection, uint8_t device_id, uint8_t param_count, uint32_t block_number);
+	std::unique_ptr<Response> write_block(const std::shared_ptr<Connection> &connection, uint8_t device_id, uint8_t param_count, uint32_t block_number, const uint8_t *data);
+
+	// Any other command may change the device's media: drop its read-ahead
+	void invalidate(const Connection *connection, uint8_t device_id);
+
+	// Wait for the device's writes, and return (and forget) the error of a failed one not reported yet: 0 if none
+	uint8_t take_write_error(const Connection *connection, uint8_t device_id);
+
+	// Wait for all the writes, keeping their errors for the devices' next calls (e.g. before a snapshot is saved)
+	void drain();
+
+	// Wait for all the writes and drop all the read-ahead (reset, or the card is going away)
+	void flush();
+
+	static const uint32_t read_ahead_depth = 8;	// blocks requested ahead of a sequential reader
+	static const size_t max_pending_writes = 16;	// write-behind: then wait for the oldest
+
+private:
+	struct Device
+	{
+		std::shared_ptr<Connection> connection;							// kept alive while requests are in flight
+		std::map<uint32_t, std::unique_ptr<ReadBlockRequest>> reads;	// read-ahead, by block number
+		std::deque<std::unique_ptr<WriteBlockRequest>> writes;			// in the order they were sent
+		uint32_t next_block = 0;										// the block a sequential reader will ask for next
+		uint8_t write_error = 0;										// of a write whose response has been collected, not reported yet
+	};
+
+	std::map<std::pair<const Connection *, uint8_t>, Device> devices_;
+
+	struct Stats
+	{
+		uint32_t reads = 0;
+		uint32_t read_ahead_hits = 0;
+		uint32_t read_ahead_wasted = 0;
+		uint32_t writes = 0;
+		uint32_t write_errors = 0;
+	} stats_;
+
+	Device &get_device(const std::shared_ptr<Connection> &connection, uint8_t device_id);
+	void request_read_ahead(Device &device, uint8_t device_id, uint8_t param_count, uint32_t block_number);
+	void collect_writes(Device &device, size_t max_pending);
+	static uint8_t take_write_error(Device &device);
+	void drop_read_ahead(Device &device, uint32_t below);
+};
+
+#endif
@@ -8,7 +8,7 @@ COMConnection::COMConnection(const std::string &port_name, struct sp_port *port,
 
 COMConnection::~COMConnection() { close_connection(); }
 
-void COMConnection::send_data(const std::vector<uint8_t> &data)
+void COMConnection::write_data(const uint8_t *data, const size_t length)
 {
 	if (!is_connected())
 	{
@@ -16,34 +16,22 @@ void COMConnection::send_data(const std::vector<uint8_t> &data)
 		return;
 	}
 
-	const auto slip_data = SLIP::encode(data);
-	sp_nonblocking_write(port_, slip_data.data(), slip_data.size());
+	sp_nonblocking_write(port_, data, length);
 }
 
 void COMConnection::create_read_channel()
 {
 	reading_thread_ = std::thread([self = shared_from_this()]() {
+		// a packet can be split across reads: the decoder keeps the partial one
+		SLIPDecoder decoder;
+		const SLIPDecoder::PacketHandler on_packet = [&self](const uint8_t *packet, const size_t length) { self->packet_received(packet, length); };
 		std::vector<uint8_t> buffer(1024);
 		while (self->is_connected())
 		{
 			int bytes_read = sp_nonblocking_read(self->port_, buffer.data(), buffer.size());
 			if (bytes_read > 0)
 			{
-				std::vector<std::vector<uint8_t>> decoded_packets = SLIP::split_into_packets(buffer.data(), buffer.size());
-				if (!decoded_packets.empty())
-				{
-					for (const auto &packet : decoded_packets)
-					{
-						if (!packet.empty())
-						{
-							{
-								std::lock_guard<std::mutex> lock(self->data_mutex_);
-								self->data_map_[packet[0]] = packet;
-							}
-							self->data_cv_.notify_all();
-						}
-					}
-				}
+				decoder.decode(buffer.data(), bytes_read, on_packet);
 			}
 		}
 	});
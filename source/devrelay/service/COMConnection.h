@@ -18,7 +18,6 @@ public:
 	explicit COMConnection(const std::string &port_name, struct sp_port *port, bool is_connected);
 	virtual ~COMConnection();
 
-	void send_data(const std::vector<uint8_t> &data) override;
 	void create_read_channel() override;
 	void close_connection() override;
 
@@ -33,6 +32,9 @@ public:
 		port_ = port;
 	}
 
+protected:
+	void write_data(const uint8_t *data, size_t length) override;
+
 private:
 	std::string port_name_;
 	struct sp_port *port_;
@@ -1,47 +1,223 @@
 #ifdef DEV_RELAY_SLIP
 
-#include <condition_variable>
 #include <cstdint>
 #include <mutex>
 #include <optional>
 #include <stdexcept>
+#include <thread>
 #include <vector>
 
 #include "Connection.h"
+#include "AtomicWait.h"
+#include "Log.h"
+#include "../slip/SLIP.h"
+#include "../types/Command.h"
+
+std::array<std::atomic<bool>, 256> Connection::request_ids_in_use_{};
+
+Connection::~Connection()
+{
+	// their responses will not arrive now
+	for (size_t request_id = 0; request_id < responses_.size(); ++request_id)
+	{
+		if (responses_[request_id].state.load() != SLOT_FREE)
+		{
+			request_ids_in_use_[request_id] = false;
+		}
+	}
+}
+
+void Connection::send_data(const std::vector<uint8_t> &data)
+{
+	if (data.empty())
+	{
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(send_mutex_);
+	send_packet(data.data(), data.size());
+}
+
+void Connection::send_command(const Command &command)
+{
+	std::lock_guard<std::mutex> lock(send_mutex_);
+	command.serialize_into(command_buffer_);
+	send_packet(command_buffer_.data(), command_buffer_.size());
+}
+
+// send_mutex_ must be held
+void Connection::send_packet(const uint8_t *data, const size_t length)
+{
+	SLIP::encode(data, length, send_buffer_);
+	write_data(send_buffer_.data(), send_buffer_.size());
+}
+
+// This is called before AppleWin sends a request to a device, so the response is recognised even if it arrives before we wait for it
+void Connection::begin_request(const uint8_t request_id)
+{
+	ResponseSlot &slot = responses_[request_id];
+	uint32_t state = slot.state.load(std::memory_order_acquire);
+	while (true)
+	{
+		// the id has wrapped around: anything left for its previous use is stale, but let the reading thread finish with it
+		if (state == SLOT_FILLING)
+		{
+			std::this_thread::yield();
+			state = slot.state.load(std::memory_order_acquire);
+		}
+		else if (slot.state.compare_exchange_weak(state, SLOT_WAITING, std::memory_order_acq_rel))
+		{
+			break;
+		}
+	}
+	request_ids_in_use_[request_id] = true;
+}
+
+// The response is no longer wanted (timeout, or a read-ahead that is not needed): discard it, now or when it arrives
+void Connection::abandon_request(const uint8_t request_id)
+{
+	ResponseSlot &slot = responses_[request_id];
+	uint32_t state = slot.state.load(std::memory_order_acquire);
+	while (true)
+	{
+		switch (state)
+		{
+		case SLOT_WAITING:
+		case SLOT_SLEEPING:
+			if (slot.state.compare_exchange_weak(state, SLOT_ABANDONED, std::memory_order_acq_rel))
+			{
+				if (state == SLOT_SLEEPING)
+				{
+					atomic_wait::wake_all(slot.state);
+				}
+				return;
+			}
+			break;
+		case SLOT_FILLING:
+			std::this_thread::yield();
+			state = slot.state.load(std::memory_order_acquire);
+			break;
+		case SLOT_READY:
+			if (slot.state.compare_exchange_weak(state, SLOT_FREE, std::memory_order_acq_rel))
+			{
+				request_ids_in_use_[request_id] = false;
+				return;
+			}
+			break;
+		default:
+			return;
+		}
+	}
+}
+
+bool Connection::has_response(const uint8_t request_id)
+{
+	return responses_[request_id].state.load(std::memory_order_acquire) == SLOT_READY;
+}
 
 // This is called after AppleWin sends a request to a device, and is waiting for the response
-std::optional<std::vector<uint8_t>> Connection::wait_for_response(uint8_t request_id, std::chrono::seconds timeout)
+bool Connection::wait_for_response(uint8_t request_id, std::chrono::milliseconds timeout, std::vector<uint8_t> &response)
 {
-	std::unique_lock<std::mutex> lock(data_mutex_);
-	// mutex is unlocked as it goes into a wait, so then the inserting thread can
-	// add to map, and this can then pick it up when notified, or timeout.
-	if (!data_cv_.wait_for(lock, timeout, [this, request_id]() { return data_map_.count(request_id) > 0; }))
+	// a response over a local connection takes some tens of us: look a few times before going to sleep
+	constexpr int spin_count = 64;
+
+	ResponseSlot &slot = responses_[request_id];
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	for (int spin = 0; ; ++spin)
 	{
-		return std::nullopt;
+		uint32_t state = slot.state.load(std::memory_order_acquire);
+		if (state == SLOT_READY)
+		{
+			break;
+		}
+		if (state != SLOT_WAITING && state != SLOT_SLEEPING && state != SLOT_FILLING)
+		{
+			// abandoned, or never begun
+			return false;
+		}
+		if (state == SLOT_FILLING || spin < spin_count)
+		{
+			std::this_thread::yield();
+			continue;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+		{
+			return false;
+		}
+		// the reading thread only wakes a SLEEPING slot: no system call when we are not sleeping
+		if (state == SLOT_WAITING && !slot.state.compare_exchange_strong(state, SLOT_SLEEPING, std::memory_order_acq_rel))
+		{
+			continue;
+		}
+		atomic_wait::wait_for(slot.state, SLOT_SLEEPING, std::chrono::duration_cast<std::chrono::microseconds>(deadline - now));
 	}
-	std::vector<uint8_t> response_data = data_map_[request_id];
-	data_map_.erase(request_id);
-	return response_data;
+
+	// the caller's previous buffer will hold the next response with this id
+	response.swap(slot.data);
+	slot.state.store(SLOT_FREE, std::memory_order_release);
+	request_ids_in_use_[request_id] = false;
+	return true;
 }
 
 // This is used by devices that are waiting for requests from AppleWin.
 // The codebase is used both sides of the connection.
-std::optional<std::vector<uint8_t>> Connection::wait_for_request()
+bool Connection::wait_for_request(std::vector<uint8_t> &request)
 {
 	// Use a timeout so we can stop waiting for responses
 	while (is_connected_)
 	{
-		std::unique_lock<std::mutex> lock(data_mutex_);
-		if (data_cv_.wait_for(lock, std::chrono::milliseconds(100), [this]() { return !data_map_.empty(); }))
+		// in order of arrival: several requests can be in flight, and a write must be processed before a later read
+		if (request_queue_.wait_pop(request, std::chrono::milliseconds(100)))
 		{
-			const auto it = data_map_.begin();
-			std::vector<uint8_t> request_data = it->second;
-			data_map_.erase(it);
+			return true;
+		}
+	}
+	return false;
+}
+
+std::optional<std::vector<uint8_t>> Connection::wait_for_request()
+{
+	std::vector<uint8_t> request_data;
+	if (!wait_for_request(request_data))
+	{
+		return std::nullopt;
+	}
+	return request_data;
+}
 
-			return request_data;
+void Connection::packet_received(const uint8_t *packet, const size_t length)
+{
+	const uint8_t id = packet[0];
+	ResponseSlot &slot = responses_[id];
+	uint32_t state = slot.state.load(std::memory_order_acquire);
+	while (state == SLOT_WAITING || state == SLOT_SLEEPING)
+	{
+		if (slot.state.compare_exchange_weak(state, SLOT_FILLING, std::memory_order_acq_rel))
+		{
+			slot.data.assign(packet, packet + length);
+			slot.state.store(SLOT_READY, std::memory_order_release);
+			if (state == SLOT_SLEEPING)
+			{
+				atomic_wait::wake_all(slot.state);
+			}
+			return;
 		}
 	}
-	return std::nullopt;
+
+	if (state == SLOT_ABANDONED && slot.state.compare_exchange_strong(state, SLOT_FREE, std::memory_order_acq_rel))
+	{
+		request_ids_in_use_[id] = false;
+		return;
+	}
+
+	// Not a response we are waiting for. As many requests as ids can be in flight: if the queue is full, no one is
+	// taking them, and it can only be stale responses on the AppleWin side.
+	if (!request_queue_.try_push(packet, length))
+	{
+		LogFileOutput("Connection: queue full, dropping a packet of %u bytes with id %u\n", static_cast<unsigned>(length), id);
+	}
 }
 
 void Connection::join()
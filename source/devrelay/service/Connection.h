@@ -4,19 +4,24 @@
 #include <array>
 #include <atomic>
 #include <chrono>
-#include <condition_variable>
 #include <cstdint>
-#include <map>
 #include <mutex>
 #include <optional>
 #include <thread>
 #include <vector>
 
+#include "PacketQueue.h"
+
+class Command;
+
 class Connection
 {
 public:
-	virtual ~Connection() = default;
-	virtual void send_data(const std::vector<uint8_t> &data) = 0;
+	virtual ~Connection();
+
+	// These SLIP encode the packet into a buffer kept by the connection
+	void send_data(const std::vector<uint8_t> &data);
+	void send_command(const Command &command);
 
 	virtual void create_read_channel() = 0;
 	virtual void close_connection() = 0;
@@ -24,20 +29,65 @@ public:
 	bool is_connected() const { return is_connected_; }
 	void set_is_connected(const bool is_connected) { is_connected_ = is_connected; }
 
-	std::optional<std::vector<uint8_t>> wait_for_response(uint8_t request_id, std::chrono::seconds timeout);
+	// AppleWin side: several requests can be in flight, their responses are matched by request_sequence_number.
+	// begin_request() must be called before the request is sent, then either wait_for_response() or abandon_request().
+	void begin_request(uint8_t request_id);
+	void abandon_request(uint8_t request_id);
+	bool has_response(uint8_t request_id);
+	// The response is swapped into the caller's buffer: reuse it, and the connection will not need to allocate either
+	bool wait_for_response(uint8_t request_id, std::chrono::milliseconds timeout, std::vector<uint8_t> &response);
+
+	// The request ids are shared by all the connections (Requestor::next_request_number()): an id must not be reused while
+	// its request is in flight, or while the response of an abandoned request may still arrive
+	static bool is_request_id_in_use(uint8_t request_id) { return request_ids_in_use_[request_id]; }
+
+	// Device side: the requests, in the order they were received
 	std::optional<std::vector<uint8_t>> wait_for_request();
+	bool wait_for_request(std::vector<uint8_t> &request);	// swapped into the caller's buffer, as above
 
 	void join();
 
 private:
 	std::atomic<bool> is_connected_{false};
 
+	static std::array<std::atomic<bool>, 256> request_ids_in_use_;
+
+	std::mutex send_mutex_;
+	std::vector<uint8_t> command_buffer_;	// serialized command
+	std::vector<uint8_t> send_buffer_;		// SLIP encoded
+
+	void send_packet(const uint8_t *data, size_t length);
+
 protected:
-	std::map<uint8_t, std::vector<uint8_t>> data_map_;
+	// Writes the SLIP encoded bytes to the device (or to AppleWin)
+	virtual void write_data(const uint8_t *data, size_t length) = 0;
+
+	// called by the reading thread for each decoded packet
+	void packet_received(const uint8_t *packet, size_t length);
+
 	std::thread reading_thread_;
 
-	std::mutex data_mutex_;
-	std::condition_variable data_cv_;
+private:
+	// The response slot of each request id. The state hands the slot's buffer over without a lock: the reading thread
+	// owns it while FILLING, the waiting thread once it is READY.
+	enum SlotState : uint32_t
+	{
+		SLOT_FREE,			// no request in flight
+		SLOT_WAITING,		// the request is in flight
+		SLOT_SLEEPING,		// in flight, and wait_for_response() sleeps on the state: the reading thread must wake it
+		SLOT_FILLING,		// the reading thread is copying the response in
+		SLOT_READY,			// the response is in data
+		SLOT_ABANDONED,		// in flight, but its response will be discarded
+	};
+
+	struct alignas(64) ResponseSlot
+	{
+		std::atomic<uint32_t> state{SLOT_FREE};
+		std::vector<uint8_t> data;
+	};
+
+	std::array<ResponseSlot, 256> responses_;
+	PacketQueue request_queue_;		// any other packet (the requests, on the device side)
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -54,9 +54,18 @@ void Listener::Initialize(std::string ip_address, const uint16_t port, const uin
 
 bool Listener::get_is_listening() const { return is_listening_; }
 
-void Listener::insert_connection(uint8_t host_id, const ConnectionInfo &info) { connection_info_map_[host_id] = info; }
+void Listener::insert_connection(uint8_t host_id, const ConnectionInfo &info)
+{
+	std::lock_guard<std::mutex> lock(connection_info_mutex_);
+	connection_info_map_[host_id] = info;
+	invalidate_disk_devices();
+}
 
-uint8_t Listener::get_total_device_count() { return static_cast<uint8_t>(connection_info_map_.size()); }
+uint8_t Listener::get_total_device_count()
+{
+	std::lock_guard<std::mutex> lock(connection_info_mutex_);
+	return static_cast<uint8_t>(connection_info_map_.size());
+}
 
 Listener::~Listener() { stop(); }
 
@@ -192,7 +201,7 @@ void Listener::create_connection(unsigned int socket)
 	uint8_t host_id = 1;
 
 	// send init requests to find all the devices on this connection, or we have too many devices.
-	while (still_scanning && connection_info_map_.size() < 254)
+	while (still_scanning && get_total_device_count() < 254)
 	{
 		LogFileOutput("SmartPortOverSlip listener sending request for device_id: %d\n", device_id);
 		InitRequest request(Requestor::next_request_number(), 1, device_id);
@@ -206,9 +215,12 @@ void Listener::create_connection(unsigned int socket)
 		still_scanning = init_response->get_status() == 0;
 
 		// find the next available host_id this device can map to
-		while (connection_info_map_.find(host_id) != connection_info_map_.end())
 		{
-			host_id++;
+			std::lock_guard<std::mutex> lock(connection_info_mutex_);
+			while (connection_info_map_.find(host_id) != connection_info_map_.end())
+			{
+				host_id++;
+			}
 		}
 
 		// create an info object for the connection... no names!
@@ -241,8 +253,14 @@ void Listener::stop()
 		LogFileOutput("Listener::stop() ... joining listener until it stops\n");
 		listening_thread_.join();
 
-		LogFileOutput("Listener::stop() - closing %ld connections\n", connection_info_map_.size());
-		for (auto &pair : connection_info_map_)
+		// the reading threads erase their connection from the map as they notice it closing: close them from a copy
+		std::map<uint8_t, ConnectionInfo> connections;
+		{
+			std::lock_guard<std::mutex> lock(connection_info_mutex_);
+			connections = connection_info_map_;
+		}
+		LogFileOutput("Listener::stop() - closing %ld connections\n", connections.size());
+		for (auto &pair : connections)
 		{
 			const auto &connection = pair.second.connection;
 			connection->set_is_connected(false);
@@ -250,7 +268,11 @@ void Listener::stop()
 			connection->join();
 		}
 	}
-	connection_info_map_.clear();
+	{
+		std::lock_guard<std::mutex> lock(connection_info_mutex_);
+		connection_info_map_.clear();
+	}
+	invalidate_disk_devices();
 
 #ifdef WIN32
 	WSACleanup();
@@ -266,6 +288,7 @@ std::pair<uint8_t, std::shared_ptr<Connection>> Listener::find_connection_with_d
 {
 	std::pair<uint8_t, std::shared_ptr<Connection>> result;
 
+	std::lock_guard<std::mutex> lock(connection_info_mutex_);
 	auto it = connection_info_map_.find(host_device_id);
 	if (it != connection_info_map_.end())
 	{
@@ -278,6 +301,7 @@ std::pair<uint8_t, std::shared_ptr<Connection>> Listener::find_connection_with_d
 std::vector<std::pair<uint8_t, Connection *>> Listener::get_all_connections() const
 {
 	std::vector<std::pair<uint8_t, Connection *>> connections;
+	std::lock_guard<std::mutex> lock(connection_info_mutex_);
 	for (const auto &kv : connection_info_map_)
 	{
 		connections.emplace_back(kv.first, kv.second.connection.get());
@@ -287,6 +311,11 @@ std::vector<std::pair<uint8_t, Connection *>> Listener::get_all_connections() co
 
 std::pair<int, int> Listener::first_two_disk_devices(std::function<bool(const std::vector<uint8_t>&)> is_disk_device) const
 {
+	if (disk_devices_valid_)
+	{
+		return disk_devices_;
+	}
+
 	std::pair<int, int> disk_ids = {-1, -1};
 	const auto connections = GetCommandListener().get_all_connections();
 	for (const auto &id_and_connection : connections)
@@ -324,17 +353,25 @@ std::pair<int, int> Listener::first_two_disk_devices(std::function<bool(const st
 		}
 	}
 
+	// Not cached while there is no disk, so one coming online is found
+	if (disk_ids.first != -1)
+	{
+		disk_devices_ = disk_ids;
+		disk_devices_valid_ = true;
+	}
 	return disk_ids;
 }
 
 void Listener::connection_closed(Connection *connection)
 {
+	std::lock_guard<std::mutex> lock(connection_info_mutex_);
 	for (auto it = connection_info_map_.begin(); it != connection_info_map_.end();)
 	{
 		if (it->second.connection.get() == connection)
 		{
 			LogFileOutput("Removing device with id: %d from listener\n", it->first);
 			it = connection_info_map_.erase(it);
+			invalidate_disk_devices();
 		}
 		else
 		{
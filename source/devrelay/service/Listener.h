@@ -1,6 +1,7 @@
 #pragma once
 #if defined(DEV_RELAY_SLIP) && defined(SLIP_PROTOCOL_NET)
 
+#include <atomic>
 #include <cstdint>
 #include <functional>
 #include <memory>
@@ -40,6 +41,11 @@ private:
 #pragma warning(pop)
 
 	std::map<uint8_t, ConnectionInfo> connection_info_map_;
+	mutable std::mutex connection_info_mutex_;	// the reading threads remove their connection when it closes
+
+	// first_two_disk_devices() costs a StatusRequest round-trip per device, and ProDOS asks on every call
+	mutable std::pair<int, int> disk_devices_;
+	mutable std::atomic<bool> disk_devices_valid_{false};
 
 public:
 	Listener();
@@ -62,6 +68,7 @@ public:
 	void set_start_on_init(bool should_start) { should_start_ = should_start; }
 	bool get_start_on_init() { return should_start_; }
 	std::pair<int, int> first_two_disk_devices(std::function<bool(const std::vector<uint8_t>&)> is_disk_device) const;
+	void invalidate_disk_devices() { disk_devices_valid_ = false; }
 
 	// default values for listener
 	bool default_start_listener = true;
@@ -90,7 +97,12 @@ public:
 	void set_response_timeout(uint16_t timeout) { response_timeout_ = timeout; }
 
 	void connection_closed(Connection *connection);
-	void add_connection_info(uint8_t key, const ConnectionInfo &info) { connection_info_map_[key] = info; }
+	void add_connection_info(uint8_t key, const ConnectionInfo &info)
+	{
+		std::lock_guard<std::mutex> lock(connection_info_mutex_);
+		connection_info_map_[key] = info;
+		invalidate_disk_devices();
+	}
 };
 
 extern class Listener &GetCommandListener(void);
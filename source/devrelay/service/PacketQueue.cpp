@@ -0,0 +1,124 @@
+#ifdef DEV_RELAY_SLIP
+
+#include "PacketQueue.h"
+#include "AtomicWait.h"
+
+static_assert((PacketQueue::capacity & (PacketQueue::capacity - 1)) == 0, "the positions wrap around");
+
+PacketQueue::PacketQueue()
+{
+	for (size_t i = 0; i < capacity; ++i)
+	{
+		cells_[i].sequence.store(i, std::memory_order_relaxed);
+	}
+}
+
+bool PacketQueue::try_push(const uint8_t *packet, const size_t length)
+{
+	Cell *cell;
+	size_t position = enqueue_position_.load(std::memory_order_relaxed);
+	while (true)
+	{
+		cell = &cells_[position & (capacity - 1)];
+		const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+		if (difference == 0)
+		{
+			// the cell is free: claim it
+			if (enqueue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			// the consumers have not emptied it yet
+			return false;
+		}
+		else
+		{
+			// another producer has claimed it
+			position = enqueue_position_.load(std::memory_order_relaxed);
+		}
+	}
+
+	cell->data.assign(packet, packet + length);
+	cell->sequence.store(position + 1, std::memory_order_release);
+
+	pushes_.fetch_add(1);
+	if (waiters_.load() != 0)
+	{
+		atomic_wait::wake_all(pushes_);
+	}
+	return true;
+}
+
+bool PacketQueue::try_pop(std::vector<uint8_t> &packet)
+{
+	Cell *cell;
+	size_t position = dequeue_position_.load(std::memory_order_relaxed);
+	while (true)
+	{
+		cell = &cells_[position & (capacity - 1)];
+		const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+		const intptr_t difference = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+		if (difference == 0)
+		{
+			if (dequeue_position_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else if (difference < 0)
+		{
+			// empty
+			return false;
+		}
+		else
+		{
+			position = dequeue_position_.load(std::memory_order_relaxed);
+		}
+	}
+
+	packet.swap(cell->data);
+	// free for the producers' next lap
+	cell->sequence.store(position + capacity, std::memory_order_release);
+	return true;
+}
+
+bool PacketQueue::wait_pop(std::vector<uint8_t> &packet, const std::chrono::microseconds timeout)
+{
+	if (try_pop(packet))
+	{
+		return true;
+	}
+
+	const auto deadline = std::chrono::steady_clock::now() + timeout;
+	while (true)
+	{
+		// announce the wait before looking again: a push after this either is seen, or sees the waiter and wakes it
+		waiters_.fetch_add(1);
+		const uint32_t pushes = pushes_.load();
+		if (try_pop(packet))
+		{
+			waiters_.fetch_sub(1);
+			return true;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+		{
+			waiters_.fetch_sub(1);
+			return false;
+		}
+		atomic_wait::wait_for(pushes_, pushes, std::chrono::duration_cast<std::chrono::microseconds>(deadline - now));
+		waiters_.fetch_sub(1);
+
+		if (try_pop(packet))
+		{
+			return true;
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,43 @@
+#pragma once
+#ifdef DEV_RELAY_SLIP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// A bounded multi-producer, multi-consumer queue of packets, after D. Vyukov: a ring of cells whose sequence numbers
+// tell producers and consumers whose turn each cell is. No lock, and once the cells' buffers have grown, no allocation.
+class PacketQueue
+{
+public:
+	static constexpr size_t capacity = 256;	// a power of 2
+
+	PacketQueue();
+
+	// Copies the packet into the next cell. Returns false if the queue is full.
+	bool try_push(const uint8_t *packet, size_t length);
+	// Swaps the oldest packet into the caller's buffer: the cell keeps the caller's storage for a later packet.
+	bool try_pop(std::vector<uint8_t> &packet);
+	// As try_pop(), but sleeps until a packet is pushed or the timeout expires
+	bool wait_pop(std::vector<uint8_t> &packet, std::chrono::microseconds timeout);
+
+private:
+	struct alignas(64) Cell
+	{
+		std::atomic<size_t> sequence;
+		std::vector<uint8_t> data;
+	};
+	std::array<Cell, capacity> cells_;
+
+	alignas(64) std::atomic<size_t> enqueue_position_{0};
+	alignas(64) std::atomic<size_t> dequeue_position_{0};
+
+	// wait_pop() sleeps on the count of pushes, and try_push() only wakes it if someone is waiting
+	alignas(64) std::atomic<uint32_t> pushes_{0};
+	std::atomic<uint32_t> waiters_{0};
+};
+
+#endif
@@ -11,23 +11,54 @@ Requestor::Requestor() = default;
 
 std::unique_ptr<Response> Requestor::send_request(const Request &request, Connection *connection)
 {
+	send_request_async(request, connection);
+	return receive_response(request, connection);
+}
+
+void Requestor::send_request_async(const Request &request, Connection *connection)
+{
+	// Register the request before sending it, the response can arrive before we wait for it
+	connection->begin_request(request.get_request_sequence_number());
+
 	// Send the serialized request
-	connection->send_data(request.serialize());
+	connection->send_command(request);
+}
+
+bool Requestor::is_response_ready(const Request &request, Connection *connection)
+{
+	return connection->has_response(request.get_request_sequence_number());
+}
 
-	std::optional<std::vector<uint8_t>> response_data = connection->wait_for_response(request.get_request_sequence_number(), std::chrono::seconds(GetCommandListener().get_response_timeout()));
-	if (!response_data)
+void Requestor::abandon_request(const Request &request, Connection *connection)
+{
+	connection->abandon_request(request.get_request_sequence_number());
+}
+
+std::unique_ptr<Response> Requestor::receive_response(const Request &request, Connection *connection)
+{
+	// reused by all the requests of this thread: the connection swaps its buffer with this one
+	thread_local std::vector<uint8_t> response_data;
+	if (!connection->wait_for_response(request.get_request_sequence_number(), std::chrono::seconds(GetCommandListener().get_response_timeout()), response_data))
 	{
 		std::cerr << "Requestor::send_request timeout waiting for response" << std::endl;
+		// a late response must not be taken for the response of a later request with the same id
+		connection->abandon_request(request.get_request_sequence_number());
 		return nullptr;
 	}
 
 	// Deserialize the response data into a Response object.
 	// Each Request type (e.g. StatusRequest) is able to deserialize into its twin Response (e.g. StatusResponse).
-	return request.deserialize(*response_data);
+	return request.deserialize(response_data);
 }
 
 uint8_t Requestor::next_request_number()
 {
+	// Skip the ids still in use, as several requests can be in flight (if all are, the stalest will be reused anyway)
+	for (int i = 0; i < 256 && Connection::is_request_id_in_use(request_number_); ++i)
+	{
+		request_number_ = (request_number_ + 1) % 256;
+	}
+
 	const uint8_t current_number = request_number_;
 	request_number_ = (request_number_ + 1) % 256;
 	return current_number;
@@ -15,6 +15,13 @@ public:
 	static std::unique_ptr<Response> send_request(const Request &request, Connection *connection);
 	static uint8_t next_request_number();
 
+	// Pipelining: send_request_async() does not wait, the response is collected later with receive_response()
+	// (or discarded with abandon_request()). The request must be kept until then, it deserializes its response.
+	static void send_request_async(const Request &request, Connection *connection);
+	static bool is_response_ready(const Request &request, Connection *connection);
+	static std::unique_ptr<Response> receive_response(const Request &request, Connection *connection);
+	static void abandon_request(const Request &request, Connection *connection);
+
 private:
 	static uint8_t request_number_;
 };
@@ -44,15 +44,9 @@ void TCPConnection::close_connection()
 	socket_ = 0;
 }
 
-void TCPConnection::send_data(const std::vector<uint8_t> &data)
+void TCPConnection::write_data(const uint8_t *data, const size_t length)
 {
-	if (data.empty())
-	{
-		return;
-	}
-
-	const auto slip_data = SLIP::encode(data);
-	send(socket_, reinterpret_cast<const char *>(slip_data.data()), slip_data.size(), 0);
+	send(socket_, reinterpret_cast<const char *>(data), static_cast<int>(length), 0);
 }
 
 void TCPConnection::create_read_channel()
@@ -61,8 +55,10 @@ void TCPConnection::create_read_channel()
 
 	// Start a new thread to listen for incoming data
 	reading_thread_ = std::thread([self = std::move(self_ptr)]() {
-		std::vector<uint8_t> complete_data;
-		std::vector<uint8_t> buffer(1024);
+		// packets can be split across reads (several requests can be in flight), the decoder keeps the partial one
+		SLIPDecoder decoder;
+		const SLIPDecoder::PacketHandler on_packet = [&self](const uint8_t *packet, const size_t length) { self->packet_received(packet, length); };
+		std::vector<uint8_t> buffer(4096);
 		bool is_initialising = true;
 
 		// Set a timeout on the socket
@@ -104,32 +100,10 @@ void TCPConnection::create_read_channel()
 				}
 				if (valread > 0)
 				{
-					// LogFileOutput("SmartPortOverSlip TCPConnection, inserting data, valread: %d\n", valread);
-					complete_data.insert(complete_data.end(), buffer.begin(), buffer.begin() + valread);
-				}
-			} while (valread == 1024);
-
-			if (!complete_data.empty())
-			{
-				std::vector<std::vector<uint8_t>> decoded_packets = SLIP::split_into_packets(complete_data.data(), complete_data.size());
-				// LogFileOutput("SmartPortOverSlip TCPConnection, packets decoded: %d\n", decoded_packets.size());
-
-				if (!decoded_packets.empty())
-				{
-					for (const auto &packet : decoded_packets)
-					{
-						if (!packet.empty())
-						{
-							{
-								std::lock_guard<std::mutex> lock(self->data_mutex_);
-								self->data_map_[packet[0]] = packet;
-							}
-							self->data_cv_.notify_all();
-						}
-					}
+					// LogFileOutput("SmartPortOverSlip TCPConnection, decoding data, valread: %d\n", valread);
+					decoder.decode(buffer.data(), valread, on_packet);
 				}
-				complete_data.clear();
-			}
+			} while (valread == static_cast<int>(buffer.size()));
 		}
 		GetCommandListener().connection_closed(self.get());
 		LogFileOutput("TCPConnection::create_read_channel - thread is EXITING\n");
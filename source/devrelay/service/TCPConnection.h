@@ -12,13 +12,15 @@ class TCPConnection : public Connection, public std::enable_shared_from_this<TCP
 public:
 	TCPConnection(int socket) : socket_(socket) {}
 
-	virtual void send_data(const std::vector<uint8_t> &data) override;
 	virtual void create_read_channel() override;
 	virtual void close_connection() override;
 
 	int get_socket() const { return socket_; }
 	void set_socket(int socket) { this->socket_ = socket; }
 
+protected:
+	virtual void write_data(const uint8_t *data, size_t length) override;
+
 private:
 	int socket_;
 };
@@ -1,98 +1,106 @@
 #ifdef DEV_RELAY_SLIP
 
+#include <cstring>
 #include <iostream>
 
 #include "SLIP.h"
 
-std::vector<uint8_t> SLIP::encode(const std::vector<uint8_t> &data)
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2) || defined(__SSE2__)
+#define SLIP_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+namespace
 {
-	std::vector<uint8_t> encoded_data;
+	// The first SLIP_END or SLIP_ESC in [data, end), or end: the bytes before it are copied as they are
+	const uint8_t *find_special(const uint8_t *data, const uint8_t *end)
+	{
+#ifdef SLIP_SSE2
+		const __m128i slip_end = _mm_set1_epi8(static_cast<char>(SLIP_END));
+		const __m128i slip_esc = _mm_set1_epi8(static_cast<char>(SLIP_ESC));
+		while (end - data >= 16)
+		{
+			const __m128i bytes = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data));
+			const int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(bytes, slip_end), _mm_cmpeq_epi8(bytes, slip_esc)));
+			if (mask != 0)
+			{
+#ifdef _MSC_VER
+				unsigned long index;
+				_BitScanForward(&index, mask);
+				return data + index;
+#else
+				return data + __builtin_ctz(mask);
+#endif
+			}
+			data += 16;
+		}
+#endif
+		while (data != end && *data != SLIP_END && *data != SLIP_ESC)
+		{
+			++data;
+		}
+		return data;
+	}
+}
+
+size_t SLIP::encode(const uint8_t *data, const size_t length, uint8_t *output)
+{
+	uint8_t *out = output;
+	const uint8_t *const end = data + length;
 
 	// start with SLIP_END
-	encoded_data.push_back(SLIP_END);
+	*out++ = SLIP_END;
 
-	// Escape any SLIP special characters in the packet data
-	for (uint8_t byte : data)
+	// Copy the runs of plain bytes, and escape any SLIP special characters in between
+	while (true)
 	{
-		if (byte == SLIP_END || byte == SLIP_ESC)
+		const uint8_t *special = find_special(data, end);
+		memcpy(out, data, special - data);
+		out += special - data;
+		if (special == end)
 		{
-			encoded_data.push_back(SLIP_ESC);
-			encoded_data.push_back(byte == SLIP_END ? SLIP_ESC_END : SLIP_ESC_ESC);
-		}
-		else
-		{
-			encoded_data.push_back(byte);
+			break;
 		}
+		*out++ = SLIP_ESC;
+		*out++ = *special == SLIP_END ? SLIP_ESC_END : SLIP_ESC_ESC;
+		data = special + 1;
 	}
 
 	// Add the SLIP END byte to the end of the encoded data
-	encoded_data.push_back(SLIP_END);
+	*out++ = SLIP_END;
+
+	return out - output;
+}
+
+void SLIP::encode(const uint8_t *data, const size_t length, std::vector<uint8_t> &output)
+{
+	output.resize(max_encoded_size(length));
+	output.resize(encode(data, length, output.data()));
+}
 
+std::vector<uint8_t> SLIP::encode(const std::vector<uint8_t> &data)
+{
+	std::vector<uint8_t> encoded_data;
+	encode(data.data(), data.size(), encoded_data);
 	return encoded_data;
 }
 
 std::vector<uint8_t> SLIP::decode(const std::vector<uint8_t> &data)
 {
+	// exactly one frame: anything else (an invalid or unterminated frame, more than one frame) decodes to nothing
 	std::vector<uint8_t> decoded_data;
-	auto bytes_read = data.size();
-
-	size_t i = 0;
-	while (i < bytes_read)
+	if (data.size() < 2 || data.front() != SLIP_END || data.back() != SLIP_END || memchr(data.data() + 1, SLIP_END, data.size() - 2) != nullptr)
 	{
-		if (data[i] == SLIP_END)
-		{
-			// Start of a SLIP packet
-			i++;
-
-			// Decode the SLIP packet data
-			while (i < bytes_read && data[i] != SLIP_END)
-			{
-				if (data[i] == SLIP_ESC)
-				{
-					// Escaped byte
-					i++;
-
-					if (data[i] == SLIP_ESC_END)
-					{
-						// Escaped END byte
-						decoded_data.push_back(SLIP_END);
-					}
-					else if (data[i] == SLIP_ESC_ESC)
-					{
-						// Escaped ESC byte
-						decoded_data.push_back(SLIP_ESC);
-					}
-					else
-					{
-						// Invalid escape sequence
-						return std::vector<uint8_t>();
-					}
-				}
-				else
-				{
-					// Non-escaped byte
-					decoded_data.push_back(data[i]);
-				}
-
-				i++;
-			}
-
-			// Check for end of packet
-			if (i == bytes_read || data[i] != SLIP_END)
-			{
-				// Incomplete SLIP packet
-				return std::vector<uint8_t>();
-			}
-		}
-		else
-		{
-			// Invalid SLIP packet
-			return std::vector<uint8_t>();
-		}
-
-		i++;
+		return decoded_data;
 	}
 
+	SLIPDecoder decoder;
+	decoder.decode(data.data(), data.size(), [&decoded_data](const uint8_t *packet, const size_t length) {
+		decoded_data.assign(packet, packet + length);
+	});
 	return decoded_data;
 }
 
@@ -103,47 +111,79 @@ std::vector<std::vector<uint8_t>> SLIP::split_into_packets(const uint8_t *data,
 	// The list of decoded SLIP packets
 	std::vector<std::vector<uint8_t>> decoded_packets;
 
-	enum class State
-	{
-		NotParsing,
-		Parsing
-	} state = State::NotParsing;
-
-	// Iterate over the data and find the SLIP packet boundaries
-	size_t i = 0;
-	const uint8_t *packet_start = nullptr; // Keep track of where the packet starts
-	while (i < bytes_read)
+	SLIPDecoder decoder;
+	decoder.decode(data, bytes_read, [&decoded_packets](const uint8_t *packet, const size_t length) {
+		decoded_packets.emplace_back(packet, packet + length);
+	});
+
+	return decoded_packets;
+}
+
+void SLIPDecoder::reset()
+{
+	packet_.clear();
+	escape_ = false;
+	invalid_ = false;
+}
+
+void SLIPDecoder::decode(const uint8_t *data, const size_t length, const PacketHandler &on_packet)
+{
+	const uint8_t *const end = data + length;
+	while (data != end)
 	{
-		switch (state)
+		if (escape_)
 		{
-		case State::NotParsing:
-			// If we are not yet parsing and see a SLIP_END byte (which also marks start), start parsing a new SLIP packet
-			if (data[i] == SLIP_END)
+			escape_ = false;
+			if (*data == SLIP_ESC_END)
 			{
-				state = State::Parsing;
-				packet_start = data + i; // Mark the start of the packet
+				// Escaped END byte
+				packet_.push_back(SLIP_END);
 			}
-			break;
-		case State::Parsing:
-			// If we see another SLIP_END byte, we have reached the end of the SLIP packet
-			if (data[i] == SLIP_END)
+			else if (*data == SLIP_ESC_ESC)
 			{
-				// Extract the SLIP packet data
-				std::vector<uint8_t> slip_packet_data(packet_start, data + i + 1); // Include all bytes in the packet
+				// Escaped ESC byte
+				packet_.push_back(SLIP_ESC);
+			}
+			else if (*data != SLIP_END)
+			{
+				// Invalid escape sequence
+				invalid_ = true;
+			}
+			else
+			{
+				// ESC END: an invalid escape, and the end of the packet
+				invalid_ = true;
+				continue;
+			}
+			++data;
+			continue;
+		}
 
-				// Add the data to the list of SLIP decoded packets
-				decoded_packets.push_back(SLIP::decode(slip_packet_data));
+		// Copy the run of plain bytes
+		const uint8_t *special = find_special(data, end);
+		packet_.insert(packet_.end(), data, special);
+		data = special;
+		if (data == end)
+		{
+			return;
+		}
 
-				// Transition back to the NotParsing state
-				state = State::NotParsing;
+		if (*data == SLIP_ESC)
+		{
+			escape_ = true;
+		}
+		else
+		{
+			// The end of the packet: an empty one (e.g. the SLIP_END that starts the next frame) is dropped
+			if (!invalid_ && !packet_.empty())
+			{
+				on_packet(packet_.data(), packet_.size());
 			}
-			break;
+			packet_.clear();
+			invalid_ = false;
 		}
-		i++;
+		++data;
 	}
-
-	return decoded_packets;
 }
 
-
 #endif
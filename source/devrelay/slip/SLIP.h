@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstddef>
+#include <functional>
 #include <stdint.h>
 #include <vector>
 
@@ -16,4 +17,29 @@ public:
 	static std::vector<uint8_t> encode(const std::vector<uint8_t> &data);
 	static std::vector<uint8_t> decode(const std::vector<uint8_t> &data);
 	static std::vector<std::vector<uint8_t>> split_into_packets(const uint8_t *data, size_t bytes_read);
+
+	// Encodes one frame into output, which must have room for max_encoded_size(length) bytes. Returns the encoded size.
+	static size_t encode(const uint8_t *data, size_t length, uint8_t *output);
+	static size_t max_encoded_size(const size_t length) { return 2 * length + 2; }
+
+	// Encodes one frame into output (resized to fit, so its capacity is reused)
+	static void encode(const uint8_t *data, size_t length, std::vector<uint8_t> &output);
+};
+
+// Decodes a stream of SLIP frames (as read from a socket or a serial port): a frame can be split across reads,
+// and a read can hold several frames. The buffer is kept between frames, so once it has grown there is no allocation.
+// As RFC 1055: every SLIP_END ends a packet (so the one between two frames ends an empty packet, which is dropped).
+class SLIPDecoder
+{
+public:
+	// on_packet is called for each complete (and non-empty) packet. The data is only valid during the call.
+	typedef std::function<void(const uint8_t *packet, size_t length)> PacketHandler;
+	void decode(const uint8_t *data, size_t length, const PacketHandler &on_packet);
+
+	void reset();
+
+private:
+	std::vector<uint8_t> packet_;
+	bool escape_ = false;		// the last byte was SLIP_ESC
+	bool invalid_ = false;		// a bad escape sequence: the packet is dropped
 };
@@ -27,5 +27,14 @@ public:
     virtual ~Command() = default;
 
     uint8_t get_request_sequence_number() const { return request_sequence_number_; }
-    virtual std::vector<uint8_t> serialize() const = 0;
+
+    // Into a caller's buffer, which is cleared first (its capacity is reused: no allocation once it is big enough)
+    virtual void serialize_into(std::vector<uint8_t> &data) const = 0;
+
+    std::vector<uint8_t> serialize() const
+    {
+        std::vector<uint8_t> data;
+        serialize_into(data);
+        return data;
+    }
 };
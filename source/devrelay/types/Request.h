@@ -15,7 +15,7 @@ class Request : public Command
 public:
 	Request(const uint8_t request_sequence_number, const uint8_t command_number, const uint8_t param_count, const uint8_t device_id);
 
-	std::vector<uint8_t> serialize() const override = 0;
+	void serialize_into(std::vector<uint8_t> &data) const override = 0;
 	virtual std::unique_ptr<Response> deserialize(const std::vector<uint8_t> &data) const = 0;
 
 	uint8_t get_command_number() const;
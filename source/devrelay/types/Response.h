@@ -9,7 +9,7 @@ class Response : public Command
 {
 public:
 	Response(uint8_t request_sequence_number, uint8_t status);
-	std::vector<uint8_t> serialize() const override = 0;
+	void serialize_into(std::vector<uint8_t> &data) const override = 0;
 
 	uint8_t get_status() const;
 
@@ -0,0 +1,310 @@
+#include <StdAfx.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CardBenchmark.h"
+#include "DeviceServer.h"
+#include "ImageDevice.h"
+
+#include "Interface.h"
+#include "Memory.h"
+#include "CPU.h"
+#include "SmartPortOverSlip.h"
+#include "devrelay/service/Listener.h"
+
+// The machine, as far as SmartPortOverSlip is concerned
+
+// From Memory.cpp
+static BYTE memimage[0x10000];
+static BYTE memdirtyimage[0x100];
+LPBYTE mem = memimage;
+LPBYTE memdirty = memdirtyimage;
+
+void RegisterIoHandler(UINT uSlot, iofunction IOReadC0, iofunction IOWriteC0, iofunction IOReadCx, iofunction IOWriteCx, LPVOID lpSlotParameter, BYTE* pExpansionRom)
+{
+}
+
+LPVOID MemGetSlotParameters(UINT uSlot)
+{
+	return NULL;
+}
+
+// From CPU.cpp
+regsrec regs;
+
+// From Windows/AppleWin.cpp: only InitializeIO() uses it, to get the firmware
+FrameBase& GetFrame(void)
+{
+	throw std::runtime_error("SmartPortServer: no frame");
+}
+
+namespace
+{
+	const UINT kSlot = 5;
+	const WORD kBuffer = 0x2000;			// the 512 byte buffer for the block
+	const WORD kCaller = 0x0300;			// JSR $Cn0A; DFB command; DW cmd_list
+	const WORD kCmdList = 0x0310;
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct Result
+	{
+		uint32_t errors = 0;
+		std::vector<double> latencies;	// us
+	};
+
+	// $C0n2 <- $66 is the ProDOS entry point, $65 the SmartPort one
+	void CallCard(SmartPortOverSlip &card, const BYTE entry)
+	{
+		card.io_write0(0, 0xC080 + (kSlot << 4) + 2, entry, 0);
+	}
+
+	void ProDOSCall(SmartPortOverSlip &card, const BYTE command, const UINT block)
+	{
+		mem[0x42] = command;
+		mem[0x43] = kSlot << 4;				// drive 1
+		mem[0x44] = kBuffer & 0xFF;
+		mem[0x45] = kBuffer >> 8;
+		mem[0x46] = block & 0xFF;
+		mem[0x47] = (block >> 8) & 0xFF;
+		CallCard(card, 0x66);
+	}
+
+	void SmartPortCall(SmartPortOverSlip &card, const BYTE command, const BYTE unit, const BYTE param, const UINT block)
+	{
+		// the firmware's JSR has pushed the address of its last byte: the card skips the command and cmd_list that follow
+		regs.sp = 0x01FD;
+		mem[regs.sp + 1] = (kCaller + 2) & 0xFF;
+		mem[regs.sp + 2] = (kCaller + 2) >> 8;
+		mem[kCaller + 3] = command;
+		mem[kCaller + 4] = kCmdList & 0xFF;
+		mem[kCaller + 5] = kCmdList >> 8;
+
+		mem[kCmdList + 0] = 3;				// parameter count
+		mem[kCmdList + 1] = unit;
+		mem[kCmdList + 2] = kBuffer & 0xFF;
+		mem[kCmdList + 3] = kBuffer >> 8;
+		mem[kCmdList + 4] = command == CMD_STATUS ? param : block & 0xFF;
+		mem[kCmdList + 5] = (block >> 8) & 0xFF;
+		mem[kCmdList + 6] = (block >> 16) & 0xFF;
+		CallCard(card, 0x65);
+	}
+
+	Result Run(const UINT count, const std::function<bool(UINT)> &call)
+	{
+		Result result;
+		result.latencies.reserve(count);
+		for (UINT i = 0; i < count; i++)
+		{
+			const auto start = Clock::now();
+			const bool ok = call(i);
+			result.latencies.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+			if (!ok)
+				result.errors++;
+		}
+		return result;
+	}
+
+	void Report(const char* name, Result &result)
+	{
+		std::vector<double> &latencies = result.latencies;
+		std::sort(latencies.begin(), latencies.end());
+		double total = 0;
+		for (const double latency : latencies)
+			total += latency;
+
+		const auto percentile = [&latencies](const double p) {
+			return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * latencies.size()))];
+		};
+		printf("%-28s %6zu calls %9.0f /s   us: p50 %8.1f  p90 %8.1f  p99 %8.1f  p99.9 %8.1f  max %8.1f   errors %u\n",
+			name, latencies.size(), latencies.size() / (total * 1e-6),
+			percentile(0.50), percentile(0.90), percentile(0.99), percentile(0.999), latencies.back(), result.errors);
+	}
+
+	bool BlockIs(const UINT block, const BYTE seed)
+	{
+		BYTE expected[ImageDevice::block_size];
+		ImageDevice::fill_block(block, seed, expected);
+		return memcmp(mem + kBuffer, expected, sizeof(expected)) == 0;
+	}
+
+	void SetBlock(const UINT block, const BYTE seed)
+	{
+		ImageDevice::fill_block(block, seed, mem + kBuffer);
+	}
+
+	UINT RandomBlock(const UINT i, const UINT count)
+	{
+		return ((i + 1) * 2654435761u >> 8) % count;
+	}
+}
+
+int RunCardBenchmark(const CardBenchmarkOptions &options)
+{
+	const UINT count = std::min(options.blocks, std::min<uint32_t>(options.image_blocks, 0xFFFF));	// ProDOS block numbers are 16 bits
+	const UINT deviceCount = std::max<uint32_t>(1, std::min<uint32_t>(options.devices, 127));
+
+	// the first device is the one the single device tests use, and the one checked at the end
+	std::vector<std::string> imagePaths(1, options.image_path);
+	for (UINT i = 1; i < deviceCount; i++)
+	{
+		const size_t dot = options.image_path.find_last_of('.');
+		imagePaths.push_back(options.image_path.substr(0, dot) + "-" + std::to_string(i + 1) + (dot == std::string::npos ? "" : options.image_path.substr(dot)));
+	}
+
+	for (const std::string &imagePath : imagePaths)
+	{
+		if (count == 0 || !ImageDevice::create(imagePath, options.image_blocks))
+		{
+			fprintf(stderr, "Cannot create the image: %s\n", imagePath.c_str());
+			return 1;
+		}
+	}
+
+	Listener &listener = GetCommandListener();
+	listener.Initialize("127.0.0.1", options.port, 10);
+	listener.start();
+
+	// One server per device, connected one after the other so that unit n is the device of the n-th server
+	std::vector<std::unique_ptr<DeviceServer>> servers;
+	std::vector<std::thread> serving;
+	bool connected = true;
+	for (UINT i = 0; i < deviceCount && connected; i++)
+	{
+		servers.push_back(std::make_unique<DeviceServer>());
+		DeviceServer &server = *servers.back();
+		auto device = std::make_unique<ImageDevice>();
+		device->open(imagePaths[i], false);
+		server.add_device(std::move(device));
+		server.set_latency(options.latency, options.jitter);
+
+		// the Listener may not be accepting yet
+		connected = false;
+		for (int attempt = 0; attempt < 100 && !connected; attempt++)
+		{
+			connected = server.connect("127.0.0.1", options.port);
+			if (!connected)
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		}
+		if (!connected)
+			break;
+		serving.emplace_back(&DeviceServer::serve, &server);
+
+		const auto start = Clock::now();
+		while (listener.get_total_device_count() <= i && Clock::now() - start < std::chrono::seconds(10))
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		connected = listener.get_total_device_count() > i;
+	}
+
+	int errors = 0;
+	if (!connected)
+	{
+		fprintf(stderr, "The device servers did not register with the Listener on port %u\n", options.port);
+		errors++;
+	}
+	else
+	{
+		printf("SmartPortOverSlip card, %u device%s of %u blocks, latency %lld us, jitter %lld us\n",
+			deviceCount, deviceCount == 1 ? "" : "s", options.image_blocks, static_cast<long long>(options.latency.count()), static_cast<long long>(options.jitter.count()));
+
+		SmartPortOverSlip card(kSlot);
+		const BYTE unit = 1;
+		Result result;
+
+		if (deviceCount > 1)
+		{
+			// every device still holds the blocks it was created with: each unit is read sequentially, in turn
+			result = Run(count, [&card, deviceCount](const UINT i) {
+				const UINT block = i / deviceCount;
+				SmartPortCall(card, CMD_READ_BLOCK, static_cast<BYTE>(1 + i % deviceCount), 0, block);
+				return regs.a == 0 && BlockIs(block, 0);
+			});
+			const std::string name = "SmartPort READBLOCK, " + std::to_string(deviceCount) + " units";
+			Report(name.c_str(), result);
+			errors += result.errors;
+		}
+
+		result = Run(count, [&card](const UINT block) {
+			ProDOSCall(card, 1, block);
+			return regs.a == 0 && BlockIs(block, 0);
+		});
+		Report("ProDOS READ, sequential", result);
+		errors += result.errors;
+
+		result = Run(count, [&card](const UINT block) {
+			SetBlock(block, 1);
+			ProDOSCall(card, 2, block);
+			return regs.a == 0;
+		});
+		Report("ProDOS WRITE, sequential", result);
+		errors += result.errors;
+
+		result = Run(count, [&card, count](const UINT i) {
+			const UINT block = RandomBlock(i, count);
+			ProDOSCall(card, 1, block);
+			return regs.a == 0 && BlockIs(block, 1);
+		});
+		Report("ProDOS READ, random", result);
+		errors += result.errors;
+
+		result = Run(count, [&card, unit](const UINT block) {
+			SmartPortCall(card, CMD_READ_BLOCK, unit, 0, block);
+			return regs.a == 0 && BlockIs(block, 1);
+		});
+		Report("SmartPort READBLOCK, seq.", result);
+		errors += result.errors;
+
+		result = Run(count, [&card, unit](const UINT block) {
+			SetBlock(block, 2);
+			SmartPortCall(card, CMD_WRITE_BLOCK, unit, 0, block);
+			return regs.a == 0;
+		});
+		Report("SmartPort WRITEBLOCK, seq.", result);
+		errors += result.errors;
+
+		result = Run(count / 4, [&card, unit](const UINT i) {
+			SmartPortCall(card, CMD_STATUS, unit, 3, 0);	// DIB
+			return regs.a == 0 && mem[kBuffer + 21] == 0x02;
+		});
+		Report("SmartPort STATUS (DIB)", result);
+		errors += result.errors;
+
+		// the writes behind
+		card.Destroy();
+	}
+
+	listener.stop();
+	for (std::thread &thread : serving)
+		thread.join();
+	// the connections' reading threads notice the sockets closing
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+	uint64_t requestsServed = 0;
+	for (const auto &server : servers)
+		requestsServed += server->get_requests_served();
+
+	if (errors == 0)
+	{
+		// everything written has reached the image
+		ImageDevice image;
+		image.open(options.image_path, true);
+		UINT mismatches = 0;
+		for (UINT block = 0; block < count; block++)
+		{
+			if (image.read_block(block, mem + kBuffer) != 0 || !BlockIs(block, 2))
+				mismatches++;
+		}
+		printf("Image check: %u of %u blocks wrong, %llu requests served\n", mismatches, count, static_cast<unsigned long long>(requestsServed));
+		errors += mismatches;
+	}
+
+	for (const std::string &imagePath : imagePaths)
+		remove(imagePath.c_str());
+	return errors;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+struct CardBenchmarkOptions
+{
+	std::string image_path = "SmartPortServer-bench.po";	// created, and removed afterwards
+	uint32_t image_blocks = 65535;
+	uint32_t blocks = 4096;									// per test
+	uint16_t port = 1985;
+	uint32_t devices = 1;									// device servers, each on its own connection and image
+	std::chrono::microseconds latency{0};
+	std::chrono::microseconds jitter{0};
+};
+
+// Runs a Listener and a DeviceServer in this process, and drives a SmartPortOverSlip card through its I/O handler
+// (the ProDOS and SmartPort entry points of its firmware) as the emulated Apple would.
+// Reports blocks per second and the latency percentiles of each call. Returns the number of errors.
+// With several devices, the first test reads from all of them in turn: their connections' reading threads hand the
+// responses over to the emulation thread at once.
+int RunCardBenchmark(const CardBenchmarkOptions &options);
@@ -0,0 +1,315 @@
+#include <cstring>
+#include <stdexcept>
+
+#include "DeviceServer.h"
+
+#ifdef WIN32
+	#include <winsock2.h>
+	#include <ws2tcpip.h>
+	#pragma comment(lib, "ws2_32.lib")
+	#define CLOSE_SOCKET closesocket
+#else
+	#include <arpa/inet.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <sys/socket.h>
+	#include <unistd.h>
+	#define CLOSE_SOCKET close
+	#define INVALID_SOCKET -1
+#endif
+
+#include "Log.h"
+#include "devrelay/commands/Close.h"
+#include "devrelay/commands/Control.h"
+#include "devrelay/commands/Format.h"
+#include "devrelay/commands/Init.h"
+#include "devrelay/commands/Open.h"
+#include "devrelay/commands/Read.h"
+#include "devrelay/commands/ReadBlock.h"
+#include "devrelay/commands/Status.h"
+#include "devrelay/commands/Write.h"
+#include "devrelay/commands/WriteBlock.h"
+#include "devrelay/service/TCPConnection.h"
+
+namespace
+{
+	constexpr uint8_t error_no_drive = 0x28;
+	// INIT: any other status than 0 tells the Listener this is the last device
+	constexpr uint8_t init_last_device = 0xFF;
+
+	uint32_t to_uint(const std::array<uint8_t, 3> &bytes) { return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16); }
+	uint16_t to_uint(const std::array<uint8_t, 2> &bytes) { return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8)); }
+
+	// Request::from_packet() trusts the packet: the header (request id, command, param count, device id, parameters), then the payload
+	bool is_complete(const std::vector<uint8_t> &packet)
+	{
+		if (packet.size() < 11)
+		{
+			return false;
+		}
+		switch (packet[1])
+		{
+		case CMD_WRITE_BLOCK:
+			return packet.size() >= 11 + ImageDevice::block_size;
+		case CMD_CONTROL:
+			return packet.size() >= 11 + 2;	// the control list starts with its length
+		default:
+			return true;
+		}
+	}
+}
+
+DeviceServer::~DeviceServer()
+{
+	stop();
+}
+
+void DeviceServer::set_latency(const std::chrono::microseconds latency, const std::chrono::microseconds jitter)
+{
+	latency_ = latency;
+	jitter_ = jitter;
+}
+
+bool DeviceServer::connect(const std::string &address, const uint16_t port)
+{
+#ifdef WIN32
+	WSADATA wsa_data;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa_data) != 0)
+	{
+		LogFileOutput("DeviceServer: WSAStartup failed: %d\n", WSAGetLastError());
+		return false;
+	}
+#endif
+
+	const auto socket_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (socket_fd == INVALID_SOCKET)
+	{
+		return false;
+	}
+
+	sockaddr_in server_address = {};
+	server_address.sin_family = AF_INET;
+	server_address.sin_port = htons(port);
+	if (inet_pton(AF_INET, address.c_str(), &server_address.sin_addr) != 1 ||
+		::connect(socket_fd, reinterpret_cast<sockaddr *>(&server_address), sizeof(server_address)) != 0)
+	{
+		CLOSE_SOCKET(socket_fd);
+		return false;
+	}
+
+	// a device answers each request as soon as it can: do not hold back the small responses
+	int no_delay = 1;
+	setsockopt(socket_fd, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char *>(&no_delay), sizeof(no_delay));
+
+	connection_ = std::make_shared<TCPConnection>(static_cast<int>(socket_fd));
+	connection_->create_read_channel();
+
+	const auto start = std::chrono::steady_clock::now();
+	while (!connection_->is_connected())
+	{
+		if (std::chrono::steady_clock::now() - start > std::chrono::seconds(10))
+		{
+			connection_->close_connection();
+			connection_.reset();
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+void DeviceServer::serve()
+{
+	if (!connection_)
+	{
+		return;
+	}
+
+	const bool delayed = latency_.count() != 0 || jitter_.count() != 0;
+	if (delayed)
+	{
+		stopping_ = false;
+		last_due_ = std::chrono::steady_clock::time_point();
+		delay_thread_ = std::thread(&DeviceServer::delay_line, this);
+	}
+
+	while (connection_->wait_for_request(packet_))
+	{
+		const auto arrival = std::chrono::steady_clock::now();
+
+		std::unique_ptr<Request> request;
+		try
+		{
+			if (is_complete(packet_))
+			{
+				request = Request::from_packet(packet_);
+			}
+		}
+		catch (const std::exception &e)
+		{
+			LogFileOutput("DeviceServer: %s\n", e.what());
+		}
+		if (!request)
+		{
+			LogFileOutput("DeviceServer: dropping a packet of %u bytes\n", static_cast<unsigned>(packet_.size()));
+			continue;
+		}
+
+		const std::unique_ptr<Response> response = handle_request(*request);
+		++requests_served_;
+		if (delayed)
+		{
+			send_response(*response, arrival);
+		}
+		else
+		{
+			connection_->send_command(*response);
+		}
+	}
+
+	if (delayed)
+	{
+		{
+			std::lock_guard<std::mutex> lock(delay_mutex_);
+			stopping_ = true;
+		}
+		delay_cv_.notify_one();
+		delay_thread_.join();
+	}
+
+	for (const auto &device : devices_)
+	{
+		device->flush();
+	}
+}
+
+void DeviceServer::stop()
+{
+	if (connection_)
+	{
+		connection_->set_is_connected(false);
+		connection_->close_connection();
+	}
+}
+
+std::unique_ptr<Response> DeviceServer::handle_request(const Request &request)
+{
+	const uint8_t device_id = request.get_device_id();
+	ImageDevice *device = device_id >= 1 && device_id <= devices_.size() ? devices_[device_id - 1].get() : nullptr;
+
+	if (request.get_command_number() == CMD_INIT)
+	{
+		const uint8_t status = device == nullptr ? error_no_drive : (device_id == devices_.size() ? init_last_device : 0);
+		return request.create_response(0, status, nullptr, 0);
+	}
+
+	if (device == nullptr)
+	{
+		return request.create_response(0, error_no_drive, nullptr, 0);
+	}
+
+	uint8_t status;
+	switch (request.get_command_number())
+	{
+	case CMD_STATUS:
+	{
+		const auto &status_request = static_cast<const StatusRequest &>(request);
+		status = device->status(status_request.get_status_code(), data_);
+		return request.create_response(0, status, data_.data(), static_cast<uint16_t>(data_.size()));
+	}
+	case CMD_READ_BLOCK:
+	{
+		uint8_t block[ImageDevice::block_size];
+		status = device->read_block(to_uint(static_cast<const ReadBlockRequest &>(request).get_block_number()), block);
+		return request.create_response(0, status, block, sizeof(block));
+	}
+	case CMD_WRITE_BLOCK:
+	{
+		const auto &write_request = static_cast<const WriteBlockRequest &>(request);
+		status = device->write_block(to_uint(write_request.get_block_number()), write_request.get_block_data().data());
+		break;
+	}
+	case CMD_READ:
+	{
+		const auto &read_request = static_cast<const ReadRequest &>(request);
+		status = device->read(to_uint(read_request.get_address()), to_uint(read_request.get_byte_count()), data_);
+		return request.create_response(0, status, data_.data(), static_cast<uint16_t>(data_.size()));
+	}
+	case CMD_WRITE:
+	{
+		const auto &write_request = static_cast<const WriteRequest &>(request);
+		status = device->write(to_uint(write_request.get_address()), write_request.get_data());
+		break;
+	}
+	case CMD_FORMAT:
+		status = device->format();
+		break;
+	case CMD_CONTROL:
+		status = device->control(static_cast<const ControlRequest &>(request).get_control_code());
+		break;
+	case CMD_OPEN:
+		status = device->open_device();
+		break;
+	case CMD_CLOSE:
+		status = device->close_device();
+		break;
+	default:
+		status = ImageDevice::ERROR_BAD_COMMAND;
+		break;
+	}
+	return request.create_response(0, status, nullptr, 0);
+}
+
+void DeviceServer::send_response(const Command &response, const std::chrono::steady_clock::time_point arrival)
+{
+	auto due = arrival + latency_;
+	if (jitter_.count() != 0)
+	{
+		due += std::chrono::microseconds(std::uniform_int_distribution<int64_t>(0, jitter_.count())(random_));
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(delay_mutex_);
+		if (due < last_due_)
+		{
+			due = last_due_;
+		}
+		last_due_ = due;
+
+		std::vector<uint8_t> data;
+		if (!free_buffers_.empty())
+		{
+			data.swap(free_buffers_.back());
+			free_buffers_.pop_back();
+		}
+		response.serialize_into(data);
+		delayed_.push_back({ due, std::move(data) });
+	}
+	delay_cv_.notify_one();
+}
+
+// Sends the delayed responses when they are due
+void DeviceServer::delay_line()
+{
+	std::vector<uint8_t> data;
+	std::unique_lock<std::mutex> lock(delay_mutex_);
+	while (true)
+	{
+		delay_cv_.wait(lock, [this]() { return stopping_ || !delayed_.empty(); });
+		if (delayed_.empty())
+		{
+			break;
+		}
+
+		const auto due = delayed_.front().due;
+		data.swap(delayed_.front().data);
+		delayed_.pop_front();
+
+		lock.unlock();
+		std::this_thread::sleep_until(due);
+		connection_->send_data(data);
+		lock.lock();
+
+		free_buffers_.push_back(std::move(data));
+	}
+}
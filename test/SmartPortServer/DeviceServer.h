@@ -0,0 +1,73 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ImageDevice.h"
+
+class Command;
+class Request;
+class Response;
+class TCPConnection;
+
+// The device side of SmartPort over SLIP: it connects to AppleWin's Listener and serves its devices (1, 2, ... in the
+// order they were added), as a FujiNet would. Requests are answered in the order they arrive.
+class DeviceServer
+{
+public:
+	~DeviceServer();
+
+	void add_device(std::unique_ptr<ImageDevice> device) { devices_.push_back(std::move(device)); }
+	size_t get_device_count() const { return devices_.size(); }
+
+	// Each response leaves latency + [0, jitter] after its request arrived, as over a slow link.
+	// It is never sent before the previous one, as the link (TCP, serial) keeps them in order.
+	void set_latency(std::chrono::microseconds latency, std::chrono::microseconds jitter);
+
+	bool connect(const std::string &address, uint16_t port);
+	// Until the connection closes, or stop()
+	void serve();
+	void stop();
+
+	uint64_t get_requests_served() const { return requests_served_; }
+
+private:
+	std::unique_ptr<Response> handle_request(const Request &request);
+	void send_response(const Command &response, std::chrono::steady_clock::time_point arrival);
+	void delay_line();
+
+	std::vector<std::unique_ptr<ImageDevice>> devices_;
+	std::shared_ptr<TCPConnection> connection_;
+	std::atomic<uint64_t> requests_served_{0};
+
+	// buffers reused for each request
+	std::vector<uint8_t> packet_;
+	std::vector<uint8_t> data_;
+
+	std::chrono::microseconds latency_{0};
+	std::chrono::microseconds jitter_{0};
+	std::mt19937 random_;
+
+	// the responses waiting for their time, when there is latency
+	struct DelayedResponse
+	{
+		std::chrono::steady_clock::time_point due;
+		std::vector<uint8_t> data;
+	};
+	std::deque<DelayedResponse> delayed_;
+	std::vector<std::vector<uint8_t>> free_buffers_;
+	std::chrono::steady_clock::time_point last_due_;
+	std::mutex delay_mutex_;
+	std::condition_variable delay_cv_;
+	std::thread delay_thread_;
+	bool stopping_ = false;
+};
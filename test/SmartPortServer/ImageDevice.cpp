@@ -0,0 +1,287 @@
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+
+#include "ImageDevice.h"
+
+namespace
+{
+	// .2mg header
+	constexpr size_t header_2mg_size = 64;
+	constexpr size_t header_2mg_data_offset = 0x18;
+	constexpr size_t header_2mg_data_length = 0x1C;
+
+	uint32_t read_le32(const uint8_t *p) { return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24); }
+
+	// Status byte (SmartPort technote #2)
+	constexpr uint8_t status_block_device = 0x80;
+	constexpr uint8_t status_write_allowed = 0x40;
+	constexpr uint8_t status_read_allowed = 0x20;
+	constexpr uint8_t status_online = 0x10;
+	constexpr uint8_t status_format_allowed = 0x08;
+	constexpr uint8_t status_write_protected = 0x04;
+
+	constexpr uint8_t device_type_hard_disk = 0x02;
+}
+
+bool ImageDevice::open(const std::string &path, const bool read_only)
+{
+	path_ = path;
+	read_only_ = read_only;
+	if (!read_only_)
+	{
+		file_.open(path, std::ios::in | std::ios::out | std::ios::binary);
+		read_only_ = !file_.is_open();
+	}
+	if (read_only_)
+	{
+		file_.open(path, std::ios::in | std::ios::binary);
+		if (!file_.is_open())
+		{
+			return false;
+		}
+	}
+
+	file_.seekg(0, std::ios::end);
+	const uint64_t file_size = static_cast<uint64_t>(file_.tellg());
+	uint64_t data_size = file_size;
+	data_offset_ = 0;
+
+	uint8_t header[header_2mg_size];
+	file_.seekg(0);
+	if (file_size >= header_2mg_size && file_.read(reinterpret_cast<char *>(header), header_2mg_size) && memcmp(header, "2IMG", 4) == 0)
+	{
+		data_offset_ = read_le32(header + header_2mg_data_offset);
+		data_size = read_le32(header + header_2mg_data_length);
+		if (data_offset_ > file_size || data_size > file_size - data_offset_)
+		{
+			return false;
+		}
+	}
+	file_.clear();
+
+	// SmartPort block numbers are 3 bytes
+	block_count_ = static_cast<uint32_t>(std::min<uint64_t>(data_size / block_size, 0xFFFFFF));
+	online_ = block_count_ != 0;
+	return online_;
+}
+
+void ImageDevice::fill_block(const uint32_t block_number, const uint8_t seed, uint8_t *data)
+{
+	for (size_t i = 0; i < block_size; ++i)
+	{
+		data[i] = static_cast<uint8_t>(i * 7 + seed);
+	}
+	data[0] = block_number & 0xFF;
+	data[1] = (block_number >> 8) & 0xFF;
+	data[2] = (block_number >> 16) & 0xFF;
+	data[3] = seed;
+}
+
+bool ImageDevice::create(const std::string &path, const uint32_t block_count)
+{
+	std::ofstream file(path, std::ios::out | std::ios::binary | std::ios::trunc);
+	uint8_t block[block_size];
+	for (uint32_t block_number = 0; block_number < block_count && file; ++block_number)
+	{
+		fill_block(block_number, 0, block);
+		file.write(reinterpret_cast<const char *>(block), block_size);
+	}
+	return static_cast<bool>(file);
+}
+
+bool ImageDevice::seek(const uint64_t offset)
+{
+	file_.clear();
+	file_.seekg(static_cast<std::streamoff>(data_offset_ + offset));
+	file_.seekp(static_cast<std::streamoff>(data_offset_ + offset));
+	return static_cast<bool>(file_);
+}
+
+uint8_t ImageDevice::status_byte() const
+{
+	uint8_t status = status_block_device | status_write_allowed | status_read_allowed | status_format_allowed;
+	if (online_)
+	{
+		status |= status_online;
+	}
+	if (read_only_)
+	{
+		status |= status_write_protected;
+	}
+	return status;
+}
+
+uint8_t ImageDevice::status(const uint8_t status_code, std::vector<uint8_t> &data) const
+{
+	data.clear();
+	switch (status_code)
+	{
+	case 0x00:
+		// general status: the status byte and the block count
+		data.push_back(status_byte());
+		data.push_back(block_count_ & 0xFF);
+		data.push_back((block_count_ >> 8) & 0xFF);
+		data.push_back((block_count_ >> 16) & 0xFF);
+		return 0;
+	case 0x03:
+	{
+		// DIB: as above, then the name (upper case, padded with spaces), the type, subtype and firmware version
+		status(0x00, data);
+		std::string name = path_.substr(path_.find_last_of("/\\") + 1);
+		name = name.substr(0, std::min<size_t>(name.find('.'), 16));
+		std::transform(name.begin(), name.end(), name.begin(), [](const char c) { return static_cast<char>(toupper(static_cast<unsigned char>(c))); });
+		data.push_back(static_cast<uint8_t>(name.size()));
+		name.resize(16, ' ');
+		data.insert(data.end(), name.begin(), name.end());
+		data.push_back(device_type_hard_disk);
+		data.push_back(0x00);
+		data.push_back(0x00);
+		data.push_back(0x01);
+		return 0;
+	}
+	default:
+		// $01 (DCB) and $02 (newline) are for character devices
+		return ERROR_BAD_CONTROL;
+	}
+}
+
+uint8_t ImageDevice::read_block(const uint32_t block_number, uint8_t *data)
+{
+	if (!online_)
+	{
+		return ERROR_OFFLINE;
+	}
+	if (block_number >= block_count_)
+	{
+		return ERROR_BAD_BLOCK;
+	}
+	if (!seek(static_cast<uint64_t>(block_number) * block_size) || !file_.read(reinterpret_cast<char *>(data), block_size))
+	{
+		return ERROR_IO;
+	}
+	return 0;
+}
+
+uint8_t ImageDevice::write_block(const uint32_t block_number, const uint8_t *data)
+{
+	if (!online_)
+	{
+		return ERROR_OFFLINE;
+	}
+	if (read_only_)
+	{
+		return ERROR_NO_WRITE;
+	}
+	if (block_number >= block_count_)
+	{
+		return ERROR_BAD_BLOCK;
+	}
+	if (!seek(static_cast<uint64_t>(block_number) * block_size) || !file_.write(reinterpret_cast<const char *>(data), block_size))
+	{
+		return ERROR_IO;
+	}
+	return 0;
+}
+
+// READ and WRITE address the image by byte
+uint8_t ImageDevice::read(const uint32_t address, const uint16_t byte_count, std::vector<uint8_t> &data)
+{
+	data.clear();
+	if (!online_)
+	{
+		return ERROR_OFFLINE;
+	}
+	if (static_cast<uint64_t>(address) + byte_count > static_cast<uint64_t>(block_count_) * block_size)
+	{
+		return ERROR_BAD_BLOCK;
+	}
+	data.resize(byte_count);
+	if (!seek(address) || !file_.read(reinterpret_cast<char *>(data.data()), byte_count))
+	{
+		data.clear();
+		return ERROR_IO;
+	}
+	return 0;
+}
+
+uint8_t ImageDevice::write(const uint32_t address, const std::vector<uint8_t> &data)
+{
+	if (!online_)
+	{
+		return ERROR_OFFLINE;
+	}
+	if (read_only_)
+	{
+		return ERROR_NO_WRITE;
+	}
+	if (static_cast<uint64_t>(address) + data.size() > static_cast<uint64_t>(block_count_) * block_size)
+	{
+		return ERROR_BAD_BLOCK;
+	}
+	if (!seek(address) || !file_.write(reinterpret_cast<const char *>(data.data()), data.size()))
+	{
+		return ERROR_IO;
+	}
+	return 0;
+}
+
+uint8_t ImageDevice::format()
+{
+	if (!online_)
+	{
+		return ERROR_OFFLINE;
+	}
+	if (read_only_)
+	{
+		return ERROR_NO_WRITE;
+	}
+	const uint8_t zeroes[block_size] = {};
+	if (!seek(0))
+	{
+		return ERROR_IO;
+	}
+	for (uint32_t block_number = 0; block_number < block_count_; ++block_number)
+	{
+		if (!file_.write(reinterpret_cast<const char *>(zeroes), block_size))
+		{
+			return ERROR_IO;
+		}
+	}
+	file_.flush();
+	return 0;
+}
+
+uint8_t ImageDevice::control(const uint8_t control_code)
+{
+	switch (control_code)
+	{
+	case 0x00:
+		// reset: the media is back
+		online_ = block_count_ != 0;
+		is_open_ = false;
+		file_.flush();
+		return 0;
+	case 0x04:
+		// eject
+		online_ = false;
+		file_.flush();
+		return 0;
+	default:
+		return ERROR_BAD_CONTROL;
+	}
+}
+
+// OPEN and CLOSE are for character devices: a block device accepts them, and they change nothing
+uint8_t ImageDevice::open_device()
+{
+	is_open_ = true;
+	return 0;
+}
+
+uint8_t ImageDevice::close_device()
+{
+	is_open_ = false;
+	file_.flush();
+	return 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// A SmartPort block device backed by a ProDOS order image (.po, .hdv) or a .2mg image.
+// All the calls answer with a SmartPort status: 0, or one of the error codes below.
+class ImageDevice
+{
+public:
+	enum : uint8_t
+	{
+		ERROR_BAD_COMMAND = 0x01,
+		ERROR_BAD_CONTROL = 0x21,
+		ERROR_IO = 0x27,
+		ERROR_NO_WRITE = 0x2B,
+		ERROR_BAD_BLOCK = 0x2D,
+		ERROR_OFFLINE = 0x2F,
+	};
+
+	static constexpr size_t block_size = 512;
+
+	// Opens the image, read-only if asked to (or if it cannot be written)
+	bool open(const std::string &path, bool read_only);
+	// Creates (or truncates) a .po image of block_count blocks, filled with a pattern that depends on the block number
+	static bool create(const std::string &path, uint32_t block_count);
+	// The pattern: the block number and the seed, so a block that ends up in the wrong place is noticed
+	static void fill_block(uint32_t block_number, uint8_t seed, uint8_t *data);
+
+	const std::string &get_path() const { return path_; }
+	uint32_t get_block_count() const { return block_count_; }
+	bool is_read_only() const { return read_only_; }
+	bool is_online() const { return online_; }
+
+	uint8_t status(uint8_t status_code, std::vector<uint8_t> &data) const;
+	uint8_t read_block(uint32_t block_number, uint8_t *data);
+	uint8_t write_block(uint32_t block_number, const uint8_t *data);
+	uint8_t read(uint32_t address, uint16_t byte_count, std::vector<uint8_t> &data);
+	uint8_t write(uint32_t address, const std::vector<uint8_t> &data);
+	uint8_t format();
+	uint8_t control(uint8_t control_code);
+	uint8_t open_device();
+	uint8_t close_device();
+
+	void flush() { file_.flush(); }
+
+private:
+	uint8_t status_byte() const;
+	bool seek(uint64_t offset);
+
+	std::string path_;
+	std::fstream file_;
+	uint64_t data_offset_ = 0;		// past the .2mg header
+	uint32_t block_count_ = 0;
+	bool read_only_ = false;
+	bool online_ = false;			// cleared by an eject (CONTROL $04), set again by a reset (CONTROL $00)
+	bool is_open_ = false;			// OPEN / CLOSE
+};
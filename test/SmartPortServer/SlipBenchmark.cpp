@@ -0,0 +1,97 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <random>
+#include <vector>
+
+#include "SlipBenchmark.h"
+
+#include "devrelay/slip/SLIP.h"
+
+namespace
+{
+	const size_t kBlockSize = 512;
+	const size_t kSegmentSize = 1460;	// a TCP read: frames are split across reads
+
+	typedef std::chrono::steady_clock Clock;
+
+	// The blocks: their bytes decide how much of the frame is escaped
+	struct Data
+	{
+		const char* name;
+		std::function<uint8_t(std::mt19937 &)> byte;
+	};
+
+	double NanosecondsPerFrame(const uint32_t iterations, const std::function<void(void)> &frame)
+	{
+		const auto start = Clock::now();
+		for (uint32_t i = 0; i < iterations; i++)
+			frame();
+		return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / iterations;
+	}
+
+	void Report(const char* data, const char* name, const double ns)
+	{
+		printf("%-14s %-16s %8.1f ns/frame %8.1f MB/s\n", data, name, ns, kBlockSize * 1e3 / ns);
+	}
+}
+
+int RunSlipBenchmark(const uint32_t iterations)
+{
+	const Data data[] =
+	{
+		{ "no END/ESC", [](std::mt19937 &random) { return static_cast<uint8_t>(random() % 0xC0); } },
+		{ "random", [](std::mt19937 &random) { return static_cast<uint8_t>(random()); } },
+		{ "all END/ESC", [](std::mt19937 &random) { return static_cast<uint8_t>(random() & 1 ? SLIP_END : SLIP_ESC); } },
+	};
+
+	printf("SLIP codec, %zu byte blocks, %u frames per test\n", kBlockSize, iterations);
+
+	int errors = 0;
+	for (const Data &d : data)
+	{
+		std::mt19937 random(1985);
+		uint8_t block[kBlockSize];
+		std::generate(block, block + kBlockSize, [&]() { return d.byte(random); });
+
+		std::vector<uint8_t> encoded;
+		Report(d.name, "encode", NanosecondsPerFrame(iterations, [&]() { SLIP::encode(block, kBlockSize, encoded); }));
+
+		SLIPDecoder decoder;
+		uint32_t decoded = 0;
+		const SLIPDecoder::PacketHandler on_packet = [&](const uint8_t *packet, const size_t length) {
+			if (length == kBlockSize && memcmp(packet, block, kBlockSize) == 0)
+				decoded++;
+		};
+		Report(d.name, "decode", NanosecondsPerFrame(iterations, [&]() { decoder.decode(encoded.data(), encoded.size(), on_packet); }));
+		if (decoded != iterations)
+		{
+			printf("  %u of %u frames did not decode\n", iterations - decoded, iterations);
+			errors += iterations - decoded;
+		}
+
+		// The frames back to back, as a device server sends its responses
+		const uint32_t frames = std::max<uint32_t>(1, std::min<uint32_t>(iterations, 1024));
+		std::vector<uint8_t> stream;
+		for (uint32_t i = 0; i < frames; i++)
+			stream.insert(stream.end(), encoded.begin(), encoded.end());
+
+		decoder.reset();
+		decoded = 0;
+		const uint32_t passes = std::max<uint32_t>(1, iterations / frames);
+		const double ns = NanosecondsPerFrame(passes, [&]() {
+			for (size_t offset = 0; offset < stream.size(); offset += kSegmentSize)
+				decoder.decode(stream.data() + offset, std::min(kSegmentSize, stream.size() - offset), on_packet);
+		}) / frames;
+		Report(d.name, "decode stream", ns);
+		if (decoded != passes * frames)
+		{
+			printf("  %u of %u frames did not decode\n", passes * frames - decoded, passes * frames);
+			errors += passes * frames - decoded;
+		}
+	}
+
+	return errors;
+}
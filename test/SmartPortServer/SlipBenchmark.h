@@ -0,0 +1,8 @@
+#pragma once
+
+#include <cstdint>
+
+// Times the SLIP codec on 512 byte blocks, as the card and the device servers use it: SLIP::encode() into a reused
+// buffer, and a SLIPDecoder fed whole frames, and a stream of frames in TCP segment sized reads.
+// Each frame is checked to decode to its block. Returns the number of errors.
+int RunSlipBenchmark(uint32_t iterations);
@@ -0,0 +1,148 @@
+// A SmartPort over SLIP device server: it serves image files to AppleWin's SmartPortOverSlip card, as a FujiNet would.
+// With -bench, it measures the card's throughput and latency against a server in this process.
+// With -bench-slip, it times the SLIP encoding and decoding of a block.
+
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CardBenchmark.h"
+#include "DeviceServer.h"
+#include "ImageDevice.h"
+#include "SlipBenchmark.h"
+
+static bool g_bLog = false;
+
+// From Log.cpp
+void LogFileOutput(const char* format, ...)
+{
+	if (!g_bLog)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+}
+
+static void Usage(void)
+{
+	fprintf(stderr,
+		"Usage:\n"
+		"  SmartPortServer [options] [-ro] image [[-ro] image ...]\n"
+		"      Serve the images (.po, .hdv, .2mg) as SmartPort devices 1, 2, ...\n"
+		"      Connects to AppleWin's SmartPortOverSlip listener, and again when it restarts.\n"
+		"  SmartPortServer -bench [options] [-blocks n] [-image-blocks n] [-devices n]\n"
+		"      Drive a SmartPortOverSlip card against a server in this process, on a scratch image.\n"
+		"      With -devices, against n servers and images, each on its own connection.\n"
+		"  SmartPortServer -bench-slip [-frames n]\n"
+		"      Time the SLIP encoding and decoding of 512 byte blocks (default 1000000 frames per test).\n"
+		"Options:\n"
+		"  -address a.b.c.d   the listener's address (default 127.0.0.1)\n"
+		"  -port n            the listener's port (default 1985)\n"
+		"  -latency us        delay each response by this much\n"
+		"  -jitter us         and by up to this much more, at random\n"
+		"  -log               log to stderr\n");
+}
+
+int main(int argc, char* argv[])
+{
+	std::string address = "127.0.0.1";
+	CardBenchmarkOptions options;
+	bool bBench = false;
+	bool bBenchSlip = false;
+	uint32_t slipFrames = 1000000;
+	bool bReadOnly = false;
+	std::vector<std::pair<std::string, bool>> images;
+
+	for (int i = 1; i < argc; i++)
+	{
+		const char* arg = argv[i];
+		const bool hasValue = i + 1 < argc;
+		if (strcmp(arg, "-bench") == 0)
+			bBench = true;
+		else if (strcmp(arg, "-bench-slip") == 0)
+			bBenchSlip = true;
+		else if (strcmp(arg, "-frames") == 0 && hasValue)
+			slipFrames = static_cast<uint32_t>(atoi(argv[++i]));
+		else if (strcmp(arg, "-log") == 0)
+			g_bLog = true;
+		else if (strcmp(arg, "-ro") == 0)
+			bReadOnly = true;
+		else if (strcmp(arg, "-address") == 0 && hasValue)
+			address = argv[++i];
+		else if (strcmp(arg, "-port") == 0 && hasValue)
+			options.port = static_cast<uint16_t>(atoi(argv[++i]));
+		else if (strcmp(arg, "-latency") == 0 && hasValue)
+			options.latency = std::chrono::microseconds(atoi(argv[++i]));
+		else if (strcmp(arg, "-jitter") == 0 && hasValue)
+			options.jitter = std::chrono::microseconds(atoi(argv[++i]));
+		else if (strcmp(arg, "-blocks") == 0 && hasValue)
+			options.blocks = static_cast<uint32_t>(atoi(argv[++i]));
+		else if (strcmp(arg, "-image-blocks") == 0 && hasValue)
+			options.image_blocks = static_cast<uint32_t>(atoi(argv[++i]));
+		else if (strcmp(arg, "-devices") == 0 && hasValue)
+			options.devices = static_cast<uint32_t>(atoi(argv[++i]));
+		else if (arg[0] != '-')
+		{
+			images.emplace_back(arg, bReadOnly);
+			bReadOnly = false;
+		}
+		else
+		{
+			Usage();
+			return 1;
+		}
+	}
+
+	if (bBenchSlip)
+	{
+		const int errors = RunSlipBenchmark(slipFrames);
+		if (errors)
+			fprintf(stderr, "%d errors\n", errors);
+		return errors ? 1 : 0;
+	}
+
+	if (bBench)
+	{
+		const int errors = RunCardBenchmark(options);
+		if (errors)
+			fprintf(stderr, "%d errors\n", errors);
+		return errors ? 1 : 0;
+	}
+
+	if (images.empty())
+	{
+		Usage();
+		return 1;
+	}
+
+	DeviceServer server;
+	for (const auto& image : images)
+	{
+		auto device = std::make_unique<ImageDevice>();
+		if (!device->open(image.first, image.second))
+		{
+			fprintf(stderr, "Cannot open the image: %s\n", image.first.c_str());
+			return 1;
+		}
+		printf("Device %zu: %s, %u blocks%s\n", server.get_device_count() + 1, image.first.c_str(), device->get_block_count(), device->is_read_only() ? ", read-only" : "");
+		server.add_device(std::move(device));
+	}
+	server.set_latency(options.latency, options.jitter);
+
+	while (true)
+	{
+		if (server.connect(address, options.port))
+		{
+			printf("Connected to %s:%u\n", address.c_str(), options.port);
+			server.serve();
+			printf("Disconnected, %llu requests served\n", static_cast<unsigned long long>(server.get_requests_served()));
+		}
+		std::this_thread::sleep_for(std::chrono::seconds(1));
+	}
+}
@@ -0,0 +1,262 @@
+// The pre-cache CImageBase::Code62(), Decode62(), NibblizeTrack() & DenibblizeTrack(), with the shared work buffer made local
+
+#include <StdAfx.h>
+
+#include "NibblizerReference.h"
+#include "DiskImage.h"
+
+static const BYTE sg_DiskByte[0x40] =
+{
+	0x96,0x97,0x9A,0x9B,0x9D,0x9E,0x9F,0xA6,
+	0xA7,0xAB,0xAC,0xAD,0xAE,0xAF,0xB2,0xB3,
+	0xB4,0xB5,0xB6,0xB7,0xB9,0xBA,0xBB,0xBC,
+	0xBD,0xBE,0xBF,0xCB,0xCD,0xCE,0xCF,0xD3,
+	0xD6,0xD7,0xD9,0xDA,0xDB,0xDC,0xDD,0xDE,
+	0xDF,0xE5,0xE6,0xE7,0xE9,0xEA,0xEB,0xEC,
+	0xED,0xEE,0xEF,0xF2,0xF3,0xF4,0xF5,0xF6,
+	0xF7,0xF9,0xFA,0xFB,0xFC,0xFD,0xFE,0xFF
+};
+
+static const BYTE sg_SectorNumber[2][0x10] =
+{
+	{0x00,0x08,0x01,0x09,0x02,0x0A,0x03,0x0B, 0x04,0x0C,0x05,0x0D,0x06,0x0E,0x07,0x0F},
+	{0x00,0x07,0x0E,0x06,0x0D,0x05,0x0C,0x04, 0x0B,0x03,0x0A,0x02,0x09,0x01,0x08,0x0F}
+};
+
+static const UINT kWorkBufferSize = TRACK_DENIBBLIZED_SIZE*2;
+
+//-----------------------------------------------------------------------------
+
+static LPBYTE Code62(LPBYTE workBuffer, int sector)
+{
+	// CONVERT THE 256 8-BIT BYTES INTO 342 6-BIT BYTES, WHICH WE STORE
+	// STARTING AT 4K INTO THE WORK BUFFER.
+	{
+		LPBYTE sectorbase = workBuffer+(sector << 8);
+		LPBYTE resultptr  = workBuffer+TRACK_DENIBBLIZED_SIZE;
+		BYTE   offset     = 0xAC;
+		while (offset != 0x02)
+		{
+			BYTE value = 0;
+#define ADDVALUE(a) value = (value << 2) |        \
+							(((a) & 0x01) << 1) | \
+							(((a) & 0x02) >> 1)
+			ADDVALUE(*(sectorbase+offset));  offset -= 0x56;
+			ADDVALUE(*(sectorbase+offset));  offset -= 0x56;
+			ADDVALUE(*(sectorbase+offset));  offset -= 0x53;
+#undef ADDVALUE
+			*(resultptr++) = value << 2;
+		}
+		*(resultptr-2) &= 0x3F;
+		*(resultptr-1) &= 0x3F;
+		int loop = 0;
+		while (loop < 0x100)
+			*(resultptr++) = *(sectorbase+(loop++));
+	}
+
+	// EXCLUSIVE-OR THE ENTIRE DATA BLOCK WITH ITSELF OFFSET BY ONE BYTE,
+	// CREATING A 343RD BYTE WHICH IS USED AS A CHECKSUM.  STORE THE NEW
+	// BLOCK OF 343 BYTES STARTING AT 5K INTO THE WORK BUFFER.
+	{
+		BYTE   savedval  = 0;
+		LPBYTE sourceptr = workBuffer+TRACK_DENIBBLIZED_SIZE;
+		LPBYTE resultptr = workBuffer+TRACK_DENIBBLIZED_SIZE+0x400;
+		int    loop      = 342;
+		while (loop--)
+		{
+			*(resultptr++) = savedval ^ *sourceptr;
+			savedval = *(sourceptr++);
+		}
+		*resultptr = savedval;
+	}
+
+	// USING A LOOKUP TABLE, CONVERT THE 6-BIT BYTES INTO DISK BYTES.
+	// THE CONVERTED BLOCK OF 343 BYTES IS STORED STARTING AT 4K INTO THE WORK BUFFER.
+	{
+		LPBYTE sourceptr = workBuffer+TRACK_DENIBBLIZED_SIZE+0x400;
+		LPBYTE resultptr = workBuffer+TRACK_DENIBBLIZED_SIZE;
+		int    loop      = 343;
+		while (loop--)
+			*(resultptr++) = sg_DiskByte[(*(sourceptr++)) >> 2];
+	}
+
+	return workBuffer+TRACK_DENIBBLIZED_SIZE;
+}
+
+//-------------------------------------
+
+static void Decode62(LPBYTE workBuffer, LPBYTE imageptr)
+{
+	static BYTE sixbitbyte[0x80];
+	memset(sixbitbyte, 0, 0x80);
+	for (int loop = 0; loop < 0x40; loop++)
+		sixbitbyte[sg_DiskByte[loop]-0x80] = loop << 2;
+
+	// USING OUR TABLE, CONVERT THE DISK BYTES BACK INTO 6-BIT BYTES
+	{
+		LPBYTE sourceptr = workBuffer+TRACK_DENIBBLIZED_SIZE;
+		LPBYTE resultptr = workBuffer+TRACK_DENIBBLIZED_SIZE+0x400;
+		int    loop      = 343;
+		while (loop--)
+			*(resultptr++) = sixbitbyte[*(sourceptr++) & 0x7F];
+	}
+
+	// EXCLUSIVE-OR THE ENTIRE DATA BLOCK WITH ITSELF OFFSET BY ONE BYTE
+	// TO UNDO THE EFFECTS OF THE CHECKSUMMING PROCESS
+	{
+		BYTE   savedval  = 0;
+		LPBYTE sourceptr = workBuffer+TRACK_DENIBBLIZED_SIZE+0x400;
+		LPBYTE resultptr = workBuffer+TRACK_DENIBBLIZED_SIZE;
+		int    loop      = 342;
+		while (loop--)
+		{
+			*resultptr = savedval ^ *(sourceptr++);
+			savedval = *(resultptr++);
+		}
+	}
+
+	// CONVERT THE 342 6-BIT BYTES INTO 256 8-BIT BYTES
+	{
+		LPBYTE lowbitsptr = workBuffer+TRACK_DENIBBLIZED_SIZE;
+		LPBYTE sectorbase = workBuffer+TRACK_DENIBBLIZED_SIZE+0x56;
+		BYTE   offset     = 0xAC;
+		while (offset != 0x02)
+		{
+			if (offset >= 0xAC)
+			{
+				*(imageptr+offset) = (*(sectorbase+offset) & 0xFC)
+										| (((*lowbitsptr) & 0x80) >> 7)
+										| (((*lowbitsptr) & 0x40) >> 5);
+			}
+
+			offset -= 0x56;
+			*(imageptr+offset) = (*(sectorbase+offset) & 0xFC)
+										| (((*lowbitsptr) & 0x20) >> 5)
+										| (((*lowbitsptr) & 0x10) >> 3);
+
+			offset -= 0x56;
+			*(imageptr+offset) = (*(sectorbase+offset) & 0xFC)
+										| (((*lowbitsptr) & 0x08) >> 3)
+										| (((*lowbitsptr) & 0x04) >> 1);
+
+			offset -= 0x53;
+			lowbitsptr++;
+		}
+	}
+}
+
+//-------------------------------------
+
+void ReferenceDenibblizeTrack(const BYTE* trackimage, LPBYTE pTrackData, ReferenceSectorOrder_e order, int nibbles)
+{
+	std::vector<BYTE> work(kWorkBufferSize);
+	LPBYTE workBuffer = &work[0];
+
+	int offset    = 0;
+	int partsleft = NUM_SECTORS*2+1;
+	int sector    = -1;
+	while (partsleft--)
+	{
+		BYTE byteval[3] = {0,0,0};
+		int  bytenum    = 0;
+		int  loop       = nibbles;
+		while ((loop--) && (bytenum < 3))
+		{
+			if (bytenum)
+				byteval[bytenum++] = *(trackimage+offset++);
+			else if (*(trackimage+offset++) == 0xD5)
+				bytenum = 1;
+
+			if (offset >= nibbles)
+				offset = 0;
+		}
+
+		if ((bytenum == 3) && (byteval[1] == 0xAA))
+		{
+			int loop       = 0;
+			int tempoffset = offset;
+			while (loop < 384)
+			{
+				*(workBuffer+TRACK_DENIBBLIZED_SIZE+loop++) = *(trackimage+tempoffset++);
+				if (tempoffset >= nibbles)
+					tempoffset = 0;
+			}
+
+			if (byteval[2] == 0x96)
+			{
+				sector = ((*(workBuffer+TRACK_DENIBBLIZED_SIZE+4) & 0x55) << 1)
+						| (*(workBuffer+TRACK_DENIBBLIZED_SIZE+5) & 0x55);
+			}
+			else if (byteval[2] == 0xAD)
+			{
+				if (sector >= 0 && sector < NUM_SECTORS)
+					Decode62(workBuffer, workBuffer+(sg_SectorNumber[order][sector] << 8));
+				sector = 0;
+			}
+		}
+	}
+
+	memcpy(pTrackData, workBuffer, TRACK_DENIBBLIZED_SIZE);
+}
+
+//-------------------------------------
+
+UINT ReferenceNibblizeTrack(const BYTE* pTrackData, LPBYTE trackimagebuffer, ReferenceSectorOrder_e order, int track, BYTE volumeNumber)
+{
+	std::vector<BYTE> work(kWorkBufferSize);
+	LPBYTE workBuffer = &work[0];
+	memcpy(workBuffer, pTrackData, TRACK_DENIBBLIZED_SIZE);
+
+	LPBYTE imageptr = trackimagebuffer;
+	BYTE   sector   = 0;
+
+	// WRITE GAP ONE, WHICH CONTAINS 48 SELF-SYNC BYTES
+	int loop;
+	for (loop = 0; loop < 48; loop++)
+		*(imageptr++) = 0xFF;
+
+	while (sector < 16)
+	{
+		// WRITE THE ADDRESS FIELD
+		*(imageptr++) = 0xD5;
+		*(imageptr++) = 0xAA;
+		*(imageptr++) = 0x96;
+#define CODE44A(a) ((((a) >> 1) & 0x55) | 0xAA)
+#define CODE44B(a) (((a) & 0x55) | 0xAA)
+		*(imageptr++) = CODE44A(volumeNumber);
+		*(imageptr++) = CODE44B(volumeNumber);
+		*(imageptr++) = CODE44A((BYTE)track);
+		*(imageptr++) = CODE44B((BYTE)track);
+		*(imageptr++) = CODE44A(sector);
+		*(imageptr++) = CODE44B(sector);
+		*(imageptr++) = CODE44A(volumeNumber ^ ((BYTE)track) ^ sector);
+		*(imageptr++) = CODE44B(volumeNumber ^ ((BYTE)track) ^ sector);
+#undef CODE44A
+#undef CODE44B
+		*(imageptr++) = 0xDE;
+		*(imageptr++) = 0xAA;
+		*(imageptr++) = 0xEB;
+
+		// WRITE GAP TWO, WHICH CONTAINS SIX SELF-SYNC BYTES
+		for (loop = 0; loop < 6; loop++)
+			*(imageptr++) = 0xFF;
+
+		// WRITE THE DATA FIELD
+		*(imageptr++) = 0xD5;
+		*(imageptr++) = 0xAA;
+		*(imageptr++) = 0xAD;
+		memcpy(imageptr, Code62(workBuffer, sg_SectorNumber[order][sector]), 343);
+		imageptr += 343;
+		*(imageptr++) = 0xDE;
+		*(imageptr++) = 0xAA;
+		*(imageptr++) = 0xEB;
+
+		// WRITE GAP THREE, WHICH CONTAINS 27 SELF-SYNC BYTES
+		for (loop = 0; loop < 27; loop++)
+			*(imageptr++) = 0xFF;
+
+		sector++;
+	}
+
+	return (UINT)(imageptr-trackimagebuffer);
+}
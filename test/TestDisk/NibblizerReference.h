@@ -0,0 +1,13 @@
+#pragma once
+
+// The 6-and-2 nibblizer as it was before the track cache and the table-driven Code62()/Decode62():
+// TestDisk checks that CImageBase (and the track cache) still produce the same nibbles and sectors
+
+enum ReferenceSectorOrder_e { eReferenceProDOSOrder, eReferenceDOSOrder };
+
+// pTrackData: a track's 16 sectors, in the image's (logical) order
+// Returns the number of nibbles written to pTrackImage
+UINT ReferenceNibblizeTrack(const BYTE* pTrackData, LPBYTE pTrackImage, ReferenceSectorOrder_e order, int track, BYTE volumeNumber);
+
+// pTrackData: is cleared, then gets each sector whose data field is found in the track image
+void ReferenceDenibblizeTrack(const BYTE* pTrackImage, LPBYTE pTrackData, ReferenceSectorOrder_e order, int nibbles);
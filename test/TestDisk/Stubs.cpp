@@ -0,0 +1,185 @@
+// The machine, as far as the Disk II card and the disk image code are concerned
+
+#include <StdAfx.h>
+
+#include <cstdarg>
+#include <stdexcept>
+
+#include "Core.h"
+#include "Card.h"
+#include "CardManager.h"
+#include "CPU.h"
+#include "FrameBase.h"
+#include "InputRecorder.h"
+#include "Interface.h"
+#include "Log.h"
+#include "Memory.h"
+#include "Registry.h"
+#include "SaveState.h"
+#include "SynchronousEventManager.h"
+
+// From Core.cpp
+std::string g_VERSIONSTRING = "TestDisk";
+std::string g_pAppTitle = "TestDisk";
+AppMode_e g_nAppMode = MODE_RUNNING;
+SynchronousEventManager g_SynchronousEventMgr;
+
+// From CPU.cpp: the test sets g_nCumulativeCycles directly
+regsrec regs;
+unsigned __int64 g_nCumulativeCycles = 0;
+
+void CpuCalcCycles(ULONG nExecutedCycles)
+{
+}
+
+void SetIrqOnLastOpcodeCycle(void)
+{
+}
+
+// From Memory.cpp
+static BYTE memimage[0x10000];
+static BYTE memdirtyimage[0x100];
+LPBYTE mem = memimage;
+LPBYTE memdirty = memdirtyimage;
+
+static LPVOID sg_slotParameters[NUM_SLOTS];
+
+void RegisterIoHandler(UINT uSlot, iofunction IOReadC0, iofunction IOWriteC0, iofunction IOReadCx, iofunction IOWriteCx, LPVOID lpSlotParameter, BYTE* pExpansionRom)
+{
+	sg_slotParameters[uSlot] = lpSlotParameter;
+}
+
+LPVOID MemGetSlotParameters(UINT uSlot)
+{
+	return sg_slotParameters[uSlot];
+}
+
+LPBYTE MemGetMainPtr(const WORD offset)
+{
+	return mem + offset;
+}
+
+LPBYTE GetCxRomPeripheral(void)
+{
+	return NULL;
+}
+
+BYTE MemReadFloatingBus(const ULONG uExecutedCycles)
+{
+	return 0;
+}
+
+// From Card.cpp
+void Card::ThrowErrorInvalidSlot()
+{
+	throw std::runtime_error("TestDisk: invalid slot");
+}
+
+void Card::ThrowErrorInvalidVersion(UINT version)
+{
+	throw std::runtime_error("TestDisk: invalid version");
+}
+
+// From CardManager.cpp: only the stepper (which the tests don't use) needs it
+CardManager& GetCardMgr(void)
+{
+	throw std::runtime_error("TestDisk: no card manager");
+}
+
+// From InputRecorder.cpp
+InputRecorder::InputRecorder(void)
+{
+}
+
+InputRecorder::~InputRecorder(void)
+{
+}
+
+void InputRecorder::Record(const Event_e type, const UINT16 arg0, const UINT32 arg1, const void* pPayload, const UINT32 payloadSize)
+{
+}
+
+InputRecorder& GetInputRecorder(void)
+{
+	static InputRecorder inputRecorder;
+	return inputRecorder;
+}
+
+// From Registry.cpp
+BOOL RegLoadString(LPCTSTR section, LPCTSTR key, BOOL peruser, LPTSTR buffer, uint32_t chars, LPCTSTR defaultValue)
+{
+	return FALSE;
+}
+
+void RegSaveString(LPCTSTR section, LPCTSTR key, BOOL peruser, const std::string& buffer)
+{
+}
+
+void RegSaveValue(LPCTSTR section, LPCTSTR key, BOOL peruser, uint32_t value)
+{
+}
+
+std::string RegGetConfigSlotSection(UINT slot)
+{
+	return std::string();
+}
+
+// From SaveState.cpp
+void Snapshot_UpdatePath(void)
+{
+}
+
+// From Log.cpp
+void LogFileOutput(const char* format, ...)
+{
+}
+
+void LogOutput(const char* format, ...)
+{
+}
+
+// From FrameBase.cpp & Windows/Win32Frame.cpp
+FrameBase::FrameBase()
+{
+}
+
+FrameBase::~FrameBase()
+{
+}
+
+void FrameBase::Video_ResetScreenshotCounter(const std::string& pDiskImageFileName)
+{
+}
+
+class TestFrame : public FrameBase
+{
+public:
+	virtual void Initialize(bool resetVideoState) {}
+	virtual void Destroy(void) {}
+	virtual void FrameDrawDiskLEDS() {}
+	virtual void FrameDrawDiskStatus() {}
+	virtual void FrameRefreshStatus(int drawflags) {}
+	virtual void FrameUpdateApple2Type() {}
+	virtual void FrameSetCursorPosByMousePos() {}
+	virtual void SetFullScreenShowSubunitStatus(bool bShow) {}
+	virtual void SetWindowedModeShowDiskiiStatus(bool bShow) {}
+	virtual bool GetBestDisplayResolutionForFullScreen(UINT& bestWidth, UINT& bestHeight, UINT userSpecifiedWidth, UINT userSpecifiedHeight) { return false; }
+	virtual int SetViewportScale(int nNewScale, bool bForce) { return nNewScale; }
+	virtual void SetAltEnterToggleFullScreen(bool mode) {}
+	virtual void SetLoadedSaveStateFlag(const bool bFlag) {}
+	virtual void VideoPresentScreen(void) {}
+	virtual void ResizeWindow(void) {}
+	virtual int FrameMessageBox(LPCSTR lpText, LPCSTR lpCaption, UINT uType) { fprintf(stderr, "%s: %s\n", lpCaption, lpText); return IDOK; }
+	virtual void GetBitmap(WORD id, LONG cb, LPVOID lpvBits) {}
+	virtual std::shared_ptr<NetworkBackend> CreateNetworkBackend(const std::string& interfaceName) { return std::shared_ptr<NetworkBackend>(); }
+	virtual std::shared_ptr<SoundBuffer> CreateSoundBuffer(uint32_t dwBufferSize, uint32_t nSampleRate, int nChannels, const char* pszVoiceName) { return std::shared_ptr<SoundBuffer>(); }
+	virtual BYTE* GetResource(WORD id, LPCSTR lpType, uint32_t expectedSize) { return NULL; }
+	virtual void Restart() {}
+	virtual std::string Video_GetScreenShotFolder() const { return std::string(); }
+};
+
+FrameBase& GetFrame(void)
+{
+	static TestFrame frame;
+	return frame;
+}
@@ -0,0 +1,472 @@
+// Disk II and disk image tests:
+// . the 6-and-2 nibblizer, directly and through the nibblized-track cache, against the previous implementation
+// . the WOZ read sequencer's 4 bit-cell table against its per bit-cell path
+// . WOZ track writes (including new tracks) through the background track writer
+// . sniffing a dropped image's type, including an HDV that's too big for a floppy image
+
+#include <StdAfx.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "NibblizerReference.h"
+
+#include "CPU.h"
+#include "Disk.h"
+#include "DiskImage.h"
+#include "DiskImageHelper.h"
+#include "DiskTrackWriter.h"
+
+namespace
+{
+	const UINT kNumTracks = TRACKS_STANDARD;
+	const UINT kImageSize = kNumTracks * TRACK_DENIBBLIZED_SIZE;
+
+	// Offset of sector n's 343 data field nibbles in a nibblized track (see ReferenceNibblizeTrack())
+	UINT DataFieldOffset(const UINT sector)
+	{
+		return 48 + sector*(3+8+3+6+3+343+3+27) + (3+8+3+6+3);
+	}
+
+	void FillRandom(std::mt19937& rng, BYTE* pData, const UINT size)
+	{
+		for (UINT i = 0; i < size; i++)
+			pData[i] = (BYTE)rng();
+	}
+
+	bool SaveFile(const std::string& pathname, const std::vector<BYTE>& data)
+	{
+		FILE* file = fopen(pathname.c_str(), "wb");
+		if (!file)
+			return false;
+		const bool res = fwrite(&data[0], 1, data.size(), file) == data.size();
+		fclose(file);
+		return res;
+	}
+
+	bool LoadFile(const std::string& pathname, std::vector<BYTE>& data)
+	{
+		FILE* file = fopen(pathname.c_str(), "rb");
+		if (!file)
+			return false;
+		const bool res = fread(&data[0], 1, data.size(), file) == data.size() && fgetc(file) == EOF;
+		fclose(file);
+		return res;
+	}
+
+	CImageBase::SectorOrder_e GetSectorOrder(const ReferenceSectorOrder_e order)
+	{
+		return (order == eReferenceDOSOrder) ? CImageBase::eDOSOrder : CImageBase::eProDOSOrder;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+// CImageBase::NibblizeTrack() vs the previous implementation, for both sector orders and a range of volume numbers
+static int TestNibblizeTrack(void)
+{
+	std::mt19937 rng(1);
+	std::vector<BYTE> trackData(TRACK_DENIBBLIZED_SIZE);
+	std::vector<BYTE> expected(NIBBLES_PER_TRACK);
+	std::vector<BYTE> actual(NIBBLES_PER_TRACK);
+
+	const BYTE volumes[] = { DEFAULT_VOLUME_NUMBER, 0x00, 0x01, 0xFF };
+
+	for (UINT i = 0; i < 256; i++)
+	{
+		if (i == 0)
+			memset(&trackData[0], 0x00, TRACK_DENIBBLIZED_SIZE);
+		else if (i == 1)
+			memset(&trackData[0], 0xFF, TRACK_DENIBBLIZED_SIZE);
+		else
+			FillRandom(rng, &trackData[0], TRACK_DENIBBLIZED_SIZE);
+
+		const int track = i % kNumTracks;
+		const BYTE volume = (i < 4*sizeof(volumes)) ? volumes[i % sizeof(volumes)] : (BYTE)rng();
+
+		for (int order = eReferenceProDOSOrder; order <= eReferenceDOSOrder; order++)
+		{
+			const UINT expectedNibbles = ReferenceNibblizeTrack(&trackData[0], &expected[0], (ReferenceSectorOrder_e)order, track, volume);
+			const UINT actualNibbles = CImageBase::NibblizeTrack(&trackData[0], &actual[0], GetSectorOrder((ReferenceSectorOrder_e)order), track, volume);
+
+			if (actualNibbles != expectedNibbles || memcmp(&actual[0], &expected[0], expectedNibbles) != 0)
+			{
+				printf("NibblizeTrack: mismatch (i=%u, order=%d, track=%d, volume=%02X)\n", i, order, track, volume);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+// A DO or PO image, read and written through ImageReadTrack()/ImageWriteTrack() (so via the nibblized-track cache):
+// . each track read (and re-read) is the previous implementation's nibblized track
+// . each track written is denibblized as the previous implementation did, including for corrupt data fields
+static int TestNibblizedImage(const std::string& pathname, const ReferenceSectorOrder_e order)
+{
+	std::mt19937 rng(2);
+	std::vector<BYTE> image(kImageSize);
+	FillRandom(rng, &image[0], kImageSize);
+
+	if (!SaveFile(pathname, image))
+	{
+		printf("%s: failed to create\n", pathname.c_str());
+		return 1;
+	}
+
+	ImageInfo* pImageInfo = NULL;
+	bool writeProtected = false;
+	std::string filenameInZip;
+	if (ImageOpen(pathname, &pImageInfo, &writeProtected, false, filenameInZip) != eIMAGE_ERROR_NONE)
+	{
+		printf("%s: failed to open\n", pathname.c_str());
+		remove(pathname.c_str());
+		return 1;
+	}
+
+	int res = 0;
+	std::vector<BYTE> expected(NIBBLES_PER_TRACK);
+	std::vector<BYTE> actual(NIBBLES_PER_TRACK);
+	std::vector<BYTE> written(NIBBLES_PER_TRACK);
+
+	// Pass 0 may race the cache's worker thread, pass 1 reads cached tracks
+	for (UINT pass = 0; pass < 2 && !res; pass++)
+	{
+		for (UINT track = 0; track < kNumTracks && !res; track++)
+		{
+			const UINT expectedNibbles = ReferenceNibblizeTrack(&image[track*TRACK_DENIBBLIZED_SIZE], &expected[0], order, track, DEFAULT_VOLUME_NUMBER);
+
+			int nibbles = 0;
+			UINT bitCount = 0;
+			ImageReadTrack(pImageInfo, (float)(track*2), &actual[0], &nibbles, &bitCount, true);
+
+			if ((UINT)nibbles != expectedNibbles || memcmp(&actual[0], &expected[0], expectedNibbles) != 0)
+			{
+				printf("%s: read mismatch (pass=%u, track=%u)\n", pathname.c_str(), pass, track);
+				res = 1;
+			}
+		}
+	}
+
+	// Write tracks with: good data fields, corrupt data field nibbles, and a data field that can't be found
+	for (UINT i = 0; i < 3*8 && !res; i++)
+	{
+		const UINT track = (i * 13) % kNumTracks;
+		std::vector<BYTE> trackData(TRACK_DENIBBLIZED_SIZE);
+		FillRandom(rng, &trackData[0], TRACK_DENIBBLIZED_SIZE);
+
+		const UINT nibbles = ReferenceNibblizeTrack(&trackData[0], &written[0], order, track, DEFAULT_VOLUME_NUMBER);
+		if (i % 3 == 1)
+		{
+			for (UINT j = 0; j < 16; j++)
+				written[DataFieldOffset(rng() % NUM_SECTORS) + rng() % 343] = (BYTE)rng();
+		}
+		else if (i % 3 == 2)
+		{
+			written[DataFieldOffset(rng() % NUM_SECTORS) - 1] = 0xAF;	// D5 AA AD -> D5 AA AF
+		}
+
+		ReferenceDenibblizeTrack(&written[0], &image[track*TRACK_DENIBBLIZED_SIZE], order, nibbles);
+
+		ImageWriteTrack(pImageInfo, (float)(track*2), &written[0], nibbles);
+
+		const UINT expectedNibbles = ReferenceNibblizeTrack(&image[track*TRACK_DENIBBLIZED_SIZE], &expected[0], order, track, DEFAULT_VOLUME_NUMBER);
+
+		int actualNibbles = 0;
+		UINT bitCount = 0;
+		ImageReadTrack(pImageInfo, (float)(track*2), &actual[0], &actualNibbles, &bitCount, true);
+
+		if ((UINT)actualNibbles != expectedNibbles || memcmp(&actual[0], &expected[0], expectedNibbles) != 0)
+		{
+			printf("%s: mismatch after write (i=%u, track=%u)\n", pathname.c_str(), i, track);
+			res = 1;
+		}
+	}
+
+	if (!ImageFlush(pImageInfo) && !res)
+	{
+		printf("%s: failed to flush\n", pathname.c_str());
+		res = 1;
+	}
+
+	ImageClose(pImageInfo);
+
+	std::vector<BYTE> file(kImageSize);
+	if (!res && (!LoadFile(pathname, file) || file != image))
+	{
+		printf("%s: image file mismatch\n", pathname.c_str());
+		res = 1;
+	}
+
+	remove(pathname.c_str());
+	return res;
+}
+
+//-----------------------------------------------------------------------------
+
+namespace
+{
+	const UINT kSlot = 6;
+	const WORD kIOBase = 0xC080 + (kSlot << 4);
+
+	// Read the latch at a mix of intervals: in a read loop, between sectors, and after skipping lots of bit-cells
+	void ReadWOZTrack(const std::string& pathname, const bool useTable, std::vector<UINT32>& trace)
+	{
+		Disk2InterfaceCard::SetReadSequencerTable(useTable);
+		srand(1);	// for AddJitter()
+		g_nCumulativeCycles = 0;
+
+		Disk2InterfaceCard card(kSlot);
+		card.InitializeIO(NULL);
+		if (card.InsertDisk(DRIVE_1, pathname, false, false) != eIMAGE_ERROR_NONE)
+			return;
+
+		Disk2InterfaceCard::IORead(0, kIOBase + 0xA, 0, 0, 0);	// drive 1
+		Disk2InterfaceCard::IORead(0, kIOBase + 0x9, 0, 0, 0);	// motor on
+		Disk2InterfaceCard::IORead(0, kIOBase + 0xE, 0, 0, 0);	// read mode
+
+		std::mt19937 rng(3);
+		for (UINT i = 0; i < 200000; i++)
+		{
+			const UINT r = rng() % 100;
+			if (r < 70)			g_nCumulativeCycles += 1 + rng() % 8;
+			else if (r < 95)	g_nCumulativeCycles += 9 + rng() % 52;
+			else if (r < 99)	g_nCumulativeCycles += 61 + rng() % 40;
+			else				g_nCumulativeCycles += 101 + rng() % 3000;
+
+			const BYTE latch = Disk2InterfaceCard::IORead(0, kIOBase + 0xC, 0, 0, 0);
+			trace.push_back((card.GetCurrentBitOffset() << 16) | (card.GetCurrentShiftReg() << 8) | latch);
+		}
+
+		Disk2InterfaceCard::SetReadSequencerTable(true);
+	}
+}
+
+// The read sequencer's 4 bit-cell table vs its per bit-cell path, on a WOZ track with:
+// . 16 sectors of nibbles, random bits, and runs of zero flux bits (weak bits)
+static int TestWozReadSequencer(const std::string& pathname)
+{
+	remove(pathname.c_str());
+
+	ImageInfo* pImageInfo = NULL;
+	bool writeProtected = false;
+	std::string filenameInZip;
+	if (ImageOpen(pathname, &pImageInfo, &writeProtected, true, filenameInZip) != eIMAGE_ERROR_NONE || !ImageIsWOZ(pImageInfo))
+	{
+		printf("%s: failed to create\n", pathname.c_str());
+		if (pImageInfo)
+			ImageClose(pImageInfo);
+		remove(pathname.c_str());
+		return 1;
+	}
+
+	std::mt19937 rng(4);
+	std::vector<BYTE> trackData(TRACK_DENIBBLIZED_SIZE);
+	FillRandom(rng, &trackData[0], TRACK_DENIBBLIZED_SIZE);
+
+	const UINT trackSize = 6400;	// 51200 bit-cells: a WOZ2 track's usual length
+	std::vector<BYTE> track(NIBBLES_PER_TRACK);
+	const UINT nibbles = ReferenceNibblizeTrack(&trackData[0], &track[0], eReferenceDOSOrder, 0, DEFAULT_VOLUME_NUMBER);
+	FillRandom(rng, &track[nibbles], trackSize - nibbles);
+	FillRandom(rng, &track[DataFieldOffset(3)], 64);
+	memset(&track[DataFieldOffset(7)], 0x00, 32);
+	memset(&track[DataFieldOffset(11)], 0x11, 32);
+	memset(&track[trackSize - 8], 0x00, 8);	// weak bits across the track's end
+
+	ImageWriteTrack(pImageInfo, 0.0f, &track[0], trackSize);
+	ImageClose(pImageInfo);
+
+	std::vector<UINT32> perBitCell, table;
+	ReadWOZTrack(pathname, false, perBitCell);
+	ReadWOZTrack(pathname, true, table);
+	remove(pathname.c_str());
+
+	if (perBitCell.empty() || perBitCell.size() != table.size())
+	{
+		printf("%s: failed to read\n", pathname.c_str());
+		return 1;
+	}
+
+	UINT latchNibbles = 0;
+	for (size_t i = 0; i < perBitCell.size(); i++)
+	{
+		if (table[i] != perBitCell[i])
+		{
+			printf("%s: read %u: table=%08X, per bit-cell=%08X (bitOffset:shiftReg:latch)\n", pathname.c_str(), (UINT)i, table[i], perBitCell[i]);
+			return 1;
+		}
+
+		if (perBitCell[i] & 0x80)
+			latchNibbles++;
+	}
+
+	if (latchNibbles < perBitCell.size() / 4)	// the track is mostly nibbles, so most reads should get one
+	{
+		printf("%s: only %u of %u reads got a nibble\n", pathname.c_str(), latchNibbles, (UINT)perBitCell.size());
+		return 1;
+	}
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+// WOZ track writes through CDiskTrackWriter, with each track read back straight after (as on a head step):
+// . a write to an empty quarter-track appends a new track (so re-allocates the image buffer), on the writer's thread
+// . a new track is also visible from its neighbouring quarter-tracks, so a write there replaces it
+static int TestWozTrackWriter(const std::string& pathname)
+{
+	remove(pathname.c_str());
+
+	ImageInfo* pImageInfo = NULL;
+	bool writeProtected = false;
+	std::string filenameInZip;
+	if (ImageOpen(pathname, &pImageInfo, &writeProtected, true, filenameInZip) != eIMAGE_ERROR_NONE || !ImageIsWOZ(pImageInfo))
+	{
+		printf("%s: failed to create\n", pathname.c_str());
+		if (pImageInfo)
+			ImageClose(pImageInfo);
+		remove(pathname.c_str());
+		return 1;
+	}
+
+	// New tracks at quarter-tracks 0, 8, 20 & 138 (ie. TMAP 0-1, 7-9, 19-21 & 137-139), then writes to these & their neighbours
+	const float phases[] = { 0.0f, 4.0f, 4.5f, 10.0f, 0.0f, 3.5f, 69.0f, 10.0f, 10.5f };
+	const UINT lastWrite[] = { 4, 5, 5, 8, 4, 5, 6, 8, 8 };	// for each phase: the write that its track ends up with
+	const UINT numPhases = sizeof(phases) / sizeof(phases[0]);
+	const UINT trackSize = 6400;
+
+	std::mt19937 rng(5);
+	std::vector<std::vector<BYTE> > written(numPhases, std::vector<BYTE>(NIBBLES_PER_TRACK));
+	std::vector<BYTE> actual(NIBBLES_PER_TRACK);
+	int res = 0;
+
+	{
+		CDiskTrackWriter trackWriter;
+
+		for (UINT i = 0; i < numPhases && !res; i++)
+		{
+			FillRandom(rng, &written[i][0], trackSize);
+			trackWriter.Write(pImageInfo, phases[i], &written[i][0], trackSize);
+
+			int nibbles = 0;
+			UINT bitCount = 0;
+			trackWriter.ReadTrack(pImageInfo, phases[i], &actual[0], &nibbles, &bitCount, false);
+			if (nibbles != trackSize || memcmp(&actual[0], &written[i][0], trackSize) != 0)
+			{
+				printf("%s: mismatch after write (i=%u, phase=%.1f)\n", pathname.c_str(), i, phases[i]);
+				res = 1;
+			}
+		}
+
+		trackWriter.Wait(pImageInfo);
+	}
+
+	ImageClose(pImageInfo);
+
+	if (res)
+	{
+		remove(pathname.c_str());
+		return res;
+	}
+
+	if (ImageOpen(pathname, &pImageInfo, &writeProtected, false, filenameInZip) != eIMAGE_ERROR_NONE)
+	{
+		printf("%s: failed to re-open\n", pathname.c_str());
+		remove(pathname.c_str());
+		return 1;
+	}
+
+	for (UINT i = 0; i < numPhases && !res; i++)
+	{
+		int nibbles = 0;
+		UINT bitCount = 0;
+		ImageReadTrack(pImageInfo, phases[i], &actual[0], &nibbles, &bitCount, false);
+		if (nibbles != trackSize || memcmp(&actual[0], &written[lastWrite[i]][0], trackSize) != 0)
+		{
+			printf("%s: image file mismatch (phase=%.1f)\n", pathname.c_str(), phases[i]);
+			res = 1;
+		}
+	}
+
+	ImageClose(pImageInfo);
+
+	remove(pathname.c_str());
+	return res;
+}
+
+//-----------------------------------------------------------------------------
+
+// ImageSniffFloppyOrHarddisk() (as used for a dropped image): a floppy image, and HDVs either side of the floppy maximum
+static int TestSniffFloppyOrHarddisk(void)
+{
+	struct
+	{
+		const char* pathname;
+		UINT size;
+		eImageType expected;
+	} images[] =
+	{
+		{ "TestDisk.dsk", kImageSize, eImageDO },
+		{ "TestDisk1.hdv", 1024*1024, eImageHDV },
+		{ "TestDisk2.hdv", 32*1024*1024, eImageHDV },	// > CDiskImageHelper::GetMaxImageSize() (~7MB)
+	};
+
+	std::mt19937 rng(6);
+	int res = 0;
+	for (UINT i = 0; i < sizeof(images)/sizeof(images[0]) && !res; i++)
+	{
+		std::vector<BYTE> image(images[i].size);
+		FillRandom(rng, &image[0], TRACK_DENIBBLIZED_SIZE);
+		if (!SaveFile(images[i].pathname, image))
+		{
+			printf("%s: failed to create\n", images[i].pathname);
+			return 1;
+		}
+
+		eImageType imageType = eImageUNKNOWN;
+		const ImageError_e Err = ImageSniffFloppyOrHarddisk(images[i].pathname, imageType);
+		if (Err != eIMAGE_ERROR_NONE || imageType != images[i].expected)
+		{
+			printf("%s: sniffed as type %d (error %d), expected type %d\n", images[i].pathname, imageType, Err, images[i].expected);
+			res = 1;
+		}
+
+		remove(images[i].pathname);
+	}
+
+	return res;
+}
+
+//-----------------------------------------------------------------------------
+
+int main(int argc, char* argv[])
+{
+	int res = 1;
+
+	res = TestNibblizeTrack();
+	if (res) return res;
+
+	res = TestNibblizedImage("TestDisk.do", eReferenceDOSOrder);
+	if (res) return res;
+
+	res = TestNibblizedImage("TestDisk.po", eReferenceProDOSOrder);
+	if (res) return res;
+
+	res = TestWozReadSequencer("TestDisk.woz");
+	if (res) return res;
+
+	res = TestWozTrackWriter("TestDisk.woz");
+	if (res) return res;
+
+	res = TestSniffFloppyOrHarddisk();
+	if (res) return res;
+
+	return 0;
+}
@@ -0,0 +1,585 @@
+// The machine, as far as the save-state & memory code are concerned
+// . the only slot card is a SAM card (see TestSnapshot.cpp), besides slot-0's language card and the aux slot's card
+// . the units that just save a few scalars don't save or load anything
+
+#include <StdAfx.h>
+
+#include <stdexcept>
+
+#include "Core.h"
+#include "Card.h"
+#include "CardManager.h"
+#include "CopyProtectionDongles.h"
+#include "CPU.h"
+#include "FrameBase.h"
+#include "Harddisk.h"
+#include "InputRecorder.h"
+#include "Interface.h"
+#include "Joystick.h"
+#include "Keyboard.h"
+#include "Log.h"
+#include "Memory.h"
+#include "NTSC.h"
+#include "Pravets.h"
+#include "Registry.h"
+#include "RGBMonitor.h"
+#include "SAM.h"
+#include "SoundCore.h"
+#include "Speaker.h"
+#include "Tape.h"
+#include "VidHD.h"
+#include "Video.h"
+#include "Configuration/Config.h"
+#include "Configuration/IPropertySheet.h"
+#include "Debugger/Debug.h"
+#include "Z80VICE/z80.h"
+
+// From Core.cpp
+std::string g_pAppTitle = "TestSnapshot";
+std::string g_sCurrentDir;
+eApple2Type g_Apple2Type = A2TYPE_APPLE2EENHANCED;
+bool g_bFullSpeed = false;
+AppMode_e g_nAppMode = MODE_RUNNING;
+int g_nMemoryClearType = MIP_FF_FF_00_00;
+HANDLE g_hCustomRomF8 = INVALID_HANDLE_VALUE;
+HANDLE g_hCustomRom = INVALID_HANDLE_VALUE;
+bool g_bDisableDirectSound = false;
+bool g_bDisableDirectSoundMockingboard = false;
+
+eApple2Type GetApple2Type(void)
+{
+	return g_Apple2Type;
+}
+
+void SetApple2Type(eApple2Type type)
+{
+	g_Apple2Type = type;
+}
+
+Pravets& GetPravets(void)
+{
+	static Pravets pravets;
+	return pravets;
+}
+
+// From CPU.cpp
+regsrec regs;
+
+void CpuInitialize(void)
+{
+}
+
+eCpuType GetMainCpu(void)
+{
+	return CPU_65C02;
+}
+
+void CpuSaveSnapshot(YamlSaveHelper& yamlSaveHelper)
+{
+}
+
+void CpuLoadSnapshot(YamlLoadHelper& yamlLoadHelper, UINT version)
+{
+}
+
+// From Z80VICE/z80.cpp
+void z80_reset(void)
+{
+}
+
+// From Card.cpp
+void Card::ThrowErrorInvalidSlot()
+{
+	throw std::runtime_error("TestSnapshot: invalid slot");
+}
+
+void Card::ThrowErrorInvalidVersion(UINT version)
+{
+	throw std::runtime_error("TestSnapshot: invalid version");
+}
+
+SS_CARDTYPE Card::GetCardType(const std::string& card)
+{
+	if (card == SAMCard::GetSnapshotCardName())
+		return CT_SAM;
+
+	throw std::runtime_error("TestSnapshot: unexpected card: " + card);
+}
+
+void DummyCard::InitializeIO(LPBYTE pCxRomPeripheral)
+{
+}
+
+void DummyCard::Update(const ULONG nExecutedCycles)
+{
+}
+
+void DummyCard::SaveSnapshot(YamlSaveHelper& yamlSaveHelper)
+{
+}
+
+bool DummyCard::LoadSnapshot(YamlLoadHelper& yamlLoadHelper, UINT version)
+{
+	return false;
+}
+
+// From CardManager.cpp
+CardManager& GetCardMgr(void)
+{
+	static CardManager cardManager;
+	return cardManager;
+}
+
+void CardManager::InsertInternal(UINT slot, SS_CARDTYPE type)
+{
+	RemoveInternal(slot);
+
+	if ((type == CT_LanguageCard || type == CT_LanguageCardIIe) && GetLanguageCardMgr().SetLanguageCard(type))
+		m_slot[slot] = GetLanguageCardMgr().GetLanguageCard();
+	else if (type == CT_SAM)
+		m_slot[slot] = new SAMCard(slot);
+	else
+		m_slot[slot] = new EmptyCard(slot);
+}
+
+void CardManager::Insert(UINT slot, SS_CARDTYPE type, bool updateRegistry/*=true*/)
+{
+	InsertInternal(slot, type);
+}
+
+void CardManager::RemoveInternal(UINT slot)
+{
+	if (m_slot[slot])
+	{
+		if (m_slot[slot]->QueryType() == CT_LanguageCard || m_slot[slot]->QueryType() == CT_LanguageCardIIe)
+			GetLanguageCardMgr().SetLanguageCard(CT_Empty);
+
+		delete m_slot[slot];
+		m_slot[slot] = NULL;
+	}
+}
+
+void CardManager::Remove(UINT slot, bool updateRegistry/*=true*/)
+{
+	Insert(slot, CT_Empty, updateRegistry);
+}
+
+void CardManager::InsertAuxInternal(SS_CARDTYPE type)
+{
+	RemoveAuxInternal();
+
+	if (type == CT_Empty)
+		m_aux = new EmptyCard(SLOT_AUX);
+	else
+		m_aux = new DummyCard(type, SLOT_AUX);
+}
+
+void CardManager::InsertAux(SS_CARDTYPE type, bool updateRegistry/*=true*/)
+{
+	InsertAuxInternal(type);
+}
+
+void CardManager::RemoveAuxInternal()
+{
+	delete m_aux;
+	m_aux = NULL;
+}
+
+void CardManager::RemoveAux(void)
+{
+	InsertAux(CT_Empty);
+}
+
+void CardManager::InitializeIO(LPBYTE pCxRomPeripheral)
+{
+	for (UINT i = SLOT0; i < NUM_SLOTS; ++i)
+		m_slot[i]->InitializeIO(pCxRomPeripheral);
+}
+
+void CardManager::SaveSnapshot(YamlSaveHelper& yamlSaveHelper)
+{
+	for (UINT i = SLOT0; i < NUM_SLOTS; ++i)
+		m_slot[i]->SaveSnapshot(yamlSaveHelper);
+}
+
+void Disk2CardManager::GetFilenameAndPathForSaveState(std::string& filename, std::string& path)
+{
+}
+
+uint32_t MockingboardCardManager::GetVolume(void)
+{
+	return 0;
+}
+
+void MockingboardCardManager::SetVolume(uint32_t volume, uint32_t volumeMax)
+{
+}
+
+void MockingboardCardManager::InitializeForLoadingSnapshot(void)
+{
+}
+
+void MockingboardCardManager::SetCumulativeCycles(void)
+{
+}
+
+// From SoundCore.cpp
+VOICE::~VOICE(void)
+{
+}
+
+// From Harddisk.cpp & VidHD.cpp: only used when the machine has these cards
+void HarddiskInterfaceCard::GetFilenameAndPathForSaveState(std::string& filename, std::string& path)
+{
+}
+
+bool VidHDCard::IsWriteAux(void)
+{
+	return false;
+}
+
+void VidHDCard::VideoIOWrite(WORD pc, WORD addr, BYTE bWrite, BYTE value, ULONG nExecutedCycles)
+{
+}
+
+// From CopyProtectionDongles.cpp
+void SetCopyProtectionDongleType(DONGLETYPE type)
+{
+}
+
+DONGLETYPE GetCopyProtectionDongleType(void)
+{
+	return DT_EMPTY;
+}
+
+void DongleControl(WORD address)
+{
+}
+
+void CopyProtectionDongleSaveSnapshot(YamlSaveHelper& yamlSaveHelper)
+{
+}
+
+void CopyProtectionDongleLoadSnapshot(YamlLoadHelper& yamlLoadHelper, UINT version, UINT kUNIT_VERSION)
+{
+}
+
+// From Debugger/Debug.cpp
+void DebugDisplay(BOOL bInitDisasm)
+{
+}
+
+void DebugReset(void)
+{
+}
+
+// From Joystick.cpp
+void JoyportControl(const UINT uControl)
+{
+}
+
+void JoyResetPosition(ULONG nExecutedCycles)
+{
+}
+
+BYTE __stdcall JoyReadButton(WORD pc, WORD addr, BYTE bWrite, BYTE d, ULONG nExecutedCycles)
+{
+	return 0;
+}
+
+BYTE __stdcall JoyReadPosition(WORD pc, WORD addr, BYTE bWrite, BYTE d, ULONG nExecutedCycles)
+{
+	return 0;
+}
+
+void JoySaveSnapshot(YamlSaveHelper& yamlSaveHelper)
+{
+}
+
+void JoyLoadSnapshot(YamlLoadHelper& yamlLoadHelper, UINT version)
+{
+}
+
+// From Keyboard.cpp
+void KeybReset()
+{
+}
+
+BYTE KeybClearStrobe(void)
+{
+	return 0;
+}
+
+BYTE KeybGetKeycode()
+{
+	return 0;
+}
+
+BYTE KeybReadData(void)
+{
+	return 0;
+}
+
+BYTE KeybReadFlag(void)
+{
+	return 0;
+}
+
+void KeybSaveSnapshot(YamlSaveHelper& yamlSaveHelper)
+{
+}
+
+void KeybLoadSnapshot(YamlLoadHelper& yamlLoadHelper, UINT version)
+{
+}
+
+// From Pravets.cpp
+Pravets::Pravets(void)
+{
+}
+
+void Pravets::Reset(void)
+{
+}
+
+BYTE Pravets::SetCapsLockAllowed(BYTE value)
+{
+	return 0;
+}
+
+// From Speaker.cpp & Tape.cpp
+SoundType_e soundtype = SOUND_NONE;
+bool g_bQuieterSpeaker = false;
+short g_nSpeakerData = 0;
+
+BYTE __stdcall SpkrToggle(WORD pc, WORD addr, BYTE bWrite, BYTE d, ULONG nExecutedCycles)
+{
+	return 0;
+}
+
+void SpkrSaveSnapshot(YamlSaveHelper& yamlSaveHelper)
+{
+}
+
+void SpkrLoadSnapshot(YamlLoadHelper& yamlLoadHelper)
+{
+}
+
+BYTE __stdcall TapeRead(WORD pc, WORD addr, BYTE bWrite, BYTE d, ULONG nExecutedCycles)
+{
+	return 0;
+}
+
+BYTE __stdcall TapeWrite(WORD pc, WORD addr, BYTE bWrite, BYTE d, ULONG nExecutedCycles)
+{
+	return 0;
+}
+
+// From Video.cpp, NTSC.cpp & RGBMonitor.cpp
+void Video::VideoResetState(void)
+{
+}
+
+bool Video::VideoGetVblBar(const uint32_t uExecutedCycles)
+{
+	return false;
+}
+
+bool Video::VideoGetSW80COL(void)
+{
+	return false;
+}
+
+bool Video::VideoGetSWDHIRES(void)
+{
+	return false;
+}
+
+bool Video::VideoGetSWHIRES(void)
+{
+	return false;
+}
+
+bool Video::VideoGetSWMIXED(void)
+{
+	return false;
+}
+
+bool Video::VideoGetSWTEXT(void)
+{
+	return true;
+}
+
+bool Video::VideoGetSWAltCharSet(void)
+{
+	return false;
+}
+
+BYTE Video::VideoSetMode(WORD pc, WORD addr, BYTE bWrite, BYTE d, ULONG uExecutedCycles)
+{
+	return 0;
+}
+
+void Video::SetVideoRefreshRate(VideoRefreshRate_e rate)
+{
+}
+
+void Video::VideoSaveSnapshot(YamlSaveHelper& yamlSaveHelper)
+{
+}
+
+void Video::VideoLoadSnapshot(YamlLoadHelper& yamlLoadHelper, UINT version)
+{
+}
+
+uint16_t NTSC_VideoGetScannerAddress(const ULONG uExecutedCycles, const bool fullSpeed)
+{
+	return 0;
+}
+
+void NTSC_VideoInitAppleType(void)
+{
+}
+
+void RGB_SaveSnapshot(YamlSaveHelper& yamlSaveHelper)
+{
+}
+
+void RGB_LoadSnapshot(YamlLoadHelper& yamlLoadHelper, UINT cardVersion)
+{
+}
+
+// From InputRecorder.cpp
+InputRecorder::InputRecorder(void)
+{
+}
+
+InputRecorder::~InputRecorder(void)
+{
+}
+
+void InputRecorder::Stop(void)
+{
+}
+
+InputRecorder& GetInputRecorder(void)
+{
+	static InputRecorder inputRecorder;
+	return inputRecorder;
+}
+
+// From Registry.cpp
+void RegSaveValue(LPCTSTR section, LPCTSTR key, BOOL peruser, uint32_t value)
+{
+}
+
+std::string RegGetConfigSlotSection(UINT slot)
+{
+	return std::string();
+}
+
+// From Log.cpp
+void LogFileOutput(const char* format, ...)
+{
+}
+
+void LogOutput(const char* format, ...)
+{
+}
+
+// From Configuration/Config.cpp: only used when loading a save-state file
+CConfigNeedingRestart CConfigNeedingRestart::Create()
+{
+	throw std::runtime_error("TestSnapshot: no config");
+}
+
+// From Windows/AppleWin.cpp, FrameBase.cpp & Windows/Win32Frame.cpp
+Video& GetVideo(void)
+{
+	static Video video;
+	return video;
+}
+
+class TestPropertySheet : public IPropertySheet
+{
+public:
+	virtual void Init(void) {}
+	virtual uint32_t GetVolumeMax(void) { return 0; }
+	virtual bool SaveStateSelectImage(HWND hWindow, bool bSave) { return false; }
+	virtual void ApplyNewConfig(const CConfigNeedingRestart& ConfigNew, const CConfigNeedingRestart& ConfigOld) {}
+	virtual void ApplyNewConfigFromSnapshot(const CConfigNeedingRestart& ConfigNew) {}
+	virtual void ConfigSaveApple2Type(eApple2Type apple2Type) {}
+	virtual UINT GetScrollLockToggle(void) { return 0; }
+	virtual void SetScrollLockToggle(UINT uValue) {}
+	virtual UINT GetJoystickCursorControl(void) { return 0; }
+	virtual void SetJoystickCursorControl(UINT uValue) {}
+	virtual UINT GetJoystickCenteringControl(void) { return 0; }
+	virtual void SetJoystickCenteringControl(UINT uValue) {}
+	virtual UINT GetAutofire(UINT uButton) { return 0; }
+	virtual void SetAutofire(UINT uValue) {}
+	virtual bool GetButtonsSwapState(void) { return false; }
+	virtual void SetButtonsSwapState(bool value) {}
+	virtual UINT GetMouseShowCrosshair(void) { return 0; }
+	virtual void SetMouseShowCrosshair(UINT uValue) {}
+	virtual UINT GetMouseRestrictToWindow(void) { return 0; }
+	virtual void SetMouseRestrictToWindow(UINT uValue) {}
+	virtual UINT GetTheFreezesF8Rom(void) { return 0; }
+	virtual void SetTheFreezesF8Rom(UINT uValue) {}
+};
+
+IPropertySheet& GetPropertySheet(void)
+{
+	static TestPropertySheet propertySheet;
+	return propertySheet;
+}
+
+FrameBase::FrameBase()
+{
+}
+
+FrameBase::~FrameBase()
+{
+}
+
+void FrameBase::VideoRedrawScreen(void)
+{
+}
+
+class TestFrame : public FrameBase
+{
+public:
+	virtual void Initialize(bool resetVideoState) {}
+	virtual void Destroy(void) {}
+	virtual void FrameDrawDiskLEDS() {}
+	virtual void FrameDrawDiskStatus() {}
+	virtual void FrameRefreshStatus(int drawflags) {}
+	virtual void FrameUpdateApple2Type() {}
+	virtual void FrameSetCursorPosByMousePos() {}
+	virtual void SetFullScreenShowSubunitStatus(bool bShow) {}
+	virtual void SetWindowedModeShowDiskiiStatus(bool bShow) {}
+	virtual bool GetBestDisplayResolutionForFullScreen(UINT& bestWidth, UINT& bestHeight, UINT userSpecifiedWidth, UINT userSpecifiedHeight) { return false; }
+	virtual int SetViewportScale(int nNewScale, bool bForce) { return nNewScale; }
+	virtual void SetAltEnterToggleFullScreen(bool mode) {}
+	virtual void SetLoadedSaveStateFlag(const bool bFlag) {}
+	virtual void VideoPresentScreen(void) {}
+	virtual void ResizeWindow(void) {}
+	virtual int FrameMessageBox(LPCSTR lpText, LPCSTR lpCaption, UINT uType) { fprintf(stderr, "%s: %s\n", lpCaption, lpText); return IDOK; }
+	virtual void GetBitmap(WORD id, LONG cb, LPVOID lpvBits) {}
+	virtual std::shared_ptr<NetworkBackend> CreateNetworkBackend(const std::string& interfaceName) { return std::shared_ptr<NetworkBackend>(); }
+	virtual std::shared_ptr<SoundBuffer> CreateSoundBuffer(uint32_t dwBufferSize, uint32_t nSampleRate, int nChannels, const char* pszVoiceName) { return std::shared_ptr<SoundBuffer>(); }
+	virtual void Restart() {}
+	virtual std::string Video_GetScreenShotFolder() const { return std::string(); }
+
+	// The ROMs: all zeros, as the benchmark doesn't run any code
+	virtual BYTE* GetResource(WORD id, LPCSTR lpType, uint32_t expectedSize)
+	{
+		static BYTE rom[64*1024];
+		return (expectedSize <= sizeof(rom)) ? rom : NULL;
+	}
+};
+
+FrameBase& GetFrame(void)
+{
+	static TestFrame frame;
+	return frame;
+}
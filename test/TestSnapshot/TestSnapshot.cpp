@@ -0,0 +1,149 @@
+// Snapshot_Capture() & Snapshot_Restore() benchmark, for an enhanced //e with:
+// . 128K: an extended 80-col card (64K main + 64K aux)
+// . 8MB : a RamWorks III card with 128 banks of 64K aux
+// The save-state & memory code is AppleWin's (see the vcxproj); the units that just save a few scalars (CPU, video,
+// keyboard, etc) are stubbed (see Stubs.cpp), so the times are the memory's, which is what scales with the config.
+// There's a SAM card in slot 5, as a snapshot's Slots unit needs at least one card.
+// Each config's restores are checked: re-capturing a restored snapshot must give the same snapshot.
+// Usage: TestSnapshot [iterations]
+
+#include <StdAfx.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include "CardManager.h"
+#include "Core.h"
+#include "Memory.h"
+#include "SaveState.h"
+#include "YamlHelper.h"
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	double ElapsedUs(const Clock::time_point& start)
+	{
+		return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+	}
+
+	// Power-on an enhanced //e with this aux slot card (see MemInitialize())
+	void InitializeMachine(const SS_CARDTYPE auxCard, const UINT auxBanks)
+	{
+		MemDestroy();
+
+		SetApple2Type(A2TYPE_APPLE2EENHANCED);
+		SetExpansionMemType(auxCard, false);
+		SetRamWorksMemorySize(auxBanks, false);
+
+		MemInitialize();
+
+		GetCardMgr().Insert(SLOT5, CT_SAM, false);
+	}
+
+	// Fill main & all aux banks, then refresh 'mem' from them
+	void FillMemory(std::mt19937& rng)
+	{
+		for (UINT bank = 0; LPBYTE pBank = MemGetBankPtr(bank); bank++)
+		{
+			for (UINT i = 0; i < _6502_MEM_LEN; i++)
+				pBank[i] = (BYTE)rng();
+		}
+
+		MemUpdatePaging(TRUE);
+	}
+
+	bool IsSameSnapshot(const MachineSnapshot& a, const MachineSnapshot& b)
+	{
+		return a.yaml == b.yaml && a.blobs == b.blobs;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+// Captures 2 snapshots (of different memory), then times capture (re-using a snapshot, as the rewind buffer does) and
+// restore (alternating between the 2 snapshots, so each restore changes all of memory)
+// Returns the number of errors
+static int RunSnapshotBenchmark(const char* pName, const SS_CARDTYPE auxCard, const UINT auxBanks, const UINT iterations)
+{
+	int errors = 0;
+	std::mt19937 rng(auxBanks);
+
+	InitializeMachine(auxCard, auxBanks);
+
+	MachineSnapshot snapshot[2];
+	for (UINT i = 0; i < 2; i++)
+	{
+		FillMemory(rng);
+		Snapshot_Capture(snapshot[i]);
+	}
+
+	size_t blobBytes = 0;
+	for (size_t i = 0; i < snapshot[0].blobs.size(); i++)
+		blobBytes += snapshot[0].blobs[i].size();
+
+	MachineSnapshot capture;
+	Clock::time_point start = Clock::now();
+	for (UINT i = 0; i < iterations; i++)
+		Snapshot_Capture(capture);
+	const double captureUs = ElapsedUs(start) / iterations;
+
+	if (!IsSameSnapshot(capture, snapshot[1]))
+	{
+		fprintf(stderr, "%s: capture differs from the previous capture\n", pName);
+		errors++;
+	}
+
+	start = Clock::now();
+	for (UINT i = 0; i < iterations; i++)
+	{
+		if (!Snapshot_Restore(snapshot[i & 1]))
+			errors++;
+	}
+	const double restoreUs = ElapsedUs(start) / iterations;
+
+	for (UINT i = 0; i < 2; i++)
+	{
+		if (!Snapshot_Restore(snapshot[i]))
+		{
+			fprintf(stderr, "%s: restore #%u failed\n", pName, i);
+			errors++;
+			continue;
+		}
+
+		Snapshot_Capture(capture);
+		if (!IsSameSnapshot(capture, snapshot[i]))
+		{
+			fprintf(stderr, "%s: restore #%u didn't restore the captured state\n", pName, i);
+			errors++;
+		}
+	}
+
+	const double mb = blobBytes / (1024.0 * 1024.0);
+	printf("%-4s %3u aux bank%s  %6.2f MB   capture %9.1f us (%7.0f MB/s)   restore %9.1f us (%7.0f MB/s)   errors %d\n",
+		pName, auxBanks, auxBanks == 1 ? " " : "s", mb,
+		captureUs, mb / (captureUs / 1e6),
+		restoreUs, mb / (restoreUs / 1e6),
+		errors);
+
+	return errors;
+}
+
+int main(int argc, char* argv[])
+{
+	const UINT iterations = (argc > 1) ? strtoul(argv[1], NULL, 10) : 100;
+	if (iterations == 0)
+	{
+		fprintf(stderr, "Usage: %s [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	int errors = 0;
+	errors += RunSnapshotBenchmark("128K", CT_Extended80Col, 1, iterations);
+	errors += RunSnapshotBenchmark("8MB", CT_RamWorksIII, 128, iterations);
+
+	MemDestroy();
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,151 @@
+// The machine, as far as the Uthernet II card is concerned
+
+#include <StdAfx.h>
+
+#include <stdexcept>
+
+#include "Card.h"
+#include "CPU.h"
+#include "FrameBase.h"
+#include "Interface.h"
+#include "Log.h"
+#include "Memory.h"
+#include "Registry.h"
+#include "Tfe/NetworkBackend.h"
+#include "Tfe/PCapBackend.h"
+
+// From CPU.cpp: only the -net-capture timestamps use it
+unsigned __int64 g_nCumulativeCycles = 0;
+
+// From Memory.cpp: the test calls Uthernet2::IO_C0() directly
+void RegisterIoHandler(UINT uSlot, iofunction IOReadC0, iofunction IOWriteC0, iofunction IOReadCx, iofunction IOWriteCx, LPVOID lpSlotParameter, BYTE* pExpansionRom)
+{
+}
+
+LPVOID MemGetSlotParameters(UINT uSlot)
+{
+	return NULL;
+}
+
+BYTE MemReadFloatingBus(const ULONG uExecutedCycles)
+{
+	return 0;
+}
+
+BYTE __stdcall IO_Null(WORD programcounter, WORD address, BYTE write, BYTE value, ULONG nExecutedCycles)
+{
+	return 0;
+}
+
+// From Card.cpp
+void Card::ThrowErrorInvalidSlot()
+{
+	throw std::runtime_error("TestUthernet2: invalid slot");
+}
+
+void Card::ThrowErrorInvalidVersion(UINT version)
+{
+	throw std::runtime_error("TestUthernet2: invalid version");
+}
+
+// From Registry.cpp: Virtual DNS off, no hosts file
+BOOL RegLoadString(LPCTSTR section, LPCTSTR key, BOOL peruser, LPTSTR buffer, uint32_t chars, LPCTSTR defaultValue)
+{
+	strncpy(buffer, defaultValue, chars);
+	buffer[chars - 1] = 0;
+	return FALSE;
+}
+
+BOOL RegLoadValue(LPCTSTR section, LPCTSTR key, BOOL peruser, uint32_t* value)
+{
+	return FALSE;
+}
+
+void RegSaveValue(LPCTSTR section, LPCTSTR key, BOOL peruser, uint32_t value)
+{
+}
+
+std::string RegGetConfigSlotSection(UINT slot)
+{
+	return std::string();
+}
+
+// From Tfe/PCapBackend.cpp
+std::string PCapBackend::GetRegistryInterface(UINT slot)
+{
+	return std::string();
+}
+
+void PCapBackend::SetRegistryInterface(UINT slot, const std::string& name)
+{
+}
+
+// From Log.cpp
+void LogFileOutput(const char* format, ...)
+{
+}
+
+void LogOutput(const char* format, ...)
+{
+}
+
+// The MACRAW & IPRAW backend: no frames in, frames out are dropped (the test only uses TCP sockets)
+class NullBackend : public NetworkBackend
+{
+public:
+	virtual void transmit(const int txlength, uint8_t* txframe) {}
+	virtual int receive(const int size, uint8_t* rxframe) { return -1; }
+	virtual void update(const ULONG nExecutedCycles) {}
+	virtual void getMACAddress(const uint32_t address, MACAddress& mac) { memset(&mac, 0, sizeof(mac)); }
+	virtual bool isValid() { return true; }
+	virtual const std::string& getInterfaceName() { return m_name; }
+
+private:
+	std::string m_name;
+};
+
+// From FrameBase.cpp & Windows/Win32Frame.cpp
+FrameBase::FrameBase()
+{
+}
+
+FrameBase::~FrameBase()
+{
+}
+
+void FrameBase::Video_ResetScreenshotCounter(const std::string& pDiskImageFileName)
+{
+}
+
+class TestFrame : public FrameBase
+{
+public:
+	virtual void Initialize(bool resetVideoState) {}
+	virtual void Destroy(void) {}
+	virtual void FrameDrawDiskLEDS() {}
+	virtual void FrameDrawDiskStatus() {}
+	virtual void FrameRefreshStatus(int drawflags) {}
+	virtual void FrameUpdateApple2Type() {}
+	virtual void FrameSetCursorPosByMousePos() {}
+	virtual void SetFullScreenShowSubunitStatus(bool bShow) {}
+	virtual void SetWindowedModeShowDiskiiStatus(bool bShow) {}
+	virtual bool GetBestDisplayResolutionForFullScreen(UINT& bestWidth, UINT& bestHeight, UINT userSpecifiedWidth, UINT userSpecifiedHeight) { return false; }
+	virtual int SetViewportScale(int nNewScale, bool bForce) { return nNewScale; }
+	virtual void SetAltEnterToggleFullScreen(bool mode) {}
+	virtual void SetLoadedSaveStateFlag(const bool bFlag) {}
+	virtual void VideoPresentScreen(void) {}
+	virtual void ResizeWindow(void) {}
+	virtual int FrameMessageBox(LPCSTR lpText, LPCSTR lpCaption, UINT uType) { fprintf(stderr, "%s: %s\n", lpCaption, lpText); return IDOK; }
+	virtual void GetBitmap(WORD id, LONG cb, LPVOID lpvBits) {}
+	virtual std::shared_ptr<NetworkBackend> CreateNetworkBackend(const std::string& interfaceName) { return std::make_shared<NullBackend>(); }
+	virtual std::shared_ptr<SoundBuffer> CreateSoundBuffer(uint32_t dwBufferSize, uint32_t nSampleRate, int nChannels, const char* pszVoiceName) { return std::shared_ptr<SoundBuffer>(); }
+	virtual BYTE* GetResource(WORD id, LPCSTR lpType, uint32_t expectedSize) { return NULL; }
+	virtual void Restart() {}
+	virtual std::string Video_GetScreenShotFolder() const { return std::string(); }
+};
+
+FrameBase& GetFrame(void)
+{
+	static TestFrame frame;
+	return frame;
+}
@@ -0,0 +1,505 @@
+// Uthernet II tests & benchmark
+// DNSResolver (the Virtual DNS cache), with a stub resolve function: caching, TTLs, the hosts file & the cache limit
+// Benchmark: a guest polling a TCP socket's Sn_RX_RSR (received size), as a driver's receive loop does
+// . idle: the peer sends nothing, so every poll should cost no more than a couple of register reads
+// . bulk: the peer sends N bytes, which the guest consumes (Sn_RX_RD += RSR, then RECV) as soon as RSR is non-zero
+// The card is AppleWin's (see the vcxproj), in slot 3, with socket 0 connected to a peer thread on the loopback.
+// Update() is called every kReadsPerUpdate polls, ie. ~1000 cycles of a ~20 cycle poll loop.
+// Each run is checked: idle must receive nothing, bulk must receive exactly N bytes.
+// Usage: TestUthernet2 [idle polls] [bulk bytes]
+
+#include <StdAfx.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Uthernet2.h"
+#include "W5100.h"
+#include "Tfe/DNS.h"
+
+#ifdef _WIN32
+typedef int socklen_t;
+#define closesocket_ closesocket
+#define SHUT_RDWR 2	// SD_BOTH, which <winsock.h> doesn't have
+#else
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+typedef int SOCKET;
+#define closesocket_ close
+#endif
+
+namespace
+{
+	typedef std::chrono::steady_clock Clock;
+
+	const UINT kSlot = 3;
+	const WORD kIOBase = 0xC080 + (kSlot << 4);
+	const uint16_t kSocket0 = W5100_S0_BASE;
+	const UINT kReadsPerUpdate = 50;
+	const ULONG kCyclesPerUpdate = 1000;
+
+	double ElapsedSecs(const Clock::time_point& start)
+	{
+		return std::chrono::duration<double>(Clock::now() - start).count();
+	}
+
+	// DNSResolver's resolve function: counts the lookups of each name, and (if closed) blocks them until Open()
+	// Names starting "fail" don't resolve, the others get an address made from the name
+	class StubResolver
+	{
+	public:
+		StubResolver(const bool closed) : m_closed(closed) {}
+
+		static uint32_t GetAddress(const std::string& name)
+		{
+			return name.compare(0, 4, "fail") == 0 ? 0 : (uint32_t)std::hash<std::string>()(name) | 1;
+		}
+
+		// NB. called on the DNSResolver's worker threads
+		uint32_t Resolve(const std::string& name)
+		{
+			std::unique_lock<std::mutex> lock(m_mutex);
+			m_lookups[name]++;
+			m_condition.wait(lock, [this] { return !m_closed; });
+			return GetAddress(name);
+		}
+
+		void Open(void)
+		{
+			{
+				std::lock_guard<std::mutex> lock(m_mutex);
+				m_closed = false;
+			}
+			m_condition.notify_all();
+		}
+
+		UINT GetLookups(const std::string& name)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			return m_lookups[name];
+		}
+
+	private:
+		std::mutex m_mutex;
+		std::condition_variable m_condition;
+		bool m_closed;
+		std::map<std::string, UINT> m_lookups;
+	};
+
+	DNSResolver::ResolveFunction GetResolveFunction(const std::shared_ptr<StubResolver>& stub)
+	{
+		return [stub](const std::string& name) { return stub->Resolve(name); };
+	}
+
+	// Calls resolve() until the name is RESOLVED, as Uthernet2::updatePendingDNS() does
+	// Returns false if it's still PENDING after a few seconds
+	bool WaitForResolve(DNSResolver& resolver, const std::string& name, uint32_t& address)
+	{
+		const Clock::time_point start = Clock::now();
+		while (resolver.resolve(name, address) == DNSResolver::PENDING)
+		{
+			if (ElapsedSecs(start) > 5.0)
+				return false;
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		return true;
+	}
+
+	std::string GetHostName(const size_t i)
+	{
+		return "host" + std::to_string(i);
+	}
+
+	// Indirect access to the W5100's registers, via the card's address & data ports
+
+	void WriteRegister(Uthernet2& card, const uint16_t address, const uint8_t value)
+	{
+		card.IO_C0(0, kIOBase + 0x05, 1, address >> 8, 0);
+		card.IO_C0(0, kIOBase + 0x06, 1, address & 0xFF, 0);
+		card.IO_C0(0, kIOBase + 0x07, 1, value, 0);
+	}
+
+	uint8_t ReadRegister(Uthernet2& card, const uint16_t address)
+	{
+		card.IO_C0(0, kIOBase + 0x05, 1, address >> 8, 0);
+		card.IO_C0(0, kIOBase + 0x06, 1, address & 0xFF, 0);
+		return card.IO_C0(0, kIOBase + 0x07, 0, 0, 0);
+	}
+
+	uint16_t ReadRegister16(Uthernet2& card, const uint16_t address)
+	{
+		const uint8_t hi = ReadRegister(card, address);
+		return (hi << 8) | ReadRegister(card, address + 1);
+	}
+
+	void WriteRegister16(Uthernet2& card, const uint16_t address, const uint16_t value)
+	{
+		WriteRegister(card, address, value >> 8);
+		WriteRegister(card, address + 1, value & 0xFF);
+	}
+
+	// The other end of socket 0: accepts one connection, sends 'bytes', then waits for the card to close
+	class LoopbackPeer
+	{
+	public:
+		LoopbackPeer(const size_t bytes) : m_listener(INVALID_SOCKET), m_port(0), m_bytes(bytes)
+		{
+			m_listener = socket(AF_INET, SOCK_STREAM, 0);
+			if (m_listener == INVALID_SOCKET)
+				return;
+
+			sockaddr_in address = {};
+			address.sin_family = AF_INET;
+			address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+			socklen_t length = sizeof(address);
+			if (bind(m_listener, (sockaddr*)&address, sizeof(address)) != 0 ||
+				listen(m_listener, 1) != 0 ||
+				getsockname(m_listener, (sockaddr*)&address, &length) != 0)
+				return;
+
+			m_port = ntohs(address.sin_port);
+			m_thread = std::thread(&LoopbackPeer::Run, this);
+		}
+
+		~LoopbackPeer()
+		{
+			if (m_listener != INVALID_SOCKET)
+			{
+				shutdown(m_listener, SHUT_RDWR);	// wake accept() if the card never connected
+				closesocket_(m_listener);
+			}
+			if (m_thread.joinable())
+				m_thread.join();
+		}
+
+		uint16_t GetPort(void) const { return m_port; }	// 0 if the listener failed
+
+	private:
+		void Run(void)
+		{
+			const SOCKET connection = accept(m_listener, NULL, NULL);
+			if (connection == INVALID_SOCKET)
+				return;
+
+			std::vector<char> buffer(4096, 'U');
+			size_t left = m_bytes;
+			while (left)
+			{
+				const int n = send(connection, &buffer[0], (int)(left < buffer.size() ? left : buffer.size()), 0);
+				if (n <= 0)
+					break;
+				left -= n;
+			}
+
+			// keep the connection up until the card closes it (or else bulk's last bytes could race a close)
+			while (recv(connection, &buffer[0], (int)buffer.size(), 0) > 0)
+				;
+			closesocket_(connection);
+		}
+
+		SOCKET m_listener;
+		uint16_t m_port;
+		const size_t m_bytes;
+		std::thread m_thread;
+	};
+
+	bool ConnectSocket0(Uthernet2& card, const uint16_t port)
+	{
+		WriteRegister(card, kSocket0 + W5100_SN_MR, W5100_SN_MR_TCP);
+		WriteRegister(card, kSocket0 + W5100_SN_DIPR0 + 0, 127);
+		WriteRegister(card, kSocket0 + W5100_SN_DIPR0 + 1, 0);
+		WriteRegister(card, kSocket0 + W5100_SN_DIPR0 + 2, 0);
+		WriteRegister(card, kSocket0 + W5100_SN_DIPR0 + 3, 1);
+		WriteRegister16(card, kSocket0 + W5100_SN_DPORT0, port);
+		WriteRegister(card, kSocket0 + W5100_SN_CR, W5100_SN_CR_OPEN);
+		WriteRegister(card, kSocket0 + W5100_SN_CR, W5100_SN_CR_CONNECT);
+
+		const Clock::time_point start = Clock::now();
+		while (ReadRegister(card, kSocket0 + W5100_SN_SR) != W5100_SN_SR_ESTABLISHED)
+		{
+			if (ElapsedSecs(start) > 5.0)
+				return false;
+			card.Update(kCyclesPerUpdate);
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+
+		return true;
+	}
+}
+
+//-----------------------------------------------------------------------------
+
+static int TestDNSCache(void)
+{
+	std::shared_ptr<StubResolver> stub(new StubResolver(false));
+	DNSResolver resolver(GetResolveFunction(stub));
+
+	uint32_t address = 0;
+	if (resolver.resolve("apple2.test", address) != DNSResolver::PENDING)
+	{
+		printf("DNS: a new name isn't pending\n");
+		return 1;
+	}
+
+	if (!WaitForResolve(resolver, "apple2.test", address) || address != StubResolver::GetAddress("apple2.test"))
+	{
+		printf("DNS: apple2.test didn't resolve\n");
+		return 1;
+	}
+
+	if (resolver.resolve("apple2.test", address) != DNSResolver::RESOLVED || stub->GetLookups("apple2.test") != 1)
+	{
+		printf("DNS: apple2.test wasn't cached (%u lookups)\n", stub->GetLookups("apple2.test"));
+		return 1;
+	}
+
+	// negative caching
+	if (!WaitForResolve(resolver, "fail.test", address) || address != 0 ||
+		resolver.resolve("fail.test", address) != DNSResolver::RESOLVED || stub->GetLookups("fail.test") != 1)
+	{
+		printf("DNS: fail.test wasn't cached as a failure (%u lookups)\n", stub->GetLookups("fail.test"));
+		return 1;
+	}
+
+	// expired entries are looked up again (NB. a new TTL applies to the results that follow)
+	resolver.setTTL(std::chrono::seconds(1), std::chrono::seconds(1));
+	if (!WaitForResolve(resolver, "expired.test", address))
+	{
+		printf("DNS: expired.test didn't resolve\n");
+		return 1;
+	}
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+	if (resolver.resolve("expired.test", address) != DNSResolver::PENDING ||
+		!WaitForResolve(resolver, "expired.test", address) || stub->GetLookups("expired.test") != 2)
+	{
+		printf("DNS: expired.test didn't expire (%u lookups)\n", stub->GetLookups("expired.test"));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int TestDNSHostsFile(const std::string& pathname)
+{
+	{
+		std::ofstream file(pathname.c_str());
+		file << "# comment\n";
+		file << "192.168.1.5  example.com www.example.com # trailing comment\n";
+		file << "::1 localhost6\n";
+	}
+
+	std::shared_ptr<StubResolver> stub(new StubResolver(false));
+	DNSResolver resolver(GetResolveFunction(stub));
+	resolver.setTTL(std::chrono::seconds(0), std::chrono::seconds(0));	// hosts file entries never expire
+
+	const size_t count = resolver.loadHostsFile(pathname);
+	remove(pathname.c_str());
+	if (count != 2)
+	{
+		printf("%s: loaded %u names, expected 2\n", pathname.c_str(), (UINT)count);
+		return 1;
+	}
+
+	uint32_t address = 0;
+	if (resolver.resolve("www.example.com", address) != DNSResolver::RESOLVED || address != inet_addr("192.168.1.5") ||
+		stub->GetLookups("www.example.com") != 0)
+	{
+		printf("%s: www.example.com wasn't resolved from the hosts file\n", pathname.c_str());
+		return 1;
+	}
+
+	if (resolver.resolve("localhost6", address) != DNSResolver::PENDING)
+	{
+		printf("%s: the IPv6 localhost6 was loaded\n", pathname.c_str());
+		return 1;
+	}
+
+	return 0;
+}
+
+// The cache is full with ourMaxEntries names
+static int TestDNSCacheLimit(void)
+{
+	const size_t maxEntries = DNSResolver::ourMaxEntries;
+	uint32_t address = 0;
+
+	// all resolved: a new name evicts the one that expires first
+	{
+		std::shared_ptr<StubResolver> stub(new StubResolver(false));
+		DNSResolver resolver(GetResolveFunction(stub));
+
+		for (size_t i = 0; i <= maxEntries; i++)
+		{
+			if (!WaitForResolve(resolver, GetHostName(i), address))
+			{
+				printf("DNS: %s didn't resolve\n", GetHostName(i).c_str());
+				return 1;
+			}
+		}
+
+		if (resolver.resolve(GetHostName(1), address) != DNSResolver::RESOLVED ||
+			resolver.resolve(GetHostName(maxEntries), address) != DNSResolver::RESOLVED)
+		{
+			printf("DNS: a full cache evicted the wrong name\n");
+			return 1;
+		}
+
+		if (resolver.resolve(GetHostName(0), address) != DNSResolver::PENDING)
+		{
+			printf("DNS: a full cache didn't evict the oldest name\n");
+			return 1;
+		}
+	}
+
+	// all pending: a new name isn't queued (nor cached) until some lookups have completed
+	{
+		std::shared_ptr<StubResolver> stub(new StubResolver(true));
+		DNSResolver resolver(GetResolveFunction(stub), 1);
+
+		for (size_t i = 0; i < maxEntries; i++)
+			resolver.resolve(GetHostName(i), address);
+
+		const std::string extra = "extra.test";
+		const DNSResolver::Status status = resolver.resolve(extra, address);
+		stub->Open();
+
+		for (size_t i = 0; i < maxEntries; i++)
+		{
+			if (!WaitForResolve(resolver, GetHostName(i), address))
+			{
+				printf("DNS: %s didn't resolve\n", GetHostName(i).c_str());
+				return 1;
+			}
+		}
+
+		if (status != DNSResolver::PENDING || stub->GetLookups(extra) != 0)
+		{
+			printf("DNS: a cache full of pending lookups queued another name\n");
+			return 1;
+		}
+
+		if (!WaitForResolve(resolver, extra, address) || address != StubResolver::GetAddress(extra))
+		{
+			printf("DNS: %s didn't resolve once the cache had room\n", extra.c_str());
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+//-----------------------------------------------------------------------------
+
+// Polls socket 0's RSR 'polls' times (idle) or until 'bytes' have been received (bulk)
+// Returns the number of errors
+static int RunRSRBenchmark(const char* pName, const size_t bytes, const UINT polls)
+{
+	LoopbackPeer peer(bytes);
+	if (!peer.GetPort())
+	{
+		printf("%s: failed to create the loopback listener\n", pName);
+		return 1;
+	}
+
+	Uthernet2 card(kSlot);
+	if (!ConnectSocket0(card, peer.GetPort()))
+	{
+		printf("%s: failed to connect socket 0\n", pName);
+		WriteRegister(card, kSocket0 + W5100_SN_CR, W5100_SN_CR_CLOSE);
+		return 1;
+	}
+
+	const double kTimeoutSecs = 30.0;
+	size_t received = 0;
+	UINT n = 0;
+	bool timedOut = false;
+	const Clock::time_point start = Clock::now();
+	for (; bytes ? received < bytes : n < polls; n++)
+	{
+		if (n % kReadsPerUpdate == 0)
+		{
+			card.Update(kCyclesPerUpdate);
+			if (bytes && ElapsedSecs(start) > kTimeoutSecs)
+			{
+				timedOut = true;
+				break;
+			}
+		}
+
+		const uint16_t rsr = ReadRegister16(card, kSocket0 + W5100_SN_RX_RSR0);
+		if (rsr)
+		{
+			const uint16_t rd = ReadRegister16(card, kSocket0 + W5100_SN_RX_RD0);
+			WriteRegister16(card, kSocket0 + W5100_SN_RX_RD0, rd + rsr);
+			WriteRegister(card, kSocket0 + W5100_SN_CR, W5100_SN_CR_RECV);
+			received += rsr;
+		}
+	}
+	const double secs = ElapsedSecs(start);
+
+	WriteRegister(card, kSocket0 + W5100_SN_CR, W5100_SN_CR_CLOSE);
+
+	int errors = 0;
+	if (timedOut || received != bytes)
+	{
+		printf("%s: received %u of %u bytes%s\n", pName, (UINT)received, (UINT)bytes, timedOut ? " (timed out)" : "");
+		errors++;
+	}
+
+	const double mb = received / (1024.0 * 1024.0);
+	printf("%-4s %9u polls  %8.3f s  %7.1f ns/poll   %7.2f MB  %8.1f MB/s   errors %d\n",
+		pName, n, secs, secs * 1e9 / (n ? n : 1), mb, mb / secs, errors);
+
+	return errors;
+}
+
+int main(int argc, char* argv[])
+{
+	const UINT polls = (argc > 1) ? strtoul(argv[1], NULL, 10) : 2000000;
+	const size_t bytes = (argc > 2) ? strtoul(argv[2], NULL, 10) : 64 * 1024 * 1024;
+	if (polls == 0 || bytes == 0)
+	{
+		fprintf(stderr, "Usage: %s [idle polls] [bulk bytes]\n", argv[0]);
+		return 1;
+	}
+
+#ifdef _WIN32
+	// the card does its own WSAStartup(), but the peer's listener is created first
+	WSADATA wsaData;
+	if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+	{
+		fprintf(stderr, "WSAStartup failed\n");
+		return 1;
+	}
+#endif
+
+	int res = TestDNSCache();
+	if (res) return res;
+
+	res = TestDNSHostsFile("TestUthernet2.hosts");
+	if (res) return res;
+
+	res = TestDNSCacheLimit();
+	if (res) return res;
+
+	int errors = 0;
+	errors += RunRSRBenchmark("idle", 0, polls);
+	errors += RunRSRBenchmark("bulk", bytes, 0);
+
+#ifdef _WIN32
+	WSACleanup();
+#endif
+
+	return errors ? 1 : 0;
+}
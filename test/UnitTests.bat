@@ -9,6 +9,10 @@
 .\%1\TestDebugger.exe
 @if errorlevel 1 GOTO failed
 
+@ECHO Performing unit-test: TestDisk
+.\%1\TestDisk.exe
+@IF errorlevel 1 GOTO failed
+
 @GOTO end
 
 :failed